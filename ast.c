@@ -9,6 +9,14 @@ bool is_stmt(Ast* ast) {
   switch (ast->type) {
     case AST_NONE:
     case AST_NUMBER:
+    case AST_INT:
+    case AST_ARRAY:
+    case AST_INDEX:
+    case AST_INDEX_SET:
+    case AST_MAP:
+    case AST_GET_FIELD:
+    case AST_SET_FIELD:
+    case AST_LOGICAL:
     case AST_BINARY:
     case AST_UNARY:
     case AST_BOOL:
@@ -44,6 +52,14 @@ bool is_expr(Ast* ast) {
     case AST_RETURN:
       return false;
     case AST_NUMBER:
+    case AST_INT:
+    case AST_ARRAY:
+    case AST_INDEX:
+    case AST_INDEX_SET:
+    case AST_MAP:
+    case AST_GET_FIELD:
+    case AST_SET_FIELD:
+    case AST_LOGICAL:
     case AST_BINARY:
     case AST_UNARY:
     case AST_BOOL:
@@ -122,6 +138,7 @@ FuncStmt* make_func_stmt(Token name,
   func_stmt->stmt = stmt;
   func_stmt->parameters = parameters;
   func_stmt->arity = arity;
+  func_stmt->memo = false;
   return func_stmt;
 }
 
@@ -137,6 +154,12 @@ NumberExpr* make_number_expr(double value) {
   return number_expr;
 }
 
+IntExpr* make_int_expr(int64_t value) {
+  IntExpr* int_expr = (IntExpr*)malloc(sizeof(IntExpr) * 1);
+  int_expr->value = value;
+  return int_expr;
+}
+
 BinaryExpr* make_binary_expr(Ast* left_expr, Ast* right_expr, Token op) {
   BinaryExpr* binary_expr = (BinaryExpr*)malloc(sizeof(BinaryExpr) * 1);
   binary_expr->left_expr = left_expr;
@@ -192,12 +215,75 @@ CallExpr* make_call_expr(Ast* callee, AstArray* arguments) {
   return call_expr;
 }
 
+ArrayExpr* make_array_expr(AstArray* elements, Token bracket) {
+  ArrayExpr* array_expr = (ArrayExpr*)malloc(sizeof(ArrayExpr) * 1);
+  array_expr->elements = elements;
+  array_expr->bracket = bracket;
+  return array_expr;
+}
+
+IndexExpr* make_index_expr(Ast* object, Ast* index, Token bracket) {
+  IndexExpr* index_expr = (IndexExpr*)malloc(sizeof(IndexExpr) * 1);
+  index_expr->object = object;
+  index_expr->index = index;
+  index_expr->bracket = bracket;
+  return index_expr;
+}
+
+IndexSetExpr* make_index_set_expr(Ast* object,
+                                  Ast* index,
+                                  Ast* value_expr,
+                                  Token bracket) {
+  IndexSetExpr* index_set_expr =
+      (IndexSetExpr*)malloc(sizeof(IndexSetExpr) * 1);
+  index_set_expr->object = object;
+  index_set_expr->index = index;
+  index_set_expr->value_expr = value_expr;
+  index_set_expr->bracket = bracket;
+  return index_set_expr;
+}
+
+MapExpr* make_map_expr(AstArray* keys, AstArray* values, Token brace) {
+  MapExpr* map_expr = (MapExpr*)malloc(sizeof(MapExpr) * 1);
+  map_expr->keys = keys;
+  map_expr->values = values;
+  map_expr->brace = brace;
+  return map_expr;
+}
+
+GetFieldExpr* make_get_field_expr(Ast* object, Token name) {
+  GetFieldExpr* get_field_expr = (GetFieldExpr*)malloc(sizeof(GetFieldExpr));
+  get_field_expr->object = object;
+  get_field_expr->name = name;
+  return get_field_expr;
+}
+
+SetFieldExpr* make_set_field_expr(Ast* object, Token name, Ast* value_expr) {
+  SetFieldExpr* set_field_expr = (SetFieldExpr*)malloc(sizeof(SetFieldExpr));
+  set_field_expr->object = object;
+  set_field_expr->name = name;
+  set_field_expr->value_expr = value_expr;
+  return set_field_expr;
+}
+
+LogicalExpr* make_logical_expr(Ast* left_expr, Ast* right_expr, Token op) {
+  LogicalExpr* logical_expr = (LogicalExpr*)malloc(sizeof(LogicalExpr));
+  logical_expr->left_expr = left_expr;
+  logical_expr->right_expr = right_expr;
+  logical_expr->op = op;
+  return logical_expr;
+}
+
 Value ast_to_value(Ast* ast) {
   switch (ast->type) {
     case AST_NUMBER: {
       NumberExpr* number_expr = (NumberExpr*)ast->as;
       return NUMBER_VAL(number_expr->value);
     }
+    case AST_INT: {
+      IntExpr* int_expr = (IntExpr*)ast->as;
+      return INT_VAL(int_expr->value);
+    }
     case AST_BOOL: {
       BoolExpr* bool_expr = (BoolExpr*)ast->as;
       return BOOLEAN_VAL(bool_expr->value);
@@ -206,8 +292,14 @@ Value ast_to_value(Ast* ast) {
       BinaryExpr* binary_expr = (BinaryExpr*)ast->as;
       Value left_value = ast_to_value(binary_expr->left_expr);
       Value right_value = ast_to_value(binary_expr->right_expr);
-      if (IS_NUMBER(left_value) && IS_NUMBER(right_value)) {
-        return NUMBER_VAL(AS_NUMBER(left_value) + AS_NUMBER(right_value));
+      int64_t sum;
+      if (IS_INT(left_value) && IS_INT(right_value) &&
+          !__builtin_add_overflow(AS_INT(left_value), AS_INT(right_value),
+                                  &sum)) {
+        return INT_VAL(sum);
+      }
+      if (IS_NUMERIC(left_value) && IS_NUMERIC(right_value)) {
+        return NUMBER_VAL(AS_NUMERIC(left_value) + AS_NUMERIC(right_value));
       }
       break;
     }
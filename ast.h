@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "array.h"
 #include "token.h"
@@ -25,6 +26,14 @@ typedef enum {
   AST_FUNC,
   AST_RETURN,
   AST_CALL,
+  AST_INT,
+  AST_ARRAY,
+  AST_INDEX,
+  AST_INDEX_SET,
+  AST_MAP,
+  AST_GET_FIELD,
+  AST_SET_FIELD,
+  AST_LOGICAL,
 } AstType;
 
 // Since in array.h it already declares typdef struct Ast to Ast
@@ -66,6 +75,8 @@ typedef struct {
   Ast* stmt;
   TokenArray* parameters;
   int arity;
+  // Declared with memo func, its results are cached if it is pure
+  bool memo;
 } FuncStmt;
 
 typedef struct {
@@ -82,6 +93,11 @@ typedef struct {
   double value;
 } NumberExpr;
 
+// Literals without a fractional part, i.e. the 10 in `let a = 10;`
+typedef struct {
+  int64_t value;
+} IntExpr;
+
 typedef struct {
   Ast* left_expr;
   Ast* right_expr;
@@ -126,6 +142,56 @@ typedef struct {
   AstArray* arguments;
 } CallExpr;
 
+// [1, 2, 3], bracket is the [ and gives the line
+typedef struct {
+  AstArray* elements;
+  Token bracket;
+} ArrayExpr;
+
+// a[i]
+typedef struct {
+  Ast* object;
+  Ast* index;
+  Token bracket;
+} IndexExpr;
+
+// a[i] = value
+typedef struct {
+  Ast* object;
+  Ast* index;
+  Ast* value_expr;
+  Token bracket;
+} IndexSetExpr;
+
+// {"a": 1, 2: "b"}, keys and values have the same count
+typedef struct {
+  AstArray* keys;
+  AstArray* values;
+  Token brace;
+} MapExpr;
+
+// p.x, name is the field
+typedef struct {
+  Ast* object;
+  Token name;
+} GetFieldExpr;
+
+// p.x = value
+typedef struct {
+  Ast* object;
+  Token name;
+  Ast* value_expr;
+} SetFieldExpr;
+
+// a and b, a or b, the right side is only evaluated when the left side
+// does not decide the result. The result is whichever side was last
+// evaluated, not necessarily a bool
+typedef struct {
+  Ast* left_expr;
+  Ast* right_expr;
+  Token op;
+} LogicalExpr;
+
 bool is_stmt(Ast* ast);
 bool is_expr(Ast* ast);
 
@@ -149,6 +215,7 @@ ReturnStmt* make_return_stmt(Ast* value_expr);
 
 // Expressions
 NumberExpr* make_number_expr(double value);
+IntExpr* make_int_expr(int64_t value);
 BinaryExpr* make_binary_expr(Ast* left_expr, Ast* right_expr, Token op);
 UnaryExpr* make_unary_expr(Ast* right_expr, Token op);
 BoolExpr* make_bool_expr(bool value);
@@ -157,6 +224,16 @@ GroupExpr* make_group_expr(Ast* expr);
 AssignmentExpr* make_assignment_expr(Token name, Ast* expr);
 StringExpr* make_string_expr(const char* start, int length);
 CallExpr* make_call_expr(Ast* callee, AstArray* arguments);
+ArrayExpr* make_array_expr(AstArray* elements, Token bracket);
+IndexExpr* make_index_expr(Ast* object, Ast* index, Token bracket);
+IndexSetExpr* make_index_set_expr(Ast* object,
+                                  Ast* index,
+                                  Ast* value_expr,
+                                  Token bracket);
+MapExpr* make_map_expr(AstArray* keys, AstArray* values, Token brace);
+GetFieldExpr* make_get_field_expr(Ast* object, Token name);
+SetFieldExpr* make_set_field_expr(Ast* object, Token name, Ast* value_expr);
+LogicalExpr* make_logical_expr(Ast* left_expr, Ast* right_expr, Token op);
 
 // Convert expressions into values
 Value ast_to_value(Ast* ast);
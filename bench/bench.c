@@ -0,0 +1,380 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../nebula.h"
+#include "../opstats.h"
+
+// Runs every program in bench/ a number of times and reports the wall
+// time, the instructions dispatched and the peak memory as JSON, and how
+// that compares to a baseline from an earlier run.
+//
+// nebula-bench [--runs n] [--counter path] [--baseline file] [--save file]
+//              programs...
+//
+// The same source built with -DOPSTATS is the counter, it runs each
+// program once and prints how many instructions were dispatched.
+// Counting is kept out of the timed binary as it slows down dispatch.
+
+#define DEFAULT_RUNS 10
+#define MAX_PROGRAMS 64
+#define MAX_RUNS 1000
+#define NAME_SIZE 64
+
+// Instruction counts are exact, any growth is a regression and fails the
+// comparison. Wall time is too noisy to fail on, it is only pointed out
+// when it grows by more than this
+#define TIME_REGRESSION_PERCENT 10.0
+
+typedef struct {
+  char name[NAME_SIZE];
+  double median_ms;
+  double p95_ms;
+  unsigned long long instructions;
+  long peak_rss_kb;
+} BenchResult;
+
+static char* read_file(const char* path) {
+  FILE* file = fopen(path, "rb");
+  if (file == NULL) {
+    fprintf(stderr, "Could not open file \"%s\".\n", path);
+    exit(74);
+  }
+
+  fseek(file, 0L, SEEK_END);
+  size_t file_size = ftell(file);
+  rewind(file);
+
+  char* buffer = (char*)malloc(file_size + 1);
+  size_t bytes_read = fread(buffer, sizeof(char), file_size, file);
+  buffer[bytes_read] = '\0';
+
+  fclose(file);
+  return buffer;
+}
+
+static double seconds_since(struct timespec start) {
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  return (double)(end.tv_sec - start.tv_sec) +
+         (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+// bench/fib.neb -> fib
+static void program_name(const char* path, char* name) {
+  const char* start = strrchr(path, '/');
+  start = start == NULL ? path : start + 1;
+
+  int length = strlen(start);
+  const char* extension = strrchr(start, '.');
+  if (extension != NULL)
+    length = extension - start;
+  if (length >= NAME_SIZE)
+    length = NAME_SIZE - 1;
+
+  memcpy(name, start, length);
+  name[length] = '\0';
+}
+
+#ifdef OPSTATS
+
+int main(int argc, const char* argv[]) {
+  for (int i = 1; i < argc; i++) {
+    char* source = read_file(argv[i]);
+
+    // Only the count is printed, not what the program prints
+    fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO);
+    freopen("/dev/null", "w", stdout);
+
+    reset_opstats();
+    Nebula nebula;
+    init_nebula(&nebula);
+    nebula_load(&nebula, source);
+    free_nebula(&nebula);
+
+    fflush(stdout);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+
+    printf("%llu\n", (unsigned long long)total_opstats());
+    free(source);
+  }
+  return 0;
+}
+
+#else
+
+static int compare_doubles(const void* a, const void* b) {
+  double double_a = *(const double*)a;
+  double double_b = *(const double*)b;
+  return (double_a > double_b) - (double_a < double_b);
+}
+
+// Every run of a program happens in a child process, so that the peak rss
+// of the child belongs to that program alone
+static bool time_program(const char* path, int runs, BenchResult* result) {
+  char* source = read_file(path);
+
+  int fds[2];
+  if (pipe(fds) != 0)
+    return false;
+
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == 0) {
+    close(fds[0]);
+    freopen("/dev/null", "w", stdout);
+
+    for (int i = 0; i < runs; i++) {
+      struct timespec start;
+      clock_gettime(CLOCK_MONOTONIC, &start);
+
+      Nebula nebula;
+      init_nebula(&nebula);
+      bool loaded = nebula_load(&nebula, source);
+      free_nebula(&nebula);
+
+      double elapsed = seconds_since(start);
+      if (!loaded)
+        elapsed = -1;
+      if (write(fds[1], &elapsed, sizeof(elapsed)) != sizeof(elapsed))
+        _exit(1);
+    }
+    _exit(0);
+  }
+
+  close(fds[1]);
+  free(source);
+
+  double times[MAX_RUNS];
+  int count = 0;
+  bool failed = false;
+  while (count < runs &&
+         read(fds[0], &times[count], sizeof(double)) == sizeof(double)) {
+    if (times[count] < 0)
+      failed = true;
+    count++;
+  }
+  close(fds[0]);
+
+  int status;
+  struct rusage usage;
+  wait4(pid, &status, 0, &usage);
+
+  if (failed || count != runs) {
+    fprintf(stderr, "%s failed to run\n", path);
+    return false;
+  }
+
+  qsort(times, count, sizeof(double), compare_doubles);
+  result->median_ms = 1000 * (count % 2 == 1 ? times[count / 2]
+                                             : (times[count / 2 - 1] +
+                                                times[count / 2]) /
+                                                   2);
+  int p95_index = (95 * count + 99) / 100 - 1;
+  result->p95_ms = 1000 * times[p95_index];
+  // Kilobytes on linux
+  result->peak_rss_kb = usage.ru_maxrss;
+  return true;
+}
+
+static unsigned long long count_instructions(const char* counter,
+                                             const char* path) {
+  if (counter == NULL)
+    return 0;
+
+  char command[1024];
+  snprintf(command, sizeof(command), "%s %s", counter, path);
+  FILE* output = popen(command, "r");
+  if (output == NULL)
+    return 0;
+
+  unsigned long long instructions = 0;
+  if (fscanf(output, "%llu", &instructions) != 1)
+    instructions = 0;
+  pclose(output);
+  return instructions;
+}
+
+static void write_results(FILE* file,
+                          int runs,
+                          BenchResult* results,
+                          int count) {
+  fprintf(file, "{\n");
+  fprintf(file, "  \"runs\": %d,\n", runs);
+  fprintf(file, "  \"programs\": [\n");
+  for (int i = 0; i < count; i++) {
+    BenchResult* result = &results[i];
+    // One program per line, which is what read_baseline expects
+    fprintf(file,
+            "    {\"name\": \"%s\", \"median_ms\": %.3f, \"p95_ms\": %.3f, "
+            "\"instructions\": %llu, \"peak_rss_kb\": %ld}%s\n",
+            result->name, result->median_ms, result->p95_ms,
+            result->instructions, result->peak_rss_kb,
+            i == count - 1 ? "" : ",");
+  }
+  fprintf(file, "  ]\n");
+  fprintf(file, "}\n");
+}
+
+// Reads back a file written by write_results
+static int read_baseline(const char* path, BenchResult* results) {
+  FILE* file = fopen(path, "r");
+  if (file == NULL)
+    return 0;
+
+  int count = 0;
+  char line[512];
+  while (count < MAX_PROGRAMS && fgets(line, sizeof(line), file) != NULL) {
+    char* name = strstr(line, "\"name\": \"");
+    char* median = strstr(line, "\"median_ms\": ");
+    char* p95 = strstr(line, "\"p95_ms\": ");
+    char* instructions = strstr(line, "\"instructions\": ");
+    char* peak_rss = strstr(line, "\"peak_rss_kb\": ");
+    if (name == NULL || median == NULL || p95 == NULL ||
+        instructions == NULL || peak_rss == NULL)
+      continue;
+
+    BenchResult* result = &results[count++];
+    name += strlen("\"name\": \"");
+    int length = strcspn(name, "\"");
+    if (length >= NAME_SIZE)
+      length = NAME_SIZE - 1;
+    memcpy(result->name, name, length);
+    result->name[length] = '\0';
+
+    result->median_ms = strtod(median + strlen("\"median_ms\": "), NULL);
+    result->p95_ms = strtod(p95 + strlen("\"p95_ms\": "), NULL);
+    result->instructions =
+        strtoull(instructions + strlen("\"instructions\": "), NULL, 10);
+    result->peak_rss_kb =
+        strtol(peak_rss + strlen("\"peak_rss_kb\": "), NULL, 10);
+  }
+
+  fclose(file);
+  return count;
+}
+
+static double percent_change(double from, double to) {
+  if (from <= 0)
+    return 0;
+  return 100.0 * (to - from) / from;
+}
+
+// Prints how the results compare to the baseline, returns false if any
+// program dispatched more instructions than it did in the baseline
+static bool compare_baseline(BenchResult* results,
+                             int count,
+                             BenchResult* baseline,
+                             int baseline_count) {
+  bool regressed = false;
+
+  fprintf(stderr, "%-12s %12s %12s %8s %14s %14s %8s\n", "program",
+          "median ms", "baseline", "change", "instructions", "baseline",
+          "change");
+  for (int i = 0; i < count; i++) {
+    BenchResult* result = &results[i];
+    BenchResult* base = NULL;
+    for (int j = 0; j < baseline_count; j++) {
+      if (strcmp(baseline[j].name, result->name) == 0)
+        base = &baseline[j];
+    }
+
+    if (base == NULL) {
+      fprintf(stderr, "%-12s %12.3f %12s %8s %14llu %14s %8s\n", result->name,
+              result->median_ms, "-", "-", result->instructions, "-", "-");
+      continue;
+    }
+
+    double time_change = percent_change(base->median_ms, result->median_ms);
+    double instruction_change =
+        percent_change(base->instructions, result->instructions);
+
+    bool slower = time_change > TIME_REGRESSION_PERCENT;
+    bool instructions_regressed = base->instructions != 0 &&
+                                  result->instructions > base->instructions;
+    regressed = regressed || instructions_regressed;
+
+    fprintf(stderr, "%-12s %12.3f %12.3f %+7.1f%% %14llu %14llu %+7.1f%%%s%s\n",
+            result->name, result->median_ms, base->median_ms, time_change,
+            result->instructions, base->instructions, instruction_change,
+            instructions_regressed ? "  REGRESSION" : "",
+            slower ? "  SLOWER" : "");
+  }
+
+  return !regressed;
+}
+
+int main(int argc, const char* argv[]) {
+  int runs = DEFAULT_RUNS;
+  const char* counter = NULL;
+  const char* baseline_path = NULL;
+  const char* save_path = NULL;
+
+  const char* programs[MAX_PROGRAMS];
+  int program_count = 0;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc) {
+      runs = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--counter") == 0 && i + 1 < argc) {
+      counter = argv[++i];
+    } else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) {
+      baseline_path = argv[++i];
+    } else if (strcmp(argv[i], "--save") == 0 && i + 1 < argc) {
+      save_path = argv[++i];
+    } else if (program_count < MAX_PROGRAMS) {
+      programs[program_count++] = argv[i];
+    }
+  }
+
+  if (runs < 1 || runs > MAX_RUNS) {
+    fprintf(stderr, "--runs has to be between 1 and %d\n", MAX_RUNS);
+    return 64;
+  }
+
+  BenchResult results[MAX_PROGRAMS];
+  int result_count = 0;
+  for (int i = 0; i < program_count; i++) {
+    BenchResult* result = &results[result_count];
+    program_name(programs[i], result->name);
+    if (!time_program(programs[i], runs, result))
+      continue;
+    result->instructions = count_instructions(counter, programs[i]);
+    result_count++;
+  }
+
+  write_results(stdout, runs, results, result_count);
+
+  if (save_path != NULL) {
+    FILE* file = fopen(save_path, "w");
+    if (file == NULL) {
+      fprintf(stderr, "Could not write \"%s\".\n", save_path);
+      return 74;
+    }
+    write_results(file, runs, results, result_count);
+    fclose(file);
+  }
+
+  if (baseline_path == NULL)
+    return 0;
+
+  BenchResult baseline[MAX_PROGRAMS];
+  int baseline_count = read_baseline(baseline_path, baseline);
+  if (baseline_count == 0) {
+    fprintf(stderr, "No baseline in \"%s\", make bench-baseline saves one\n",
+            baseline_path);
+    return 0;
+  }
+
+  return compare_baseline(results, result_count, baseline, baseline_count) ? 0
+                                                                          : 1;
+}
+
+#endif
@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../array.h"
+#include "../codegen.h"
+#include "../lexer.h"
+#include "../parser.h"
+
+// Times lexing, parsing and codegen of generated scripts with thousands of
+// variables, so that name resolution shows up on its own. Every function
+// declares its locals one after the other, each one read from two earlier
+// locals and a global:
+//
+// let g0 = 0; ...
+// func f0(a) { let v0 = a + a * g0; let v1 = v0 + a * g1; ... return v..; }
+//
+// Prints milliseconds per script and nanoseconds per variable declared.
+
+#define GLOBAL_COUNT 40
+#define FUNC_COUNT 80
+#define ROUNDS 5
+
+static const int local_counts[] = {25, 100, 400, 1600};
+
+typedef struct {
+  char* chars;
+  int length;
+  int capacity;
+} Buffer;
+
+static void append(Buffer* buffer, const char* format, int a, int b, int c) {
+  int needed = snprintf(NULL, 0, format, a, b, c);
+  if (buffer->length + needed + 1 > buffer->capacity) {
+    buffer->capacity = (buffer->length + needed + 1) * 2;
+    buffer->chars = realloc(buffer->chars, buffer->capacity);
+  }
+  snprintf(buffer->chars + buffer->length, needed + 1, format, a, b, c);
+  buffer->length += needed;
+}
+
+static char* make_script(int local_count) {
+  Buffer buffer = {NULL, 0, 0};
+  for (int i = 0; i < GLOBAL_COUNT; i++) {
+    append(&buffer, "let g%d = %d;\n", i, i, 0);
+  }
+  for (int f = 0; f < FUNC_COUNT; f++) {
+    append(&buffer, "func f%d(a) {\n  let v0 = a + a * g0;\n", f, 0, 0);
+    for (int i = 1; i < local_count; i++) {
+      // One recent local and one from further back
+      append(&buffer, "  let v%d = v%d + v%d", i, i - 1, i / 2);
+      append(&buffer, " * g%d;\n", i % GLOBAL_COUNT, 0, 0);
+    }
+    append(&buffer, "  return v%d;\n}\n", local_count - 1, 0, 0);
+  }
+  return buffer.chars;
+}
+
+static double seconds_since(struct timespec start) {
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  return (double)(end.tv_sec - start.tv_sec) +
+         (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+static double compile(const char* source) {
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  TokenArray token_array;
+  init_token_array(&token_array);
+  lex_source(&token_array, source);
+
+  ErrorArray error_array;
+  init_error_array(&error_array);
+  AstArray ast_array;
+  init_ast_array(&ast_array);
+  parse_tokens(&token_array, &ast_array, &error_array);
+  codegen(&ast_array, NULL);
+
+  double seconds = seconds_since(start);
+  if (error_array.count > 0) {
+    fprintf(stderr, "The generated script does not parse\n");
+    exit(1);
+  }
+  free_token_array(&token_array);
+  free_error_array(&error_array);
+  return seconds;
+}
+
+int main() {
+  int size_count = sizeof(local_counts) / sizeof(local_counts[0]);
+  for (int i = 0; i < size_count; i++) {
+    char* source = make_script(local_counts[i]);
+
+    // The best of a few rounds, the first one warms up the allocator
+    double best = compile(source);
+    for (int round = 1; round < ROUNDS; round++) {
+      double seconds = compile(source);
+      if (seconds < best)
+        best = seconds;
+    }
+
+    int variables = FUNC_COUNT * local_counts[i];
+    printf("%3d locals per func %6d variables %10.2f ms %8.1f ns/variable\n",
+           local_counts[i], variables, best * 1e3, best * 1e9 / variables);
+    free(source);
+  }
+  return 0;
+}
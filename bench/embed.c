@@ -0,0 +1,64 @@
+#include <stdio.h>
+#include <time.h>
+
+#include "../nebula.h"
+
+// Measures how many calls per second a host can make into a nebula
+// function through the embedding API
+
+#define CALL_COUNT 1000000
+
+static double seconds_since(struct timespec start) {
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  return (double)(end.tv_sec - start.tv_sec) +
+         (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+static void bench_call(Nebula* nebula, const char* name, int argument_count) {
+  NebulaFunc func;
+  if (!nebula_get_func(nebula, name, &func)) {
+    fprintf(stderr, "Could not find function %s\n", name);
+    return;
+  }
+
+  Value args[2] = {NUMBER_VAL(1), NUMBER_VAL(2)};
+  Value result;
+
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  for (int i = 0; i < CALL_COUNT; i++) {
+    args[0] = NUMBER_VAL(i);
+    if (!nebula_call(nebula, &func, argument_count, args, &result)) {
+      fprintf(stderr, "Call to %s failed\n", name);
+      return;
+    }
+  }
+
+  double elapsed = seconds_since(start);
+  printf("%-10s %10d calls %8.3fs %14.0f calls/s\n", name, CALL_COUNT,
+         elapsed, CALL_COUNT / elapsed);
+}
+
+int main() {
+  Nebula nebula;
+  init_nebula(&nebula);
+
+  const char* source =
+      "func noop() { return 0; }"
+      "func add(a, b) { return a + b; }"
+      "func sq(x) { return x * x; }";
+
+  if (!nebula_load(&nebula, source))
+    return 1;
+
+  bench_call(&nebula, "noop", 0);
+  bench_call(&nebula, "add", 2);
+  bench_call(&nebula, "sq", 1);
+  // Natives skip the frame setup entirely
+  bench_call(&nebula, "clock", 0);
+
+  free_nebula(&nebula);
+  return 0;
+}
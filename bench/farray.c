@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../kernels.h"
+
+// Compares the float array kernels of every level the cpu supports, on
+// arrays that fit in L1, in L2 and in none of the caches.
+// Prints nanoseconds per call and gigabytes per second read.
+
+typedef struct {
+  const char* name;
+  // Arrays read per call, for the bandwidth
+  int arrays;
+} Kernel;
+
+static const Kernel kernel_names[] = {
+    {"sum", 1},
+    {"dot", 2},
+    {"add", 2},
+};
+
+// Keeps the compiler from throwing away results that are not used
+static volatile double sink;
+
+static double seconds_since(struct timespec start) {
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  return (double)(end.tv_sec - start.tv_sec) +
+         (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+static double run_kernel(const Kernels* kernels,
+                         int kernel,
+                         double* a,
+                         double* b,
+                         int count) {
+  switch (kernel) {
+    case 0:
+      return kernels->sum(a, count);
+    case 1:
+      return kernels->dot(a, b, count);
+    default:
+      kernels->add(a, b, count);
+      return a[0];
+  }
+}
+
+static void bench_kernel(KernelLevel level, int kernel, int count, int rounds) {
+  double* a = malloc(sizeof(double) * count);
+  double* b = malloc(sizeof(double) * count);
+  for (int i = 0; i < count; i++) {
+    a[i] = i % 17;
+    b[i] = 1.0 / (1 + i % 5);
+  }
+
+  set_kernel_level(level);
+  const Kernels* kernels = get_kernels();
+
+  double result = 0;
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int round = 0; round < rounds; round++) {
+    result += run_kernel(kernels, kernel, a, b, count);
+  }
+  double seconds = seconds_since(start);
+  sink = result;
+
+  const Kernel* name = &kernel_names[kernel];
+  char input[32];
+  snprintf(input, sizeof(input), "%s %d doubles", name->name, count);
+  double bytes = (double)sizeof(double) * count * name->arrays * rounds;
+  printf("%-8s %-22s %12.2f ns/call %8.2f GB/s\n", kernel_level_name(level),
+         input, seconds * 1e9 / rounds, bytes / seconds / 1e9);
+  free(a);
+  free(b);
+}
+
+int main() {
+  KernelLevel levels[] = {KERNELS_SCALAR, KERNELS_SSE2, KERNELS_AVX2};
+  int kernel_count = sizeof(kernel_names) / sizeof(kernel_names[0]);
+  for (int kernel = 0; kernel < kernel_count; kernel++) {
+    for (int i = 0; i < 3; i++) {
+      if (!kernel_level_supported(levels[i]))
+        continue;
+      bench_kernel(levels[i], kernel, 1024, 200000);
+      bench_kernel(levels[i], kernel, 1 << 15, 5000);
+      bench_kernel(levels[i], kernel, 1 << 22, 40);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../hash.h"
+
+// Compares the string hashes in hash.h, on short identifiers like the
+// ones that end up as global names, and on long strings.
+// Prints nanoseconds per hash and gigabytes per second.
+
+#define IDENTIFIER_COUNT 4096
+#define IDENTIFIER_ROUNDS 2000
+#define IDENTIFIER_SIZE 16
+
+typedef uint32_t (*HashFunc)(const char* key, int length);
+
+typedef struct {
+  const char* name;
+  HashFunc func;
+} Hash;
+
+static const Hash hashes[] = {
+    {"fnv_hash32", fnv_hash32},
+    {"wy_hash32", wy_hash32},
+};
+
+// Keeps the compiler from throwing away hashes that are not used
+static volatile uint32_t sink;
+
+static double seconds_since(struct timespec start) {
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  return (double)(end.tv_sec - start.tv_sec) +
+         (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+static void print_result(const char* hash,
+                         const char* input,
+                         double seconds,
+                         long hash_count,
+                         long bytes) {
+  printf("%-12s %-22s %12.2f ns/hash %8.2f GB/s\n", hash, input,
+         seconds * 1e9 / hash_count, bytes / seconds / 1e9);
+}
+
+// 5 to 12 characters of [a-z_0-9]
+static void make_identifiers(char identifiers[][IDENTIFIER_SIZE],
+                             int* lengths) {
+  const char alphabet[] = "abcdefghijklmnopqrstuvwxyz_0123456789";
+  srand(42);
+  for (int i = 0; i < IDENTIFIER_COUNT; i++) {
+    lengths[i] = 5 + rand() % 8;
+    for (int j = 0; j < lengths[i]; j++) {
+      identifiers[i][j] = alphabet[rand() % (sizeof(alphabet) - 1)];
+    }
+  }
+}
+
+static void bench_identifiers(const Hash* hash) {
+  static char identifiers[IDENTIFIER_COUNT][IDENTIFIER_SIZE];
+  static int lengths[IDENTIFIER_COUNT];
+  make_identifiers(identifiers, lengths);
+
+  long bytes = 0;
+  for (int i = 0; i < IDENTIFIER_COUNT; i++) {
+    bytes += lengths[i];
+  }
+
+  uint32_t result = 0;
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int round = 0; round < IDENTIFIER_ROUNDS; round++) {
+    for (int i = 0; i < IDENTIFIER_COUNT; i++) {
+      result ^= hash->func(identifiers[i], lengths[i]);
+    }
+  }
+  double seconds = seconds_since(start);
+  sink = result;
+
+  long hash_count = (long)IDENTIFIER_COUNT * IDENTIFIER_ROUNDS;
+  print_result(hash->name, "identifiers 5-12", seconds, hash_count,
+               bytes * IDENTIFIER_ROUNDS);
+}
+
+static void bench_long_string(const Hash* hash, int length, int rounds) {
+  char* string = malloc(length);
+  for (int i = 0; i < length; i++) {
+    string[i] = 'a' + i % 26;
+  }
+
+  uint32_t result = 0;
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int round = 0; round < rounds; round++) {
+    // Changes the input a bit so that the hash is not hoisted out
+    string[0] = (char)round;
+    result ^= hash->func(string, length);
+  }
+  double seconds = seconds_since(start);
+  sink = result;
+
+  char input[32];
+  snprintf(input, sizeof(input), "string %d bytes", length);
+  print_result(hash->name, input, seconds, rounds, (long)length * rounds);
+  free(string);
+}
+
+int main() {
+  int hash_count = sizeof(hashes) / sizeof(hashes[0]);
+  for (int i = 0; i < hash_count; i++) {
+    bench_identifiers(&hashes[i]);
+    bench_long_string(&hashes[i], 64, 1000000);
+    bench_long_string(&hashes[i], 4096, 100000);
+    bench_long_string(&hashes[i], 1 << 20, 500);
+  }
+  return 0;
+}
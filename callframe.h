@@ -8,4 +8,6 @@ typedef struct {
   OpCode* ip;
   // ValueArray* slots;
   Value* slots;
+  // Where the result goes in the function's memo cache, -1 if nowhere
+  int memo_entry;
 } CallFrame;
@@ -9,6 +9,12 @@ void init_chunk(Chunk* chunk) {
   init_op_array(&chunk->code);
   init_int_array(&chunk->lines);
   init_value_array(&chunk->constants);
+  chunk->field_caches = NULL;
+  chunk->field_cache_count = 0;
+  chunk->field_cache_capacity = 0;
+  chunk->call_caches = NULL;
+  chunk->call_cache_count = 0;
+  chunk->call_cache_capacity = 0;
 }
 
 void write_chunk(Chunk* chunk, uint8_t byte, int line) {
@@ -30,7 +36,38 @@ void write_chunk(Chunk* chunk, uint8_t byte, int line) {
   chunk->count++;
 }
 
+int add_field_cache(Chunk* chunk) {
+  if (chunk->field_cache_count == chunk->field_cache_capacity) {
+    chunk->field_cache_capacity =
+        chunk->field_cache_capacity == 0 ? 4 : chunk->field_cache_capacity * 2;
+    chunk->field_caches = (FieldCache*)realloc(
+        chunk->field_caches, sizeof(FieldCache) * chunk->field_cache_capacity);
+  }
+
+  FieldCache* cache = &chunk->field_caches[chunk->field_cache_count];
+  cache->shape = NULL;
+  cache->transition = NULL;
+  cache->offset = 0;
+  return chunk->field_cache_count++;
+}
+
+int add_call_cache(Chunk* chunk) {
+  if (chunk->call_cache_count == chunk->call_cache_capacity) {
+    chunk->call_cache_capacity =
+        chunk->call_cache_capacity == 0 ? 4 : chunk->call_cache_capacity * 2;
+    chunk->call_caches = (CallCache*)realloc(
+        chunk->call_caches, sizeof(CallCache) * chunk->call_cache_capacity);
+  }
+
+  CallCache* cache = &chunk->call_caches[chunk->call_cache_count];
+  cache->callee = NULL;
+  cache->kind = CALL_CACHE_EMPTY;
+  return chunk->call_cache_count++;
+}
+
 void free_chunk(Chunk* chunk) {
+  free(chunk->call_caches);
+  free(chunk->field_caches);
   free_value_array(&chunk->constants);
   free_int_array(&chunk->lines);
   free_op_array(&chunk->code);
@@ -4,15 +4,51 @@
 
 #include "array.h"
 
+// The inline cache of one field access instruction, the shape of the
+// record it saw last and the slot of the field in records of that shape.
+// For a store that added the field, transition is the shape the record
+// moved to, NULL otherwise
+typedef struct {
+  struct Shape* shape;
+  struct Shape* transition;
+  int offset;
+} FieldCache;
+
+typedef enum {
+  CALL_CACHE_EMPTY,
+  CALL_CACHE_FUNC,
+  CALL_CACHE_NATIVE,
+} CallCacheKind;
+
+// The inline cache of one call instruction, the callee it called last.
+// The argument count of a call site never changes, so once a callee
+// passed the arity check here it always will
+typedef struct {
+  Obj* callee;
+  CallCacheKind kind;
+} CallCache;
+
 typedef struct {
   int count;
   int capacity;
   OpArray code;
   IntArray lines;
   ValueArray constants;
+  // Side table of the field access instructions, which carry their index
+  FieldCache* field_caches;
+  int field_cache_count;
+  int field_cache_capacity;
+  // Same for the call instructions
+  CallCache* call_caches;
+  int call_cache_count;
+  int call_cache_capacity;
 } Chunk;
 
 void init_chunk(Chunk* chunk);
 void write_chunk(Chunk* chunk, uint8_t byte, int line);
 void free_chunk(Chunk* chunk);
 
+// Add an empty cache, return its index
+int add_field_cache(Chunk* chunk);
+int add_call_cache(Chunk* chunk);
+
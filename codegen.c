@@ -1,14 +1,21 @@
 #include "codegen.h"
 
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "ast.h"
 #include "debugging.h"
+#include "ir.h"
 #include "macros.h"
+#include "memo.h"
+#include "native.h"
 #include "object.h"
 #include "op.h"
+#include "symbol.h"
+#include "vm.h"
 
 typedef struct {
   struct Compiler* enclosing;
@@ -19,20 +26,74 @@ typedef struct {
   LocalArray local_array;
   int local_depth;
   int scope_depth;
+
+  // Name to the slot of the innermost local with that name, -1 once the
+  // scope of every local with the name has closed
+  SymbolTable local_slots;
+  // Name to the constant in this function that holds the name of the
+  // global, every read and write of a global shares the one constant
+  SymbolTable global_constants;
+
+  // Values that the expression being generated left on the stack above the
+  // locals for a later op, i.e. the left side of a binary while the right
+  // side is generated
+  int temporaries;
+  // Locals below this slot cannot be seen by name, which is how the body
+  // of an inlined function only sees its own locals
+  int local_floor;
 } Compiler;
 
 static Compiler* current_compiler;
 
+// Natives whose name the program also defines, calls to these have to go
+// through the global like any other function
+static bool shadowed_natives[MAX_NATIVES];
+// How many times each name is defined or assigned anywhere in the program
+static SymbolTable name_writes;
+
+// Whether the IR of every function is printed before it is emitted
+static bool dumping_ir = false;
+
+void set_dump_ir(bool dump) {
+  dumping_ir = dump;
+}
+
+// Whether the number of unchecked arithmetic ops of every function is
+// printed
+static bool reporting_types = false;
+
+void set_type_report(bool report) {
+  reporting_types = report;
+}
+
+// Set by any error that leaves the bytecode wrong, codegen() returns NULL
+// instead of a program that cannot run as written
+static bool had_error = false;
+
+static void codegen_error(const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  vprintf(format, args);
+  va_end(args);
+  had_error = true;
+}
+
 static Chunk* current_chunk() {
   return &current_compiler->func->chunk;
 }
 
+// The source line of the node that is being generated, only some nodes
+// carry a token, the others take on the line of the last one that did
+static int current_line = 0;
+
 static void emit_byte(OpCode op) {
-  write_chunk(current_chunk(), op, 0);
+  write_chunk(current_chunk(), op, current_line);
 }
 
 static void print_value(Value value) {
-  if (IS_NUMBER(value)) {
+  if (IS_INT(value)) {
+    printf("%lld\n", (long long)AS_INT(value));
+  } else if (IS_NUMBER(value)) {
     printf("%f\n", AS_NUMBER(value));
   } else if (IS_BOOLEAN(value) && AS_BOOLEAN(value) == true) {
     printf("true\n");
@@ -45,39 +106,122 @@ static void print_value(Value value) {
   }
 }
 
-static void emit_constant(Value value) {
-  emit_byte(OP_CONSTANT);
-  // Add to value_array
-  // push_value_array(constants_array, value);
-  push_value_array(&current_chunk()->constants, value);
-  emit_byte((OpCode)(current_chunk()->constants.count));
+static void emit_short(int operand) {
+  emit_byte((operand >> 8) & 0xff);
+  emit_byte(operand & 0xff);
 }
 
-static int make_constant(Value value) {
-  push_value_array(&current_chunk()->constants, value);
-  int constant_index = current_chunk()->constants.count - 1;
-  emit_byte((OpCode)constant_index);
-  return constant_index;
+// The op with a one byte operand when it fits, the wide form of the op
+// with a two byte one otherwise
+static void emit_operand(OpCode op, OpCode wide_op, int operand) {
+  if (operand <= UINT8_MAX) {
+    emit_byte(op);
+    emit_byte(operand);
+  } else {
+    emit_byte(wide_op);
+    emit_short(operand);
+  }
 }
 
-static bool identifier_equal(Token* a, Token* b) {
-  if (a->length != b->length)
-    return false;
+// Constants are indexed by at most two bytes. The ones past the limit are
+// still added, so that only the first one is reported
+static int add_constant(Value value) {
+  Chunk* chunk = current_chunk();
+  if (chunk->constants.count == UINT16_MAX + 1)
+    codegen_error("Tried to add more than %d constants in one function\n",
+                  UINT16_MAX + 1);
+  push_value_array(&chunk->constants, value);
+  return chunk->constants.count - 1;
+}
+
+static void emit_constant(Value value) {
+  int constant_index = add_constant(value);
+  // OP_CONSTANT takes the index + 1
+  if (constant_index + 1 <= UINT8_MAX) {
+    emit_byte(OP_CONSTANT);
+    emit_byte(constant_index + 1);
+  } else {
+    emit_byte(OP_CONSTANT_WIDE);
+    emit_short(constant_index);
+  }
+}
 
-  return memcmp(a->start, b->start, a->length) == 0;
+// The field name as a constant, and a new inline cache for this one
+// instruction
+static void emit_field_access(OpCode op, Token name) {
+  Chunk* chunk = current_chunk();
+  if (chunk->field_cache_count == UINT16_MAX + 1)
+    codegen_error(
+        "Tried to access fields more than %d times in one function\n",
+        UINT16_MAX + 1);
+  emit_byte(op);
+  emit_short(add_constant(OBJ_VAL(make_obj_string_from_token(name))));
+  emit_short(add_field_cache(chunk));
 }
 
-// Given the token name, and which compiler,
-// look through the local arrays, to see if it exists
+// The slot of the innermost local with the name, -1 if it is not a local
 static int resolve_local(Token* name) {
-  for (int i = current_compiler->local_array.count - 1; i >= 0; i--) {
-    Local* local = &current_compiler->local_array.locals[i];
-    if (identifier_equal(name, &local->name)) {
-      return i;
-    }
+  int slot = find_symbol(&current_compiler->local_slots, *name);
+  return slot < current_compiler->local_floor ? -1 : slot;
+}
+
+// Locals and temporaries are both slots of the frame, with one more for the
+// value that is being generated on top of them. The vm checks that there is
+// room for the most the function has at once when it is called
+static void count_slots() {
+  ObjFunc* func = current_compiler->func;
+  int slots = current_compiler->local_array.count +
+              current_compiler->temporaries + 1;
+  func->slot_count = MAX(func->slot_count, slots);
+}
+
+// The local takes the next slot and hides any local of the same name in
+// the scopes around it
+static void add_local(Token name) {
+  LocalArray* locals = &current_compiler->local_array;
+  Local local;
+  local.name = name;
+  local.depth = current_compiler->scope_depth;
+  local.shadowed = find_symbol(&current_compiler->local_slots, name);
+  set_symbol(&current_compiler->local_slots, name, locals->count);
+  push_local_array(locals, local);
+  count_slots();
+}
+
+// The local in the last slot goes out of scope, the one it hid if any is
+// what the name refers to again
+static void remove_local() {
+  LocalArray* locals = &current_compiler->local_array;
+  Local* local = &locals->locals[--locals->count];
+  set_symbol(&current_compiler->local_slots, local->name, local->shadowed);
+}
+
+// The constant that holds the name of the global, it is only added to the
+// constants the first time the function uses the global
+static int global_constant(Token name) {
+  int constant_index = find_symbol(&current_compiler->global_constants, name);
+  if (constant_index == -1) {
+    constant_index = add_constant(OBJ_VAL(make_obj_string_from_token(name)));
+    set_symbol(&current_compiler->global_constants, name, constant_index);
   }
+  return constant_index;
+}
+
+static void emit_get_variable(Token name) {
+  int slot = resolve_local(&name);
+  if (slot != -1)
+    emit_operand(OP_GET_LOCAL, OP_GET_LOCAL_WIDE, slot);
+  else
+    emit_operand(OP_GET_GLOBAL, OP_GET_GLOBAL_WIDE, global_constant(name));
+}
 
-  return -1;
+// Leaves the value on the stack
+static void emit_set_variable(Token name) {
+  int slot = resolve_local(&name);
+  if (slot != -1)
+    emit_operand(OP_SET_LOCAL, OP_SET_LOCAL_WIDE, slot);
+  else
+    emit_operand(OP_SET_GLOBAL, OP_SET_GLOBAL_WIDE, global_constant(name));
 }
 
 static void init_compiler(Compiler* compiler,
@@ -85,11 +229,15 @@ static void init_compiler(Compiler* compiler,
                           Token name) {
   init_local_array(&compiler->local_array);
   reserve_local_array(&compiler->local_array, UINT8_MAX + 1);  // 256
+  init_symbol_table(&compiler->local_slots);
+  init_symbol_table(&compiler->global_constants);
 
   compiler->enclosing = (struct Compiler*)current_compiler;
   compiler->func = NULL;
   compiler->local_depth = 0;
   compiler->scope_depth = 0;
+  compiler->temporaries = 0;
+  compiler->local_floor = 0;
   compiler->func_type = func_type;
   // TODO : Figure out why func is set twice?
   // Probably because of garbage collection, but note this down
@@ -99,23 +247,27 @@ static void init_compiler(Compiler* compiler,
 
   if (func_type != TYPE_SCRIPT) {
     ObjString* obj_string = make_obj_string_from_token(name);
-    print_obj_string(obj_string);
     current_compiler->func->name = obj_string;
     // current_compiler->func->name = make_obj_string_sl("PLACEHOLDER TEST");
   }
 
   // Compiler implicitly claims stack slot 0
   // for vm's internal usage
-  Local* local = &current_compiler->local_array
-                      .locals[current_compiler->local_array.count++];
-  local->depth = 0;
+  Token slot_name;
   if (func_type != TYPE_FUNCTION) {
-    local->name.start = "this";
-    local->name.length = 4;
+    slot_name.start = "this";
+    slot_name.length = 4;
   } else {
-    local->name.start = "";
-    local->name.length = 0;
+    slot_name.start = "";
+    slot_name.length = 0;
   }
+  add_local(slot_name);
+}
+
+static void free_compiler(Compiler* compiler) {
+  free_local_array(&compiler->local_array);
+  free_symbol_table(&compiler->local_slots);
+  free_symbol_table(&compiler->global_constants);
 }
 
 static ObjFunc* end_compiler() {
@@ -177,7 +329,10 @@ static ObjFunc* end_compiler() {
             current_compiler->func->chunk.constants
                 .values[current_compiler->func->chunk.code.ops[i] - 1];
 
-        if (IS_NUMBER(value)) {
+        if (IS_INT(value)) {
+          printf("[%d-%d] [%-20s] at %d: %lld\n", i - 1, i, "OP_CONSTANT", i,
+                 (long long)AS_INT(value));
+        } else if (IS_NUMBER(value)) {
           printf("[%d-%d] [%-20s] at %d: %f\n", i - 1, i, "OP_CONSTANT", i,
                  AS_NUMBER(value));
         } else if (IS_STRING(value)) {
@@ -186,116 +341,1757 @@ static ObjFunc* end_compiler() {
                  string->chars);
         }
 
-        break;
-      }
-      case OP_RETURN:
-        printf("[%d] [%-20s]\n", i, "OP_RETURN");
-        break;
-      case OP_PRINT:
-        printf("[%d] [%-20s]\n", i, "OP_PRINT");
-        break;
-      case OP_SET_GLOBAL:
-        printf("[%d-%d] [%-20s]\n", i, i + 1, "OP_SET_GLOBAL");
-        i++;  // name index
-        break;
-      case OP_SET_LOCAL:
-        printf("[%d-%d] [%-20s]\n", i, i + 1, "OP_SET_LOCAL");
-        i++;
-        break;
-      case OP_GET_GLOBAL:
-        i++;
-        Value value = current_compiler->func->chunk.constants
-                          .values[current_compiler->func->chunk.code.ops[i]];
+        break;
+      }
+      case OP_RETURN:
+        printf("[%d] [%-20s]\n", i, "OP_RETURN");
+        break;
+      case OP_PRINT:
+        printf("[%d] [%-20s]\n", i, "OP_PRINT");
+        break;
+      case OP_SET_GLOBAL:
+        printf("[%d-%d] [%-20s]\n", i, i + 1, "OP_SET_GLOBAL");
+        i++;  // name index
+        break;
+      case OP_SET_LOCAL:
+        printf("[%d-%d] [%-20s]\n", i, i + 1, "OP_SET_LOCAL");
+        i++;
+        break;
+      case OP_GET_GLOBAL:
+        i++;
+        Value value = current_compiler->func->chunk.constants
+                          .values[current_compiler->func->chunk.code.ops[i]];
+
+        if (IS_NUMBER(value)) {
+          printf("[%d-%d] [%-20s] at %d: %f\n", i - 1, i, "OP_GET_GLOBAL", i,
+                 AS_NUMBER(value));
+        } else if (IS_STRING(value)) {
+          ObjString* string = AS_OBJ_STRING(value);
+          printf("[%d-%d] [%-20s] at %d: %s\n", i - 1, i, "OP_GET_GLOBAL", i,
+                 string->chars);
+        }
+
+        // printf("[%d-%d] [%-20s] at constants_array: \n", i - 1, i,
+        //        "OP_GET_GLOBAL");
+        break;
+      case OP_GET_LOCAL:
+        i++;  //
+        printf("[%d-%d] [%-20s] at constants_array: %d\n", i - 1, i,
+               "OP_GET_LOCAL", current_compiler->func->chunk.code.ops[i]);
+        // op_arr->ops[i]);
+        break;
+      case OP_DEFINE_GLOBAL:
+        printf("[%d-%d] [%-20s]\n", i, i + 1, "OP_DEFINE_GLOBAL");
+        i++;  // name index
+        break;
+      case OP_JUMP:
+        printf("[%d] [%-20s]\n", i, "OP_JUMP");
+        break;
+      case OP_JUMP_IF_FALSE: {
+        // i+=2; // get the index of the jump, if false
+        // uint16_t number =
+        //     (uint16_t)((op_arr->ops[i + 1] << 8) | (op_arr->ops[i + 2]));
+        // i += 2;
+        // printf("[%d-%d] [%-20s] jump if false to : %d\n", i - 2, i,
+        //        "OP_JUMP_IF_FALSE", number);
+        printf("OP_JUMP_IF_FALSE\n");
+        break;
+      }
+      case OP_CALL: {
+        OpCode* ops = current_compiler->func->chunk.code.ops;
+        printf("[%d-%d] [%-20s] argument count: %d, cache %d\n", i, i + 3,
+               "OP_CALL", ops[i + 1], ops[i + 2] << 8 | ops[i + 3]);
+        i += 3;
+        break;
+      }
+      case OP_NIL:
+        printf("[%d] [%-20s]\n", i, "OP_NIL");
+        break;
+      case OP_LOOP:
+        printf("OP_LOOP\n");
+        break;
+      case OP_CALL_NATIVE:
+        i += 2;
+        printf("[%d-%d] [%-20s] %s, argument count: %d\n", i - 2, i,
+               "OP_CALL_NATIVE",
+               get_native(current_compiler->func->chunk.code.ops[i - 1])->name,
+               current_compiler->func->chunk.code.ops[i]);
+        break;
+      case OP_ARRAY:
+      case OP_ARRAY_EXTEND:
+        i++;
+        printf("[%d-%d] [%-20s] %d elements\n", i - 1, i,
+               opcode_name(current_compiler->func->chunk.code.ops[i - 1]),
+               current_compiler->func->chunk.code.ops[i]);
+        break;
+      case OP_MAP:
+      case OP_MAP_EXTEND:
+        i++;
+        printf("[%d-%d] [%-20s] %d entries\n", i - 1, i,
+               opcode_name(current_compiler->func->chunk.code.ops[i - 1]),
+               current_compiler->func->chunk.code.ops[i]);
+        break;
+      case OP_JUMP_IF_TRUE:
+      case OP_POP_JUMP_IF_FALSE:
+      case OP_POP_JUMP_IF_TRUE: {
+        OpCode* ops = current_compiler->func->chunk.code.ops;
+        printf("[%d-%d] [%-20s] jump by %d\n", i, i + 2, opcode_name(ops[i]),
+               ops[i + 1] << 8 | ops[i + 2]);
+        i += 2;
+        break;
+      }
+      case OP_GET_FIELD:
+      case OP_SET_FIELD: {
+        OpCode* ops = current_compiler->func->chunk.code.ops;
+        ObjString* name =
+            AS_OBJ_STRING(current_compiler->func->chunk.constants
+                              .values[ops[i + 1] << 8 | ops[i + 2]]);
+        printf("[%d-%d] [%-20s] %.*s, cache %d\n", i, i + 4,
+               opcode_name(ops[i]), name->length, name->chars,
+               ops[i + 3] << 8 | ops[i + 4]);
+        i += 4;
+        break;
+      }
+      case OP_CONSTANT_WIDE:
+      case OP_GET_LOCAL_WIDE:
+      case OP_SET_LOCAL_WIDE:
+      case OP_GET_GLOBAL_WIDE:
+      case OP_SET_GLOBAL_WIDE:
+      case OP_DEFINE_GLOBAL_WIDE: {
+        OpCode* ops = current_compiler->func->chunk.code.ops;
+        printf("[%d-%d] [%-20s] %d\n", i, i + 2, opcode_name(ops[i]),
+               ops[i + 1] << 8 | ops[i + 2]);
+        i += 2;
+        break;
+      }
+      case OP_JUMP_IF_GLOBAL: {
+        OpCode* ops = current_compiler->func->chunk.code.ops;
+        printf("[%d-%d] [%-20s] %d is %d, jump by %d\n", i, i + 6,
+               "OP_JUMP_IF_GLOBAL", ops[i + 1] << 8 | ops[i + 2],
+               ops[i + 3] << 8 | ops[i + 4], ops[i + 5] << 8 | ops[i + 6]);
+        i += 6;
+        break;
+      }
+      case OP_POP_BELOW:
+        i++;
+        printf("[%d-%d] [%-20s] %d\n", i - 1, i, "OP_POP_BELOW",
+               current_compiler->func->chunk.code.ops[i]);
+        break;
+      case OP_MODULO:
+      case OP_BIT_AND:
+      case OP_BIT_OR:
+      case OP_BIT_XOR:
+      case OP_SHIFT_LEFT:
+      case OP_SHIFT_RIGHT:
+      case OP_BIT_NOT:
+      case OP_INDEX_GET:
+      case OP_INDEX_SET:
+      case OP_ADD_NUMBER:
+      case OP_SUBTRACT_NUMBER:
+      case OP_MULTIPLY_NUMBER:
+      case OP_DIVIDE_NUMBER:
+      case OP_GREATER_NUMBER:
+      case OP_LESS_NUMBER:
+        printf("[%d] [%-20s]\n", i, opcode_name(current_compiler->func->chunk.code.ops[i]));
+        break;
+    }
+  }
+#endif
+
+  free_compiler(current_compiler);
+  current_compiler = (Compiler*)current_compiler->enclosing;
+  return func;
+}
+
+static void begin_scope(Compiler* compiler) {
+  compiler->scope_depth++;
+}
+
+static void close_scope(Compiler* compiler) {
+  compiler->scope_depth--;
+}
+
+static int emit_jump(uint8_t instruction) {
+  emit_byte(instruction);
+  emit_byte(0xff);
+  emit_byte(0xff);
+  return current_chunk()->count - 2;
+}
+
+static void emit_loop(int loop_start) {
+  emit_byte(OP_LOOP);
+
+  int offset = current_chunk()->count - loop_start + 2;
+  if (offset > UINT16_MAX)
+    codegen_error("Loop body is larger than %d bytes\n", UINT16_MAX);
+
+  emit_byte((offset >> 8) & 0xff);
+  emit_byte(offset & 0xff);
+}
+
+static void patch_jump(int start) {
+  int jump = current_chunk()->count - start - 2;
+  if (jump > UINT16_MAX)
+    codegen_error("Too much code to jump over, more than %d bytes\n",
+                  UINT16_MAX);
+
+  current_chunk()->code.ops[start] = (jump >> 8) & 0xff;
+  current_chunk()->code.ops[start + 1] = jump & 0xff;
+}
+
+static void patch_jumps(IntArray* jumps) {
+  for (int i = 0; i < jumps->count; i++) {
+    patch_jump(jumps->ints[i]);
+  }
+}
+
+// Natives whose global an earlier program on the vm replaced
+static void find_replaced_natives(Vm* vm) {
+  for (int i = 0; i < native_count(); i++) {
+    Native* native = get_native(i);
+    ObjString* name = make_obj_string_sl(native->name);
+    Value value = get_hashmap(&vm->variables, name);
+    free_obj_string(name);
+    if (!IS_NATIVE_FUNC(value) || AS_OBJ_NATIVE(value)->func != native->func)
+      shadowed_natives[i] = true;
+  }
+}
+
+static void write_name(Token name) {
+  int native_index = find_native(name.start, name.length);
+  if (native_index != -1)
+    shadowed_natives[native_index] = true;
+  int writes = find_symbol(&name_writes, name);
+  set_symbol(&name_writes, name, writes == -1 ? 1 : writes + 1);
+}
+
+// Walks the program for functions, variables and assignments, before any
+// of it is generated, as a call can come before the definition. Natives
+// whose name the program uses are shadowed, and a function whose name is
+// written by nothing but its definition always holds it
+static void find_written_names(Ast* ast) {
+  if (ast == NULL)
+    return;
+
+  switch (ast->type) {
+    case AST_PRINT:
+      find_written_names(((PrintStmt*)ast->as)->expr);
+      break;
+    case AST_IF: {
+      IfStmt* if_stmt = (IfStmt*)ast->as;
+      find_written_names(if_stmt->condition_expr);
+      find_written_names(if_stmt->then_stmt);
+      find_written_names(if_stmt->else_stmt);
+      break;
+    }
+    case AST_WHILE: {
+      WhileStmt* while_stmt = (WhileStmt*)ast->as;
+      find_written_names(while_stmt->condition_expr);
+      find_written_names(while_stmt->block_stmt);
+      break;
+    }
+    case AST_FOR: {
+      ForStmt* for_stmt = (ForStmt*)ast->as;
+      find_written_names(for_stmt->assignment_stmt);
+      find_written_names(for_stmt->condition_expr);
+      find_written_names(for_stmt->then_expr);
+      find_written_names(for_stmt->block_stmt);
+      break;
+    }
+    case AST_BLOCK: {
+      BlockStmt* block_stmt = (BlockStmt*)ast->as;
+      for (int i = 0; i < block_stmt->ast_array.count; i++) {
+        find_written_names(block_stmt->ast_array.ast[i]);
+      }
+      break;
+    }
+    case AST_FUNC: {
+      FuncStmt* func_stmt = (FuncStmt*)ast->as;
+      write_name(func_stmt->name);
+      find_written_names(func_stmt->stmt);
+      break;
+    }
+    case AST_VARIABLE_STMT: {
+      VariableStmt* variable_stmt = (VariableStmt*)ast->as;
+      write_name(variable_stmt->name);
+      find_written_names(variable_stmt->initializer_expr);
+      break;
+    }
+    case AST_ASSIGNMENT_EXPR: {
+      AssignmentExpr* assignment_expr = (AssignmentExpr*)ast->as;
+      write_name(assignment_expr->name);
+      find_written_names(assignment_expr->expr);
+      break;
+    }
+    case AST_BINARY: {
+      BinaryExpr* binary_expr = (BinaryExpr*)ast->as;
+      find_written_names(binary_expr->left_expr);
+      find_written_names(binary_expr->right_expr);
+      break;
+    }
+    case AST_UNARY:
+      find_written_names(((UnaryExpr*)ast->as)->right_expr);
+      break;
+    case AST_GROUP:
+      find_written_names(((GroupExpr*)ast->as)->expr);
+      break;
+    case AST_RETURN:
+      find_written_names(((ReturnStmt*)ast->as)->value_expr);
+      break;
+    case AST_CALL: {
+      CallExpr* call_expr = (CallExpr*)ast->as;
+      for (int i = 0; i < call_expr->arguments->count; i++) {
+        find_written_names(call_expr->arguments->ast[i]);
+      }
+      break;
+    }
+    case AST_ARRAY: {
+      ArrayExpr* array_expr = (ArrayExpr*)ast->as;
+      for (int i = 0; i < array_expr->elements->count; i++) {
+        find_written_names(array_expr->elements->ast[i]);
+      }
+      break;
+    }
+    case AST_INDEX: {
+      IndexExpr* index_expr = (IndexExpr*)ast->as;
+      find_written_names(index_expr->object);
+      find_written_names(index_expr->index);
+      break;
+    }
+    case AST_INDEX_SET: {
+      IndexSetExpr* index_set_expr = (IndexSetExpr*)ast->as;
+      find_written_names(index_set_expr->object);
+      find_written_names(index_set_expr->index);
+      find_written_names(index_set_expr->value_expr);
+      break;
+    }
+    case AST_MAP: {
+      MapExpr* map_expr = (MapExpr*)ast->as;
+      for (int i = 0; i < map_expr->keys->count; i++) {
+        find_written_names(map_expr->keys->ast[i]);
+        find_written_names(map_expr->values->ast[i]);
+      }
+      break;
+    }
+    case AST_GET_FIELD:
+      find_written_names(((GetFieldExpr*)ast->as)->object);
+      break;
+    case AST_LOGICAL:
+      find_written_names(((LogicalExpr*)ast->as)->left_expr);
+      find_written_names(((LogicalExpr*)ast->as)->right_expr);
+      break;
+    case AST_SET_FIELD: {
+      SetFieldExpr* set_field_expr = (SetFieldExpr*)ast->as;
+      find_written_names(set_field_expr->object);
+      find_written_names(set_field_expr->value_expr);
+      break;
+    }
+    default:
+      break;
+  }
+}
+
+// Returns the index of the native that a call to this name can be bound
+// to at compile time, -1 if it has to be looked up at runtime. The name
+// not being a local is up to the caller
+static int native_for_call(Token* name, int argument_count) {
+  int native_index = find_native(name->start, name->length);
+  if (native_index == -1 || shadowed_natives[native_index])
+    return -1;
+
+  // Leave arity mismatches to the runtime check in OP_CALL
+  Native* native = get_native(native_index);
+  if (native->arity != VARIADIC && native->arity != argument_count)
+    return -1;
+
+  return native_index;
+}
+
+static int resolve_native(Token* name, int argument_count) {
+  if (resolve_local(name) != -1)
+    return -1;
+  return native_for_call(name, argument_count);
+}
+
+#define FUNC_PURE (1 << 0)
+#define FUNC_RECURSIVE (1 << 1)
+
+// Functions of the top level whose name nothing else writes, a call to the
+// name is always a call to them, with what the purity analysis found out
+// about each
+static SymbolTable top_func_names;
+static AstArray top_funcs;
+static IntArray top_func_flags;
+
+// Whether pure functions that call themselves are memoized without memo
+static bool auto_memo = false;
+
+void set_auto_memo(bool memo) {
+  auto_memo = memo;
+}
+
+// A function is pure when it does not print, write globals or change
+// arrays, maps and records, reads no globals, and only calls the functions
+// above that are pure or natives flagged NATIVE_PURE, so that the same
+// arguments always give the same result
+typedef struct {
+  FuncStmt* func;
+  // Names to how many locals of the name are in scope, and the names in
+  // the order they were declared, to take them out when their scope ends
+  SymbolTable locals;
+  TokenArray declared;
+  bool recursive;
+} Purity;
+
+static bool same_name(Token a, Token b) {
+  return a.length == b.length && memcmp(a.start, b.start, a.length) == 0;
+}
+
+static bool is_purity_local(Purity* purity, Token name) {
+  return find_symbol(&purity->locals, name) > 0;
+}
+
+static void declare_purity_local(Purity* purity, Token name) {
+  int count = find_symbol(&purity->locals, name);
+  set_symbol(&purity->locals, name, count <= 0 ? 1 : count + 1);
+  push_token_array(&purity->declared, name);
+}
+
+static void close_purity_scope(Purity* purity, int declared) {
+  while (purity->declared.count > declared) {
+    Token name = purity->declared.tokens[--purity->declared.count];
+    set_symbol(&purity->locals, name, find_symbol(&purity->locals, name) - 1);
+  }
+}
+
+static bool is_pure_ast(Purity* purity, Ast* ast);
+
+static bool are_pure_asts(Purity* purity, AstArray* asts) {
+  for (int i = 0; i < asts->count; i++) {
+    if (!is_pure_ast(purity, asts->ast[i]))
+      return false;
+  }
+  return true;
+}
+
+static bool is_pure_call(Purity* purity, CallExpr* call_expr) {
+  if (call_expr->callee->type != AST_VARIABLE_EXPR ||
+      !are_pure_asts(purity, call_expr->arguments))
+    return false;
+
+  Token name = ((VariableExpr*)call_expr->callee->as)->name;
+  if (is_purity_local(purity, name))
+    return false;
+  int index = find_symbol(&top_func_names, name);
+  if (index != -1) {
+    if (same_name(name, purity->func->name))
+      purity->recursive = true;
+    return top_func_flags.ints[index] & FUNC_PURE;
+  }
+  int native_index = native_for_call(&name, call_expr->arguments->count);
+  return native_index != -1 && (get_native(native_index)->flags & NATIVE_PURE);
+}
+
+static bool is_pure_ast(Purity* purity, Ast* ast) {
+  if (ast == NULL)
+    return true;
+
+  switch (ast->type) {
+    case AST_NONE:
+    case AST_NUMBER:
+    case AST_INT:
+    case AST_STRING:
+    case AST_BOOL:
+      return true;
+    case AST_VARIABLE_EXPR: {
+      Token name = ((VariableExpr*)ast->as)->name;
+      return is_purity_local(purity, name);
+    }
+    case AST_ASSIGNMENT_EXPR: {
+      AssignmentExpr* assignment_expr = (AssignmentExpr*)ast->as;
+      return is_purity_local(purity, assignment_expr->name) &&
+             is_pure_ast(purity, assignment_expr->expr);
+    }
+    case AST_VARIABLE_STMT: {
+      VariableStmt* variable_stmt = (VariableStmt*)ast->as;
+      if (!is_pure_ast(purity, variable_stmt->initializer_expr))
+        return false;
+      declare_purity_local(purity, variable_stmt->name);
+      return true;
+    }
+    case AST_BLOCK: {
+      int declared = purity->declared.count;
+      bool pure = are_pure_asts(purity, &((BlockStmt*)ast->as)->ast_array);
+      close_purity_scope(purity, declared);
+      return pure;
+    }
+    case AST_IF: {
+      IfStmt* if_stmt = (IfStmt*)ast->as;
+      return is_pure_ast(purity, if_stmt->condition_expr) &&
+             is_pure_ast(purity, if_stmt->then_stmt) &&
+             is_pure_ast(purity, if_stmt->else_stmt);
+    }
+    case AST_WHILE: {
+      WhileStmt* while_stmt = (WhileStmt*)ast->as;
+      return is_pure_ast(purity, while_stmt->condition_expr) &&
+             is_pure_ast(purity, while_stmt->block_stmt);
+    }
+    case AST_FOR: {
+      ForStmt* for_stmt = (ForStmt*)ast->as;
+      int declared = purity->declared.count;
+      bool pure = is_pure_ast(purity, for_stmt->assignment_stmt) &&
+                  is_pure_ast(purity, for_stmt->condition_expr) &&
+                  is_pure_ast(purity, for_stmt->then_expr) &&
+                  is_pure_ast(purity, for_stmt->block_stmt);
+      close_purity_scope(purity, declared);
+      return pure;
+    }
+    case AST_RETURN:
+      return is_pure_ast(purity, ((ReturnStmt*)ast->as)->value_expr);
+    case AST_BINARY: {
+      BinaryExpr* binary_expr = (BinaryExpr*)ast->as;
+      return is_pure_ast(purity, binary_expr->left_expr) &&
+             is_pure_ast(purity, binary_expr->right_expr);
+    }
+    case AST_LOGICAL: {
+      LogicalExpr* logical_expr = (LogicalExpr*)ast->as;
+      return is_pure_ast(purity, logical_expr->left_expr) &&
+             is_pure_ast(purity, logical_expr->right_expr);
+    }
+    case AST_UNARY:
+      return is_pure_ast(purity, ((UnaryExpr*)ast->as)->right_expr);
+    case AST_GROUP:
+      return is_pure_ast(purity, ((GroupExpr*)ast->as)->expr);
+    case AST_CALL:
+      return is_pure_call(purity, (CallExpr*)ast->as);
+    // New arrays and maps, and reads out of them
+    case AST_ARRAY:
+      return are_pure_asts(purity, ((ArrayExpr*)ast->as)->elements);
+    case AST_MAP: {
+      MapExpr* map_expr = (MapExpr*)ast->as;
+      return are_pure_asts(purity, map_expr->keys) &&
+             are_pure_asts(purity, map_expr->values);
+    }
+    case AST_INDEX: {
+      IndexExpr* index_expr = (IndexExpr*)ast->as;
+      return is_pure_ast(purity, index_expr->object) &&
+             is_pure_ast(purity, index_expr->index);
+    }
+    case AST_GET_FIELD:
+      return is_pure_ast(purity, ((GetFieldExpr*)ast->as)->object);
+    default:
+      return false;
+  }
+}
+
+// Every function starts out pure and stops being pure when its body is
+// not, until no function changes, so that functions that call each other
+// can be pure together
+static void find_pure_funcs(AstArray* ast_arr) {
+  for (int i = 0; i < ast_arr->count; i++) {
+    Ast* ast = ast_arr->ast[i];
+    if (ast == NULL || ast->type != AST_FUNC)
+      continue;
+    FuncStmt* func_stmt = (FuncStmt*)ast->as;
+    if (find_symbol(&name_writes, func_stmt->name) != 1)
+      continue;
+    set_symbol(&top_func_names, func_stmt->name, top_funcs.count);
+    push_ast_array(&top_funcs, ast);
+    push_int_array(&top_func_flags, FUNC_PURE);
+  }
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int i = 0; i < top_funcs.count; i++) {
+      if (!(top_func_flags.ints[i] & FUNC_PURE))
+        continue;
+
+      Purity purity;
+      purity.func = (FuncStmt*)top_funcs.ast[i]->as;
+      init_symbol_table(&purity.locals);
+      init_token_array(&purity.declared);
+      purity.recursive = false;
+      for (int j = 0; j < purity.func->parameters->count; j++) {
+        declare_purity_local(&purity, purity.func->parameters->tokens[j]);
+      }
+      if (is_pure_ast(&purity, purity.func->stmt)) {
+        top_func_flags.ints[i] =
+            FUNC_PURE | (purity.recursive ? FUNC_RECURSIVE : 0);
+      } else {
+        top_func_flags.ints[i] = 0;
+        changed = true;
+      }
+      free_symbol_table(&purity.locals);
+      free_token_array(&purity.declared);
+    }
+  }
+}
+
+// Declared with memo func, or calling itself with auto_memo on, and pure
+static bool is_memoized(FuncStmt* func_stmt) {
+  int index = find_symbol(&top_func_names, func_stmt->name);
+  if (index == -1 || top_funcs.ast[index]->as != func_stmt)
+    return false;
+  int flags = top_func_flags.ints[index];
+  return (flags & FUNC_PURE) &&
+         (func_stmt->memo || (auto_memo && (flags & FUNC_RECURSIVE)));
+}
+
+// Calls to pure functions of the top level with only constants for
+// arguments are run at compile time and replaced by the value they return.
+// Every pure function is defined in the sandbox once its definition is
+// generated, so a call only sees the functions whose definitions come
+// before the statement of the top level it is in, which are the ones that
+// are sure to be defined by the time the call runs. The sandbox gives each
+// call fold_steps calls and backward jumps to finish in, a call that runs
+// out of steps, errors out or returns an array, map or record is left to
+// the runtime. The functions are the ones the program runs, so memoized
+// functions keep what they cached at compile time
+static bool folding = true;
+static int fold_steps = FOLD_DEFAULT_STEPS;
+static Vm* sandbox = NULL;
+
+void set_fold_calls(bool fold) {
+  folding = fold;
+}
+
+void set_fold_steps(int steps) {
+  fold_steps = steps < 1 ? 1 : steps;
+}
+
+static void define_in_sandbox(FuncStmt* func_stmt, ObjFunc* func) {
+  if (sandbox == NULL)
+    return;
+  int index = find_symbol(&top_func_names, func_stmt->name);
+  if (index != -1 && top_funcs.ast[index]->as == func_stmt &&
+      (top_func_flags.ints[index] & FUNC_PURE))
+    push_hashmap(&sandbox->variables, func->name, OBJ_VAL(func));
+}
+
+// A literal, or a minus in front of a number literal
+static bool constant_argument(Ast* ast, Value* value) {
+  switch (ast->type) {
+    case AST_INT:
+      *value = INT_VAL(((IntExpr*)ast->as)->value);
+      return true;
+    case AST_NUMBER:
+      *value = NUMBER_VAL(((NumberExpr*)ast->as)->value);
+      return true;
+    case AST_BOOL:
+      *value = BOOLEAN_VAL(((BoolExpr*)ast->as)->value);
+      return true;
+    case AST_STRING: {
+      StringExpr* string_expr = (StringExpr*)ast->as;
+      *value =
+          OBJ_VAL(make_obj_string(string_expr->start, string_expr->length));
+      return true;
+    }
+    case AST_GROUP:
+      return constant_argument(((GroupExpr*)ast->as)->expr, value);
+    case AST_UNARY: {
+      UnaryExpr* unary_expr = (UnaryExpr*)ast->as;
+      if (unary_expr->op.type != TOKEN_MINUS ||
+          !constant_argument(unary_expr->right_expr, value))
+        return false;
+      // The same as OP_NEGATE
+      if (IS_INT(*value) && AS_INT(*value) != INT64_MIN)
+        *value = INT_VAL(-AS_INT(*value));
+      else if (IS_NUMERIC(*value))
+        *value = NUMBER_VAL(-AS_NUMERIC(*value));
+      else
+        return false;
+      return true;
+    }
+    default:
+      return false;
+  }
+}
+
+// The value the call returns when it is run in the sandbox, false if the
+// call has to be made at runtime
+static bool fold_call(CallExpr* call_expr, Value* result) {
+  if (sandbox == NULL)
+    return false;
+
+  Token name = ((VariableExpr*)call_expr->callee->as)->name;
+  int index = find_symbol(&top_func_names, name);
+  if (index == -1 || !(top_func_flags.ints[index] & FUNC_PURE))
+    return false;
+
+  ValueArray arguments;
+  init_value_array(&arguments);
+  bool folded = true;
+  for (int i = 0; i < call_expr->arguments->count && folded; i++) {
+    Value argument;
+    folded = constant_argument(call_expr->arguments->ast[i], &argument);
+    push_value_array(&arguments, argument);
+  }
+
+  // A function that is not defined yet is nil, which cannot be called
+  if (folded) {
+    Value callee = get_hashmap(&sandbox->variables,
+                               make_obj_string_from_token(name));
+    sandbox->steps = fold_steps;
+    folded = call_func(sandbox, callee, arguments.count, arguments.values,
+                       result) &&
+             (!IS_OBJ(*result) || IS_STRING(*result));
+  }
+  free_value_array(&arguments);
+  return folded;
+}
+
+static void gen(Ast* ast);
+static bool lower_func(IrFunc* ir, FuncStmt* func_stmt);
+
+// A value that stays on the stack while the rest of the expression is
+// generated, the op that takes it off takes it out of temporaries as well
+static void gen_operand(Ast* ast) {
+  gen(ast);
+  current_compiler->temporaries++;
+  count_slots();
+}
+
+// Code that jumps when the truthiness of condition is jump_if, and falls
+// through otherwise, with nothing left on the stack either way. The jumps
+// are added to jumps for the caller to patch. and/or become jumps between
+// their sides, so the bool of the whole condition is never made
+static void gen_branch(Ast* condition, bool jump_if, IntArray* jumps) {
+  if (condition->type == AST_GROUP) {
+    gen_branch(((GroupExpr*)condition->as)->expr, jump_if, jumps);
+    return;
+  }
+
+  if (condition->type == AST_LOGICAL) {
+    LogicalExpr* logical_expr = (LogicalExpr*)condition->as;
+    // Where the left side alone decides the result, which for "and" is
+    // when it is false and for "or" when it is true
+    bool decides = logical_expr->op.type == TOKEN_OR;
+    if (decides == jump_if) {
+      // a and b jumps if false when either is false, a or b jumps if true
+      // when either is true
+      gen_branch(logical_expr->left_expr, jump_if, jumps);
+      gen_branch(logical_expr->right_expr, jump_if, jumps);
+    } else {
+      // Otherwise the left side deciding skips past the right side
+      IntArray skips;
+      init_int_array(&skips);
+      gen_branch(logical_expr->left_expr, decides, &skips);
+      gen_branch(logical_expr->right_expr, jump_if, jumps);
+      patch_jumps(&skips);
+      free_int_array(&skips);
+    }
+    return;
+  }
+
+  gen(condition);
+  push_int_array(jumps, emit_jump(jump_if ? OP_POP_JUMP_IF_TRUE
+                                          : OP_POP_JUMP_IF_FALSE));
+}
+
+// Expressions used as statements, i.e. `a = 10;` or `f();` leave their
+// value on the stack, which nothing is going to use
+static void gen_stmt(Ast* ast) {
+  gen(ast);
+  if (ast != NULL && is_expr(ast))
+    emit_byte(OP_POP);
+}
+
+static void set_line(Token token) {
+  if (token.line > 0)
+    current_line = token.line;
+}
+
+// Compiles the function into its own ObjFunc, defining it is up to the
+// caller
+static ObjFunc* gen_func(FuncStmt* func_stmt) {
+  int line = current_line;
+  set_line(func_stmt->name);
+
+  // Initialize another compiler instance
+  Compiler compiler;
+  init_compiler(&compiler, TYPE_FUNCTION, func_stmt->name);
+
+  // This begin_scope has no close_scope, as it will close with
+  // end_compiler
+  begin_scope(current_compiler);
+
+  IrFunc ir;
+  init_ir_func(&ir, current_compiler->func->name,
+               func_stmt->parameters->count);
+  if (lower_func(&ir, func_stmt)) {
+    optimize_ir(&ir);
+    if (dumping_ir)
+      dump_ir(&ir);
+    if (reporting_types)
+      printf("%s: %d of %d numeric ops unchecked\n",
+             current_compiler->func->name->chars, ir.unchecked_sites,
+             ir.numeric_sites);
+    if (!emit_ir(&ir, current_compiler->func))
+      had_error = true;
+  } else {
+    if (reporting_types)
+      printf("%s: not lowered, every op is checked\n",
+             current_compiler->func->name->chars);
+    set_line(func_stmt->name);
+    // Generate parameters as local variables here
+    for (int i = 0; i < func_stmt->parameters->count; i++) {
+      Token parameter = func_stmt->parameters->tokens[i];
+      int slot = resolve_local(&parameter);
+      if (slot != -1 && current_compiler->local_array.locals[slot].depth ==
+                            current_compiler->scope_depth) {
+        codegen_error(
+            "There is already a variable with this name in this "
+            "scope.\n");
+        continue;
+      }
+      add_local(parameter);
+    }
+
+    // Emit byte-code for the block statement
+    gen(func_stmt->stmt);
+  }
+  free_ir_func(&ir);
+  ObjFunc* func = end_compiler();
+  func->arity = func_stmt->arity;
+  if (is_memoized(func_stmt))
+    func->memo = make_memo_cache(func->name->chars, func->arity);
+  else if (func_stmt->memo)
+    printf("%s is not memoized, only pure functions of the top level are\n",
+           func->name->chars);
+  current_line = line;
+  return func;
+}
+
+// Calls the function in the global through OP_CALL
+static void gen_call(CallExpr* call_expr) {
+  Token name = ((VariableExpr*)call_expr->callee->as)->name;
+  emit_operand(OP_GET_GLOBAL, OP_GET_GLOBAL_WIDE, global_constant(name));
+  current_compiler->temporaries++;
+  count_slots();
+
+  for (int i = 0; i < call_expr->arguments->count; i++) {
+    gen_operand(call_expr->arguments->ast[i]);
+  }
+  current_compiler->temporaries -= call_expr->arguments->count + 1;
+
+  // The argument count, then the index of the call's inline cache
+  if (current_chunk()->call_cache_count == UINT16_MAX + 1)
+    codegen_error("Tried to make more than %d calls in one function\n",
+                  UINT16_MAX + 1);
+  emit_byte(OP_CALL);
+  emit_byte(call_expr->arguments->count);
+  emit_short(add_call_cache(current_chunk()));
+}
+
+// Calls to small leaf functions are replaced by the body of the function.
+// Its parameters and lets take the slots above the caller's locals, and a
+// guard checks that the global still holds the function, the program
+// reassigning it makes the call a real one again.
+//
+// The functions are found before any code is generated, as a call can come
+// before the definition. inline_names is the name to the index in
+// inline_funcs, the function object is made the first time a call or the
+// definition needs it, so that both refer to the same one
+#define INLINE_MAX_SIZE 24
+
+static SymbolTable inline_names;
+static AstArray inline_funcs;
+static ValueArray inline_values;
+
+static int add_inline_sizes(int a, int b) {
+  return a == -1 || b == -1 ? -1 : a + b;
+}
+
+// The number of nodes in the expression, -1 if it has a node that is not
+// inlined, calls most of all as only leaf functions are
+static int inline_size(Ast* ast) {
+  if (ast == NULL)
+    return -1;
+
+  switch (ast->type) {
+    case AST_NUMBER:
+    case AST_INT:
+    case AST_STRING:
+    case AST_BOOL:
+    case AST_VARIABLE_EXPR:
+      return 1;
+    case AST_GROUP:
+      return inline_size(((GroupExpr*)ast->as)->expr);
+    case AST_UNARY:
+      return add_inline_sizes(1,
+                              inline_size(((UnaryExpr*)ast->as)->right_expr));
+    case AST_ASSIGNMENT_EXPR:
+      return add_inline_sizes(1,
+                              inline_size(((AssignmentExpr*)ast->as)->expr));
+    case AST_GET_FIELD:
+      return add_inline_sizes(1,
+                              inline_size(((GetFieldExpr*)ast->as)->object));
+    case AST_BINARY: {
+      BinaryExpr* binary_expr = (BinaryExpr*)ast->as;
+      return add_inline_sizes(
+          1, add_inline_sizes(inline_size(binary_expr->left_expr),
+                              inline_size(binary_expr->right_expr)));
+    }
+    case AST_LOGICAL: {
+      LogicalExpr* logical_expr = (LogicalExpr*)ast->as;
+      return add_inline_sizes(
+          1, add_inline_sizes(inline_size(logical_expr->left_expr),
+                              inline_size(logical_expr->right_expr)));
+    }
+    case AST_INDEX: {
+      IndexExpr* index_expr = (IndexExpr*)ast->as;
+      return add_inline_sizes(
+          1, add_inline_sizes(inline_size(index_expr->object),
+                              inline_size(index_expr->index)));
+    }
+    default:
+      return -1;
+  }
+}
+
+// A body of lets followed by a return, with no two parameters or lets of
+// the same name, and small enough to be copied to every call
+static bool is_inlinable(FuncStmt* func_stmt) {
+  if (func_stmt->stmt == NULL || func_stmt->stmt->type != AST_BLOCK)
+    return false;
+  AstArray* body = &((BlockStmt*)func_stmt->stmt->as)->ast_array;
+  for (int i = 0; i < body->count; i++) {
+    if (body->ast[i] == NULL)
+      return false;
+  }
+  if (body->count == 0 || body->ast[body->count - 1]->type != AST_RETURN)
+    return false;
+
+  SymbolTable names;
+  init_symbol_table(&names);
+  int size = 0;
+  for (int i = 0; i < func_stmt->parameters->count && size != -1; i++) {
+    Token parameter = func_stmt->parameters->tokens[i];
+    size = find_symbol(&names, parameter) == -1 ? size + 1 : -1;
+    set_symbol(&names, parameter, i);
+  }
+  for (int i = 0; i < body->count - 1 && size != -1; i++) {
+    if (body->ast[i]->type != AST_VARIABLE_STMT) {
+      size = -1;
+      break;
+    }
+    VariableStmt* variable_stmt = (VariableStmt*)body->ast[i]->as;
+    if (find_symbol(&names, variable_stmt->name) != -1) {
+      size = -1;
+      break;
+    }
+    set_symbol(&names, variable_stmt->name, i);
+    if (variable_stmt->initializer_expr->type != AST_NONE)
+      size = add_inline_sizes(size,
+                              inline_size(variable_stmt->initializer_expr));
+    size = add_inline_sizes(size, 1);
+  }
+  free_symbol_table(&names);
+
+  ReturnStmt* return_stmt = (ReturnStmt*)body->ast[body->count - 1]->as;
+  if (return_stmt->value_expr->type != AST_NONE)
+    size = add_inline_sizes(size, inline_size(return_stmt->value_expr));
+  return size != -1 && size <= INLINE_MAX_SIZE;
+}
+
+// Functions of the top level only, when a name is defined more than once
+// the first definition is the one inlined, the guard sends calls to the
+// real function once another definition replaced it
+static void find_inline_funcs(AstArray* ast_arr) {
+  for (int i = 0; i < ast_arr->count; i++) {
+    Ast* ast = ast_arr->ast[i];
+    if (ast == NULL || ast->type != AST_FUNC)
+      continue;
+    FuncStmt* func_stmt = (FuncStmt*)ast->as;
+    if (find_symbol(&inline_names, func_stmt->name) != -1 ||
+        !is_inlinable(func_stmt) || is_memoized(func_stmt))
+      continue;
+    set_symbol(&inline_names, func_stmt->name, inline_funcs.count);
+    push_ast_array(&inline_funcs, ast);
+    push_value_array(&inline_values, NIL_VAL);
+  }
+}
+
+static ObjFunc* inline_func(int index) {
+  if (IS_NIL(inline_values.values[index]))
+    inline_values.values[index] =
+        OBJ_VAL(gen_func((FuncStmt*)inline_funcs.ast[index]->as));
+  return (ObjFunc*)AS_OBJ(inline_values.values[index]);
+}
+
+// The function for a definition, which a call may have made already
+static ObjFunc* func_for_definition(FuncStmt* func_stmt) {
+  int index = find_symbol(&inline_names, func_stmt->name);
+  if (index != -1 && inline_funcs.ast[index]->as == func_stmt)
+    return inline_func(index);
+  return gen_func(func_stmt);
+}
+
+// The inline function a call to the name is, -1 if there is none
+static int find_inline(Token* name, int argument_count) {
+  int index = find_symbol(&inline_names, *name);
+  if (index == -1)
+    return -1;
+
+  // Leave arity mismatches to the runtime check in OP_CALL
+  FuncStmt* func_stmt = (FuncStmt*)inline_funcs.ast[index]->as;
+  if (func_stmt->arity != argument_count)
+    return -1;
+  return index;
+}
+
+// The inline function a call can be replaced by, -1 if it has to be a real
+// call
+static int resolve_inline(Token* name, int argument_count) {
+  int index = find_inline(name, argument_count);
+  if (index == -1)
+    return -1;
+
+  LocalArray* locals = &current_compiler->local_array;
+  if (locals->count + current_compiler->temporaries + INLINE_MAX_SIZE >
+      UINT16_MAX + 1)
+    return -1;
+  return index;
+}
+
+static void gen_inline_call(CallExpr* call_expr, int index) {
+  Compiler* compiler = current_compiler;
+  Token name = ((VariableExpr*)call_expr->callee->as)->name;
+  FuncStmt* func_stmt = (FuncStmt*)inline_funcs.ast[index]->as;
+  ObjFunc* func = inline_func(index);
+
+  // A real call when the global is not the function anymore, jumped over
+  // to the body otherwise
+  emit_byte(OP_JUMP_IF_GLOBAL);
+  emit_short(global_constant(name));
+  emit_short(add_constant(OBJ_VAL(func)));
+  int inline_jump = current_chunk()->count;
+  emit_short(0xffff);
+
+  gen_call(call_expr);
+  int end_jump = emit_jump(OP_JUMP);
+  patch_jump(inline_jump);
+
+  for (int i = 0; i < call_expr->arguments->count; i++) {
+    gen_operand(call_expr->arguments->ast[i]);
+  }
+  compiler->temporaries -= call_expr->arguments->count;
+
+  // The temporaries under the arguments are given locals with no name, so
+  // that the parameters are the slots the arguments were pushed to
+  int temporaries = compiler->temporaries;
+  int local_floor = compiler->local_floor;
+  Token no_name = name;
+  no_name.start = "";
+  no_name.length = 0;
+
+  begin_scope(compiler);
+  for (int i = 0; i < temporaries; i++) {
+    add_local(no_name);
+  }
+  int first_slot = compiler->local_array.count;
+  compiler->local_floor = first_slot;
+  compiler->temporaries = 0;
+  for (int i = 0; i < func_stmt->parameters->count; i++) {
+    add_local(func_stmt->parameters->tokens[i]);
+  }
+
+  AstArray* body = &((BlockStmt*)func_stmt->stmt->as)->ast_array;
+  for (int i = 0; i < body->count - 1; i++) {
+    VariableStmt* variable_stmt = (VariableStmt*)body->ast[i]->as;
+    set_line(variable_stmt->name);
+    add_local(variable_stmt->name);
+    if (variable_stmt->initializer_expr->type != AST_NONE)
+      gen(variable_stmt->initializer_expr);
+    else
+      emit_byte(OP_NIL);
+  }
+  ReturnStmt* return_stmt = (ReturnStmt*)body->ast[body->count - 1]->as;
+  if (return_stmt->value_expr->type != AST_NONE)
+    gen(return_stmt->value_expr);
+  else
+    emit_byte(OP_NIL);
+
+  // The result takes the place of the parameters and lets
+  set_line(name);
+  int local_count = compiler->local_array.count - first_slot;
+  if (local_count > 0) {
+    emit_byte(OP_POP_BELOW);
+    emit_byte(local_count);
+  }
+  while (compiler->local_array.count > first_slot - temporaries) {
+    remove_local();
+  }
+  close_scope(compiler);
+  compiler->local_floor = local_floor;
+  compiler->temporaries = temporaries;
+
+  patch_jump(end_jump);
+}
+
+// Function bodies are lowered to the SSA form of ir.h and optimized there
+// before their bytecode is emitted. A function with anything the lowering
+// does not handle, a nested function or an error gen reports, is generated
+// directly by gen instead, which also keeps the error messages in one
+// place. The top level is always generated by gen
+typedef struct {
+  IrFunc* ir;
+  // The block that is being lowered into
+  int block;
+
+  // The locals in scope, and the IR variable of each
+  LocalArray locals;
+  IntArray variables;
+  SymbolTable local_indexes;
+  int scope_depth;
+  // Locals below this cannot be seen by name, the caller's locals while an
+  // inlined body is lowered
+  int local_floor;
+
+  // The names of globals and fields, made once per function
+  SymbolTable names;
+  ValueArray name_values;
+
+  bool failed;
+} Lowering;
+
+static int lower(Lowering* lowering, Ast* ast);
+
+// The lowering carries on after a failure so that it does not have to
+// unwind, the nil stands in for the value that could not be lowered
+static int fail_lowering(Lowering* lowering) {
+  lowering->failed = true;
+  return add_ir_constant(lowering->ir, NIL_VAL);
+}
+
+static Value name_value(Lowering* lowering, Token name) {
+  int index = find_symbol(&lowering->names, name);
+  if (index == -1) {
+    index = lowering->name_values.count;
+    set_symbol(&lowering->names, name, index);
+    push_value_array(&lowering->name_values,
+                     OBJ_VAL(make_obj_string_from_token(name)));
+  }
+  return lowering->name_values.values[index];
+}
+
+static int add_lowered(Lowering* lowering, IrOp op) {
+  return add_ir_instr(lowering->ir, lowering->block, op, current_line);
+}
+
+static int add_lowered_unary(Lowering* lowering, IrOp op, int operand) {
+  int instr = add_lowered(lowering, op);
+  add_ir_operand(lowering->ir, instr, operand);
+  return instr;
+}
+
+static int add_lowered_binary(Lowering* lowering,
+                              IrOp op,
+                              int left,
+                              int right) {
+  int instr = add_lowered_unary(lowering, op, left);
+  add_ir_operand(lowering->ir, instr, right);
+  return instr;
+}
+
+static void switch_block(Lowering* lowering, int block) {
+  start_ir_block(lowering->ir, block);
+  lowering->block = block;
+}
+
+static void jump_to(Lowering* lowering, int target) {
+  add_ir_jump(lowering->ir, lowering->block, target, current_line);
+}
+
+// The index of the innermost local with the name in the locals, -1 if it
+// is not a local
+static int find_lowered_local(Lowering* lowering, Token* name) {
+  int index = find_symbol(&lowering->local_indexes, *name);
+  return index < lowering->local_floor ? -1 : index;
+}
+
+// Fails on the same duplicate names and local count gen reports an error
+// for, the local's variable is returned
+static int add_lowered_local(Lowering* lowering, Token name) {
+  int index = find_lowered_local(lowering, &name);
+  if ((index != -1 &&
+       lowering->locals.locals[index].depth == lowering->scope_depth) ||
+      lowering->locals.count == UINT16_MAX + 1) {
+    lowering->failed = true;
+  }
+
+  Local local;
+  local.name = name;
+  local.depth = lowering->scope_depth;
+  local.shadowed = find_symbol(&lowering->local_indexes, name);
+  set_symbol(&lowering->local_indexes, name, lowering->locals.count);
+  push_local_array(&lowering->locals, local);
+
+  int variable = add_ir_variable(lowering->ir);
+  push_int_array(&lowering->variables, variable);
+  return variable;
+}
+
+static void remove_lowered_locals(Lowering* lowering, int count) {
+  while (lowering->locals.count > count) {
+    Local* local = &lowering->locals.locals[--lowering->locals.count];
+    set_symbol(&lowering->local_indexes, local->name, local->shadowed);
+    lowering->variables.count--;
+  }
+}
+
+static void close_lowered_scope(Lowering* lowering) {
+  lowering->scope_depth--;
+  int count = lowering->locals.count;
+  while (count > 0 &&
+         lowering->locals.locals[count - 1].depth > lowering->scope_depth) {
+    count--;
+  }
+  remove_lowered_locals(lowering, count);
+}
+
+static void write_local(Lowering* lowering, int index, int value) {
+  write_ir_variable(lowering->ir, lowering->variables.ints[index],
+                    lowering->block, value);
+}
+
+// Ends the block in a branch to truthy or falsy on the condition, and/or
+// become branches between their sides like in gen_branch. The caller seals
+// the targets once it has added any other edges into them
+static void lower_branch(Lowering* lowering,
+                         Ast* condition,
+                         int truthy,
+                         int falsy) {
+  if (condition->type == AST_GROUP) {
+    lower_branch(lowering, ((GroupExpr*)condition->as)->expr, truthy, falsy);
+    return;
+  }
+
+  if (condition->type == AST_LOGICAL) {
+    LogicalExpr* logical_expr = (LogicalExpr*)condition->as;
+    int right = add_ir_block(lowering->ir);
+    if (logical_expr->op.type == TOKEN_AND)
+      lower_branch(lowering, logical_expr->left_expr, right, falsy);
+    else
+      lower_branch(lowering, logical_expr->left_expr, truthy, right);
+    seal_ir_block(lowering->ir, right);
+    switch_block(lowering, right);
+    lower_branch(lowering, logical_expr->right_expr, truthy, falsy);
+    return;
+  }
+
+  int value = lower(lowering, condition);
+  add_ir_branch(lowering->ir, lowering->block, value, truthy, falsy,
+                current_line);
+}
+
+// The result is the value of the side that decided, which goes through a
+// variable so that the block after both gets a phi of the two
+static int lower_logical(Lowering* lowering, LogicalExpr* logical_expr) {
+  IrFunc* ir = lowering->ir;
+  int variable = add_ir_variable(ir);
+  int left = lower(lowering, logical_expr->left_expr);
+  write_ir_variable(ir, variable, lowering->block, left);
+  set_line(logical_expr->op);
+
+  int right_block = add_ir_block(ir);
+  int end_block = add_ir_block(ir);
+  if (logical_expr->op.type == TOKEN_AND)
+    add_ir_branch(ir, lowering->block, left, right_block, end_block,
+                  current_line);
+  else
+    add_ir_branch(ir, lowering->block, left, end_block, right_block,
+                  current_line);
+  seal_ir_block(ir, right_block);
+  switch_block(lowering, right_block);
+  int right = lower(lowering, logical_expr->right_expr);
+  write_ir_variable(ir, variable, lowering->block, right);
+  jump_to(lowering, end_block);
+
+  seal_ir_block(ir, end_block);
+  switch_block(lowering, end_block);
+  return read_ir_variable(ir, variable, end_block);
+}
+
+// The callee then the arguments, like gen_call
+static int lower_call(Lowering* lowering, CallExpr* call_expr) {
+  Token name = ((VariableExpr*)call_expr->callee->as)->name;
+  int callee = add_lowered(lowering, IR_GET_GLOBAL);
+  lowering->ir->instrs[callee].value = name_value(lowering, name);
+
+  IntArray arguments;
+  init_int_array(&arguments);
+  for (int i = 0; i < call_expr->arguments->count; i++) {
+    push_int_array(&arguments, lower(lowering, call_expr->arguments->ast[i]));
+  }
+  set_line(name);
+  int call = add_lowered_unary(lowering, IR_CALL, callee);
+  for (int i = 0; i < arguments.count; i++) {
+    add_ir_operand(lowering->ir, call, arguments.ints[i]);
+  }
+  free_int_array(&arguments);
+  return call;
+}
+
+// The same guard and real call as gen_inline_call, with the body's
+// parameters and lets as variables of this function
+static int lower_inline_call(Lowering* lowering,
+                             CallExpr* call_expr,
+                             int index) {
+  IrFunc* ir = lowering->ir;
+  Token name = ((VariableExpr*)call_expr->callee->as)->name;
+  FuncStmt* func_stmt = (FuncStmt*)inline_funcs.ast[index]->as;
+  ObjFunc* func = inline_func(index);
+  int result = add_ir_variable(ir);
+
+  int inline_block = add_ir_block(ir);
+  int call_block = add_ir_block(ir);
+  int end_block = add_ir_block(ir);
+  add_ir_branch_global(ir, lowering->block, name_value(lowering, name),
+                       OBJ_VAL(func), inline_block, call_block, current_line);
+  seal_ir_block(ir, call_block);
+  seal_ir_block(ir, inline_block);
+
+  switch_block(lowering, call_block);
+  write_ir_variable(ir, result, call_block, lower_call(lowering, call_expr));
+  jump_to(lowering, end_block);
+
+  switch_block(lowering, inline_block);
+  IntArray arguments;
+  init_int_array(&arguments);
+  for (int i = 0; i < call_expr->arguments->count; i++) {
+    push_int_array(&arguments, lower(lowering, call_expr->arguments->ast[i]));
+  }
 
-        if (IS_NUMBER(value)) {
-          printf("[%d-%d] [%-20s] at %d: %f\n", i - 1, i, "OP_GET_GLOBAL", i,
-                 AS_NUMBER(value));
-        } else if (IS_STRING(value)) {
-          ObjString* string = AS_OBJ_STRING(value);
-          printf("[%d-%d] [%-20s] at %d: %s\n", i - 1, i, "OP_GET_GLOBAL", i,
-                 string->chars);
-        }
+  int local_count = lowering->locals.count;
+  int local_floor = lowering->local_floor;
+  lowering->local_floor = local_count;
+  lowering->scope_depth++;
+  for (int i = 0; i < func_stmt->parameters->count; i++) {
+    add_lowered_local(lowering, func_stmt->parameters->tokens[i]);
+    write_local(lowering, lowering->locals.count - 1, arguments.ints[i]);
+  }
+  free_int_array(&arguments);
 
-        // printf("[%d-%d] [%-20s] at constants_array: \n", i - 1, i,
-        //        "OP_GET_GLOBAL");
-        break;
-      case OP_GET_LOCAL:
-        i++;  //
-        printf("[%d-%d] [%-20s] at constants_array: %d\n", i - 1, i,
-               "OP_GET_LOCAL", current_compiler->func->chunk.code.ops[i]);
-        // op_arr->ops[i]);
-        break;
-      case OP_DEFINE_GLOBAL:
-        printf("[%d] [%-20s]\n", i, "OP_DEFINE_GLOBAL");
-        break;
-      case OP_JUMP:
-        printf("[%d] [%-20s]\n", i, "OP_JUMP");
-        break;
-      case OP_JUMP_IF_FALSE: {
-        // i+=2; // get the index of the jump, if false
-        // uint16_t number =
-        //     (uint16_t)((op_arr->ops[i + 1] << 8) | (op_arr->ops[i + 2]));
-        // i += 2;
-        // printf("[%d-%d] [%-20s] jump if false to : %d\n", i - 2, i,
-        //        "OP_JUMP_IF_FALSE", number);
-        printf("OP_JUMP_IF_FALSE\n");
-        break;
-      }
-      case OP_CALL:
-        printf("[%d] [%-20s]\n", i, "OP_CALL");
-        break;
-      case OP_NIL:
-        printf("[%d] [%-20s]\n", i, "OP_NIL");
-        break;
-      case OP_LOOP:
-        printf("OP_LOOP\n");
-        break;
+  AstArray* body = &((BlockStmt*)func_stmt->stmt->as)->ast_array;
+  for (int i = 0; i < body->count - 1; i++) {
+    lower(lowering, body->ast[i]);
+  }
+  ReturnStmt* return_stmt = (ReturnStmt*)body->ast[body->count - 1]->as;
+  int value = return_stmt->value_expr->type != AST_NONE
+                  ? lower(lowering, return_stmt->value_expr)
+                  : add_ir_constant(ir, NIL_VAL);
+  write_ir_variable(ir, result, lowering->block, value);
+
+  lowering->scope_depth--;
+  remove_lowered_locals(lowering, local_count);
+  lowering->local_floor = local_floor;
+  set_line(name);
+  jump_to(lowering, end_block);
+
+  seal_ir_block(ir, end_block);
+  switch_block(lowering, end_block);
+  return read_ir_variable(ir, result, end_block);
+}
+
+static int lower_call_expr(Lowering* lowering, CallExpr* call_expr) {
+  Token name = ((VariableExpr*)call_expr->callee->as)->name;
+  int argument_count = call_expr->arguments->count;
+  set_line(name);
+  if (argument_count > UINT8_MAX)
+    return fail_lowering(lowering);
+
+  int native_index = find_lowered_local(lowering, &name) == -1
+                         ? native_for_call(&name, argument_count)
+                         : -1;
+  if (native_index != -1) {
+    IntArray arguments;
+    init_int_array(&arguments);
+    for (int i = 0; i < argument_count; i++) {
+      push_int_array(&arguments,
+                     lower(lowering, call_expr->arguments->ast[i]));
+    }
+    int call = add_lowered(lowering, IR_CALL_NATIVE);
+    lowering->ir->instrs[call].index = native_index;
+    for (int i = 0; i < arguments.count; i++) {
+      add_ir_operand(lowering->ir, call, arguments.ints[i]);
     }
+    free_int_array(&arguments);
+    return call;
   }
-#endif
 
-  current_compiler = (Compiler*)current_compiler->enclosing;
-  return func;
+  Value folded;
+  if (fold_call(call_expr, &folded))
+    return add_ir_constant(lowering->ir, folded);
+
+  int inline_index = find_inline(&name, argument_count);
+  if (inline_index != -1 &&
+      lowering->locals.count + INLINE_MAX_SIZE <= UINT16_MAX + 1)
+    return lower_inline_call(lowering, call_expr, inline_index);
+  return lower_call(lowering, call_expr);
 }
 
-static void free_compiler(Compiler* compiler) {
-  free_local_array(&compiler->local_array);
+// IR_PARAM for a token that is not a binary op
+static IrOp binary_ir_op(TokenType type) {
+  switch (type) {
+    case TOKEN_PLUS:
+    case TOKEN_PLUS_EQUAL:
+      return IR_ADD;
+    case TOKEN_MINUS:
+    case TOKEN_MINUS_EQUAL:
+      return IR_SUBTRACT;
+    case TOKEN_STAR:
+    case TOKEN_STAR_EQUAL:
+      return IR_MULTIPLY;
+    case TOKEN_SLASH:
+    case TOKEN_SLASH_EQUAL:
+      return IR_DIVIDE;
+    case TOKEN_PERCENT:
+      return IR_MODULO;
+    case TOKEN_AMPERSAND:
+      return IR_BIT_AND;
+    case TOKEN_PIPE:
+      return IR_BIT_OR;
+    case TOKEN_CARET:
+      return IR_BIT_XOR;
+    case TOKEN_LESS_LESS:
+      return IR_SHIFT_LEFT;
+    case TOKEN_GREATER_GREATER:
+      return IR_SHIFT_RIGHT;
+    // != <= and >= are the negation of the op after them
+    case TOKEN_EQUAL_EQUAL:
+    case TOKEN_BANG_EQUAL:
+      return IR_EQUAL;
+    case TOKEN_LESS:
+    case TOKEN_GREATER_EQUAL:
+      return IR_LESS;
+    case TOKEN_GREATER:
+    case TOKEN_LESS_EQUAL:
+      return IR_GREATER;
+    default:
+      return IR_PARAM;
+  }
 }
 
-static void begin_scope(Compiler* compiler) {
-  compiler->scope_depth++;
+static int lower_binary(Lowering* lowering, BinaryExpr* binary_expr) {
+  set_line(binary_expr->op);
+  int left = lower(lowering, binary_expr->left_expr);
+  int right = lower(lowering, binary_expr->right_expr);
+  TokenType type = binary_expr->op.type;
+  IrOp op = binary_ir_op(type);
+  if (op == IR_PARAM)
+    return fail_lowering(lowering);
+
+  int value = add_lowered_binary(lowering, op, left, right);
+  if (type == TOKEN_BANG_EQUAL || type == TOKEN_LESS_EQUAL ||
+      type == TOKEN_GREATER_EQUAL)
+    value = add_lowered_unary(lowering, IR_NOT, value);
+  return value;
 }
 
-static void close_scope(Compiler* compiler) {
-  compiler->scope_depth--;
+static int lower_elements(Lowering* lowering, IrOp op, AstArray* elements) {
+  IntArray values;
+  init_int_array(&values);
+  for (int i = 0; i < elements->count; i++) {
+    push_int_array(&values, lower(lowering, elements->ast[i]));
+  }
+  int instr = add_lowered(lowering, op);
+  for (int i = 0; i < values.count; i++) {
+    add_ir_operand(lowering->ir, instr, values.ints[i]);
+  }
+  free_int_array(&values);
+  return instr;
 }
 
-static int emit_jump(uint8_t instruction) {
-  emit_byte(instruction);
-  emit_byte(0xff);
-  emit_byte(0xff);
-  return current_chunk()->count - 2;
+static void lower_if(Lowering* lowering, IfStmt* if_stmt) {
+  IrFunc* ir = lowering->ir;
+  int then_block = add_ir_block(ir);
+  int end_block = add_ir_block(ir);
+  int else_block = if_stmt->else_stmt != NULL ? add_ir_block(ir) : end_block;
+  lower_branch(lowering, if_stmt->condition_expr, then_block, else_block);
+
+  seal_ir_block(ir, then_block);
+  switch_block(lowering, then_block);
+  lower(lowering, if_stmt->then_stmt);
+  jump_to(lowering, end_block);
+
+  if (if_stmt->else_stmt != NULL) {
+    seal_ir_block(ir, else_block);
+    switch_block(lowering, else_block);
+    lower(lowering, if_stmt->else_stmt);
+    jump_to(lowering, end_block);
+  }
+  seal_ir_block(ir, end_block);
+  switch_block(lowering, end_block);
 }
 
-static void emit_loop(int loop_start) {
-  emit_byte(OP_LOOP);
+// The condition is tested once before the loop and again at the end of
+// every iteration, so that the loop has a block that runs only when the
+// body is about to, for what the optimizer moves out of the loop. The
+// body and for's then expression jump back to the top of the body
+static void lower_loop(Lowering* lowering,
+                       Ast* condition,
+                       Ast* body,
+                       Ast* then_expr) {
+  IrFunc* ir = lowering->ir;
+  if (condition == NULL || condition->type == AST_NONE) {
+    lowering->failed = true;
+    return;
+  }
 
-  int offset = current_chunk()->count - loop_start + 2;
-  if (offset > UINT16_MAX)
-    printf("loop body too large\n");
+  int preheader_block = add_ir_block(ir);
+  int body_block = add_ir_block(ir);
+  int exit_block = add_ir_block(ir);
+  lower_branch(lowering, condition, preheader_block, exit_block);
+  seal_ir_block(ir, preheader_block);
+  switch_block(lowering, preheader_block);
+  jump_to(lowering, body_block);
+
+  switch_block(lowering, body_block);
+  lower(lowering, body);
+  lower(lowering, then_expr);
+  lower_branch(lowering, condition, body_block, exit_block);
+  seal_ir_block(ir, body_block);
+  seal_ir_block(ir, exit_block);
+
+  switch_block(lowering, exit_block);
+}
 
-  emit_byte((offset >> 8) & 0xff);
-  emit_byte(offset & 0xff);
+// The value of an expression, -1 for a statement
+static int lower(Lowering* lowering, Ast* ast) {
+  IrFunc* ir = lowering->ir;
+  if (ast == NULL)
+    return -1;
+
+  switch (ast->type) {
+    case AST_NONE:
+      return -1;
+    case AST_PRINT: {
+      int value = lower(lowering, ((PrintStmt*)ast->as)->expr);
+      add_lowered_unary(lowering, IR_PRINT, value);
+      return -1;
+    }
+    case AST_IF:
+      lower_if(lowering, (IfStmt*)ast->as);
+      return -1;
+    case AST_WHILE: {
+      WhileStmt* while_stmt = (WhileStmt*)ast->as;
+      lower_loop(lowering, while_stmt->condition_expr, while_stmt->block_stmt,
+                 NULL);
+      return -1;
+    }
+    case AST_FOR: {
+      // The initialization is in the scope around the loop, like in gen
+      ForStmt* for_stmt = (ForStmt*)ast->as;
+      lower(lowering, for_stmt->assignment_stmt);
+      lower_loop(lowering, for_stmt->condition_expr, for_stmt->block_stmt,
+                 for_stmt->then_expr);
+      return -1;
+    }
+    case AST_BLOCK: {
+      BlockStmt* block_stmt = (BlockStmt*)ast->as;
+      lowering->scope_depth++;
+      for (int i = 0; i < block_stmt->ast_array.count; i++) {
+        lower(lowering, block_stmt->ast_array.ast[i]);
+      }
+      close_lowered_scope(lowering);
+      return -1;
+    }
+    case AST_VARIABLE_STMT: {
+      // The local is in scope in its own initializer like in gen, where
+      // it reads as nil
+      VariableStmt* variable_stmt = (VariableStmt*)ast->as;
+      set_line(variable_stmt->name);
+      add_lowered_local(lowering, variable_stmt->name);
+      int index = lowering->locals.count - 1;
+      write_local(lowering, index, add_ir_constant(ir, NIL_VAL));
+
+      int value = add_ir_constant(ir, NIL_VAL);
+      if (variable_stmt->initializer_expr->type != AST_NONE) {
+        value = lower(lowering, variable_stmt->initializer_expr);
+        variable_stmt->initialized = true;
+      }
+      write_local(lowering, index, value);
+      return -1;
+    }
+    case AST_RETURN: {
+      ReturnStmt* return_stmt = (ReturnStmt*)ast->as;
+      int value = return_stmt->value_expr->type != AST_NONE
+                      ? lower(lowering, return_stmt->value_expr)
+                      : add_ir_constant(ir, NIL_VAL);
+      add_lowered_unary(lowering, IR_RETURN, value);
+
+      // Anything after the return cannot be reached, it is lowered into a
+      // block of its own that the optimizer drops
+      int block = add_ir_block(ir);
+      seal_ir_block(ir, block);
+      switch_block(lowering, block);
+      return -1;
+    }
+    case AST_NUMBER:
+      return add_ir_constant(ir, NUMBER_VAL(((NumberExpr*)ast->as)->value));
+    case AST_INT:
+      return add_ir_constant(ir, INT_VAL(((IntExpr*)ast->as)->value));
+    case AST_BOOL:
+      return add_ir_constant(ir, BOOLEAN_VAL(((BoolExpr*)ast->as)->value));
+    case AST_STRING: {
+      StringExpr* string_expr = (StringExpr*)ast->as;
+      return add_ir_constant(
+          ir, OBJ_VAL(make_obj_string(string_expr->start,
+                                      string_expr->length)));
+    }
+    case AST_VARIABLE_EXPR: {
+      Token name = ((VariableExpr*)ast->as)->name;
+      set_line(name);
+      int index = find_lowered_local(lowering, &name);
+      if (index != -1)
+        return read_ir_variable(ir, lowering->variables.ints[index],
+                                lowering->block);
+      int value = add_lowered(lowering, IR_GET_GLOBAL);
+      ir->instrs[value].value = name_value(lowering, name);
+      return value;
+    }
+    case AST_ASSIGNMENT_EXPR: {
+      AssignmentExpr* assignment_expr = (AssignmentExpr*)ast->as;
+      Token name = assignment_expr->name;
+      set_line(name);
+      int value = lower(lowering, assignment_expr->expr);
+      int index = find_lowered_local(lowering, &name);
+      if (index != -1) {
+        write_local(lowering, index, value);
+        return value;
+      }
+      int set = add_lowered_unary(lowering, IR_SET_GLOBAL, value);
+      ir->instrs[set].value = name_value(lowering, name);
+      return set;
+    }
+    case AST_GROUP:
+      return lower(lowering, ((GroupExpr*)ast->as)->expr);
+    case AST_BINARY:
+      return lower_binary(lowering, (BinaryExpr*)ast->as);
+    case AST_UNARY: {
+      UnaryExpr* unary_expr = (UnaryExpr*)ast->as;
+      set_line(unary_expr->op);
+      int value = lower(lowering, unary_expr->right_expr);
+      switch (unary_expr->op.type) {
+        case TOKEN_BANG:
+          return add_lowered_unary(lowering, IR_NOT, value);
+        case TOKEN_MINUS:
+          return add_lowered_unary(lowering, IR_NEGATE, value);
+        case TOKEN_TILDE:
+          return add_lowered_unary(lowering, IR_BIT_NOT, value);
+        default:
+          return value;
+      }
+    }
+    case AST_LOGICAL:
+      return lower_logical(lowering, (LogicalExpr*)ast->as);
+    case AST_CALL:
+      return lower_call_expr(lowering, (CallExpr*)ast->as);
+    case AST_ARRAY: {
+      ArrayExpr* array_expr = (ArrayExpr*)ast->as;
+      set_line(array_expr->bracket);
+      if (array_expr->elements->count > UINT8_MAX)
+        return fail_lowering(lowering);
+      int value = lower_elements(lowering, IR_ARRAY, array_expr->elements);
+      ir->instrs[value].line = array_expr->bracket.line;
+      return value;
+    }
+    case AST_MAP: {
+      // The keys and values in pairs
+      MapExpr* map_expr = (MapExpr*)ast->as;
+      set_line(map_expr->brace);
+      if (map_expr->keys->count > UINT8_MAX)
+        return fail_lowering(lowering);
+      IntArray values;
+      init_int_array(&values);
+      for (int i = 0; i < map_expr->keys->count; i++) {
+        push_int_array(&values, lower(lowering, map_expr->keys->ast[i]));
+        push_int_array(&values, lower(lowering, map_expr->values->ast[i]));
+      }
+      set_line(map_expr->brace);
+      int map = add_lowered(lowering, IR_MAP);
+      for (int i = 0; i < values.count; i++) {
+        add_ir_operand(ir, map, values.ints[i]);
+      }
+      free_int_array(&values);
+      return map;
+    }
+    case AST_INDEX: {
+      IndexExpr* index_expr = (IndexExpr*)ast->as;
+      int object = lower(lowering, index_expr->object);
+      int index = lower(lowering, index_expr->index);
+      set_line(index_expr->bracket);
+      return add_lowered_binary(lowering, IR_INDEX_GET, object, index);
+    }
+    case AST_INDEX_SET: {
+      IndexSetExpr* index_set_expr = (IndexSetExpr*)ast->as;
+      int object = lower(lowering, index_set_expr->object);
+      int index = lower(lowering, index_set_expr->index);
+      int value = lower(lowering, index_set_expr->value_expr);
+      set_line(index_set_expr->bracket);
+      int set = add_lowered_binary(lowering, IR_INDEX_SET, object, index);
+      add_ir_operand(ir, set, value);
+      return set;
+    }
+    case AST_GET_FIELD: {
+      GetFieldExpr* get_field_expr = (GetFieldExpr*)ast->as;
+      int object = lower(lowering, get_field_expr->object);
+      set_line(get_field_expr->name);
+      int get = add_lowered_unary(lowering, IR_GET_FIELD, object);
+      ir->instrs[get].value = name_value(lowering, get_field_expr->name);
+      return get;
+    }
+    case AST_SET_FIELD: {
+      SetFieldExpr* set_field_expr = (SetFieldExpr*)ast->as;
+      int object = lower(lowering, set_field_expr->object);
+      int value = lower(lowering, set_field_expr->value_expr);
+      set_line(set_field_expr->name);
+      int set = add_lowered_binary(lowering, IR_SET_FIELD, object, value);
+      ir->instrs[set].value = name_value(lowering, set_field_expr->name);
+      return set;
+    }
+    default:
+      // Functions in functions
+      return fail_lowering(lowering);
+  }
 }
 
-static void patch_jump(int start) {
-  int jump = current_chunk()->count - start - 2;
-  if (jump > UINT16_MAX) {
-    printf("Too much code to jump over\n");
+// The parameters are the first variables, the body is in a scope of its
+// own under them like in gen_func. Returns false if gen has to generate
+// the function instead
+static bool lower_func(IrFunc* ir, FuncStmt* func_stmt) {
+  Lowering lowering;
+  lowering.ir = ir;
+  init_local_array(&lowering.locals);
+  init_int_array(&lowering.variables);
+  init_symbol_table(&lowering.local_indexes);
+  lowering.scope_depth = 1;
+  lowering.local_floor = 0;
+  init_symbol_table(&lowering.names);
+  init_value_array(&lowering.name_values);
+  lowering.failed = false;
+
+  int entry = add_ir_block(ir);
+  seal_ir_block(ir, entry);
+  switch_block(&lowering, entry);
+  for (int i = 0; i < func_stmt->parameters->count; i++) {
+    add_lowered_local(&lowering, func_stmt->parameters->tokens[i]);
+    int param = add_lowered(&lowering, IR_PARAM);
+    ir->instrs[param].index = i;
+    write_local(&lowering, i, param);
   }
 
-  current_chunk()->code.ops[start] = (jump >> 8) & 0xff;
-  current_chunk()->code.ops[start + 1] = jump & 0xff;
+  lower(&lowering, func_stmt->stmt);
+  add_lowered_unary(&lowering, IR_RETURN, add_ir_constant(ir, NIL_VAL));
+
+  free_local_array(&lowering.locals);
+  free_int_array(&lowering.variables);
+  free_symbol_table(&lowering.local_indexes);
+  free_symbol_table(&lowering.names);
+  free_value_array(&lowering.name_values);
+  return !lowering.failed;
 }
 
 static void gen(Ast* ast) {
@@ -314,20 +2110,21 @@ static void gen(Ast* ast) {
     }
     case AST_IF: {
       IfStmt* if_stmt = (IfStmt*)ast->as;
-      gen(if_stmt->condition_expr);
-
-      int then_jump = emit_jump(OP_JUMP_IF_FALSE);
-      emit_byte(OP_POP);
+      IntArray else_jumps;
+      init_int_array(&else_jumps);
+      gen_branch(if_stmt->condition_expr, false, &else_jumps);
 
-      gen(if_stmt->then_stmt);
+      gen_stmt(if_stmt->then_stmt);
 
-      int else_jump = emit_jump(OP_JUMP);
-      patch_jump(then_jump);
-      emit_byte(OP_POP);
-
-      if (if_stmt->else_stmt != AST_NONE)
-        gen(if_stmt->else_stmt);
-      patch_jump(else_jump);
+      if (if_stmt->else_stmt != AST_NONE) {
+        int end_jump = emit_jump(OP_JUMP);
+        patch_jumps(&else_jumps);
+        gen_stmt(if_stmt->else_stmt);
+        patch_jump(end_jump);
+      } else {
+        patch_jumps(&else_jumps);
+      }
+      free_int_array(&else_jumps);
       break;
     }
     case AST_WHILE: {
@@ -335,18 +2132,15 @@ static void gen(Ast* ast) {
 
       int loop_start = current_chunk()->count;
 
-      // Generate the condition expr
-      gen(while_stmt->condition_expr);
+      IntArray exit_jumps;
+      init_int_array(&exit_jumps);
+      gen_branch(while_stmt->condition_expr, false, &exit_jumps);
 
-      int exit_jump = emit_jump(OP_JUMP_IF_FALSE);
-      emit_byte(OP_POP);
-
-      gen(while_stmt->block_stmt);
+      gen_stmt(while_stmt->block_stmt);
       emit_loop(loop_start);
 
-      patch_jump(exit_jump);
-      emit_byte(OP_POP);
-
+      patch_jumps(&exit_jumps);
+      free_int_array(&exit_jumps);
       break;
     }
     case AST_FOR: {
@@ -358,11 +2152,9 @@ static void gen(Ast* ast) {
 
       int loop_start = current_chunk()->count;
 
-      // Generate the condition expression
-      gen(for_stmt->condition_expr);
-
-      int exit_jump = emit_jump(OP_JUMP_IF_FALSE);
-      emit_byte(OP_POP);
+      IntArray exit_jumps;
+      init_int_array(&exit_jumps);
+      gen_branch(for_stmt->condition_expr, false, &exit_jumps);
 
       int body_jump = emit_jump(OP_JUMP);
       int increment_start = current_chunk()->count;
@@ -376,11 +2168,11 @@ static void gen(Ast* ast) {
       patch_jump(body_jump);
 
       // Generate main function body
-      gen(for_stmt->block_stmt);
+      gen_stmt(for_stmt->block_stmt);
       emit_loop(loop_start);
 
-      patch_jump(exit_jump);
-      emit_byte(OP_POP);
+      patch_jumps(&exit_jumps);
+      free_int_array(&exit_jumps);
 
       break;
     }
@@ -389,7 +2181,7 @@ static void gen(Ast* ast) {
       begin_scope(current_compiler);
       // For every statement inside the block, do the codegen
       for (int i = 0; i < block_stmt->ast_array.count; i++) {
-        gen(block_stmt->ast_array.ast[i]);
+        gen_stmt(block_stmt->ast_array.ast[i]);
       }
       close_scope(current_compiler);
       while (current_compiler->local_array.count > 0 &&
@@ -397,127 +2189,72 @@ static void gen(Ast* ast) {
                      .locals[current_compiler->local_array.count - 1]
                      .depth > current_compiler->scope_depth) {
         emit_byte(OP_POP);
-        current_compiler->local_array.count--;
+        remove_local();
       }
       break;
     }
     case AST_FUNC: {
       FuncStmt* func_stmt = (FuncStmt*)ast->as;
-
-      // Initialize another compiler instance
-      Compiler compiler;
-      init_compiler(&compiler, TYPE_FUNCTION, func_stmt->name);
-
-      // This begin_scope has no close_scope, as it will close with
-      // end_compiler
-      begin_scope(current_compiler);
-
-      // Generate parameters as local variables here
-      bool exists = false;
-      for (int i = 0; i < func_stmt->parameters->count; i++) {
-        for (int j = current_compiler->local_array.count - 1; j >= 0; j--) {
-          Local* local = &current_compiler->local_array.locals[i];
-          if (local->depth != -1 &&
-              local->depth < current_compiler->scope_depth) {
-            break;
-          }
-
-          if (identifier_equal(&local->name,
-                               &func_stmt->parameters->tokens[i])) {
-            printf(
-                "There is already a variable with this name in this "
-                "scope.\n");
-            exists = true;
-          }
-        }
-
-        if (!exists) {
-          Local* local = &current_compiler->local_array
-                              .locals[current_compiler->local_array.count++];
-          local->name = func_stmt->parameters->tokens[i];
-          local->depth = current_compiler->scope_depth;
-        }
-      }
-
-      // Emit byte-code for the block statement
-      gen(func_stmt->stmt);
-      ObjFunc* func = end_compiler();
+      ObjFunc* func = func_for_definition(func_stmt);
+      define_in_sandbox(func_stmt, func);
+      set_line(func_stmt->name);
 
       // emit the function as a constant
-      func->arity = func_stmt->arity;
       Value func_value = OBJ_VAL(func);
       emit_constant(func_value);
 
-      emit_byte(OP_DEFINE_GLOBAL);
-
-      // emit function name
-      ObjString* name = func->name;
-      Value string_value = OBJ_VAL(name);
-      emit_constant(string_value);
+      // Functions are always globals, even when declared in a function
+      emit_operand(OP_DEFINE_GLOBAL, OP_DEFINE_GLOBAL_WIDE,
+                   global_constant(func_stmt->name));
       break;
     }
     case AST_VARIABLE_STMT: {
       VariableStmt* variable_stmt = (VariableStmt*)ast->as;
       Token name = variable_stmt->name;
+      set_line(name);
 
       // Note that scope_depth 0 is the global scope
       // If this variable is a local variable
       if (current_compiler->scope_depth != 0) {
         // Check whether there is a variable of the same name
         // in the same local scope
-
-        for (int i = current_compiler->local_array.count - 1; i >= 0; i--) {
-          Local* local = &current_compiler->local_array.locals[i];
-          if (local->depth != -1 &&
-              local->depth < current_compiler->scope_depth) {
-            break;
-          }
-
-          if (identifier_equal(&name, &local->name)) {
-            PRINT_TOKEN_STRING(local->name);
-            PRINT_TOKEN_STRING(name);
-            printf(
-                "There already exists a variable of this name in this "
-                "scope\n");
-            return;
-          }
+        int slot = resolve_local(&name);
+        if (slot != -1 && current_compiler->local_array.locals[slot].depth ==
+                              current_compiler->scope_depth) {
+          Local* local = &current_compiler->local_array.locals[slot];
+          PRINT_TOKEN_STRING(local->name);
+          PRINT_TOKEN_STRING(name);
+          codegen_error(
+              "There already exists a variable of this name in this "
+              "scope\n");
+          return;
         }
 
-        if (current_compiler->local_array.count == UINT8_MAX + 1) {
-          printf("Tried to add more than 256 locals while codegen\n");
+        if (current_compiler->local_array.count == UINT16_MAX + 1) {
+          codegen_error("Tried to add more than %d locals while codegen\n",
+                        UINT16_MAX + 1);
           return;
         }
 
         // Using the token, add to the local array
-        printf("local_array count: %d\n", current_compiler->local_array.count);
-        Local* local = &current_compiler->local_array
-                            .locals[current_compiler->local_array.count++];
-        local->name = name;
-        local->depth = current_compiler->scope_depth;
+        add_local(name);
       }
 
+      // `let a;` starts off as nil, so that it still takes up its slot
       if (variable_stmt->initializer_expr->type != AST_NONE)
         gen(variable_stmt->initializer_expr);
-
-      int variable_scope = resolve_local(&name);
-      // Not a local variable
-      if (variable_scope == -1) {
-        emit_byte(OP_SET_GLOBAL);
-      }
+      else
+        emit_byte(OP_NIL);
 
       if (variable_stmt->initializer_expr->type != AST_NONE &&
           variable_stmt->initialized == false) {
         variable_stmt->initialized = true;
       }
 
-      ObjString* variable_name = make_obj_string(variable_stmt->name.start,
-                                                 variable_stmt->name.length);
-
-      // Only make constant for when its in the global scope
-      if (current_compiler->scope_depth == 0) {
-        Value variable_name_value = OBJ_VAL(variable_name);
-        make_constant(variable_name_value);
-      }
+      // A local's value is already in its slot, a global is set by name
+      if (current_compiler->scope_depth == 0)
+        emit_operand(OP_DEFINE_GLOBAL, OP_DEFINE_GLOBAL_WIDE,
+                     global_constant(name));
       break;
     }
     case AST_NUMBER: {  // emit a constant
@@ -525,10 +2262,128 @@ static void gen(Ast* ast) {
       emit_constant(NUMBER_VAL(number_expr->value));
       break;
     }
+    case AST_INT: {
+      IntExpr* int_expr = (IntExpr*)ast->as;
+      emit_constant(INT_VAL(int_expr->value));
+      break;
+    }
+    case AST_ARRAY: {
+      ArrayExpr* array_expr = (ArrayExpr*)ast->as;
+      AstArray* elements = array_expr->elements;
+      set_line(array_expr->bracket);
+      // The elements are laid out on the stack, OP_ARRAY moves them over.
+      // Its count is a single operand, past that the rest are added by
+      // OP_ARRAY_EXTEND at most UINT8_MAX at a time, with the array under
+      int count = MIN(elements->count, UINT8_MAX);
+      for (int i = 0; i < count; i++) {
+        gen_operand(elements->ast[i]);
+      }
+      current_compiler->temporaries -= count;
+      set_line(array_expr->bracket);
+      emit_byte(OP_ARRAY);
+      emit_byte(count);
+
+      current_compiler->temporaries++;
+      count_slots();
+      for (int start = count; start < elements->count; start += count) {
+        count = MIN(elements->count - start, UINT8_MAX);
+        for (int i = start; i < start + count; i++) {
+          gen_operand(elements->ast[i]);
+        }
+        current_compiler->temporaries -= count;
+        set_line(array_expr->bracket);
+        emit_byte(OP_ARRAY_EXTEND);
+        emit_byte(count);
+      }
+      current_compiler->temporaries--;
+      break;
+    }
+    case AST_MAP: {
+      MapExpr* map_expr = (MapExpr*)ast->as;
+      int entries = map_expr->keys->count;
+      set_line(map_expr->brace);
+      // Key value pairs on the stack, OP_MAP makes a map sized for them.
+      // Past the UINT8_MAX it counts OP_MAP_EXTEND adds the rest in parts
+      int count = MIN(entries, UINT8_MAX);
+      for (int i = 0; i < count; i++) {
+        gen_operand(map_expr->keys->ast[i]);
+        gen_operand(map_expr->values->ast[i]);
+      }
+      current_compiler->temporaries -= 2 * count;
+      set_line(map_expr->brace);
+      emit_byte(OP_MAP);
+      emit_byte(count);
+
+      current_compiler->temporaries++;
+      count_slots();
+      for (int start = count; start < entries; start += count) {
+        count = MIN(entries - start, UINT8_MAX);
+        for (int i = start; i < start + count; i++) {
+          gen_operand(map_expr->keys->ast[i]);
+          gen_operand(map_expr->values->ast[i]);
+        }
+        current_compiler->temporaries -= 2 * count;
+        set_line(map_expr->brace);
+        emit_byte(OP_MAP_EXTEND);
+        emit_byte(count);
+      }
+      current_compiler->temporaries--;
+      break;
+    }
+    case AST_LOGICAL: {
+      // The value of the side that decided is the result
+      LogicalExpr* logical_expr = (LogicalExpr*)ast->as;
+      gen(logical_expr->left_expr);
+      set_line(logical_expr->op);
+      int end_jump = emit_jump(logical_expr->op.type == TOKEN_AND
+                                   ? OP_JUMP_IF_FALSE
+                                   : OP_JUMP_IF_TRUE);
+      emit_byte(OP_POP);
+      gen(logical_expr->right_expr);
+      patch_jump(end_jump);
+      break;
+    }
+    case AST_GET_FIELD: {
+      GetFieldExpr* get_field_expr = (GetFieldExpr*)ast->as;
+      gen(get_field_expr->object);
+      set_line(get_field_expr->name);
+      emit_field_access(OP_GET_FIELD, get_field_expr->name);
+      break;
+    }
+    case AST_SET_FIELD: {
+      SetFieldExpr* set_field_expr = (SetFieldExpr*)ast->as;
+      gen_operand(set_field_expr->object);
+      gen(set_field_expr->value_expr);
+      current_compiler->temporaries--;
+      set_line(set_field_expr->name);
+      emit_field_access(OP_SET_FIELD, set_field_expr->name);
+      break;
+    }
+    case AST_INDEX: {
+      IndexExpr* index_expr = (IndexExpr*)ast->as;
+      gen_operand(index_expr->object);
+      gen(index_expr->index);
+      current_compiler->temporaries--;
+      set_line(index_expr->bracket);
+      emit_byte(OP_INDEX_GET);
+      break;
+    }
+    case AST_INDEX_SET: {
+      IndexSetExpr* index_set_expr = (IndexSetExpr*)ast->as;
+      gen_operand(index_set_expr->object);
+      gen_operand(index_set_expr->index);
+      gen(index_set_expr->value_expr);
+      current_compiler->temporaries -= 2;
+      set_line(index_set_expr->bracket);
+      emit_byte(OP_INDEX_SET);
+      break;
+    }
     case AST_BINARY: {
       BinaryExpr* binary_expr = (BinaryExpr*)ast->as;
-      gen(binary_expr->left_expr);
+      set_line(binary_expr->op);
+      gen_operand(binary_expr->left_expr);
       gen(binary_expr->right_expr);
+      current_compiler->temporaries--;
       switch (binary_expr->op.type) {
         case TOKEN_PLUS:
         case TOKEN_PLUS_EQUAL:
@@ -546,6 +2401,24 @@ static void gen(Ast* ast) {
         case TOKEN_SLASH_EQUAL:
           emit_byte(OP_DIVIDE);
           break;
+        case TOKEN_PERCENT:
+          emit_byte(OP_MODULO);
+          break;
+        case TOKEN_AMPERSAND:
+          emit_byte(OP_BIT_AND);
+          break;
+        case TOKEN_PIPE:
+          emit_byte(OP_BIT_OR);
+          break;
+        case TOKEN_CARET:
+          emit_byte(OP_BIT_XOR);
+          break;
+        case TOKEN_LESS_LESS:
+          emit_byte(OP_SHIFT_LEFT);
+          break;
+        case TOKEN_GREATER_GREATER:
+          emit_byte(OP_SHIFT_RIGHT);
+          break;
         case TOKEN_EQUAL_EQUAL:
           emit_byte(OP_EQUAL);
           break;
@@ -574,6 +2447,7 @@ static void gen(Ast* ast) {
     }
     case AST_UNARY: {
       UnaryExpr* unary_expr = (UnaryExpr*)ast->as;
+      set_line(unary_expr->op);
       gen(unary_expr->right_expr);
       switch (unary_expr->op.type) {
         case TOKEN_BANG:
@@ -582,6 +2456,9 @@ static void gen(Ast* ast) {
         case TOKEN_MINUS:
           emit_byte(OP_NEGATE);
           break;
+        case TOKEN_TILDE:
+          emit_byte(OP_BIT_NOT);
+          break;
         default:
           break;
       }
@@ -601,45 +2478,9 @@ static void gen(Ast* ast) {
     case AST_VARIABLE_EXPR: {
       VariableExpr* variable_expr = (VariableExpr*)ast->as;
       Token name = variable_expr->name;
+      set_line(name);
 
-      // Check if this variable is a local or global variable
-      int variable_scope = resolve_local(&name);
-      if (variable_scope == -1)
-        emit_byte(OP_GET_GLOBAL);
-      else
-        emit_byte(OP_GET_LOCAL);
-
-      // Find the constant
-      // For global scope
-      if (variable_scope == -1) {
-        bool found_variable = false;
-        for (int i = 0; i < current_chunk()->constants.count; i++) {
-          Value value = current_chunk()->constants.values[i];
-          // If it is an object and is an ObjString*
-          if (IS_OBJ(value) && OBJ_TYPE(value) == OBJ_STRING) {
-            // this obj_string can be used to debug string variables
-            // ObjString* obj_string = AS_OBJ_STRING(value);
-            // print_obj_string(obj_string);
-            if (token_value_equals(name, value)) {
-              // printf("found variable name at : %d\n", i);
-              emit_byte((OpCode)i);
-              found_variable = true;
-              break;
-            }
-          }
-        }
-        // If it did not find the variable
-        if (!found_variable)
-          printf("Error: Could not find token\n");
-      } else {  // For local scope
-        for (int i = current_compiler->local_array.count - 1; i >= 0; i--) {
-          Local* local = &current_compiler->local_array.locals[i];
-          if (identifier_equal(&name, &local->name)) {
-            emit_byte((OpCode)i);
-            break;
-          }
-        }
-      }
+      emit_get_variable(name);
       break;
     }
     case AST_GROUP: {
@@ -649,20 +2490,9 @@ static void gen(Ast* ast) {
     }
     case AST_ASSIGNMENT_EXPR: {
       AssignmentExpr* assignment_expr = (AssignmentExpr*)ast->as;
+      set_line(assignment_expr->name);
       gen(assignment_expr->expr);
-
-      int variable_scope = resolve_local(&assignment_expr->name);
-      if (variable_scope == -1) {
-        emit_byte(OP_SET_GLOBAL);
-
-        ObjString* variable_name = make_obj_string(
-            assignment_expr->name.start, assignment_expr->name.length);
-        Value variable_name_value = OBJ_VAL(variable_name);
-        make_constant(variable_name_value);
-      } else {
-        emit_byte(OP_SET_LOCAL);
-        emit_byte(variable_scope);
-      }
+      emit_set_variable(assignment_expr->name);
       break;
     }
     case AST_STRING: {
@@ -677,24 +2507,35 @@ static void gen(Ast* ast) {
       CallExpr* call_expr = (CallExpr*)ast->as;
 
       VariableExpr* variable_expr = (VariableExpr*)call_expr->callee->as;
-      ObjString* token_string = make_obj_string_from_token(variable_expr->name);
-      Value token_string_value = OBJ_VAL(token_string);
-
-      // Get the function here
-      emit_byte(OP_GET_GLOBAL);
-      make_constant(token_string_value);
-
-      // printf("AST_CALL argument_count: %d\n", call_expr->arguments->count);
-      for (int i = 0; i < call_expr->arguments->count; i++) {
-        gen(call_expr->arguments->ast[i]);
+      set_line(variable_expr->name);
+
+      // Natives known at compile time are called directly, without
+      // looking up the callee or pushing it
+      int native_index =
+          resolve_native(&variable_expr->name, call_expr->arguments->count);
+      if (native_index != -1) {
+        for (int i = 0; i < call_expr->arguments->count; i++) {
+          gen_operand(call_expr->arguments->ast[i]);
+        }
+        current_compiler->temporaries -= call_expr->arguments->count;
+        emit_byte(OP_CALL_NATIVE);
+        emit_byte(native_index);
+        emit_byte(call_expr->arguments->count);
+        break;
       }
 
-      emit_byte(OP_CALL);
-      emit_constant(token_string_value);
-
-      // emit argument count
-      emit_byte(call_expr->arguments->count);
+      Value folded;
+      if (fold_call(call_expr, &folded)) {
+        emit_constant(folded);
+        break;
+      }
 
+      int inline_index =
+          resolve_inline(&variable_expr->name, call_expr->arguments->count);
+      if (inline_index != -1)
+        gen_inline_call(call_expr, inline_index);
+      else
+        gen_call(call_expr);
       break;
     }
     case AST_RETURN: {
@@ -702,7 +2543,7 @@ static void gen(Ast* ast) {
 
       // Check for when the user tries to return from top level function body
       if (current_compiler->func_type == TYPE_SCRIPT) {
-        printf("Cannot return from top level function body\n");
+        codegen_error("Cannot return from top level function body\n");
         return;
       }
 
@@ -720,7 +2561,7 @@ static void gen(Ast* ast) {
   }
 }
 
-ObjFunc* codegen(AstArray* ast_arr) {
+ObjFunc* codegen(AstArray* ast_arr, Vm* vm) {
   // Create the compiler instance that tracks scope and depth
   Compiler compiler;
   Token null_token;
@@ -733,11 +2574,51 @@ ObjFunc* codegen(AstArray* ast_arr) {
   // Track which compiler is being used
   current_compiler = &compiler;
 
+  current_line = 0;
+  had_error = false;
+  memset(shadowed_natives, 0, sizeof(shadowed_natives));
+  if (vm != NULL)
+    find_replaced_natives(vm);
+  init_symbol_table(&name_writes);
+  for (int i = 0; i < ast_arr->count; i++) {
+    find_written_names(ast_arr->ast[i]);
+  }
+
+  init_symbol_table(&top_func_names);
+  init_ast_array(&top_funcs);
+  init_int_array(&top_func_flags);
+  find_pure_funcs(ast_arr);
+  if (folding && top_funcs.count > 0) {
+    sandbox = ALLOCATE(Vm, 1);
+    init_vm(sandbox);
+    sandbox->quiet = true;
+  }
+
+  init_symbol_table(&inline_names);
+  init_ast_array(&inline_funcs);
+  init_value_array(&inline_values);
+  find_inline_funcs(ast_arr);
+
   for (int i = 0; i < ast_arr->count; i++) {
-    gen(ast_arr->ast[i]);
+    gen_stmt(ast_arr->ast[i]);
+  }
+
+  free_symbol_table(&inline_names);
+  free_ast_array(&inline_funcs);
+  free_value_array(&inline_values);
+  free_symbol_table(&top_func_names);
+  free_ast_array(&top_funcs);
+  free_int_array(&top_func_flags);
+  free_symbol_table(&name_writes);
+  if (sandbox != NULL) {
+    free_vm(sandbox);
+    free(sandbox);
+    sandbox = NULL;
   }
 
   ObjFunc* main_func = end_compiler();
+  if (had_error)
+    return NULL;
   return main_func;
 }
 
@@ -784,7 +2665,7 @@ void disassemble_opcode_values(OpArray* op_arr, ValueArray* value_arr) {
       case OP_CONSTANT:
         i++;
         printf("[%d-%d] [%-20s] at %d: %f\n", i - 1, i, "OP_CONSTANT", i,
-               AS_NUMBER(value_arr->values[op_arr->ops[i]]));
+               AS_NUMERIC(value_arr->values[op_arr->ops[i]]));
         break;
       case OP_RETURN:
         printf("[%d] [%-20s]\n", i, "OP_RETURN");
@@ -810,6 +2691,11 @@ void disassemble_opcode_values(OpArray* op_arr, ValueArray* value_arr) {
         printf("[%d-%d] [%-20s] at constants_array: %d\n", i - 1, i,
                "OP_GET_LOCAL", op_arr->ops[i]);
         break;
+      case OP_DEFINE_GLOBAL:
+        i++;
+        printf("[%d-%d] [%-20s] at constants_array: %d\n", i - 1, i,
+               "OP_DEFINE_GLOBAL", op_arr->ops[i]);
+        break;
       case OP_JUMP:
         printf("[%d] [%-20s]\n", i, "OP_JUMP");
         break;
@@ -825,11 +2711,88 @@ void disassemble_opcode_values(OpArray* op_arr, ValueArray* value_arr) {
       case OP_LOOP:
         break;
       case OP_CALL:
-        printf("[%d] [%-20s]\n", i, "OP_CALL");
+        printf("[%d-%d] [%-20s] argument count: %d, cache %d\n", i, i + 3,
+               "OP_CALL", op_arr->ops[i + 1],
+               op_arr->ops[i + 2] << 8 | op_arr->ops[i + 3]);
+        i += 3;
         break;
       case OP_NIL:
         printf("[%d] [%-20s]\n", i, "OP_NIL");
         break;
+      case OP_CALL_NATIVE:
+        i += 2;
+        printf("[%d-%d] [%-20s] %s, argument count: %d\n", i - 2, i,
+               "OP_CALL_NATIVE", get_native(op_arr->ops[i - 1])->name,
+               op_arr->ops[i]);
+        break;
+      case OP_ARRAY:
+      case OP_ARRAY_EXTEND:
+        i++;
+        printf("[%d-%d] [%-20s] %d elements\n", i - 1, i,
+               opcode_name(op_arr->ops[i - 1]), op_arr->ops[i]);
+        break;
+      case OP_MAP:
+      case OP_MAP_EXTEND:
+        i++;
+        printf("[%d-%d] [%-20s] %d entries\n", i - 1, i,
+               opcode_name(op_arr->ops[i - 1]), op_arr->ops[i]);
+        break;
+      case OP_JUMP_IF_TRUE:
+      case OP_POP_JUMP_IF_FALSE:
+      case OP_POP_JUMP_IF_TRUE:
+        printf("[%d-%d] [%-20s] jump by %d\n", i, i + 2,
+               opcode_name(op_arr->ops[i]),
+               op_arr->ops[i + 1] << 8 | op_arr->ops[i + 2]);
+        i += 2;
+        break;
+      case OP_GET_FIELD:
+      case OP_SET_FIELD:
+        printf("[%d-%d] [%-20s] at constants_array: %d, cache %d\n", i,
+               i + 4, opcode_name(op_arr->ops[i]),
+               op_arr->ops[i + 1] << 8 | op_arr->ops[i + 2],
+               op_arr->ops[i + 3] << 8 | op_arr->ops[i + 4]);
+        i += 4;
+        break;
+      case OP_CONSTANT_WIDE:
+      case OP_GET_LOCAL_WIDE:
+      case OP_SET_LOCAL_WIDE:
+      case OP_GET_GLOBAL_WIDE:
+      case OP_SET_GLOBAL_WIDE:
+      case OP_DEFINE_GLOBAL_WIDE:
+        printf("[%d-%d] [%-20s] %d\n", i, i + 2, opcode_name(op_arr->ops[i]),
+               op_arr->ops[i + 1] << 8 | op_arr->ops[i + 2]);
+        i += 2;
+        break;
+      case OP_JUMP_IF_GLOBAL:
+        printf("[%d-%d] [%-20s] %d is %d, jump by %d\n", i, i + 6,
+               "OP_JUMP_IF_GLOBAL",
+               op_arr->ops[i + 1] << 8 | op_arr->ops[i + 2],
+               op_arr->ops[i + 3] << 8 | op_arr->ops[i + 4],
+               op_arr->ops[i + 5] << 8 | op_arr->ops[i + 6]);
+        i += 6;
+        break;
+      case OP_POP_BELOW:
+        i++;
+        printf("[%d-%d] [%-20s] %d\n", i - 1, i, "OP_POP_BELOW",
+               op_arr->ops[i]);
+        break;
+      case OP_MODULO:
+      case OP_BIT_AND:
+      case OP_BIT_OR:
+      case OP_BIT_XOR:
+      case OP_SHIFT_LEFT:
+      case OP_SHIFT_RIGHT:
+      case OP_BIT_NOT:
+      case OP_INDEX_GET:
+      case OP_INDEX_SET:
+      case OP_ADD_NUMBER:
+      case OP_SUBTRACT_NUMBER:
+      case OP_MULTIPLY_NUMBER:
+      case OP_DIVIDE_NUMBER:
+      case OP_GREATER_NUMBER:
+      case OP_LESS_NUMBER:
+        printf("[%d] [%-20s]\n", i, opcode_name(op_arr->ops[i]));
+        break;
     }
   }
 }
@@ -1,12 +1,33 @@
 #pragma once
 
+#include <stdbool.h>
+
 #include "array.h"
 #include "ast.h"
 #include "object.h"
+#include "vm.h"
 
 // ObjFunc* codegen(OpArray* op_arr,
 //                  ValueArray* constants_arr,
 //                  AstArray* ast_arr,
 //                  LocalArray* local_arr);
-ObjFunc* codegen(AstArray* ast_arr);
+// vm is the one the program runs on, with whatever earlier programs left
+// in its globals, NULL for a new one
+ObjFunc* codegen(AstArray* ast_arr, Vm* vm);
+// Prints the IR of each function that is compiled through it
+void set_dump_ir(bool dump);
+// Prints how many of the arithmetic ops of each function are unchecked
+void set_type_report(bool report);
+// Memoizes the pure functions that call themselves, and not only the ones
+// declared with memo func
+void set_auto_memo(bool memo);
+
+// The most calls and backward jumps a call folded at compile time can take
+#define FOLD_DEFAULT_STEPS (1 << 20)
+
+// Runs calls to pure functions with constant arguments at compile time, on
+// by default
+void set_fold_calls(bool fold);
+// For the calls folded after it is called, at least 1
+void set_fold_steps(int steps);
 void disassemble_opcode_values(OpArray* op_arr, ValueArray* value_arr);
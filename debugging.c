@@ -66,7 +66,7 @@ void disassemble_individual_ast(Ast* ast) {
     }
     case AST_FUNC: {
       FuncStmt* func_stmt = (FuncStmt*)ast->as;
-      printf("[%-20s]\n", "FUNC_STMT");
+      printf("[%-20s]\n", func_stmt->memo ? "MEMO_FUNC_STMT" : "FUNC_STMT");
       printf("  [Parameter Count: %d]\n", func_stmt->arity);
       for (int i = 0; i < func_stmt->parameters->count; i++) {
         PRINT_TOKEN_STRING(func_stmt->parameters->tokens[i]);
@@ -93,6 +93,11 @@ void disassemble_individual_ast(Ast* ast) {
       printf("[%-20s]: %f\n", "AST_NUMBER", number_expr->value);
       break;
     }
+    case AST_INT: {
+      IntExpr* int_expr = (IntExpr*)ast->as;
+      printf("[%-20s]: %lld\n", "AST_INT", (long long)int_expr->value);
+      break;
+    }
     case AST_BINARY: {
       BinaryExpr* binary_expr = (BinaryExpr*)ast->as;
       printf("[%-20s]\n", "BINARY_EXPR");
@@ -175,6 +180,62 @@ void disassemble_individual_ast(Ast* ast) {
       disassemble_individual_ast(return_stmt->value_expr);
       break;
     }
+    case AST_ARRAY: {
+      ArrayExpr* array_expr = (ArrayExpr*)ast->as;
+      printf("[%-20s] (Count: %d)\n", "ARRAY_EXPR",
+             array_expr->elements->count);
+      for (int i = 0; i < array_expr->elements->count; i++) {
+        disassemble_individual_ast(array_expr->elements->ast[i]);
+      }
+      break;
+    }
+    case AST_INDEX: {
+      IndexExpr* index_expr = (IndexExpr*)ast->as;
+      printf("[%-20s]\n", "INDEX_EXPR");
+      disassemble_individual_ast(index_expr->object);
+      disassemble_individual_ast(index_expr->index);
+      break;
+    }
+    case AST_INDEX_SET: {
+      IndexSetExpr* index_set_expr = (IndexSetExpr*)ast->as;
+      printf("[%-20s]\n", "INDEX_SET_EXPR");
+      disassemble_individual_ast(index_set_expr->object);
+      disassemble_individual_ast(index_set_expr->index);
+      disassemble_individual_ast(index_set_expr->value_expr);
+      break;
+    }
+    case AST_MAP: {
+      MapExpr* map_expr = (MapExpr*)ast->as;
+      printf("[%-20s] (Count: %d)\n", "MAP_EXPR", map_expr->keys->count);
+      for (int i = 0; i < map_expr->keys->count; i++) {
+        disassemble_individual_ast(map_expr->keys->ast[i]);
+        disassemble_individual_ast(map_expr->values->ast[i]);
+      }
+      break;
+    }
+    case AST_LOGICAL: {
+      LogicalExpr* logical_expr = (LogicalExpr*)ast->as;
+      printf("[%-20s] ", "LOGICAL_EXPR");
+      PRINT_TOKEN_STRING(logical_expr->op);
+      disassemble_individual_ast(logical_expr->left_expr);
+      disassemble_individual_ast(logical_expr->right_expr);
+      break;
+    }
+    case AST_GET_FIELD: {
+      GetFieldExpr* get_field_expr = (GetFieldExpr*)ast->as;
+      printf("[%-20s] ", "GET_FIELD_EXPR");
+      PRINT_TOKEN_STRING(get_field_expr->name);
+      disassemble_individual_ast(get_field_expr->object);
+      break;
+    }
+    case AST_SET_FIELD: {
+      SetFieldExpr* set_field_expr = (SetFieldExpr*)ast->as;
+      printf("[%-20s] ", "SET_FIELD_EXPR");
+      PRINT_TOKEN_STRING(set_field_expr->name);
+      disassemble_individual_ast(set_field_expr->object);
+      disassemble_individual_ast(set_field_expr->value_expr);
+      break;
+    }
   }
 }
 
@@ -192,3 +253,125 @@ char* get_string_from_token(Token token) {
   s[token.length] = '\0';
   return s;
 }
+
+const char* opcode_name(OpCode op) {
+  switch (op) {
+    case OP_CONSTANT:
+      return "OP_CONSTANT";
+    case OP_POP:
+      return "OP_POP";
+    case OP_TRUE:
+      return "OP_TRUE";
+    case OP_FALSE:
+      return "OP_FALSE";
+    case OP_ADD:
+      return "OP_ADD";
+    case OP_SUBTRACT:
+      return "OP_SUBTRACT";
+    case OP_MULTIPLY:
+      return "OP_MULTIPLY";
+    case OP_DIVIDE:
+      return "OP_DIVIDE";
+    case OP_NEGATE:
+      return "OP_NEGATE";
+    case OP_GREATER:
+      return "OP_GREATER";
+    case OP_LESS:
+      return "OP_LESS";
+    case OP_NOT:
+      return "OP_NOT";
+    case OP_EQUAL:
+      return "OP_EQUAL";
+    case OP_RETURN:
+      return "OP_RETURN";
+    case OP_PRINT:
+      return "OP_PRINT";
+    case OP_SET_GLOBAL:
+      return "OP_SET_GLOBAL";
+    case OP_GET_GLOBAL:
+      return "OP_GET_GLOBAL";
+    case OP_SET_LOCAL:
+      return "OP_SET_LOCAL";
+    case OP_GET_LOCAL:
+      return "OP_GET_LOCAL";
+    case OP_DEFINE_GLOBAL:
+      return "OP_DEFINE_GLOBAL";
+    case OP_JUMP:
+      return "OP_JUMP";
+    case OP_JUMP_IF_FALSE:
+      return "OP_JUMP_IF_FALSE";
+    case OP_LOOP:
+      return "OP_LOOP";
+    case OP_CALL:
+      return "OP_CALL";
+    case OP_NIL:
+      return "OP_NIL";
+    case OP_CALL_NATIVE:
+      return "OP_CALL_NATIVE";
+    case OP_MODULO:
+      return "OP_MODULO";
+    case OP_BIT_AND:
+      return "OP_BIT_AND";
+    case OP_BIT_OR:
+      return "OP_BIT_OR";
+    case OP_BIT_XOR:
+      return "OP_BIT_XOR";
+    case OP_SHIFT_LEFT:
+      return "OP_SHIFT_LEFT";
+    case OP_SHIFT_RIGHT:
+      return "OP_SHIFT_RIGHT";
+    case OP_BIT_NOT:
+      return "OP_BIT_NOT";
+    case OP_ARRAY:
+      return "OP_ARRAY";
+    case OP_INDEX_GET:
+      return "OP_INDEX_GET";
+    case OP_INDEX_SET:
+      return "OP_INDEX_SET";
+    case OP_MAP:
+      return "OP_MAP";
+    case OP_GET_FIELD:
+      return "OP_GET_FIELD";
+    case OP_SET_FIELD:
+      return "OP_SET_FIELD";
+    case OP_JUMP_IF_TRUE:
+      return "OP_JUMP_IF_TRUE";
+    case OP_POP_JUMP_IF_FALSE:
+      return "OP_POP_JUMP_IF_FALSE";
+    case OP_POP_JUMP_IF_TRUE:
+      return "OP_POP_JUMP_IF_TRUE";
+    case OP_CONSTANT_WIDE:
+      return "OP_CONSTANT_WIDE";
+    case OP_GET_LOCAL_WIDE:
+      return "OP_GET_LOCAL_WIDE";
+    case OP_SET_LOCAL_WIDE:
+      return "OP_SET_LOCAL_WIDE";
+    case OP_GET_GLOBAL_WIDE:
+      return "OP_GET_GLOBAL_WIDE";
+    case OP_SET_GLOBAL_WIDE:
+      return "OP_SET_GLOBAL_WIDE";
+    case OP_DEFINE_GLOBAL_WIDE:
+      return "OP_DEFINE_GLOBAL_WIDE";
+    case OP_JUMP_IF_GLOBAL:
+      return "OP_JUMP_IF_GLOBAL";
+    case OP_POP_BELOW:
+      return "OP_POP_BELOW";
+    case OP_ADD_NUMBER:
+      return "OP_ADD_NUMBER";
+    case OP_SUBTRACT_NUMBER:
+      return "OP_SUBTRACT_NUMBER";
+    case OP_MULTIPLY_NUMBER:
+      return "OP_MULTIPLY_NUMBER";
+    case OP_DIVIDE_NUMBER:
+      return "OP_DIVIDE_NUMBER";
+    case OP_GREATER_NUMBER:
+      return "OP_GREATER_NUMBER";
+    case OP_LESS_NUMBER:
+      return "OP_LESS_NUMBER";
+    case OP_ARRAY_EXTEND:
+      return "OP_ARRAY_EXTEND";
+    case OP_MAP_EXTEND:
+      return "OP_MAP_EXTEND";
+  }
+  return "OP_UNKNOWN";
+}
@@ -3,13 +3,20 @@
 #include "array.h"
 #include "token.h"
 
-#define TOTAL_FLAGS 5
+#define TOTAL_FLAGS 12
 
 static const int DUMP_TOKEN = 0;
 static const int DUMP_AST = 1;
 static const int DUMP_CODEGEN = 2;
 static const int VM_OUTPUT = 3;
 static const int HELP = 4;
+static const int PROFILE = 5;
+static const int OPCODE_STATS = 6;
+static const int DUMP_IR = 7;
+static const int TYPE_REPORT = 8;
+static const int AUTO_MEMO = 9;
+static const int MEMO_STATS = 10;
+static const int NO_FOLD = 11;
 
 // Debugging
 void disassemble_individual_ast(Ast* ast);
@@ -17,3 +24,4 @@ void disassemble_ast(AstArray* ast_array);
 
 // Helper functions
 char* get_string_from_token(Token token);
+const char* opcode_name(OpCode op);
@@ -1,10 +1,13 @@
 #pragma once
 #include <stdint.h>
+#include <string.h>
 
-// This header will contain all the hash functions used
+// This header will contain all the hash functions used.
+// They are static inline so that anything can include this header,
+// i.e. the hash benchmark next to object.c
 
 // https://en.wikipedia.org/wiki/Fowler%E2%80%93Noll%E2%80%93Vo_hash_function
-uint32_t fnv_hash32(const char* key, int length) {
+static inline uint32_t fnv_hash32(const char* key, int length) {
   uint32_t hash = 2166136261u;
   for (int i = 0; i < length; i++) {
     hash ^= (uint8_t)key[i];
@@ -14,11 +17,92 @@ uint32_t fnv_hash32(const char* key, int length) {
 }
 
 // https://en.wikipedia.org/wiki/Fowler%E2%80%93Noll%E2%80%93Vo_hash_function
-uint64_t fnv_hash64(const char* key, int length) {
+static inline uint64_t fnv_hash64(const char* key, int length) {
   uint64_t hash = 14695981039346656037u;
   for (int i = 0; i < length; i++) {
-    hash ^= (uint16_t)key[i];
+    hash ^= (uint8_t)key[i];
     hash *= 1099511628211;
   }
   return hash;
 }
+
+// https://github.com/wangyi-fudan/wyhash
+// Reads 8 bytes at a time and mixes them with a 64x64->128 bit multiply,
+// without the 48 byte unrolled loop of the original
+#define WY_SEED 0xa0761d6478bd642full
+#define WY_P0 0xe7037ed1a0b428dbull
+#define WY_P1 0x8ebc6af09c88c6e3ull
+
+static inline void wy_multiply(uint64_t* a, uint64_t* b) {
+  __extension__ typedef unsigned __int128 wy_uint128;
+  wy_uint128 result = (wy_uint128)*a * *b;
+  *a = (uint64_t)result;
+  *b = (uint64_t)(result >> 64);
+}
+
+static inline uint64_t wy_mix(uint64_t a, uint64_t b) {
+  wy_multiply(&a, &b);
+  return a ^ b;
+}
+
+// memcpy so that unaligned reads are fine, compilers turn it into a load
+static inline uint64_t wy_read64(const uint8_t* p) {
+  uint64_t value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+static inline uint64_t wy_read32(const uint8_t* p) {
+  uint32_t value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+// 1 to 3 bytes, the first, middle and last bytes cover all of them
+static inline uint64_t wy_read_small(const uint8_t* p, int length) {
+  return ((uint64_t)p[0] << 16) | ((uint64_t)p[length >> 1] << 8) |
+         p[length - 1];
+}
+
+static inline uint64_t wy_hash64(const char* key, int length) {
+  const uint8_t* p = (const uint8_t*)key;
+  uint64_t seed = WY_SEED ^ wy_mix(WY_SEED ^ WY_P0, WY_P1);
+  uint64_t a;
+  uint64_t b;
+
+  if (length <= 16) {
+    if (length >= 4) {
+      // Two overlapping pairs of 4 byte reads cover 4 to 16 bytes
+      int middle = (length >> 3) << 2;
+      a = (wy_read32(p) << 32) | wy_read32(p + middle);
+      b = (wy_read32(p + length - 4) << 32) |
+          wy_read32(p + length - 4 - middle);
+    } else if (length > 0) {
+      a = wy_read_small(p, length);
+      b = 0;
+    } else {
+      a = 0;
+      b = 0;
+    }
+  } else {
+    int remaining = length;
+    while (remaining > 16) {
+      seed = wy_mix(wy_read64(p) ^ WY_P1, wy_read64(p + 8) ^ seed);
+      p += 16;
+      remaining -= 16;
+    }
+    // The last 16 bytes, which can overlap with the ones before
+    a = wy_read64(p + remaining - 16);
+    b = wy_read64(p + remaining - 8);
+  }
+
+  a ^= WY_P1;
+  b ^= seed;
+  wy_multiply(&a, &b);
+  return wy_mix(a ^ WY_P0 ^ (uint64_t)length, b ^ WY_P1);
+}
+
+static inline uint32_t wy_hash32(const char* key, int length) {
+  uint64_t hash = wy_hash64(key, length);
+  return (uint32_t)(hash ^ (hash >> 32));
+}
@@ -17,7 +17,7 @@ static int resize_capacity(int capacity) {
 }
 
 static Entry* find_entry(Entry* entries, int capacity, ObjString* key) {
-  int index = key->hash % capacity;
+  int index = hash_obj_string(key) % capacity;
   // printf("find_entry : key : %s | hash : %d | bucket : %d | \n", key->chars,
   //        key->hash, index);
   // return &entries[index];
@@ -39,11 +39,10 @@ static Entry* find_entry(Entry* entries, int capacity, ObjString* key) {
     // Otherwise, check that the key already exists, and it is the same key
     // Note that we cannot do entry->key == key->chars as a check here
     // because string equality is not the same.
-    // Note to compare with key->length and not entry->key->length
-    // e.g. if entry->key is "data", and key is "data2"
-    // comparing data and data2 with a length of 4 will be true, when it's not
-    if (strncmp(entry->key->chars, key->chars,
-                MAX(entry->key->length, key->length)) == 0) {
+    // Strings are not always terminated at their length, i.e. when they
+    // share a buffer, so compare the lengths and then the characters
+    if (entry->key->length == key->length &&
+        memcmp(entry->key->chars, key->chars, key->length) == 0) {
       // if (strncmp(key->chars, entry->key->chars, key->length) == 0) {
       return entry;
     }
@@ -0,0 +1,2337 @@
+#include "ir.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chunk.h"
+#include "macros.h"
+#include "native.h"
+#include "op.h"
+
+// The SSA form is built the way Braun et al. describe it in "Simple and
+// Efficient Construction of Static Single Assignment Form": reading a
+// variable looks for its last write in the block and otherwise asks the
+// predecessors, blocks that can still get predecessors make a phi that is
+// completed once they are sealed, and phis that turn out to merge a single
+// value are replaced by that value
+
+void init_ir_func(IrFunc* func, ObjString* name, int param_count) {
+  func->name = name;
+  func->param_count = param_count;
+  func->blocks = NULL;
+  func->block_count = 0;
+  func->block_capacity = 0;
+  func->instrs = NULL;
+  func->instr_count = 0;
+  func->instr_capacity = 0;
+  init_int_array(&func->layout);
+  func->variable_count = 0;
+  func->numeric_sites = 0;
+  func->unchecked_sites = 0;
+}
+
+void free_ir_func(IrFunc* func) {
+  for (int i = 0; i < func->block_count; i++) {
+    IrBlock* block = &func->blocks[i];
+    free_int_array(&block->phis);
+    free_int_array(&block->instrs);
+    free_int_array(&block->preds);
+    free_int_array(&block->defs);
+    free_int_array(&block->incomplete_phis);
+  }
+  for (int i = 0; i < func->instr_count; i++) {
+    free_int_array(&func->instrs[i].operands);
+    free(func->instrs[i].known);
+  }
+  free(func->blocks);
+  free(func->instrs);
+  free_int_array(&func->layout);
+  init_ir_func(func, NULL, 0);
+}
+
+int add_ir_block(IrFunc* func) {
+  if (func->block_count == func->block_capacity) {
+    func->block_capacity =
+        func->block_capacity == 0 ? 8 : func->block_capacity * 2;
+    func->blocks = (IrBlock*)realloc(func->blocks,
+                                     sizeof(IrBlock) * func->block_capacity);
+  }
+
+  IrBlock* block = &func->blocks[func->block_count];
+  init_int_array(&block->phis);
+  init_int_array(&block->instrs);
+  init_int_array(&block->preds);
+  init_int_array(&block->defs);
+  init_int_array(&block->incomplete_phis);
+  for (int i = 0; i < func->variable_count; i++) {
+    push_int_array(&block->defs, -1);
+  }
+  block->sealed = false;
+  return func->block_count++;
+}
+
+void start_ir_block(IrFunc* func, int block) {
+  push_int_array(&func->layout, block);
+}
+
+static int new_ir_instr(IrFunc* func, int block, IrOp op, int line) {
+  if (func->instr_count == func->instr_capacity) {
+    func->instr_capacity =
+        func->instr_capacity == 0 ? 32 : func->instr_capacity * 2;
+    func->instrs = (IrInstr*)realloc(func->instrs,
+                                     sizeof(IrInstr) * func->instr_capacity);
+  }
+
+  IrInstr* instr = &func->instrs[func->instr_count];
+  instr->op = op;
+  instr->block = block;
+  instr->line = line;
+  instr->type = IR_TYPE_ANY;
+  instr->removed = false;
+  instr->forward = -1;
+  instr->value = NIL_VAL;
+  instr->expected = NIL_VAL;
+  instr->index = 0;
+  init_int_array(&instr->operands);
+  instr->targets[0] = -1;
+  instr->targets[1] = -1;
+  instr->known = NULL;
+  instr->unchecked = false;
+  return func->instr_count++;
+}
+
+int add_ir_instr(IrFunc* func, int block, IrOp op, int line) {
+  int instr = new_ir_instr(func, block, op, line);
+  if (op == IR_PHI)
+    push_int_array(&func->blocks[block].phis, instr);
+  else if (op != IR_PARAM && op != IR_CONSTANT)
+    push_int_array(&func->blocks[block].instrs, instr);
+  return instr;
+}
+
+void add_ir_operand(IrFunc* func, int instr, int operand) {
+  push_int_array(&func->instrs[instr].operands, operand);
+}
+
+int add_ir_constant(IrFunc* func, Value value) {
+  int instr = new_ir_instr(func, -1, IR_CONSTANT, 0);
+  func->instrs[instr].value = value;
+  return instr;
+}
+
+int add_ir_jump(IrFunc* func, int block, int target, int line) {
+  int instr = add_ir_instr(func, block, IR_JUMP, line);
+  func->instrs[instr].targets[0] = target;
+  push_int_array(&func->blocks[target].preds, block);
+  return instr;
+}
+
+int add_ir_branch(IrFunc* func,
+                  int block,
+                  int condition,
+                  int truthy,
+                  int falsy,
+                  int line) {
+  int instr = add_ir_instr(func, block, IR_BRANCH, line);
+  add_ir_operand(func, instr, condition);
+  func->instrs[instr].targets[0] = truthy;
+  func->instrs[instr].targets[1] = falsy;
+  push_int_array(&func->blocks[truthy].preds, block);
+  push_int_array(&func->blocks[falsy].preds, block);
+  return instr;
+}
+
+int add_ir_branch_global(IrFunc* func,
+                         int block,
+                         Value name,
+                         Value expected,
+                         int holds,
+                         int otherwise,
+                         int line) {
+  int instr = add_ir_instr(func, block, IR_BRANCH_GLOBAL, line);
+  func->instrs[instr].value = name;
+  func->instrs[instr].expected = expected;
+  func->instrs[instr].targets[0] = holds;
+  func->instrs[instr].targets[1] = otherwise;
+  push_int_array(&func->blocks[holds].preds, block);
+  push_int_array(&func->blocks[otherwise].preds, block);
+  return instr;
+}
+
+static bool is_terminator(IrOp op) {
+  return op >= IR_JUMP;
+}
+
+static int successor_count(IrInstr* instr) {
+  switch (instr->op) {
+    case IR_JUMP:
+      return 1;
+    case IR_BRANCH:
+    case IR_BRANCH_GLOBAL:
+      return 2;
+    default:
+      return 0;
+  }
+}
+
+// Every block ends in a terminator once it is lowered, -1 before that
+static int block_terminator(IrFunc* func, int block) {
+  IntArray* instrs = &func->blocks[block].instrs;
+  if (instrs->count == 0)
+    return -1;
+  int last = instrs->ints[instrs->count - 1];
+  return is_terminator(func->instrs[last].op) ? last : -1;
+}
+
+static void remove_int(IntArray* arr, int index) {
+  for (int i = index; i < arr->count - 1; i++) {
+    arr->ints[i] = arr->ints[i + 1];
+  }
+  arr->count--;
+}
+
+// The value that stands in for the instruction, after the phis and copies
+// it was replaced by are followed
+static int resolve(IrFunc* func, int instr) {
+  while (func->instrs[instr].forward != -1) {
+    instr = func->instrs[instr].forward;
+  }
+  return instr;
+}
+
+int add_ir_variable(IrFunc* func) {
+  for (int i = 0; i < func->block_count; i++) {
+    push_int_array(&func->blocks[i].defs, -1);
+  }
+  return func->variable_count++;
+}
+
+void write_ir_variable(IrFunc* func, int variable, int block, int value) {
+  func->blocks[block].defs.ints[variable] = value;
+}
+
+static void remove_trivial_phi(IrFunc* func, int phi);
+
+static void add_phi_operands(IrFunc* func, int phi) {
+  IrInstr* instr = &func->instrs[phi];
+  int block = instr->block;
+  int variable = instr->index;
+  for (int i = 0; i < func->blocks[block].preds.count; i++) {
+    int pred = func->blocks[block].preds.ints[i];
+    int value = read_ir_variable(func, variable, pred);
+    add_ir_operand(func, phi, value);
+  }
+  remove_trivial_phi(func, phi);
+}
+
+int read_ir_variable(IrFunc* func, int variable, int block) {
+  int value = func->blocks[block].defs.ints[variable];
+  if (value != -1)
+    return resolve(func, value);
+
+  IrBlock* ir_block = &func->blocks[block];
+  if (!ir_block->sealed) {
+    value = add_ir_instr(func, block, IR_PHI, 0);
+    func->instrs[value].index = variable;
+    push_int_array(&func->blocks[block].incomplete_phis, value);
+  } else if (ir_block->preds.count == 1) {
+    value = read_ir_variable(func, variable, ir_block->preds.ints[0]);
+  } else if (ir_block->preds.count == 0) {
+    // Only the entry block has no predecessors, the variable was read
+    // before anything was written to it
+    value = add_ir_constant(func, NIL_VAL);
+  } else {
+    // Written before the operands are read so that a loop back to this
+    // block finds the phi and stops there
+    value = add_ir_instr(func, block, IR_PHI, 0);
+    func->instrs[value].index = variable;
+    write_ir_variable(func, variable, block, value);
+    add_phi_operands(func, value);
+    value = resolve(func, value);
+  }
+  write_ir_variable(func, variable, block, value);
+  return value;
+}
+
+void seal_ir_block(IrFunc* func, int block) {
+  // Completing a phi can read variables of this block again, which may
+  // add incomplete phis while the list is walked
+  for (int i = 0; i < func->blocks[block].incomplete_phis.count; i++) {
+    add_phi_operands(func, func->blocks[block].incomplete_phis.ints[i]);
+  }
+  func->blocks[block].incomplete_phis.count = 0;
+  func->blocks[block].sealed = true;
+}
+
+static bool is_complete_phi(IrFunc* func, int phi) {
+  IrInstr* instr = &func->instrs[phi];
+  IrBlock* block = &func->blocks[instr->block];
+  return !instr->removed && block->sealed &&
+         instr->operands.count == block->preds.count;
+}
+
+// A phi whose operands are all the same value, or the phi itself, is that
+// value. Replacing it can make the phis that use it trivial in turn
+static void remove_trivial_phi(IrFunc* func, int phi) {
+  if (func->instrs[phi].removed)
+    return;
+
+  int same = -1;
+  IntArray* operands = &func->instrs[phi].operands;
+  for (int i = 0; i < operands->count; i++) {
+    int operand = resolve(func, operands->ints[i]);
+    if (operand == same || operand == phi)
+      continue;
+    if (same != -1)
+      return;
+    same = operand;
+  }
+  if (same == -1)
+    same = add_ir_constant(func, NIL_VAL);
+
+  IntArray users;
+  init_int_array(&users);
+  for (int i = 0; i < func->block_count; i++) {
+    IntArray* phis = &func->blocks[i].phis;
+    for (int j = 0; j < phis->count; j++) {
+      IrInstr* user = &func->instrs[phis->ints[j]];
+      if (user->removed || phis->ints[j] == phi)
+        continue;
+      for (int k = 0; k < user->operands.count; k++) {
+        if (resolve(func, user->operands.ints[k]) == phi) {
+          push_int_array(&users, phis->ints[j]);
+          break;
+        }
+      }
+    }
+  }
+  func->instrs[phi].forward = same;
+  func->instrs[phi].removed = true;
+
+  for (int i = 0; i < users.count; i++) {
+    if (is_complete_phi(func, users.ints[i]))
+      remove_trivial_phi(func, users.ints[i]);
+  }
+  free_int_array(&users);
+}
+
+// The blocks in reverse postorder from the entry, which puts every block
+// after its dominators, and the immediate dominator of each block, found
+// the way Cooper, Harvey and Kennedy do in "A Simple, Fast Dominance
+// Algorithm". Blocks that cannot be reached have an rpo_index of -1
+typedef struct {
+  int* rpo;
+  int count;
+  int* rpo_index;
+  int* idom;
+} Cfg;
+
+static void visit_block(IrFunc* func, int block, bool* visited, Cfg* cfg) {
+  visited[block] = true;
+  int terminator = block_terminator(func, block);
+  if (terminator != -1) {
+    IrInstr* instr = &func->instrs[terminator];
+    for (int i = successor_count(instr) - 1; i >= 0; i--) {
+      if (!visited[instr->targets[i]])
+        visit_block(func, instr->targets[i], visited, cfg);
+    }
+  }
+  cfg->rpo[cfg->count++] = block;
+}
+
+static int intersect(Cfg* cfg, int a, int b) {
+  while (a != b) {
+    while (cfg->rpo_index[a] > cfg->rpo_index[b]) {
+      a = cfg->idom[a];
+    }
+    while (cfg->rpo_index[b] > cfg->rpo_index[a]) {
+      b = cfg->idom[b];
+    }
+  }
+  return a;
+}
+
+static void init_cfg(IrFunc* func, Cfg* cfg) {
+  int block_count = func->block_count;
+  cfg->rpo = ALLOCATE(int, block_count);
+  cfg->rpo_index = ALLOCATE(int, block_count);
+  cfg->idom = ALLOCATE(int, block_count);
+  cfg->count = 0;
+
+  bool* visited = ALLOCATE(bool, block_count);
+  memset(visited, 0, sizeof(bool) * block_count);
+  visit_block(func, 0, visited, cfg);
+  free(visited);
+
+  for (int i = 0; i < cfg->count / 2; i++) {
+    int block = cfg->rpo[i];
+    cfg->rpo[i] = cfg->rpo[cfg->count - 1 - i];
+    cfg->rpo[cfg->count - 1 - i] = block;
+  }
+  for (int i = 0; i < block_count; i++) {
+    cfg->rpo_index[i] = -1;
+    cfg->idom[i] = -1;
+  }
+  for (int i = 0; i < cfg->count; i++) {
+    cfg->rpo_index[cfg->rpo[i]] = i;
+  }
+
+  cfg->idom[0] = 0;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int i = 1; i < cfg->count; i++) {
+      int block = cfg->rpo[i];
+      IntArray* preds = &func->blocks[block].preds;
+      int idom = -1;
+      for (int j = 0; j < preds->count; j++) {
+        int pred = preds->ints[j];
+        if (cfg->rpo_index[pred] == -1 || cfg->idom[pred] == -1)
+          continue;
+        idom = idom == -1 ? pred : intersect(cfg, pred, idom);
+      }
+      if (idom != cfg->idom[block]) {
+        cfg->idom[block] = idom;
+        changed = true;
+      }
+    }
+  }
+}
+
+static void free_cfg(Cfg* cfg) {
+  free(cfg->rpo);
+  free(cfg->rpo_index);
+  free(cfg->idom);
+}
+
+static bool dominates(Cfg* cfg, int a, int b) {
+  while (b != a && b != 0) {
+    b = cfg->idom[b];
+  }
+  return b == a;
+}
+
+static void remove_instrs(IrFunc* func, IntArray* instrs) {
+  for (int i = 0; i < instrs->count; i++) {
+    func->instrs[instrs->ints[i]].removed = true;
+  }
+}
+
+// Code after a return, and the other block of an inlined call that can
+// never be taken, is dropped along with its edges into the blocks that
+// can be reached
+static void remove_unreachable_blocks(IrFunc* func) {
+  Cfg cfg;
+  init_cfg(func, &cfg);
+
+  for (int i = 0; i < func->block_count; i++) {
+    IrBlock* block = &func->blocks[i];
+    if (cfg.rpo_index[i] == -1) {
+      remove_instrs(func, &block->phis);
+      remove_instrs(func, &block->instrs);
+      continue;
+    }
+    for (int j = block->preds.count - 1; j >= 0; j--) {
+      if (cfg.rpo_index[block->preds.ints[j]] != -1)
+        continue;
+      remove_int(&block->preds, j);
+      for (int k = 0; k < block->phis.count; k++) {
+        IntArray* operands = &func->instrs[block->phis.ints[k]].operands;
+        if (j < operands->count)
+          remove_int(operands, j);
+      }
+    }
+  }
+
+  int count = 0;
+  for (int i = 0; i < func->layout.count; i++) {
+    int block = func->layout.ints[i];
+    if (cfg.rpo_index[block] != -1)
+      func->layout.ints[count++] = block;
+  }
+  func->layout.count = count;
+  free_cfg(&cfg);
+}
+
+static bool has_result(IrOp op) {
+  return op != IR_PRINT && !is_terminator(op);
+}
+
+static void resolve_operands(IrFunc* func) {
+  for (int i = 0; i < func->instr_count; i++) {
+    IrInstr* instr = &func->instrs[i];
+    if (instr->removed)
+      continue;
+    for (int j = 0; j < instr->operands.count; j++) {
+      instr->operands.ints[j] = resolve(func, instr->operands.ints[j]);
+    }
+  }
+}
+
+static void remove_trivial_phis(IrFunc* func) {
+  for (int i = 0; i < func->instr_count; i++) {
+    if (func->instrs[i].op == IR_PHI)
+      remove_trivial_phi(func, i);
+  }
+  resolve_operands(func);
+}
+
+// Assignments are expressions whose value is the value assigned, so their
+// users can take that value directly
+static void propagate_copies(IrFunc* func) {
+  for (int i = 0; i < func->instr_count; i++) {
+    IrInstr* instr = &func->instrs[i];
+    if (instr->removed)
+      continue;
+    for (int j = 0; j < instr->operands.count; j++) {
+      int operand = instr->operands.ints[j];
+      while (func->instrs[operand].op == IR_SET_GLOBAL ||
+             func->instrs[operand].op == IR_SET_FIELD ||
+             func->instrs[operand].op == IR_INDEX_SET) {
+        IntArray* operands = &func->instrs[operand].operands;
+        operand = operands->ints[operands->count - 1];
+      }
+      instr->operands.ints[j] = operand;
+    }
+  }
+}
+
+static bool is_pure(IrOp op) {
+  return op >= IR_ADD && op <= IR_BIT_NOT;
+}
+
+static bool same_constant(Value a, Value b) {
+  if (a.type != b.type)
+    return false;
+  switch (a.type) {
+    case VAL_INT:
+      return AS_INT(a) == AS_INT(b);
+    case VAL_NUMBER: {
+      // Bit for bit, so that 0.0 and -0.0 stay apart
+      double x = AS_NUMBER(a);
+      double y = AS_NUMBER(b);
+      return memcmp(&x, &y, sizeof(double)) == 0;
+    }
+    case VAL_BOOLEAN:
+      return AS_BOOLEAN(a) == AS_BOOLEAN(b);
+    case VAL_NIL:
+      return true;
+    default:
+      return AS_OBJ(a) == AS_OBJ(b);
+  }
+}
+
+static uint32_t hash_constant(Value value) {
+  uint64_t bits = 0;
+  switch (value.type) {
+    case VAL_INT:
+      bits = (uint64_t)AS_INT(value);
+      break;
+    case VAL_NUMBER: {
+      double number = AS_NUMBER(value);
+      memcpy(&bits, &number, sizeof(double));
+      break;
+    }
+    case VAL_BOOLEAN:
+      bits = AS_BOOLEAN(value);
+      break;
+    case VAL_NIL:
+      break;
+    default:
+      bits = (uint64_t)(uintptr_t)AS_OBJ(value);
+      break;
+  }
+  bits ^= (uint64_t)value.type << 56;
+  bits *= 0x9e3779b97f4a7c15ull;
+  return (uint32_t)(bits >> 32);
+}
+
+static uint32_t hash_instr(IrInstr* instr) {
+  if (instr->op == IR_CONSTANT)
+    return hash_constant(instr->value);
+  uint32_t hash = 2166136261u ^ instr->op;
+  for (int i = 0; i < instr->operands.count; i++) {
+    hash = (hash ^ (uint32_t)instr->operands.ints[i]) * 16777619u;
+  }
+  return hash;
+}
+
+static bool same_value(IrInstr* a, IrInstr* b) {
+  if (a->op != b->op)
+    return false;
+  if (a->op == IR_CONSTANT)
+    return same_constant(a->value, b->value);
+  if (a->operands.count != b->operands.count)
+    return false;
+  for (int i = 0; i < a->operands.count; i++) {
+    if (a->operands.ints[i] != b->operands.ints[i])
+      return false;
+  }
+  return true;
+}
+
+// Global value numbering. Equal constants become one, and an operation on
+// the same values as one that dominates it is replaced by that one. The
+// blocks are walked in reverse postorder, so the operands of an operation
+// have their numbers before it is looked at
+static void number_values(IrFunc* func) {
+  Cfg cfg;
+  init_cfg(func, &cfg);
+
+  int capacity = 16;
+  while (capacity < func->instr_count * 2) {
+    capacity *= 2;
+  }
+  int* table = ALLOCATE(int, capacity);
+  for (int i = 0; i < capacity; i++) {
+    table[i] = -1;
+  }
+
+  // Constants first, they are in no block and dominate everything
+  uint32_t mask = capacity - 1;
+  for (int i = 0; i < func->instr_count; i++) {
+    IrInstr* instr = &func->instrs[i];
+    if (instr->op != IR_CONSTANT || instr->removed)
+      continue;
+    uint32_t slot = hash_instr(instr) & mask;
+    while (table[slot] != -1 &&
+           !same_value(&func->instrs[table[slot]], instr)) {
+      slot = (slot + 1) & mask;
+    }
+    if (table[slot] == -1) {
+      table[slot] = i;
+    } else {
+      instr->forward = table[slot];
+      instr->removed = true;
+    }
+  }
+  resolve_operands(func);
+
+  for (int i = 0; i < cfg.count; i++) {
+    IntArray* instrs = &func->blocks[cfg.rpo[i]].instrs;
+    for (int j = 0; j < instrs->count; j++) {
+      int instr = instrs->ints[j];
+      IrInstr* ir_instr = &func->instrs[instr];
+      if (ir_instr->removed)
+        continue;
+      for (int k = 0; k < ir_instr->operands.count; k++) {
+        ir_instr->operands.ints[k] =
+            resolve(func, ir_instr->operands.ints[k]);
+      }
+      if (!is_pure(ir_instr->op))
+        continue;
+
+      uint32_t slot = hash_instr(ir_instr) & mask;
+      int found = -1;
+      while (table[slot] != -1) {
+        IrInstr* other = &func->instrs[table[slot]];
+        if (same_value(other, ir_instr) &&
+            dominates(&cfg, other->block, ir_instr->block)) {
+          found = table[slot];
+          break;
+        }
+        slot = (slot + 1) & mask;
+      }
+      if (found != -1) {
+        ir_instr->forward = found;
+        ir_instr->removed = true;
+      } else {
+        table[slot] = instr;
+      }
+    }
+  }
+
+  free(table);
+  free_cfg(&cfg);
+  resolve_operands(func);
+}
+
+static uint8_t constant_type(Value value) {
+  switch (value.type) {
+    case VAL_INT:
+      return IR_TYPE_INT;
+    case VAL_NUMBER:
+      return IR_TYPE_DOUBLE;
+    case VAL_BOOLEAN:
+      return IR_TYPE_BOOL;
+    case VAL_NIL:
+      return IR_TYPE_NIL;
+    default:
+      return IS_STRING(value) ? IR_TYPE_STRING : IR_TYPE_OBJECT;
+  }
+}
+
+static bool is_number_type(uint8_t type) {
+  return type != 0 && (type & ~IR_TYPE_NUMBER) == 0;
+}
+
+// int with int can overflow into a double, a double with any number is a
+// double. Types that are not numbers are left to the runtime error
+static uint8_t arithmetic_type(uint8_t left, uint8_t right) {
+  uint8_t type = 0;
+  if ((left & IR_TYPE_INT) && (right & IR_TYPE_INT))
+    type |= IR_TYPE_NUMBER;
+  if (((left & IR_TYPE_DOUBLE) && (right & IR_TYPE_NUMBER)) ||
+      ((left & IR_TYPE_NUMBER) && (right & IR_TYPE_DOUBLE)))
+    type |= IR_TYPE_DOUBLE;
+  return type;
+}
+
+static uint8_t operand_type(IrFunc* func, IrInstr* instr, int index) {
+  uint8_t type = func->instrs[instr->operands.ints[index]].type;
+  if (instr->known != NULL)
+    type &= instr->known[index];
+  return type;
+}
+
+static uint8_t infer_type(IrFunc* func, IrInstr* instr) {
+  switch (instr->op) {
+    case IR_PARAM:
+      return IR_TYPE_ANY;
+    case IR_CONSTANT:
+      return constant_type(instr->value);
+    case IR_PHI: {
+      uint8_t type = 0;
+      for (int i = 0; i < instr->operands.count; i++) {
+        type |= operand_type(func, instr, i);
+      }
+      return type;
+    }
+    case IR_ADD: {
+      uint8_t left = operand_type(func, instr, 0);
+      uint8_t right = operand_type(func, instr, 1);
+      uint8_t type = arithmetic_type(left, right);
+      if ((left & IR_TYPE_STRING) && (right & IR_TYPE_STRING))
+        type |= IR_TYPE_STRING;
+      return type;
+    }
+    case IR_SUBTRACT:
+    case IR_MULTIPLY:
+      return arithmetic_type(operand_type(func, instr, 0),
+                             operand_type(func, instr, 1));
+    case IR_DIVIDE:
+      return IR_TYPE_DOUBLE;
+    case IR_MODULO: {
+      uint8_t left = operand_type(func, instr, 0);
+      uint8_t right = operand_type(func, instr, 1);
+      uint8_t type = arithmetic_type(left, right) & IR_TYPE_DOUBLE;
+      if ((left & IR_TYPE_INT) && (right & IR_TYPE_INT))
+        type |= IR_TYPE_INT;
+      return type;
+    }
+    case IR_NEGATE: {
+      // Negating the smallest int does not fit in an int
+      uint8_t operand = operand_type(func, instr, 0);
+      return ((operand & IR_TYPE_INT) ? IR_TYPE_NUMBER : 0) |
+             (operand & IR_TYPE_DOUBLE);
+    }
+    case IR_BIT_AND:
+    case IR_BIT_OR:
+    case IR_BIT_XOR:
+    case IR_SHIFT_LEFT:
+    case IR_SHIFT_RIGHT:
+    case IR_BIT_NOT:
+      return IR_TYPE_INT;
+    case IR_EQUAL:
+    case IR_GREATER:
+    case IR_LESS:
+    case IR_NOT:
+      return IR_TYPE_BOOL;
+    case IR_ARRAY:
+    case IR_MAP:
+      return IR_TYPE_OBJECT;
+    case IR_SET_GLOBAL:
+    case IR_SET_FIELD:
+    case IR_INDEX_SET:
+      return operand_type(func, instr, instr->operands.count - 1);
+    default:
+      return IR_TYPE_ANY;
+  }
+}
+
+// What every value can be, starting from nothing and growing until no
+// type changes, so that a loop does not make its variables anything just
+// because the back edge has not been looked at yet
+static void infer_types(IrFunc* func) {
+  Cfg cfg;
+  init_cfg(func, &cfg);
+  for (int i = 0; i < func->instr_count; i++) {
+    IrInstr* instr = &func->instrs[i];
+    instr->type = instr->op == IR_CONSTANT || instr->op == IR_PARAM
+                      ? infer_type(func, instr)
+                      : 0;
+  }
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int i = 0; i < cfg.count; i++) {
+      IrBlock* block = &func->blocks[cfg.rpo[i]];
+      for (int j = 0; j < block->phis.count + block->instrs.count; j++) {
+        int id = j < block->phis.count ? block->phis.ints[j]
+                                       : block->instrs.ints[j -
+                                                            block->phis.count];
+        IrInstr* instr = &func->instrs[id];
+        if (instr->removed || !has_result(instr->op))
+          continue;
+        uint8_t type = instr->type | infer_type(func, instr);
+        if (type != instr->type) {
+          instr->type = type;
+          changed = true;
+        }
+      }
+    }
+  }
+  free_cfg(&cfg);
+}
+
+static bool is_int_constant(IrInstr* instr, int64_t value) {
+  return instr->op == IR_CONSTANT && IS_INT(instr->value) &&
+         AS_INT(instr->value) == value;
+}
+
+// Whether the instruction can do anything but make its value, which
+// includes the runtime errors of operations on the wrong types
+static bool has_effects(IrFunc* func, IrInstr* instr) {
+  switch (instr->op) {
+    case IR_PARAM:
+    case IR_CONSTANT:
+    case IR_PHI:
+    case IR_EQUAL:
+    case IR_NOT:
+    case IR_ARRAY:
+      return false;
+    case IR_ADD: {
+      uint8_t left = operand_type(func, instr, 0);
+      uint8_t right = operand_type(func, instr, 1);
+      return !(is_number_type(left) && is_number_type(right)) &&
+             !(left == IR_TYPE_STRING && right == IR_TYPE_STRING);
+    }
+    case IR_SUBTRACT:
+    case IR_MULTIPLY:
+    case IR_DIVIDE:
+    case IR_GREATER:
+    case IR_LESS:
+      return !is_number_type(operand_type(func, instr, 0)) ||
+             !is_number_type(operand_type(func, instr, 1));
+    case IR_MODULO: {
+      // An int divided by 0 is an error, a double is not
+      IrInstr* divisor = &func->instrs[instr->operands.ints[1]];
+      if (!is_number_type(operand_type(func, instr, 0)) ||
+          !is_number_type(divisor->type))
+        return true;
+      return (divisor->type & IR_TYPE_INT) && (divisor->op != IR_CONSTANT ||
+                                               is_int_constant(divisor, 0));
+    }
+    case IR_NEGATE:
+      return !is_number_type(operand_type(func, instr, 0));
+    case IR_BIT_AND:
+    case IR_BIT_OR:
+    case IR_BIT_XOR:
+    case IR_SHIFT_LEFT:
+    case IR_SHIFT_RIGHT:
+      return operand_type(func, instr, 0) != IR_TYPE_INT ||
+             operand_type(func, instr, 1) != IR_TYPE_INT;
+    case IR_BIT_NOT:
+      return operand_type(func, instr, 0) != IR_TYPE_INT;
+    default:
+      return true;
+  }
+}
+
+// Drops the removed instructions from the lists of the blocks
+static void compact_blocks(IrFunc* func) {
+  for (int i = 0; i < func->block_count; i++) {
+    IntArray* lists[2] = {&func->blocks[i].phis, &func->blocks[i].instrs};
+    for (int j = 0; j < 2; j++) {
+      int count = 0;
+      for (int k = 0; k < lists[j]->count; k++) {
+        if (!func->instrs[lists[j]->ints[k]].removed)
+          lists[j]->ints[count++] = lists[j]->ints[k];
+      }
+      lists[j]->count = count;
+    }
+  }
+}
+
+// Everything that is not needed by a terminator or an instruction with
+// effects goes, phis that only feed each other in a loop included
+static void remove_dead_code(IrFunc* func) {
+  bool* live = ALLOCATE(bool, func->instr_count);
+  memset(live, 0, sizeof(bool) * func->instr_count);
+  IntArray worklist;
+  init_int_array(&worklist);
+
+  for (int i = 0; i < func->block_count; i++) {
+    IntArray* instrs = &func->blocks[i].instrs;
+    for (int j = 0; j < instrs->count; j++) {
+      IrInstr* instr = &func->instrs[instrs->ints[j]];
+      if (instr->removed)
+        continue;
+      if (is_terminator(instr->op) || has_effects(func, instr)) {
+        live[instrs->ints[j]] = true;
+        push_int_array(&worklist, instrs->ints[j]);
+      }
+    }
+  }
+  while (worklist.count > 0) {
+    IrInstr* instr = &func->instrs[worklist.ints[--worklist.count]];
+    for (int i = 0; i < instr->operands.count; i++) {
+      int operand = instr->operands.ints[i];
+      if (!live[operand]) {
+        live[operand] = true;
+        push_int_array(&worklist, operand);
+      }
+    }
+  }
+
+  for (int i = 0; i < func->instr_count; i++) {
+    IrInstr* instr = &func->instrs[i];
+    if (!live[i] && instr->op != IR_PARAM)
+      instr->removed = true;
+  }
+  free_int_array(&worklist);
+  free(live);
+  compact_blocks(func);
+}
+
+// The blocks of the loop with the header, found by walking back from the
+// blocks that jump back to the header until the header is reached
+static void find_loop_blocks(IrFunc* func,
+                             Cfg* cfg,
+                             int header,
+                             bool* in_loop) {
+  memset(in_loop, 0, sizeof(bool) * func->block_count);
+  in_loop[header] = true;
+  IntArray worklist;
+  init_int_array(&worklist);
+  IntArray* preds = &func->blocks[header].preds;
+  for (int i = 0; i < preds->count; i++) {
+    if (dominates(cfg, header, preds->ints[i]))
+      push_int_array(&worklist, preds->ints[i]);
+  }
+  while (worklist.count > 0) {
+    int block = worklist.ints[--worklist.count];
+    if (in_loop[block])
+      continue;
+    in_loop[block] = true;
+    for (int i = 0; i < func->blocks[block].preds.count; i++) {
+      push_int_array(&worklist, func->blocks[block].preds.ints[i]);
+    }
+  }
+  free_int_array(&worklist);
+}
+
+// The one block outside the loop that jumps to its header, -1 if there is
+// not exactly one or it goes anywhere else as well
+static int find_preheader(IrFunc* func, int header, bool* in_loop) {
+  int preheader = -1;
+  IntArray* preds = &func->blocks[header].preds;
+  for (int i = 0; i < preds->count; i++) {
+    if (in_loop[preds->ints[i]])
+      continue;
+    if (preheader != -1)
+      return -1;
+    preheader = preds->ints[i];
+  }
+  if (preheader == -1 ||
+      func->instrs[block_terminator(func, preheader)].op != IR_JUMP)
+    return -1;
+  return preheader;
+}
+
+static bool writes_globals(IrFunc* func, bool* in_loop) {
+  for (int i = 0; i < func->block_count; i++) {
+    if (!in_loop[i])
+      continue;
+    IntArray* instrs = &func->blocks[i].instrs;
+    for (int j = 0; j < instrs->count; j++) {
+      IrOp op = func->instrs[instrs->ints[j]].op;
+      if (op == IR_SET_GLOBAL || op == IR_CALL)
+        return true;
+    }
+  }
+  return false;
+}
+
+// Moves what a loop computes the same way on every iteration to the end of
+// its preheader, where it is computed once into a slot of its own. Loops
+// are lowered with their condition tested once before the preheader, so
+// the preheader only runs when the body does. Values that cannot fail are
+// moved from anywhere in the loop. The ones that can fail at runtime, on
+// operands of the wrong type or an undefined global, are only moved from
+// the header before anything the loop keeps that has effects, as then the
+// first iteration would have failed on them just the same
+static void hoist_loop(IrFunc* func, Cfg* cfg, int header, bool* in_loop) {
+  find_loop_blocks(func, cfg, header, in_loop);
+  int preheader = find_preheader(func, header, in_loop);
+  if (preheader == -1)
+    return;
+  bool globals_written = writes_globals(func, in_loop);
+
+  IntArray* hoisted = &func->blocks[preheader].instrs;
+  int terminator = hoisted->ints[--hoisted->count];
+  bool blocked = false;
+  for (int i = cfg->rpo_index[header]; i < cfg->count; i++) {
+    int block = cfg->rpo[i];
+    if (!in_loop[block])
+      continue;
+
+    IntArray* instrs = &func->blocks[block].instrs;
+    int count = 0;
+    for (int j = 0; j < instrs->count; j++) {
+      int id = instrs->ints[j];
+      IrInstr* instr = &func->instrs[id];
+      bool invariant =
+          !instr->removed &&
+          (is_pure(instr->op) ||
+           (instr->op == IR_GET_GLOBAL && !globals_written));
+      for (int k = 0; k < instr->operands.count && invariant; k++) {
+        int operand_block = func->instrs[instr->operands.ints[k]].block;
+        invariant = operand_block == -1 || !in_loop[operand_block];
+      }
+      bool effects = has_effects(func, instr);
+      if (invariant && (!effects || (block == header && !blocked))) {
+        instr->block = preheader;
+        push_int_array(hoisted, id);
+      } else {
+        blocked = blocked || (block == header && !instr->removed && effects);
+        instrs->ints[count++] = id;
+      }
+    }
+    instrs->count = count;
+  }
+  push_int_array(hoisted, terminator);
+}
+
+// Inner loops first, their headers come after the headers of the loops
+// around them, so what leaves an inner loop can leave the outer one too
+static void hoist_invariants(IrFunc* func) {
+  Cfg cfg;
+  init_cfg(func, &cfg);
+  bool* in_loop = ALLOCATE(bool, func->block_count);
+  for (int i = cfg.count - 1; i >= 0; i--) {
+    int block = cfg.rpo[i];
+    IntArray* preds = &func->blocks[block].preds;
+    for (int j = 0; j < preds->count; j++) {
+      if (dominates(&cfg, block, preds->ints[j])) {
+        hoist_loop(func, &cfg, block, in_loop);
+        break;
+      }
+    }
+  }
+  free(in_loop);
+  free_cfg(&cfg);
+}
+
+// What the operand has to be for the instruction not to fail. Adding to a
+// number needs a number and adding to a string needs a string
+static uint8_t checked_type(IrFunc* func, IrInstr* instr, int index) {
+  switch (instr->op) {
+    case IR_ADD: {
+      uint8_t other = operand_type(func, instr, 1 - index);
+      if (is_number_type(other))
+        return IR_TYPE_NUMBER;
+      return other == IR_TYPE_STRING ? IR_TYPE_STRING : IR_TYPE_ANY;
+    }
+    case IR_SUBTRACT:
+    case IR_MULTIPLY:
+    case IR_DIVIDE:
+    case IR_MODULO:
+    case IR_GREATER:
+    case IR_LESS:
+    case IR_NEGATE:
+      return IR_TYPE_NUMBER;
+    case IR_BIT_AND:
+    case IR_BIT_OR:
+    case IR_BIT_XOR:
+    case IR_SHIFT_LEFT:
+    case IR_SHIFT_RIGHT:
+    case IR_BIT_NOT:
+      return IR_TYPE_INT;
+    default:
+      return IR_TYPE_ANY;
+  }
+}
+
+// Whether the check has run by the time the operand is used, the operand
+// of a phi is used at the end of its predecessor
+static bool checked_before(IrFunc* func,
+                           Cfg* cfg,
+                           int* positions,
+                           int check,
+                           int use,
+                           int index) {
+  IrInstr* instr = &func->instrs[use];
+  int check_block = func->instrs[check].block;
+  if (instr->op == IR_PHI) {
+    int pred = func->blocks[instr->block].preds.ints[index];
+    return dominates(cfg, check_block, pred);
+  }
+  if (check_block == instr->block)
+    return positions[check] < positions[use];
+  return dominates(cfg, check_block, instr->block);
+}
+
+// A value that an instruction checked is known to have the type the check
+// needs everywhere the check dominates, as the function would have failed
+// otherwise. The types are inferred again with what is known at every use,
+// and the arithmetic whose operands are then numbers is made unchecked.
+// This runs last, the checks have to stay where they are for it to hold
+static void specialize_types(IrFunc* func) {
+  Cfg cfg;
+  init_cfg(func, &cfg);
+  int* positions = ALLOCATE(int, func->instr_count);
+  // Pairs of the instruction that checks the value and the type it needs
+  IntArray* checks = ALLOCATE(IntArray, func->instr_count);
+  for (int i = 0; i < func->instr_count; i++) {
+    init_int_array(&checks[i]);
+  }
+
+  for (int i = 0; i < cfg.count; i++) {
+    IntArray* instrs = &func->blocks[cfg.rpo[i]].instrs;
+    for (int j = 0; j < instrs->count; j++) {
+      IrInstr* instr = &func->instrs[instrs->ints[j]];
+      positions[instrs->ints[j]] = j;
+      for (int k = 0; k < instr->operands.count; k++) {
+        uint8_t type = checked_type(func, instr, k);
+        if (type != IR_TYPE_ANY) {
+          push_int_array(&checks[instr->operands.ints[k]], instrs->ints[j]);
+          push_int_array(&checks[instr->operands.ints[k]], type);
+        }
+      }
+    }
+  }
+
+  for (int i = 0; i < cfg.count; i++) {
+    IrBlock* block = &func->blocks[cfg.rpo[i]];
+    for (int j = 0; j < block->phis.count + block->instrs.count; j++) {
+      int id = j < block->phis.count
+                   ? block->phis.ints[j]
+                   : block->instrs.ints[j - block->phis.count];
+      IrInstr* instr = &func->instrs[id];
+      if (instr->operands.count == 0)
+        continue;
+      instr->known = ALLOCATE(uint8_t, instr->operands.count);
+      for (int k = 0; k < instr->operands.count; k++) {
+        IntArray* value_checks = &checks[instr->operands.ints[k]];
+        uint8_t known = IR_TYPE_ANY;
+        for (int l = 0; l < value_checks->count; l += 2) {
+          if (value_checks->ints[l] != id &&
+              checked_before(func, &cfg, positions, value_checks->ints[l], id,
+                             k))
+            known &= value_checks->ints[l + 1];
+        }
+        instr->known[k] = known;
+      }
+    }
+  }
+  for (int i = 0; i < func->instr_count; i++) {
+    free_int_array(&checks[i]);
+  }
+  free(checks);
+  free(positions);
+  free_cfg(&cfg);
+
+  infer_types(func);
+  func->numeric_sites = 0;
+  func->unchecked_sites = 0;
+  for (int i = 0; i < func->block_count; i++) {
+    IntArray* instrs = &func->blocks[i].instrs;
+    for (int j = 0; j < instrs->count; j++) {
+      IrInstr* instr = &func->instrs[instrs->ints[j]];
+      if (instr->op != IR_ADD && instr->op != IR_SUBTRACT &&
+          instr->op != IR_MULTIPLY && instr->op != IR_DIVIDE &&
+          instr->op != IR_GREATER && instr->op != IR_LESS)
+        continue;
+      func->numeric_sites++;
+      instr->unchecked = is_number_type(operand_type(func, instr, 0)) &&
+                         is_number_type(operand_type(func, instr, 1));
+      if (instr->unchecked)
+        func->unchecked_sites++;
+    }
+  }
+}
+
+void optimize_ir(IrFunc* func) {
+  remove_unreachable_blocks(func);
+  remove_trivial_phis(func);
+  propagate_copies(func);
+  remove_trivial_phis(func);
+  number_values(func);
+  remove_trivial_phis(func);
+  infer_types(func);
+  hoist_invariants(func);
+  remove_dead_code(func);
+  specialize_types(func);
+}
+
+static const char* ir_op_name(IrOp op) {
+  static const char* names[] = {
+      "param",      "constant",    "phi",       "add",       "subtract",
+      "multiply",   "divide",      "modulo",    "bit_and",   "bit_or",
+      "bit_xor",    "shift_left",  "shift_right", "equal",   "greater",
+      "less",       "not",         "negate",    "bit_not",   "get_global",
+      "set_global", "array",       "map",       "index_get", "index_set",
+      "get_field",  "set_field",   "call",      "call_native", "print",
+      "jump",       "branch",      "branch_global", "return",
+  };
+  return names[op];
+}
+
+static void print_ir_type(uint8_t type) {
+  static const char* names[] = {"int",  "double", "bool",
+                                "nil",  "string", "object"};
+  if (type == IR_TYPE_ANY) {
+    printf("any");
+    return;
+  }
+  if (type == 0) {
+    printf("none");
+    return;
+  }
+  bool first = true;
+  for (int i = 0; i < 6; i++) {
+    if (type & (1 << i)) {
+      printf("%s%s", first ? "" : "|", names[i]);
+      first = false;
+    }
+  }
+}
+
+static void print_ir_constant(Value value) {
+  if (IS_INT(value))
+    printf("%lld", (long long)AS_INT(value));
+  else if (IS_NUMBER(value))
+    printf("%g", AS_NUMBER(value));
+  else if (IS_BOOLEAN(value))
+    printf(AS_BOOLEAN(value) ? "true" : "false");
+  else if (IS_NIL(value))
+    printf("nil");
+  else if (IS_STRING(value))
+    printf("\"%s\"", ((ObjString*)AS_OBJ(value))->chars);
+  else
+    printf("<object>");
+}
+
+// Constants are printed where they are used, the other operands by their
+// number
+static void print_ir_operand(IrFunc* func, int operand) {
+  IrInstr* instr = &func->instrs[operand];
+  if (instr->op == IR_CONSTANT)
+    print_ir_constant(instr->value);
+  else
+    printf("v%d", operand);
+}
+
+static void print_ir_instr(IrFunc* func, int id) {
+  IrInstr* instr = &func->instrs[id];
+  printf("  ");
+  if (has_result(instr->op))
+    printf("v%d = ", id);
+  printf("%s%s", ir_op_name(instr->op), instr->unchecked ? "_number" : "");
+
+  bool first = true;
+  if (instr->op == IR_PARAM) {
+    printf(" %d", instr->index);
+    first = false;
+  } else if (instr->op == IR_CALL_NATIVE) {
+    printf(" %s", get_native(instr->index)->name);
+    first = false;
+  }
+  if (instr->op == IR_GET_GLOBAL || instr->op == IR_SET_GLOBAL ||
+      instr->op == IR_GET_FIELD || instr->op == IR_SET_FIELD ||
+      instr->op == IR_BRANCH_GLOBAL) {
+    printf(" %s", ((ObjString*)AS_OBJ(instr->value))->chars);
+    first = false;
+  }
+  for (int i = 0; i < instr->operands.count; i++) {
+    printf(first ? " " : ", ");
+    print_ir_operand(func, instr->operands.ints[i]);
+    first = false;
+  }
+  for (int i = 0; i < successor_count(instr); i++) {
+    printf(first ? " block%d" : ", block%d", instr->targets[i]);
+    first = false;
+  }
+
+  if (has_result(instr->op)) {
+    printf(" : ");
+    print_ir_type(instr->type);
+  }
+  printf("\n");
+}
+
+void dump_ir(IrFunc* func) {
+  printf("-----IR %s-----\n", func->name != NULL ? func->name->chars : "");
+  for (int i = 0; i < func->instr_count; i++) {
+    if (func->instrs[i].op == IR_PARAM && !func->instrs[i].removed)
+      print_ir_instr(func, i);
+  }
+  for (int i = 0; i < func->layout.count; i++) {
+    int block = func->layout.ints[i];
+    IrBlock* ir_block = &func->blocks[block];
+    printf("block%d:", block);
+    for (int j = 0; j < ir_block->preds.count; j++) {
+      printf(j == 0 ? " preds block%d" : ", block%d", ir_block->preds.ints[j]);
+    }
+    printf("\n");
+    for (int j = 0; j < ir_block->phis.count; j++) {
+      print_ir_instr(func, ir_block->phis.ints[j]);
+    }
+    for (int j = 0; j < ir_block->instrs.count; j++) {
+      print_ir_instr(func, ir_block->instrs.ints[j]);
+    }
+  }
+}
+
+// The emitter turns the values back into a stack machine. A value that
+// is used once, by an instruction later in the same block with nothing
+// else computed in between, stays on the stack for it, the same way gen()
+// leaves an operand for its op. The other values live in slots of the
+// frame: phis are joined with their operands into one slot where their
+// live ranges allow it, the rest are copied on the edge into the block.
+//
+// The frame grows as values are stored into the slot past its top, which
+// is how a let pushes its value, and every block has the height it starts
+// at, the edges into it push or pop to get there. The slots are given out
+// as the code is emitted, so that a value can be pushed right where its
+// slot is whenever that slot is free
+
+typedef uint64_t Word;
+
+#define WORD_BITS 64
+
+static bool test_bit(Word* set, int bit) {
+  return (set[bit / WORD_BITS] >> (bit % WORD_BITS)) & 1;
+}
+
+static void set_bit(Word* set, int bit) {
+  set[bit / WORD_BITS] |= (Word)1 << (bit % WORD_BITS);
+}
+
+static void clear_bit(Word* set, int bit) {
+  set[bit / WORD_BITS] &= ~((Word)1 << (bit % WORD_BITS));
+}
+
+typedef struct {
+  IrFunc* ir;
+  ObjFunc* func;
+
+  int* uses;
+  // Left on the stack for the one instruction that uses it
+  bool* stacked;
+  // Index among the values that need a slot, -1 for the others
+  int* locations;
+  int* located;
+  int location_count;
+  int words;
+
+  // Live values at the start and the end of each block
+  Word* live_in;
+  Word* live_out;
+  // The values each value is live at the same time as, and for the root of
+  // each class of values that share a slot, its members and everything
+  // that any of them interferes with
+  Word* interference;
+  Word* members;
+  int* parents;
+  int* class_slots;
+  int* param_slots;
+
+  int* heights;
+  int* offsets;
+  int* layout_index;
+  int* constants;
+  // The constants of the global names, to give each name one
+  IntArray globals;
+  // Pairs of the offset of a jump operand and the block it jumps to
+  IntArray jumps;
+
+  int height;
+  int max_height;
+  // Loads the root that is being emitted takes from the top of the frame
+  int skip_loads;
+  int line;
+  // A limit was gone over, only the first is printed
+  bool failed;
+} Emitter;
+
+static Word* bitset(Emitter* emitter, Word* sets, int index) {
+  return sets + (size_t)index * emitter->words;
+}
+
+static void emitter_error(Emitter* emitter, const char* message, int limit) {
+  if (!emitter->failed)
+    printf(message, limit);
+  emitter->failed = true;
+}
+
+static Chunk* emitter_chunk(Emitter* emitter) {
+  return &emitter->func->chunk;
+}
+
+static void emit(Emitter* emitter, uint8_t byte) {
+  write_chunk(emitter_chunk(emitter), byte, emitter->line);
+}
+
+static void emit_short_operand(Emitter* emitter, int operand) {
+  emit(emitter, (operand >> 8) & 0xff);
+  emit(emitter, operand & 0xff);
+}
+
+static void emit_with_operand(Emitter* emitter,
+                              OpCode op,
+                              OpCode wide_op,
+                              int operand) {
+  if (operand <= UINT8_MAX) {
+    emit(emitter, op);
+    emit(emitter, operand);
+  } else {
+    emit(emitter, wide_op);
+    emit_short_operand(emitter, operand);
+  }
+}
+
+static int add_chunk_constant(Emitter* emitter, Value value) {
+  Chunk* chunk = emitter_chunk(emitter);
+  if (chunk->constants.count > UINT16_MAX) {
+    emitter_error(emitter,
+                  "Tried to add more than %d constants in one function\n",
+                  UINT16_MAX + 1);
+    return 0;
+  }
+  push_value_array(&chunk->constants, value);
+  return chunk->constants.count - 1;
+}
+
+static int global_name_constant(Emitter* emitter, Value name) {
+  ObjString* string = AS_OBJ_STRING(name);
+  Value* constants = emitter_chunk(emitter)->constants.values;
+  for (int i = 0; i < emitter->globals.count; i++) {
+    ObjString* other = AS_OBJ_STRING(constants[emitter->globals.ints[i]]);
+    if (other->length == string->length &&
+        memcmp(other->chars, string->chars, string->length) == 0)
+      return emitter->globals.ints[i];
+  }
+  int constant = add_chunk_constant(emitter, name);
+  push_int_array(&emitter->globals, constant);
+  return constant;
+}
+
+static int find_class(Emitter* emitter, int location) {
+  while (emitter->parents[location] != location) {
+    location = emitter->parents[location];
+  }
+  return location;
+}
+
+// The slot of the value, -1 if it does not have one yet
+static int value_slot(Emitter* emitter, int value) {
+  int location = emitter->locations[value];
+  if (location == -1)
+    return -1;
+  return emitter->class_slots[find_class(emitter, location)];
+}
+
+static void count_uses(Emitter* emitter) {
+  IrFunc* ir = emitter->ir;
+  for (int i = 0; i < ir->layout.count; i++) {
+    IrBlock* block = &ir->blocks[ir->layout.ints[i]];
+    for (int j = 0; j < block->phis.count + block->instrs.count; j++) {
+      int id = j < block->phis.count
+                   ? block->phis.ints[j]
+                   : block->instrs.ints[j - block->phis.count];
+      IntArray* operands = &ir->instrs[id].operands;
+      for (int k = 0; k < operands->count; k++) {
+        emitter->uses[operands->ints[k]]++;
+      }
+    }
+  }
+}
+
+// Walks back from the root over the instructions that compute its
+// operands, the last operand is the instruction right before it, the one
+// before that is the instruction before the last operand's own operands,
+// and so on. Returns where the instructions of the root start
+static int match_operands(Emitter* emitter,
+                          IntArray* instrs,
+                          int cursor,
+                          int root) {
+  IrFunc* ir = emitter->ir;
+  for (int i = ir->instrs[root].operands.count - 1; i >= 0; i--) {
+    int operand = ir->instrs[root].operands.ints[i];
+    if (cursor >= 0 && instrs->ints[cursor] == operand &&
+        emitter->uses[operand] == 1 && has_result(ir->instrs[operand].op)) {
+      emitter->stacked[operand] = true;
+      cursor = match_operands(emitter, instrs, cursor - 1, operand);
+    }
+  }
+  return cursor;
+}
+
+static void find_stacked(Emitter* emitter) {
+  IrFunc* ir = emitter->ir;
+  for (int i = 0; i < ir->layout.count; i++) {
+    IntArray* instrs = &ir->blocks[ir->layout.ints[i]].instrs;
+    int cursor = instrs->count - 1;
+    while (cursor >= 0) {
+      cursor =
+          match_operands(emitter, instrs, cursor - 1, instrs->ints[cursor]);
+    }
+  }
+}
+
+static bool needs_slot(Emitter* emitter, int value) {
+  IrInstr* instr = &emitter->ir->instrs[value];
+  if (instr->removed)
+    return false;
+  if (instr->op == IR_PARAM || instr->op == IR_PHI)
+    return true;
+  return instr->op != IR_CONSTANT && has_result(instr->op) &&
+         !emitter->stacked[value] && emitter->uses[value] > 0;
+}
+
+static void add_interference(Emitter* emitter, int a, int b) {
+  if (a == b)
+    return;
+  set_bit(bitset(emitter, emitter->interference, a), b);
+  set_bit(bitset(emitter, emitter->interference, b), a);
+}
+
+// The index of the pred in the block's preds, which is the index of its
+// operand in the block's phis
+static int pred_index(IrFunc* ir, int block, int pred) {
+  IntArray* preds = &ir->blocks[block].preds;
+  for (int i = 0; i < preds->count; i++) {
+    if (preds->ints[i] == pred)
+      return i;
+  }
+  return -1;
+}
+
+static int phi_input(IrFunc* ir, int phi, int pred) {
+  IrInstr* instr = &ir->instrs[phi];
+  return instr->operands.ints[pred_index(ir, instr->block, pred)];
+}
+
+static void compute_liveness(Emitter* emitter) {
+  IrFunc* ir = emitter->ir;
+  int words = emitter->words;
+  Word* uses = ALLOCATE(Word, (size_t)ir->block_count * words);
+  Word* defs = ALLOCATE(Word, (size_t)ir->block_count * words);
+  memset(uses, 0, sizeof(Word) * ir->block_count * words);
+  memset(defs, 0, sizeof(Word) * ir->block_count * words);
+
+  for (int i = 0; i < ir->layout.count; i++) {
+    int block = ir->layout.ints[i];
+    IrBlock* ir_block = &ir->blocks[block];
+    Word* use = bitset(emitter, uses, block);
+    Word* def = bitset(emitter, defs, block);
+    for (int j = 0; j < ir_block->phis.count; j++) {
+      set_bit(def, emitter->locations[ir_block->phis.ints[j]]);
+    }
+    for (int j = 0; j < ir_block->instrs.count; j++) {
+      IrInstr* instr = &ir->instrs[ir_block->instrs.ints[j]];
+      for (int k = 0; k < instr->operands.count; k++) {
+        int location = emitter->locations[instr->operands.ints[k]];
+        if (location != -1 && !test_bit(def, location))
+          set_bit(use, location);
+      }
+      int location = emitter->locations[ir_block->instrs.ints[j]];
+      if (location != -1)
+        set_bit(def, location);
+    }
+  }
+
+  // Backwards to a fixpoint, the layout is close enough to the order of
+  // the code that a few rounds do
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int i = ir->layout.count - 1; i >= 0; i--) {
+      int block = ir->layout.ints[i];
+      Word* out = bitset(emitter, emitter->live_out, block);
+      Word* in = bitset(emitter, emitter->live_in, block);
+      int terminator = block_terminator(ir, block);
+      IrInstr* instr = &ir->instrs[terminator];
+      for (int j = 0; j < successor_count(instr); j++) {
+        int successor = instr->targets[j];
+        Word* successor_in = bitset(emitter, emitter->live_in, successor);
+        for (int k = 0; k < words; k++) {
+          out[k] |= successor_in[k];
+        }
+        IntArray* phis = &ir->blocks[successor].phis;
+        for (int k = 0; k < phis->count; k++) {
+          int input = emitter->locations[phi_input(ir, phis->ints[k], block)];
+          if (input != -1)
+            set_bit(out, input);
+        }
+      }
+      Word* use = bitset(emitter, uses, block);
+      Word* def = bitset(emitter, defs, block);
+      for (int k = 0; k < words; k++) {
+        Word word = use[k] | (out[k] & ~def[k]);
+        if (word != in[k]) {
+          in[k] = word;
+          changed = true;
+        }
+      }
+    }
+  }
+  free(uses);
+  free(defs);
+}
+
+// Two values interfere when one is live where the other is defined, they
+// can never share a slot
+static void compute_interference(Emitter* emitter) {
+  IrFunc* ir = emitter->ir;
+  int words = emitter->words;
+  Word* live = ALLOCATE(Word, words);
+
+  for (int i = 0; i < ir->layout.count; i++) {
+    int block = ir->layout.ints[i];
+    IrBlock* ir_block = &ir->blocks[block];
+    memcpy(live, bitset(emitter, emitter->live_out, block),
+           sizeof(Word) * words);
+
+    for (int j = ir_block->instrs.count - 1; j >= 0; j--) {
+      IrInstr* instr = &ir->instrs[ir_block->instrs.ints[j]];
+      int location = emitter->locations[ir_block->instrs.ints[j]];
+      if (location != -1) {
+        for (int k = 0; k < emitter->location_count; k++) {
+          if (test_bit(live, k))
+            add_interference(emitter, location, k);
+        }
+        clear_bit(live, location);
+      }
+      for (int k = 0; k < instr->operands.count; k++) {
+        int operand = emitter->locations[instr->operands.ints[k]];
+        if (operand != -1)
+          set_bit(live, operand);
+      }
+    }
+
+    // The phis are all defined where the block starts, the parameters
+    // where the function does
+    IntArray defined;
+    init_int_array(&defined);
+    for (int j = 0; j < ir_block->phis.count; j++) {
+      push_int_array(&defined, emitter->locations[ir_block->phis.ints[j]]);
+    }
+    if (block == 0) {
+      for (int j = 0; j < ir->instr_count; j++) {
+        if (ir->instrs[j].op == IR_PARAM)
+          push_int_array(&defined, emitter->locations[j]);
+      }
+    }
+    for (int j = 0; j < defined.count; j++) {
+      for (int k = 0; k < emitter->location_count; k++) {
+        if (test_bit(live, k))
+          add_interference(emitter, defined.ints[j], k);
+      }
+      for (int k = 0; k < defined.count; k++) {
+        add_interference(emitter, defined.ints[j], defined.ints[k]);
+      }
+    }
+    free_int_array(&defined);
+  }
+  free(live);
+}
+
+// Joins a phi with its operands into one class where none of their values
+// interfere, the copies on the edges into the block are not needed then
+static void coalesce_phis(Emitter* emitter) {
+  IrFunc* ir = emitter->ir;
+  int words = emitter->words;
+  for (int i = 0; i < emitter->location_count; i++) {
+    emitter->parents[i] = i;
+    set_bit(bitset(emitter, emitter->members, i), i);
+  }
+
+  for (int i = 0; i < ir->layout.count; i++) {
+    IrBlock* block = &ir->blocks[ir->layout.ints[i]];
+    for (int j = 0; j < block->phis.count; j++) {
+      IrInstr* phi = &ir->instrs[block->phis.ints[j]];
+      for (int k = 0; k < phi->operands.count; k++) {
+        int location = emitter->locations[phi->operands.ints[k]];
+        if (location == -1)
+          continue;
+        int a = find_class(emitter, emitter->locations[block->phis.ints[j]]);
+        int b = find_class(emitter, location);
+        if (a == b ||
+            (emitter->param_slots[a] != -1 && emitter->param_slots[b] != -1))
+          continue;
+
+        Word* a_interference = bitset(emitter, emitter->interference, a);
+        Word* b_members = bitset(emitter, emitter->members, b);
+        bool interferes = false;
+        for (int w = 0; w < words && !interferes; w++) {
+          interferes = (a_interference[w] & b_members[w]) != 0;
+        }
+        if (interferes)
+          continue;
+
+        Word* a_members = bitset(emitter, emitter->members, a);
+        Word* b_interference = bitset(emitter, emitter->interference, b);
+        for (int w = 0; w < words; w++) {
+          a_members[w] |= b_members[w];
+          a_interference[w] |= b_interference[w];
+        }
+        if (emitter->param_slots[a] == -1)
+          emitter->param_slots[a] = emitter->param_slots[b];
+        emitter->parents[b] = a;
+      }
+    }
+  }
+
+  for (int i = 0; i < emitter->location_count; i++) {
+    emitter->class_slots[i] =
+        emitter->parents[i] == i ? emitter->param_slots[i] : -1;
+  }
+}
+
+// The slot past the top when it is free, so that the value can be pushed
+// right into it, the lowest free one otherwise
+static int choose_slot(Emitter* emitter, int value, int preferred) {
+  int class = find_class(emitter, emitter->locations[value]);
+  if (emitter->class_slots[class] != -1)
+    return emitter->class_slots[class];
+
+  int first = emitter->ir->param_count + 1;
+  int limit = first + emitter->location_count + 1;
+  bool* taken = ALLOCATE(bool, limit);
+  memset(taken, 0, sizeof(bool) * limit);
+  Word* interference = bitset(emitter, emitter->interference, class);
+  for (int i = 0; i < emitter->location_count; i++) {
+    if (!test_bit(interference, i))
+      continue;
+    int slot = emitter->class_slots[find_class(emitter, i)];
+    if (slot != -1 && slot < limit)
+      taken[slot] = true;
+  }
+
+  int slot = preferred;
+  if (slot < first || slot >= limit || taken[slot]) {
+    slot = first;
+    while (taken[slot]) {
+      slot++;
+    }
+  }
+  free(taken);
+  emitter->class_slots[class] = slot;
+  return slot;
+}
+
+static void set_height(Emitter* emitter, int height) {
+  emitter->height = height;
+  emitter->max_height = MAX(emitter->max_height, height);
+}
+
+// Values pushed on top of the frame for an op, the height only counts the
+// frame, but the vm has to make room for both
+static void count_above(Emitter* emitter, int values) {
+  emitter->max_height = MAX(emitter->max_height, emitter->height + values);
+}
+
+static void emit_pop(Emitter* emitter) {
+  emit(emitter, OP_POP);
+  set_height(emitter, emitter->height - 1);
+}
+
+static void emit_push(Emitter* emitter, OpCode op) {
+  emit(emitter, op);
+  set_height(emitter, emitter->height + 1);
+}
+
+// Pushes the value of a constant, a parameter or a value with a slot
+static void emit_load(Emitter* emitter, int value) {
+  if (emitter->skip_loads > 0) {
+    emitter->skip_loads--;
+    return;
+  }
+
+  IrInstr* instr = &emitter->ir->instrs[value];
+  if (instr->op != IR_CONSTANT) {
+    emit_with_operand(emitter, OP_GET_LOCAL, OP_GET_LOCAL_WIDE,
+                      value_slot(emitter, value));
+    return;
+  }
+
+  if (IS_NIL(instr->value)) {
+    emit(emitter, OP_NIL);
+  } else if (IS_BOOLEAN(instr->value)) {
+    emit(emitter, AS_BOOLEAN(instr->value) ? OP_TRUE : OP_FALSE);
+  } else {
+    if (emitter->constants[value] == -1)
+      emitter->constants[value] = add_chunk_constant(emitter, instr->value);
+    // OP_CONSTANT takes the index + 1
+    int constant = emitter->constants[value];
+    if (constant + 1 <= UINT8_MAX) {
+      emit(emitter, OP_CONSTANT);
+      emit(emitter, constant + 1);
+    } else {
+      emit(emitter, OP_CONSTANT_WIDE);
+      emit_short_operand(emitter, constant);
+    }
+  }
+}
+
+static void emit_value(Emitter* emitter, int value);
+
+// The operands, each either computed right here or loaded, then the op.
+// depth is how many operands of the trees it is in are under it
+static void emit_tree(Emitter* emitter, int value, int depth) {
+  IrInstr* instr = &emitter->ir->instrs[value];
+  for (int i = 0; i < instr->operands.count; i++) {
+    int operand = emitter->ir->instrs[value].operands.ints[i];
+    if (emitter->stacked[operand])
+      emit_tree(emitter, operand, depth + i);
+    else
+      emit_load(emitter, operand);
+  }
+  count_above(emitter, depth + MAX(instr->operands.count, 1));
+  emitter->line = emitter->ir->instrs[value].line;
+  emit_value(emitter, value);
+}
+
+static void emit_value(Emitter* emitter, int value) {
+  IrInstr* instr = &emitter->ir->instrs[value];
+  Chunk* chunk = emitter_chunk(emitter);
+  switch (instr->op) {
+    case IR_ADD:
+      emit(emitter, instr->unchecked ? OP_ADD_NUMBER : OP_ADD);
+      break;
+    case IR_SUBTRACT:
+      emit(emitter, instr->unchecked ? OP_SUBTRACT_NUMBER : OP_SUBTRACT);
+      break;
+    case IR_MULTIPLY:
+      emit(emitter, instr->unchecked ? OP_MULTIPLY_NUMBER : OP_MULTIPLY);
+      break;
+    case IR_DIVIDE:
+      emit(emitter, instr->unchecked ? OP_DIVIDE_NUMBER : OP_DIVIDE);
+      break;
+    case IR_MODULO:
+      emit(emitter, OP_MODULO);
+      break;
+    case IR_BIT_AND:
+      emit(emitter, OP_BIT_AND);
+      break;
+    case IR_BIT_OR:
+      emit(emitter, OP_BIT_OR);
+      break;
+    case IR_BIT_XOR:
+      emit(emitter, OP_BIT_XOR);
+      break;
+    case IR_SHIFT_LEFT:
+      emit(emitter, OP_SHIFT_LEFT);
+      break;
+    case IR_SHIFT_RIGHT:
+      emit(emitter, OP_SHIFT_RIGHT);
+      break;
+    case IR_EQUAL:
+      emit(emitter, OP_EQUAL);
+      break;
+    case IR_GREATER:
+      emit(emitter, instr->unchecked ? OP_GREATER_NUMBER : OP_GREATER);
+      break;
+    case IR_LESS:
+      emit(emitter, instr->unchecked ? OP_LESS_NUMBER : OP_LESS);
+      break;
+    case IR_NOT:
+      emit(emitter, OP_NOT);
+      break;
+    case IR_NEGATE:
+      emit(emitter, OP_NEGATE);
+      break;
+    case IR_BIT_NOT:
+      emit(emitter, OP_BIT_NOT);
+      break;
+    case IR_GET_GLOBAL:
+      emit_with_operand(emitter, OP_GET_GLOBAL, OP_GET_GLOBAL_WIDE,
+                        global_name_constant(emitter, instr->value));
+      break;
+    case IR_SET_GLOBAL:
+      emit_with_operand(emitter, OP_SET_GLOBAL, OP_SET_GLOBAL_WIDE,
+                        global_name_constant(emitter, instr->value));
+      break;
+    case IR_ARRAY:
+      emit(emitter, OP_ARRAY);
+      emit(emitter, instr->operands.count);
+      break;
+    case IR_MAP:
+      emit(emitter, OP_MAP);
+      emit(emitter, instr->operands.count / 2);
+      break;
+    case IR_INDEX_GET:
+      emit(emitter, OP_INDEX_GET);
+      break;
+    case IR_INDEX_SET:
+      emit(emitter, OP_INDEX_SET);
+      break;
+    case IR_GET_FIELD:
+    case IR_SET_FIELD:
+      if (chunk->field_cache_count > UINT16_MAX) {
+        emitter_error(
+            emitter,
+            "Tried to access fields more than %d times in one function\n",
+            UINT16_MAX + 1);
+        return;
+      }
+      emit(emitter, instr->op == IR_GET_FIELD ? OP_GET_FIELD : OP_SET_FIELD);
+      emit_short_operand(emitter, add_chunk_constant(emitter, instr->value));
+      emit_short_operand(emitter, add_field_cache(chunk));
+      break;
+    case IR_CALL:
+      if (chunk->call_cache_count > UINT16_MAX) {
+        emitter_error(emitter,
+                      "Tried to make more than %d calls in one function\n",
+                      UINT16_MAX + 1);
+        return;
+      }
+      emit(emitter, OP_CALL);
+      emit(emitter, instr->operands.count - 1);
+      emit_short_operand(emitter, add_call_cache(chunk));
+      break;
+    case IR_CALL_NATIVE:
+      emit(emitter, OP_CALL_NATIVE);
+      emit(emitter, instr->index);
+      emit(emitter, instr->operands.count);
+      break;
+    case IR_PRINT:
+      emit(emitter, OP_PRINT);
+      break;
+    case IR_RETURN:
+      emit(emitter, OP_RETURN);
+      break;
+    default:
+      break;
+  }
+}
+
+static bool is_live_out(Emitter* emitter, int block, int value) {
+  int location = emitter->locations[value];
+  return location != -1 &&
+         test_bit(bitset(emitter, emitter->live_out, block), location);
+}
+
+// The values the root loads before it computes anything. The ones of them
+// that are on top of the frame and die here are taken from there instead
+// of being loaded, so `i = i + 1` on the last local does not copy it
+static int count_frame_operands(Emitter* emitter, int block, int root) {
+  IrFunc* ir = emitter->ir;
+  IntArray loads;
+  init_int_array(&loads);
+  int value = root;
+  while (value != -1) {
+    int next = -1;
+    IntArray* operands = &ir->instrs[value].operands;
+    for (int i = 0; i < operands->count && next == -1; i++) {
+      if (emitter->stacked[operands->ints[i]])
+        next = operands->ints[i];
+      else
+        push_int_array(&loads, operands->ints[i]);
+    }
+    value = next;
+  }
+
+  int count = 0;
+  for (int i = loads.count; i > 0; i--) {
+    bool on_top = true;
+    for (int j = 0; j < i && on_top; j++) {
+      int load = loads.ints[j];
+      on_top = emitter->locations[load] != -1 && emitter->uses[load] == 1 &&
+               !is_live_out(emitter, block, load) &&
+               value_slot(emitter, load) == emitter->height - i + j;
+    }
+    if (on_top) {
+      count = i;
+      break;
+    }
+  }
+  free_int_array(&loads);
+  return count;
+}
+
+static void emit_root(Emitter* emitter, int block, int root) {
+  IrInstr* instr = &emitter->ir->instrs[root];
+  int taken = count_frame_operands(emitter, block, root);
+  int slot = -1;
+  if (emitter->locations[root] != -1) {
+    slot = choose_slot(emitter, root, emitter->height - taken);
+    if (slot > emitter->height - taken)
+      taken = 0;
+    // Fills the frame up to the slot so the value lands in it
+    while (slot > emitter->height) {
+      emitter->line = instr->line;
+      emit_push(emitter, OP_NIL);
+    }
+  }
+
+  emitter->skip_loads = taken;
+  set_height(emitter, emitter->height - taken);
+  emit_tree(emitter, root, 0);
+  emitter->skip_loads = 0;
+
+  if (slot == emitter->height) {
+    set_height(emitter, emitter->height + 1);
+  } else if (slot != -1) {
+    emit_with_operand(emitter, OP_SET_LOCAL, OP_SET_LOCAL_WIDE, slot);
+    emit(emitter, OP_POP);
+  } else if (has_result(instr->op)) {
+    emit(emitter, OP_POP);
+  }
+}
+
+// Where the block starts, decided by the first edge into it. The phis get
+// their slots here, past the top of the frame when they can so that the
+// edge pushes them. A block with a single pred, and the target of a branch
+// which cannot pop on the way, start at the height of the edge
+static void decide_height(Emitter* emitter, int pred, int block, bool branch) {
+  if (emitter->heights[block] != -1)
+    return;
+
+  IrFunc* ir = emitter->ir;
+  IrBlock* ir_block = &ir->blocks[block];
+  int height = emitter->height;
+  int needed = ir->param_count + 1;
+  for (int i = 0; i < ir_block->phis.count; i++) {
+    int slot = choose_slot(emitter, ir_block->phis.ints[i], height);
+    if (slot == height)
+      height++;
+    needed = MAX(needed, slot + 1);
+  }
+  Word* live_in = bitset(emitter, emitter->live_in, block);
+  for (int i = 0; i < emitter->location_count; i++) {
+    if (test_bit(live_in, i))
+      needed = MAX(needed, choose_slot(emitter, emitter->located[i],
+                                       emitter->height) + 1);
+  }
+
+  if (pred == -1 || (!branch && ir_block->preds.count > 1))
+    emitter->heights[block] = needed;
+  else
+    emitter->heights[block] = MAX(needed, emitter->height);
+}
+
+static int copy_source(Emitter* emitter, int pred, int phi) {
+  int input = phi_input(emitter->ir, phi, pred);
+  return value_slot(emitter, input) == value_slot(emitter, phi) ? -1 : input;
+}
+
+// Whether the edge can be taken straight by a jump, with no code for the
+// frame of the block
+static bool is_plain_edge(Emitter* emitter, int pred, int block) {
+  if (emitter->heights[block] != emitter->height ||
+      emitter->offsets[block] != -1)
+    return false;
+  IntArray* phis = &emitter->ir->blocks[block].phis;
+  for (int i = 0; i < phis->count; i++) {
+    if (copy_source(emitter, pred, phis->ints[i]) != -1)
+      return false;
+  }
+  return true;
+}
+
+// Gets the frame from the height at the end of pred to the height the
+// block starts at, with the phis of the block holding their values from
+// pred. Slots past the top are pushed, the others are copied all at once
+// by pushing every value before any slot is set, as a phi can be the
+// operand of another. Nothing above the block's height is needed by it
+static void emit_edge_frame(Emitter* emitter, int pred, int block) {
+  IrFunc* ir = emitter->ir;
+  IntArray* phis = &ir->blocks[block].phis;
+  int target = emitter->heights[block];
+  int height = emitter->height;
+
+  while (emitter->height < target) {
+    int source = -1;
+    for (int i = 0; i < phis->count && source == -1; i++) {
+      if (value_slot(emitter, phis->ints[i]) == emitter->height)
+        source = copy_source(emitter, pred, phis->ints[i]);
+    }
+    if (source != -1)
+      emit_load(emitter, source);
+    else
+      emit(emitter, OP_NIL);
+    set_height(emitter, emitter->height + 1);
+  }
+
+  IntArray copies;
+  init_int_array(&copies);
+  for (int i = 0; i < phis->count; i++) {
+    if (value_slot(emitter, phis->ints[i]) < height &&
+        copy_source(emitter, pred, phis->ints[i]) != -1)
+      push_int_array(&copies, phis->ints[i]);
+  }
+  for (int i = 0; i < copies.count; i++) {
+    emit_load(emitter, copy_source(emitter, pred, copies.ints[i]));
+  }
+  count_above(emitter, copies.count);
+  for (int i = copies.count - 1; i >= 0; i--) {
+    emit_with_operand(emitter, OP_SET_LOCAL, OP_SET_LOCAL_WIDE,
+                      value_slot(emitter, copies.ints[i]));
+    emit(emitter, OP_POP);
+  }
+  free_int_array(&copies);
+
+  while (emitter->height > target) {
+    emit_pop(emitter);
+  }
+}
+
+static bool is_next_block(Emitter* emitter, int block, int next) {
+  return emitter->layout_index[next] == emitter->layout_index[block] + 1;
+}
+
+// A jump forward is patched once the block it goes to is emitted
+static void emit_jump_to(Emitter* emitter, int block) {
+  Chunk* chunk = emitter_chunk(emitter);
+  if (emitter->offsets[block] != -1) {
+    emit(emitter, OP_LOOP);
+    int offset = chunk->count + 2 - emitter->offsets[block];
+    if (offset > UINT16_MAX)
+      emitter_error(emitter, "Loop body is larger than %d bytes\n",
+                    UINT16_MAX);
+    emit_short_operand(emitter, offset);
+    return;
+  }
+  emit(emitter, OP_JUMP);
+  emit_short_operand(emitter, 0xffff);
+  push_int_array(&emitter->jumps, chunk->count - 2);
+  push_int_array(&emitter->jumps, block);
+}
+
+// The operand of a conditional jump, to be patched to a block or to the
+// code right after it. Returns where the operand is
+static int emit_conditional_jump(Emitter* emitter, IrInstr* instr, OpCode op) {
+  emit(emitter, op);
+  if (op == OP_JUMP_IF_GLOBAL) {
+    emit_short_operand(emitter, global_name_constant(emitter, instr->value));
+    emit_short_operand(emitter, add_chunk_constant(emitter, instr->expected));
+  }
+  emit_short_operand(emitter, 0xffff);
+  return emitter_chunk(emitter)->count - 2;
+}
+
+static void patch_jump_to(Emitter* emitter, int operand, int offset) {
+  int jump = offset - operand - 2;
+  if (jump > UINT16_MAX)
+    emitter_error(emitter, "Too much code to jump over, more than %d bytes\n",
+                  UINT16_MAX);
+  OpCode* ops = emitter_chunk(emitter)->code.ops;
+  ops[operand] = (jump >> 8) & 0xff;
+  ops[operand + 1] = jump & 0xff;
+}
+
+static void jump_to_block(Emitter* emitter, int operand, int block) {
+  push_int_array(&emitter->jumps, operand);
+  push_int_array(&emitter->jumps, block);
+}
+
+static void emit_edge(Emitter* emitter, int pred, int block, bool fall) {
+  decide_height(emitter, pred, block, false);
+  emit_edge_frame(emitter, pred, block);
+  if (!fall || !is_next_block(emitter, pred, block))
+    emit_jump_to(emitter, block);
+}
+
+// The edges that need code of their own for the frame get it after the
+// conditional jump, the other edges are taken by the jump itself. Only
+// the target of OP_JUMP_IF_GLOBAL can be jumped to on a condition
+static void emit_branch(Emitter* emitter, int block, int terminator) {
+  IrInstr* instr = &emitter->ir->instrs[terminator];
+  int truthy = instr->targets[0];
+  int falsy = instr->targets[1];
+  bool global = instr->op == IR_BRANCH_GLOBAL;
+
+  decide_height(emitter, block, truthy, true);
+  decide_height(emitter, block, falsy, true);
+  int height = emitter->height;
+  bool plain_truthy = is_plain_edge(emitter, block, truthy);
+  bool plain_falsy = !global && is_plain_edge(emitter, block, falsy);
+
+  if (plain_truthy && plain_falsy) {
+    if (is_next_block(emitter, block, truthy)) {
+      jump_to_block(emitter,
+                    emit_conditional_jump(emitter, instr, OP_POP_JUMP_IF_FALSE),
+                    falsy);
+    } else if (is_next_block(emitter, block, falsy)) {
+      jump_to_block(emitter,
+                    emit_conditional_jump(emitter, instr, OP_POP_JUMP_IF_TRUE),
+                    truthy);
+    } else {
+      jump_to_block(emitter,
+                    emit_conditional_jump(emitter, instr, OP_POP_JUMP_IF_FALSE),
+                    falsy);
+      emit_jump_to(emitter, truthy);
+    }
+  } else if (plain_truthy) {
+    OpCode op = global ? OP_JUMP_IF_GLOBAL : OP_POP_JUMP_IF_TRUE;
+    jump_to_block(emitter, emit_conditional_jump(emitter, instr, op), truthy);
+    emit_edge(emitter, block, falsy, true);
+  } else if (plain_falsy) {
+    jump_to_block(emitter,
+                  emit_conditional_jump(emitter, instr, OP_POP_JUMP_IF_FALSE),
+                  falsy);
+    emit_edge(emitter, block, truthy, true);
+  } else if (global) {
+    int jump = emit_conditional_jump(emitter, instr, OP_JUMP_IF_GLOBAL);
+    emit_edge(emitter, block, falsy, false);
+    patch_jump_to(emitter, jump, emitter_chunk(emitter)->count);
+    emitter->height = height;
+    emit_edge(emitter, block, truthy, true);
+  } else {
+    int jump = emit_conditional_jump(emitter, instr, OP_POP_JUMP_IF_FALSE);
+    emit_edge(emitter, block, truthy, false);
+    patch_jump_to(emitter, jump, emitter_chunk(emitter)->count);
+    emitter->height = height;
+    emit_edge(emitter, block, falsy, true);
+  }
+}
+
+static void emit_block(Emitter* emitter, int block) {
+  IrFunc* ir = emitter->ir;
+  if (emitter->heights[block] == -1)
+    decide_height(emitter, -1, block, false);
+  emitter->height = emitter->heights[block];
+  emitter->offsets[block] = emitter_chunk(emitter)->count;
+
+  IntArray* instrs = &ir->blocks[block].instrs;
+  for (int i = 0; i < instrs->count; i++) {
+    int id = instrs->ints[i];
+    IrInstr* instr = &ir->instrs[id];
+    emitter->line = instr->line;
+    switch (instr->op) {
+      case IR_JUMP:
+        emit_edge(emitter, block, instr->targets[0], true);
+        break;
+      case IR_BRANCH:
+      case IR_BRANCH_GLOBAL:
+        // The condition is an operand like any other, it is popped by the
+        // jump
+        if (instr->op == IR_BRANCH) {
+          int taken = count_frame_operands(emitter, block, id);
+          emitter->skip_loads = taken;
+          set_height(emitter, emitter->height - taken);
+          int condition = instr->operands.ints[0];
+          if (emitter->stacked[condition])
+            emit_tree(emitter, condition, 0);
+          else
+            emit_load(emitter, condition);
+          count_above(emitter, 1);
+          emitter->skip_loads = 0;
+          emitter->line = ir->instrs[id].line;
+        }
+        emit_branch(emitter, block, id);
+        break;
+      default:
+        // Stacked values are emitted in the tree of their user
+        if (!emitter->stacked[id])
+          emit_root(emitter, block, id);
+        break;
+    }
+  }
+}
+
+bool emit_ir(IrFunc* ir, ObjFunc* func) {
+  Emitter emitter;
+  Emitter* e = &emitter;
+  int instr_count = ir->instr_count;
+  int block_count = ir->block_count;
+  e->ir = ir;
+  e->func = func;
+  e->uses = ALLOCATE(int, instr_count);
+  e->stacked = ALLOCATE(bool, instr_count);
+  e->locations = ALLOCATE(int, instr_count);
+  e->located = ALLOCATE(int, instr_count);
+  e->constants = ALLOCATE(int, instr_count);
+  for (int i = 0; i < instr_count; i++) {
+    e->uses[i] = 0;
+    e->stacked[i] = false;
+    e->locations[i] = -1;
+    e->constants[i] = -1;
+  }
+  count_uses(e);
+  find_stacked(e);
+
+  e->location_count = 0;
+  for (int i = 0; i < instr_count; i++) {
+    if (needs_slot(e, i)) {
+      e->located[e->location_count] = i;
+      e->locations[i] = e->location_count++;
+    }
+  }
+  int locations = MAX(e->location_count, 1);
+  e->words = (locations + WORD_BITS - 1) / WORD_BITS;
+  size_t block_words = (size_t)block_count * e->words;
+  size_t value_words = (size_t)locations * e->words;
+  e->live_in = ALLOCATE(Word, block_words);
+  e->live_out = ALLOCATE(Word, block_words);
+  e->interference = ALLOCATE(Word, value_words);
+  e->members = ALLOCATE(Word, value_words);
+  memset(e->live_in, 0, sizeof(Word) * block_words);
+  memset(e->live_out, 0, sizeof(Word) * block_words);
+  memset(e->interference, 0, sizeof(Word) * value_words);
+  memset(e->members, 0, sizeof(Word) * value_words);
+  e->parents = ALLOCATE(int, locations);
+  e->class_slots = ALLOCATE(int, locations);
+  e->param_slots = ALLOCATE(int, locations);
+  for (int i = 0; i < e->location_count; i++) {
+    IrInstr* instr = &ir->instrs[e->located[i]];
+    e->param_slots[i] = instr->op == IR_PARAM ? instr->index + 1 : -1;
+  }
+
+  compute_liveness(e);
+  compute_interference(e);
+  coalesce_phis(e);
+
+  e->heights = ALLOCATE(int, block_count);
+  e->offsets = ALLOCATE(int, block_count);
+  e->layout_index = ALLOCATE(int, block_count);
+  for (int i = 0; i < block_count; i++) {
+    e->heights[i] = -1;
+    e->offsets[i] = -1;
+    e->layout_index[i] = -1;
+  }
+  for (int i = 0; i < ir->layout.count; i++) {
+    e->layout_index[ir->layout.ints[i]] = i;
+  }
+  init_int_array(&e->globals);
+  init_int_array(&e->jumps);
+  e->skip_loads = 0;
+  e->line = 0;
+  e->failed = false;
+  e->height = ir->param_count + 1;
+  e->max_height = e->height;
+  e->heights[ir->layout.ints[0]] = e->height;
+
+  for (int i = 0; i < ir->layout.count; i++) {
+    emit_block(e, ir->layout.ints[i]);
+  }
+  for (int i = 0; i < e->jumps.count; i += 2) {
+    patch_jump_to(e, e->jumps.ints[i], e->offsets[e->jumps.ints[i + 1]]);
+  }
+  func->slot_count = MAX(func->slot_count, e->max_height);
+
+  free(e->uses);
+  free(e->stacked);
+  free(e->locations);
+  free(e->located);
+  free(e->constants);
+  free(e->live_in);
+  free(e->live_out);
+  free(e->interference);
+  free(e->members);
+  free(e->parents);
+  free(e->class_slots);
+  free(e->param_slots);
+  free(e->heights);
+  free(e->offsets);
+  free(e->layout_index);
+  free_int_array(&e->globals);
+  free_int_array(&e->jumps);
+  return !e->failed;
+}
@@ -0,0 +1,175 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "array.h"
+#include "object.h"
+#include "value.h"
+
+// A function body in SSA form, what codegen lowers functions to so that
+// they can be optimized before the bytecode is emitted.
+//
+// Every instruction is a value, the id of the value is its index in
+// instrs. A block is a list of instructions that ends in exactly one
+// terminator, the blocks that jump to it are its predecessors, and a phi
+// at the start of a block has one operand per predecessor, in the same
+// order. Constants and parameters are not in any block, they are loaded
+// wherever they are used.
+
+typedef enum {
+  IR_PARAM,
+  IR_CONSTANT,
+  IR_PHI,
+
+  IR_ADD,
+  IR_SUBTRACT,
+  IR_MULTIPLY,
+  IR_DIVIDE,
+  IR_MODULO,
+  IR_BIT_AND,
+  IR_BIT_OR,
+  IR_BIT_XOR,
+  IR_SHIFT_LEFT,
+  IR_SHIFT_RIGHT,
+  IR_EQUAL,
+  IR_GREATER,
+  IR_LESS,
+  IR_NOT,
+  IR_NEGATE,
+  IR_BIT_NOT,
+
+  IR_GET_GLOBAL,
+  IR_SET_GLOBAL,
+  IR_ARRAY,
+  IR_MAP,
+  IR_INDEX_GET,
+  IR_INDEX_SET,
+  IR_GET_FIELD,
+  IR_SET_FIELD,
+  // The callee, then the arguments
+  IR_CALL,
+  IR_CALL_NATIVE,
+  IR_PRINT,
+
+  // Terminators
+  IR_JUMP,
+  // To the first target when the operand is truthy, the second otherwise
+  IR_BRANCH,
+  // To the first target when the global still holds the function, the
+  // second otherwise, the guard of an inlined call
+  IR_BRANCH_GLOBAL,
+  IR_RETURN,
+} IrOp;
+
+// What a value can be at runtime, a set of these bits. A value that could
+// be anything has them all
+#define IR_TYPE_INT (1 << 0)
+#define IR_TYPE_DOUBLE (1 << 1)
+#define IR_TYPE_BOOL (1 << 2)
+#define IR_TYPE_NIL (1 << 3)
+#define IR_TYPE_STRING (1 << 4)
+// Every other object
+#define IR_TYPE_OBJECT (1 << 5)
+#define IR_TYPE_NUMBER (IR_TYPE_INT | IR_TYPE_DOUBLE)
+#define IR_TYPE_ANY 0x3f
+
+typedef struct {
+  IrOp op;
+  int block;
+  int line;
+  uint8_t type;
+  bool removed;
+  // The value that replaced this one, -1 if it was not replaced
+  int forward;
+  // Constants, the names of globals and fields, and the name of the
+  // global that IR_BRANCH_GLOBAL checks
+  Value value;
+  // The function IR_BRANCH_GLOBAL checks the global against
+  Value expected;
+  // The parameter of IR_PARAM, the native of IR_CALL_NATIVE, the variable
+  // of a phi
+  int index;
+  IntArray operands;
+  int targets[2];
+  // What each operand is known to be where the instruction runs, narrowed
+  // by the checks that always run before it. NULL until the types are
+  // specialized
+  uint8_t* known;
+  // Emitted without the checks for operands that are not numbers
+  bool unchecked;
+} IrInstr;
+
+typedef struct {
+  IntArray phis;
+  IntArray instrs;
+  IntArray preds;
+  // The last value of every variable written in the block, -1 if the block
+  // did not write it, for building the SSA form
+  IntArray defs;
+  // Phis that were made while the block could still get predecessors,
+  // their operands are filled in when the block is sealed
+  IntArray incomplete_phis;
+  bool sealed;
+} IrBlock;
+
+typedef struct {
+  ObjString* name;
+  int param_count;
+  IrBlock* blocks;
+  int block_count;
+  int block_capacity;
+  IrInstr* instrs;
+  int instr_count;
+  int instr_capacity;
+  // The order the blocks are emitted in, the entry block first
+  IntArray layout;
+  int variable_count;
+  // The arithmetic and comparisons, and how many of them are unchecked
+  int numeric_sites;
+  int unchecked_sites;
+} IrFunc;
+
+void init_ir_func(IrFunc* func, ObjString* name, int param_count);
+void free_ir_func(IrFunc* func);
+
+int add_ir_block(IrFunc* func);
+// The block goes after the blocks started before it
+void start_ir_block(IrFunc* func, int block);
+// Appends the instruction to the block, constants, parameters and phis
+// are not appended to the block's instructions
+int add_ir_instr(IrFunc* func, int block, IrOp op, int line);
+void add_ir_operand(IrFunc* func, int instr, int operand);
+int add_ir_constant(IrFunc* func, Value value);
+// Terminators, which add the block as a predecessor of their targets
+int add_ir_jump(IrFunc* func, int block, int target, int line);
+int add_ir_branch(IrFunc* func,
+                  int block,
+                  int condition,
+                  int truthy,
+                  int falsy,
+                  int line);
+int add_ir_branch_global(IrFunc* func,
+                         int block,
+                         Value name,
+                         Value expected,
+                         int holds,
+                         int otherwise,
+                         int line);
+
+// Local variables, which the SSA form turns into values. A block is
+// sealed once all of its predecessors are known
+int add_ir_variable(IrFunc* func);
+void write_ir_variable(IrFunc* func, int variable, int block, int value);
+int read_ir_variable(IrFunc* func, int variable, int block);
+void seal_ir_block(IrFunc* func, int block);
+
+// Copy propagation, global value numbering, loop-invariant code motion,
+// dead code elimination, and unchecked arithmetic on the values that are
+// proven to be numbers
+void optimize_ir(IrFunc* func);
+void dump_ir(IrFunc* func);
+// Emits the bytecode into the chunk of the function and sets its
+// slot_count, the function has to be optimized first. Returns false if
+// the function went over a limit of the bytecode, which is printed
+bool emit_ir(IrFunc* ir, ObjFunc* func);
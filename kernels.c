@@ -0,0 +1,373 @@
+#include "kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define KERNELS_X86
+#include <immintrin.h>
+#endif
+
+static double sum_scalar(const double* a, int count) {
+  double sum = 0;
+  for (int i = 0; i < count; i++) {
+    sum += a[i];
+  }
+  return sum;
+}
+
+static double min_scalar(const double* a, int count) {
+  double min = a[0];
+  for (int i = 1; i < count; i++) {
+    if (a[i] < min)
+      min = a[i];
+  }
+  return min;
+}
+
+static double max_scalar(const double* a, int count) {
+  double max = a[0];
+  for (int i = 1; i < count; i++) {
+    if (a[i] > max)
+      max = a[i];
+  }
+  return max;
+}
+
+static double dot_scalar(const double* a, const double* b, int count) {
+  double sum = 0;
+  for (int i = 0; i < count; i++) {
+    sum += a[i] * b[i];
+  }
+  return sum;
+}
+
+static void scale_scalar(double* a, double k, int count) {
+  for (int i = 0; i < count; i++) {
+    a[i] *= k;
+  }
+}
+
+static void add_scalar(double* a, const double* b, int count) {
+  for (int i = 0; i < count; i++) {
+    a[i] += b[i];
+  }
+}
+
+static void mul_scalar(double* a, const double* b, int count) {
+  for (int i = 0; i < count; i++) {
+    a[i] *= b[i];
+  }
+}
+
+static const Kernels scalar_kernels = {
+    sum_scalar,   min_scalar, max_scalar, dot_scalar,
+    scale_scalar, add_scalar, mul_scalar,
+};
+
+#ifdef KERNELS_X86
+
+// The vector kernels are compiled for their instruction set with a target
+// attribute, the rest of the program stays at the baseline so it runs on
+// any cpu. Loads and stores are unaligned, the elements that do not fill
+// a whole vector are done by the scalar loop at the end.
+
+#define SSE2 __attribute__((target("sse2")))
+#define AVX2 __attribute__((target("avx2")))
+
+SSE2 static double horizontal_sum_sse2(__m128d v) {
+  return _mm_cvtsd_f64(_mm_add_sd(v, _mm_unpackhi_pd(v, v)));
+}
+
+SSE2 static double sum_sse2(const double* a, int count) {
+  // Two accumulators, so that an add does not wait on the one before
+  __m128d sum0 = _mm_setzero_pd();
+  __m128d sum1 = _mm_setzero_pd();
+  int i = 0;
+  for (; i + 4 <= count; i += 4) {
+    sum0 = _mm_add_pd(sum0, _mm_loadu_pd(a + i));
+    sum1 = _mm_add_pd(sum1, _mm_loadu_pd(a + i + 2));
+  }
+  double sum = horizontal_sum_sse2(_mm_add_pd(sum0, sum1));
+  for (; i < count; i++) {
+    sum += a[i];
+  }
+  return sum;
+}
+
+SSE2 static double min_sse2(const double* a, int count) {
+  if (count < 2)
+    return min_scalar(a, count);
+
+  __m128d min = _mm_loadu_pd(a);
+  int i = 2;
+  for (; i + 2 <= count; i += 2) {
+    min = _mm_min_pd(min, _mm_loadu_pd(a + i));
+  }
+  min = _mm_min_sd(min, _mm_unpackhi_pd(min, min));
+  double result = _mm_cvtsd_f64(min);
+  for (; i < count; i++) {
+    if (a[i] < result)
+      result = a[i];
+  }
+  return result;
+}
+
+SSE2 static double max_sse2(const double* a, int count) {
+  if (count < 2)
+    return max_scalar(a, count);
+
+  __m128d max = _mm_loadu_pd(a);
+  int i = 2;
+  for (; i + 2 <= count; i += 2) {
+    max = _mm_max_pd(max, _mm_loadu_pd(a + i));
+  }
+  max = _mm_max_sd(max, _mm_unpackhi_pd(max, max));
+  double result = _mm_cvtsd_f64(max);
+  for (; i < count; i++) {
+    if (a[i] > result)
+      result = a[i];
+  }
+  return result;
+}
+
+SSE2 static double dot_sse2(const double* a, const double* b, int count) {
+  __m128d sum0 = _mm_setzero_pd();
+  __m128d sum1 = _mm_setzero_pd();
+  int i = 0;
+  for (; i + 4 <= count; i += 4) {
+    sum0 = _mm_add_pd(sum0,
+                      _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+    sum1 = _mm_add_pd(
+        sum1, _mm_mul_pd(_mm_loadu_pd(a + i + 2), _mm_loadu_pd(b + i + 2)));
+  }
+  double sum = horizontal_sum_sse2(_mm_add_pd(sum0, sum1));
+  for (; i < count; i++) {
+    sum += a[i] * b[i];
+  }
+  return sum;
+}
+
+SSE2 static void scale_sse2(double* a, double k, int count) {
+  __m128d factor = _mm_set1_pd(k);
+  int i = 0;
+  for (; i + 2 <= count; i += 2) {
+    _mm_storeu_pd(a + i, _mm_mul_pd(_mm_loadu_pd(a + i), factor));
+  }
+  for (; i < count; i++) {
+    a[i] *= k;
+  }
+}
+
+SSE2 static void add_sse2(double* a, const double* b, int count) {
+  int i = 0;
+  for (; i + 2 <= count; i += 2) {
+    _mm_storeu_pd(a + i,
+                  _mm_add_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+  }
+  for (; i < count; i++) {
+    a[i] += b[i];
+  }
+}
+
+SSE2 static void mul_sse2(double* a, const double* b, int count) {
+  int i = 0;
+  for (; i + 2 <= count; i += 2) {
+    _mm_storeu_pd(a + i,
+                  _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+  }
+  for (; i < count; i++) {
+    a[i] *= b[i];
+  }
+}
+
+static const Kernels sse2_kernels = {
+    sum_sse2, min_sse2, max_sse2, dot_sse2, scale_sse2, add_sse2, mul_sse2,
+};
+
+AVX2 static double horizontal_sum_avx2(__m256d v) {
+  __m128d sum =
+      _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+  return _mm_cvtsd_f64(_mm_add_sd(sum, _mm_unpackhi_pd(sum, sum)));
+}
+
+AVX2 static double sum_avx2(const double* a, int count) {
+  __m256d sum0 = _mm256_setzero_pd();
+  __m256d sum1 = _mm256_setzero_pd();
+  int i = 0;
+  for (; i + 8 <= count; i += 8) {
+    sum0 = _mm256_add_pd(sum0, _mm256_loadu_pd(a + i));
+    sum1 = _mm256_add_pd(sum1, _mm256_loadu_pd(a + i + 4));
+  }
+  double sum = horizontal_sum_avx2(_mm256_add_pd(sum0, sum1));
+  for (; i < count; i++) {
+    sum += a[i];
+  }
+  return sum;
+}
+
+AVX2 static double min_avx2(const double* a, int count) {
+  if (count < 4)
+    return min_scalar(a, count);
+
+  __m256d min = _mm256_loadu_pd(a);
+  int i = 4;
+  for (; i + 4 <= count; i += 4) {
+    min = _mm256_min_pd(min, _mm256_loadu_pd(a + i));
+  }
+  __m128d half =
+      _mm_min_pd(_mm256_castpd256_pd128(min), _mm256_extractf128_pd(min, 1));
+  half = _mm_min_sd(half, _mm_unpackhi_pd(half, half));
+  double result = _mm_cvtsd_f64(half);
+  for (; i < count; i++) {
+    if (a[i] < result)
+      result = a[i];
+  }
+  return result;
+}
+
+AVX2 static double max_avx2(const double* a, int count) {
+  if (count < 4)
+    return max_scalar(a, count);
+
+  __m256d max = _mm256_loadu_pd(a);
+  int i = 4;
+  for (; i + 4 <= count; i += 4) {
+    max = _mm256_max_pd(max, _mm256_loadu_pd(a + i));
+  }
+  __m128d half =
+      _mm_max_pd(_mm256_castpd256_pd128(max), _mm256_extractf128_pd(max, 1));
+  half = _mm_max_sd(half, _mm_unpackhi_pd(half, half));
+  double result = _mm_cvtsd_f64(half);
+  for (; i < count; i++) {
+    if (a[i] > result)
+      result = a[i];
+  }
+  return result;
+}
+
+AVX2 static double dot_avx2(const double* a, const double* b, int count) {
+  // No fma, so that the products round the same way as the other levels
+  __m256d sum0 = _mm256_setzero_pd();
+  __m256d sum1 = _mm256_setzero_pd();
+  int i = 0;
+  for (; i + 8 <= count; i += 8) {
+    sum0 = _mm256_add_pd(
+        sum0, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+    sum1 = _mm256_add_pd(sum1, _mm256_mul_pd(_mm256_loadu_pd(a + i + 4),
+                                             _mm256_loadu_pd(b + i + 4)));
+  }
+  double sum = horizontal_sum_avx2(_mm256_add_pd(sum0, sum1));
+  for (; i < count; i++) {
+    sum += a[i] * b[i];
+  }
+  return sum;
+}
+
+AVX2 static void scale_avx2(double* a, double k, int count) {
+  __m256d factor = _mm256_set1_pd(k);
+  int i = 0;
+  for (; i + 4 <= count; i += 4) {
+    _mm256_storeu_pd(a + i, _mm256_mul_pd(_mm256_loadu_pd(a + i), factor));
+  }
+  for (; i < count; i++) {
+    a[i] *= k;
+  }
+}
+
+AVX2 static void add_avx2(double* a, const double* b, int count) {
+  int i = 0;
+  for (; i + 4 <= count; i += 4) {
+    _mm256_storeu_pd(
+        a + i, _mm256_add_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+  }
+  for (; i < count; i++) {
+    a[i] += b[i];
+  }
+}
+
+AVX2 static void mul_avx2(double* a, const double* b, int count) {
+  int i = 0;
+  for (; i + 4 <= count; i += 4) {
+    _mm256_storeu_pd(
+        a + i, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+  }
+  for (; i < count; i++) {
+    a[i] *= b[i];
+  }
+}
+
+static const Kernels avx2_kernels = {
+    sum_avx2, min_avx2, max_avx2, dot_avx2, scale_avx2, add_avx2, mul_avx2,
+};
+
+#endif
+
+static const Kernels* kernels = NULL;
+static KernelLevel kernel_level = KERNELS_SCALAR;
+
+bool kernel_level_supported(KernelLevel level) {
+  switch (level) {
+    case KERNELS_SCALAR:
+      return true;
+#ifdef KERNELS_X86
+    // cpuid, and for avx2 that the os saves the ymm registers as well
+    case KERNELS_SSE2:
+      return __builtin_cpu_supports("sse2");
+    case KERNELS_AVX2:
+      return __builtin_cpu_supports("avx2");
+#else
+    case KERNELS_SSE2:
+    case KERNELS_AVX2:
+      return false;
+#endif
+  }
+  return false;
+}
+
+bool set_kernel_level(KernelLevel level) {
+  if (!kernel_level_supported(level))
+    return false;
+
+  switch (level) {
+    case KERNELS_SCALAR:
+      kernels = &scalar_kernels;
+      break;
+#ifdef KERNELS_X86
+    case KERNELS_SSE2:
+      kernels = &sse2_kernels;
+      break;
+    case KERNELS_AVX2:
+      kernels = &avx2_kernels;
+      break;
+#else
+    default:
+      return false;
+#endif
+  }
+  kernel_level = level;
+  return true;
+}
+
+// Picks the best level the first time the kernels are needed
+const Kernels* get_kernels() {
+  if (kernels == NULL) {
+    if (!set_kernel_level(KERNELS_AVX2) && !set_kernel_level(KERNELS_SSE2))
+      set_kernel_level(KERNELS_SCALAR);
+  }
+  return kernels;
+}
+
+KernelLevel get_kernel_level() {
+  get_kernels();
+  return kernel_level;
+}
+
+const char* kernel_level_name(KernelLevel level) {
+  switch (level) {
+    case KERNELS_SCALAR:
+      return "scalar";
+    case KERNELS_SSE2:
+      return "sse2";
+    case KERNELS_AVX2:
+      return "avx2";
+  }
+  return "unknown";
+}
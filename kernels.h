@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdbool.h>
+
+// Loops over raw doubles for the float array natives. There is a
+// scalar version of every kernel, and SSE2 and AVX2 versions on x86,
+// which one is used is picked at runtime from what the cpu supports.
+//
+// Summing in vector lanes adds the numbers up in a different order than
+// the scalar loop, so sums and dot products can differ in the last bits
+// between the levels.
+
+typedef enum {
+  KERNELS_SCALAR,
+  KERNELS_SSE2,
+  KERNELS_AVX2,
+} KernelLevel;
+
+typedef struct {
+  double (*sum)(const double* a, int count);
+  // min and max need at least one element
+  double (*min)(const double* a, int count);
+  double (*max)(const double* a, int count);
+  double (*dot)(const double* a, const double* b, int count);
+  // a = a * k
+  void (*scale)(double* a, double k, int count);
+  // a = a + b
+  void (*add)(double* a, const double* b, int count);
+  // a = a * b
+  void (*mul)(double* a, const double* b, int count);
+} Kernels;
+
+// The kernels for the best level the cpu supports, unless another level
+// was set with set_kernel_level
+const Kernels* get_kernels();
+KernelLevel get_kernel_level();
+
+// For benchmarks and tests, returns false if the cpu does not support it
+bool set_kernel_level(KernelLevel level);
+bool kernel_level_supported(KernelLevel level);
+const char* kernel_level_name(KernelLevel level);
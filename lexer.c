@@ -83,6 +83,8 @@ void lex_source(TokenArray* token_array, const char* source) {
 
   // While it is not the end
   while (!is_end()) {
+    int previous = current;
+
     if (is_whitespace()) {  // Will also handle incrementing new lines
       start++;
       current++;
@@ -90,9 +92,15 @@ void lex_source(TokenArray* token_array, const char* source) {
 
     if (s[current] == '"') {
       current++;
-      while (s[current] != '"') {
+      while (s[current] != '"' && !is_end()) {
         current++;
       }
+      // Unterminated string, stop here instead of reading past the source
+      if (is_end()) {
+        Token token_error = make_token(TOKEN_ERROR);
+        push_token_array(token_array, token_error);
+        break;
+      }
       // Increment past the last semicolon
       current++;
 
@@ -109,6 +117,13 @@ void lex_source(TokenArray* token_array, const char* source) {
       while (is_digit()) {
         current++;
       }
+      // 1.5 is a double, 1 is an int, the parser tells them apart by the .
+      if (s[current] == '.' && s[current + 1] >= '0' && s[current + 1] <= '9') {
+        current++;
+        while (is_digit()) {
+          current++;
+        }
+      }
       Token token_digit = make_token(TOKEN_NUMBER);
       push_token_array(token_array, token_digit);
       start = current;
@@ -147,12 +162,21 @@ void lex_source(TokenArray* token_array, const char* source) {
       } else if (check_keyword("func", 4)) {
         Token token_func = make_token(TOKEN_FUNC);
         push_token_array(token_array, token_func);
+      } else if (check_keyword("memo", 4)) {
+        Token token_memo = make_token(TOKEN_MEMO);
+        push_token_array(token_array, token_memo);
       } else if (check_keyword("nil", 3)) {
         Token token_nil = make_token(TOKEN_NIL);
         push_token_array(token_array, token_nil);
       } else if (check_keyword("return", 6)) {
         Token token_return = make_token(TOKEN_RETURN);
         push_token_array(token_array, token_return);
+      } else if (check_keyword("and", 3)) {
+        Token token_and = make_token(TOKEN_AND);
+        push_token_array(token_array, token_and);
+      } else if (check_keyword("or", 2)) {
+        Token token_or = make_token(TOKEN_OR);
+        push_token_array(token_array, token_or);
       } else if (check_keyword("print", 5)) {
         Token token_print = make_token(TOKEN_PRINT);
         push_token_array(token_array, token_print);
@@ -184,11 +208,26 @@ void lex_source(TokenArray* token_array, const char* source) {
       Token token_right_paren = make_token(TOKEN_RIGHT_BRACE);
       push_token_array(token_array, token_right_paren);
       start = current;
+    } else if (s[current] == '[') {
+      current++;
+      Token token_left_bracket = make_token(TOKEN_LEFT_BRACKET);
+      push_token_array(token_array, token_left_bracket);
+      start = current;
+    } else if (s[current] == ']') {
+      current++;
+      Token token_right_bracket = make_token(TOKEN_RIGHT_BRACKET);
+      push_token_array(token_array, token_right_bracket);
+      start = current;
     } else if (s[current] == ',') {
       current++;
       Token token_comma = make_token(TOKEN_COMMA);
       push_token_array(token_array, token_comma);
       start = current;
+    } else if (s[current] == ':') {
+      current++;
+      Token token_colon = make_token(TOKEN_COLON);
+      push_token_array(token_array, token_colon);
+      start = current;
     } else if (s[current] == '.') {
       current++;
       Token token_dot = make_token(TOKEN_DOT);
@@ -199,6 +238,31 @@ void lex_source(TokenArray* token_array, const char* source) {
       Token token_semicolon = make_token(TOKEN_SEMICOLON);
       push_token_array(token_array, token_semicolon);
       start = current;
+    } else if (s[current] == '%') {
+      current++;
+      Token token_percent = make_token(TOKEN_PERCENT);
+      push_token_array(token_array, token_percent);
+      start = current;
+    } else if (s[current] == '&') {
+      current++;
+      Token token_ampersand = make_token(TOKEN_AMPERSAND);
+      push_token_array(token_array, token_ampersand);
+      start = current;
+    } else if (s[current] == '|') {
+      current++;
+      Token token_pipe = make_token(TOKEN_PIPE);
+      push_token_array(token_array, token_pipe);
+      start = current;
+    } else if (s[current] == '^') {
+      current++;
+      Token token_caret = make_token(TOKEN_CARET);
+      push_token_array(token_array, token_caret);
+      start = current;
+    } else if (s[current] == '~') {
+      current++;
+      Token token_tilde = make_token(TOKEN_TILDE);
+      push_token_array(token_array, token_tilde);
+      start = current;
     }
 
     // Lex the double character tokens
@@ -228,7 +292,12 @@ void lex_source(TokenArray* token_array, const char* source) {
         start = current;
       }
     } else if (s[current] == '>') {
-      if (s[current + 1] == '=') {
+      if (s[current + 1] == '>') {
+        current += 2;
+        Token token_greater_greater = make_token(TOKEN_GREATER_GREATER);
+        push_token_array(token_array, token_greater_greater);
+        start = current;
+      } else if (s[current + 1] == '=') {
         current += 2;
         Token token_greater_equal = make_token(TOKEN_GREATER_EQUAL);
         push_token_array(token_array, token_greater_equal);
@@ -240,7 +309,12 @@ void lex_source(TokenArray* token_array, const char* source) {
         start = current;
       }
     } else if (s[current] == '<') {
-      if (s[current + 1] == '=') {
+      if (s[current + 1] == '<') {
+        current += 2;
+        Token token_less_less = make_token(TOKEN_LESS_LESS);
+        push_token_array(token_array, token_less_less);
+        start = current;
+      } else if (s[current + 1] == '=') {
         current += 2;
         Token token_less_equal = make_token(TOKEN_LESS_EQUAL);
         push_token_array(token_array, token_less_equal);
@@ -300,6 +374,15 @@ void lex_source(TokenArray* token_array, const char* source) {
         start = current;
       }
     }
+
+    // None of the above could lex this character, turn it into an error
+    // token and move past it, otherwise this would never terminate
+    if (current == previous && !is_end()) {
+      current++;
+      Token token_error = make_token(TOKEN_ERROR);
+      push_token_array(token_array, token_error);
+      start = current;
+    }
   }
 }
 
@@ -319,9 +402,18 @@ void disassemble_token_array(TokenArray* token_array) {
       case TOKEN_RIGHT_BRACE:
         printf("[%-20s]: %s\n", "TOKEN_RIGHT_BRACE", "}");
         break;
+      case TOKEN_LEFT_BRACKET:
+        printf("[%-20s]: %s\n", "TOKEN_LEFT_BRACKET", "[");
+        break;
+      case TOKEN_RIGHT_BRACKET:
+        printf("[%-20s]: %s\n", "TOKEN_RIGHT_BRACKET", "]");
+        break;
       case TOKEN_COMMA:
         printf("[%-20s]: %s\n", "TOKEN_COMMA", ",");
         break;
+      case TOKEN_COLON:
+        printf("[%-20s]: %s\n", "TOKEN_COLON", ":");
+        break;
       case TOKEN_DOT:
         printf("[%-20s]: %s\n", "TOKEN_DOT", ".");
         break;
@@ -340,6 +432,21 @@ void disassemble_token_array(TokenArray* token_array) {
       case TOKEN_STAR:
         printf("[%-20s]: %s\n", "TOKEN_STAR", "*");
         break;
+      case TOKEN_PERCENT:
+        printf("[%-20s]: %s\n", "TOKEN_PERCENT", "%");
+        break;
+      case TOKEN_AMPERSAND:
+        printf("[%-20s]: %s\n", "TOKEN_AMPERSAND", "&");
+        break;
+      case TOKEN_PIPE:
+        printf("[%-20s]: %s\n", "TOKEN_PIPE", "|");
+        break;
+      case TOKEN_CARET:
+        printf("[%-20s]: %s\n", "TOKEN_CARET", "^");
+        break;
+      case TOKEN_TILDE:
+        printf("[%-20s]: %s\n", "TOKEN_TILDE", "~");
+        break;
       case TOKEN_BANG:
         printf("[%-20s]: %s\n", "TOKEN_BANG", "!");
         break;
@@ -361,6 +468,12 @@ void disassemble_token_array(TokenArray* token_array) {
       case TOKEN_LESS_EQUAL:
         printf("[%-20s]: %s\n", "TOKEN_LESS_EQUAL", "<=");
         break;
+      case TOKEN_LESS_LESS:
+        printf("[%-20s]: %s\n", "TOKEN_LESS_LESS", "<<");
+        break;
+      case TOKEN_GREATER_GREATER:
+        printf("[%-20s]: %s\n", "TOKEN_GREATER_GREATER", ">>");
+        break;
       case TOKEN_IDENTIFIER: {
         char s[token_array->tokens[i].length + 1];
         strncpy(s, token_array->tokens[i].start, token_array->tokens[i].length);
@@ -392,6 +505,9 @@ void disassemble_token_array(TokenArray* token_array) {
       case TOKEN_IF:
         printf("[%-20s]: %s\n", "TOKEN_IF", "IF");
         break;
+      case TOKEN_MEMO:
+        printf("[%-20s]: %s\n", "TOKEN_MEMO", "MEMO");
+        break;
       case TOKEN_NIL:
         printf("[%-20s]: %s\n", "TOKEN_NIL", "NIL");
         break;
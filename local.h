@@ -5,4 +5,6 @@
 typedef struct {
   Token name;
   int depth;
+  // The slot of the local this one hides, -1 if there is none
+  int shadowed;
 } Local;
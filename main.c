@@ -1,19 +1,20 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "array.h"
 #include "ast.h"
 #include "codegen.h"
 #include "debugging.h"
 #include "lexer.h"
+#include "macros.h"
+#include "memo.h"
+#include "opstats.h"
 #include "parser.h"
+#include "profiler.h"
 #include "vm.h"
 
-static void start_repl() {
-  printf("Nebula REPL\n");
-}
-
 static char* read_file(const char* path) {
   // Open the file, the file is readable, checked
   // by file_exists before this
@@ -54,7 +55,11 @@ static char* read_file(const char* path) {
   return buffer;
 }
 
-static void run_source(bool arguments[const], const char* source) {
+// Lex, parse and codegen the source into a top-level function.
+// Returns NULL if there were any syntax errors, which are printed out here
+static ObjFunc* compile_source(bool arguments[const],
+                               Vm* vm,
+                               const char* source) {
   TokenArray token_array;
   init_token_array(&token_array);
   lex_source(&token_array, source);
@@ -76,35 +81,124 @@ static void run_source(bool arguments[const], const char* source) {
     for (int i = 0; i < error_array.count; i++) {
       print_error(error_array.errors[i]);
     }
-    // End the program
-    return;
+    free_token_array(&token_array);
+    free_error_array(&error_array);
+    return NULL;
   }
 
   if (arguments[DUMP_AST])
     disassemble_ast(&ast_array);
 
-  OpArray op_array;
-  ValueArray value_array;
-  LocalArray local_array;
+  set_dump_ir(arguments[DUMP_IR]);
+  set_type_report(arguments[TYPE_REPORT]);
+  set_auto_memo(arguments[AUTO_MEMO]);
+  set_fold_calls(!arguments[NO_FOLD]);
+  ObjFunc* main_func = codegen(&ast_array, vm);
 
-  init_op_array(&op_array);
-  init_value_array(&value_array);
-  init_local_array(&local_array);
-  reserve_local_array(&local_array, UINT8_MAX + 1);  // 256
+  free_token_array(&token_array);
+  free_error_array(&error_array);
+  return main_func;
+}
 
-  ObjFunc* main_func = codegen(&ast_array);
+static void run_source(bool arguments[const], const char* source) {
+  Vm vm;
+  init_vm(&vm);
+
+  ObjFunc* main_func = compile_source(arguments, &vm, source);
+  if (main_func != NULL)
+    run(arguments, &vm, main_func);
+
+  free_vm(&vm);
+}
+
+// Counts how many braces and parentheses are still left open, as well
+// as whether a string is left unterminated, so that the REPL knows
+// whether it needs to keep reading before it can compile the input
+static bool is_input_complete(const char* source) {
+  int depth = 0;
+  bool in_string = false;
+  for (const char* c = source; *c != '\0'; c++) {
+    if (*c == '"') {
+      in_string = !in_string;
+    } else if (!in_string && (*c == '{' || *c == '(')) {
+      depth++;
+    } else if (!in_string && (*c == '}' || *c == ')')) {
+      depth--;
+    }
+  }
+  return depth <= 0 && !in_string;
+}
+
+#define REPL_LINE_SIZE 1024
+
+// The REPL keeps a single Vm alive for the whole session, every input is
+// compiled on its own into a new top-level function and ran on that Vm,
+// so globals and functions defined on earlier lines stay available
+// without having to lex or compile the earlier lines again.
+static void start_repl(bool arguments[const]) {
+  // Only show the banner and prompts when a person is typing, statements
+  // piped in through stdin should only produce the program output
+  bool interactive = isatty(fileno(stdin));
+  if (interactive)
+    printf("Nebula REPL\n");
 
   Vm vm;
   init_vm(&vm);
-  run(arguments, &vm, main_func);
 
+  char line[REPL_LINE_SIZE];
+  int capacity = REPL_LINE_SIZE;
+  int length = 0;
+  char* source = ALLOCATE(char, capacity);
+  source[0] = '\0';
+  // A line longer than the buffer is read in more than one piece
+  bool at_line_start = true;
+
+  for (;;) {
+    if (interactive && at_line_start) {
+      printf(length == 0 ? "> " : "... ");
+      fflush(stdout);
+    }
+
+    if (fgets(line, sizeof(line), stdin) == NULL)
+      break;
+
+    // Keep appending lines until the input is complete, i.e. a function
+    // declaration that spans over multiple lines
+    int line_length = strlen(line);
+    if (length + line_length + 1 > capacity) {
+      capacity = MAX(capacity * 2, length + line_length + 1);
+      source = (char*)realloc(source, sizeof(char) * capacity);
+    }
+    memcpy(source + length, line, line_length + 1);
+    length += line_length;
+
+    // Only a whole line can finish the input, the rest of it may still
+    // open a brace or a string
+    at_line_start = line_length > 0 && line[line_length - 1] == '\n';
+    if (!at_line_start || !is_input_complete(source))
+      continue;
+
+    ObjFunc* main_func = compile_source(arguments, &vm, source);
+    if (main_func != NULL)
+      run(arguments, &vm, main_func);
+
+    length = 0;
+    source[0] = '\0';
+  }
+
+  // Whatever is left over is incomplete, but run it anyway so that it can
+  // report its syntax errors
+  if (length > 0) {
+    ObjFunc* main_func = compile_source(arguments, &vm, source);
+    if (main_func != NULL)
+      run(arguments, &vm, main_func);
+  }
+
+  if (interactive)
+    printf("\n");
+
+  free(source);
   free_vm(&vm);
-  free_op_array(&op_array);
-  free_value_array(&value_array);
-  free_local_array(&local_array);
-  free_token_array(&token_array);
-  free_error_array(&error_array);
-  // free(source);
 }
 
 static void run_file(bool arguments[const], const char* path) {
@@ -124,6 +218,19 @@ static bool file_exists(const char* path) {
   return true;
 }
 
+static void report_opstats() {
+#ifdef OPSTATS
+  print_opstats();
+#else
+  fprintf(stderr,
+          "--opstats: this build has no opcode counters, build it with "
+          "make nebula-opstats\n");
+#endif
+}
+
+// Where --profile writes the sampled stacks to
+static const char* profile_path = PROFILER_DEFAULT_PATH;
+
 // Flags guide
 // ./nebula { no option } => REPL
 // ./nebula { no option } { file } => Run file
@@ -165,6 +272,40 @@ int main(int argc, const char* argv[]) {
                strncmp(argv[i], "--help", 6) == 0) {
       arguments[HELP] = true;
       available_flags_count++;
+    } else if (strncmp(argv[i], "-p", 2) == 0 ||
+               strncmp(argv[i], "--profile", 9) == 0) {
+      arguments[PROFILE] = true;
+      // --profile=file.folded
+      const char* path = strchr(argv[i], '=');
+      if (path != NULL)
+        profile_path = path + 1;
+      available_flags_count++;
+    } else if (strncmp(argv[i], "--opstats", 9) == 0) {
+      arguments[OPCODE_STATS] = true;
+      available_flags_count++;
+    } else if (strncmp(argv[i], "--dump-ir", 9) == 0) {
+      arguments[DUMP_IR] = true;
+      available_flags_count++;
+    } else if (strncmp(argv[i], "--type-report", 13) == 0) {
+      arguments[TYPE_REPORT] = true;
+      available_flags_count++;
+    } else if (strncmp(argv[i], "--auto-memo", 11) == 0) {
+      arguments[AUTO_MEMO] = true;
+      available_flags_count++;
+    } else if (strncmp(argv[i], "--memo-stats", 12) == 0) {
+      arguments[MEMO_STATS] = true;
+      available_flags_count++;
+    } else if (strncmp(argv[i], "--memo-limit=", 13) == 0) {
+      // --memo-limit=entries
+      set_memo_limit(atoi(argv[i] + 13));
+      available_flags_count++;
+    } else if (strncmp(argv[i], "--no-fold", 9) == 0) {
+      arguments[NO_FOLD] = true;
+      available_flags_count++;
+    } else if (strncmp(argv[i], "--fold-steps=", 13) == 0) {
+      // --fold-steps=steps
+      set_fold_steps(atoi(argv[i] + 13));
+      available_flags_count++;
     }
   }
 
@@ -173,15 +314,54 @@ int main(int argc, const char* argv[]) {
     printf("Nebula flags:\n");
     printf("-a/--ast: Dump AST\n");
     printf("-c/--codegen: Dump Bytecode\n");
+    printf("--dump-ir: Dump the IR of every function\n");
+    printf(
+        "--type-report: Print how many arithmetic ops of every function "
+        "are unchecked\n");
+    printf(
+        "--auto-memo: Cache the results of pure functions that call "
+        "themselves, like memo func does\n");
+    printf(
+        "--memo-stats: Print the entries, hits and misses of every memo "
+        "cache after running\n");
+    printf(
+        "--memo-limit=entries: The most results a memo cache keeps, %d by "
+        "default\n",
+        MEMO_DEFAULT_LIMIT);
+    printf(
+        "--no-fold: Make every call at runtime, also calls to pure "
+        "functions with constant arguments\n");
+    printf(
+        "--fold-steps=steps: The most calls and loop iterations a call run "
+        "at compile time takes, %d by default\n",
+        FOLD_DEFAULT_STEPS);
     printf("-v/--vm: Show VM output\n");
+    printf(
+        "-p/--profile[=file]: Sample the script and write collapsed stacks "
+        "for flamegraphs, to %s by default\n",
+        PROFILER_DEFAULT_PATH);
+    printf(
+        "--opstats: Print opcode counts after running, needs a build with "
+        "-DOPSTATS (make nebula-opstats)\n");
     printf("Nebula usage: ./nebula {flags} {file.neb}\n");
+    printf("Without a file, ./nebula {flags} starts the REPL\n");
     return 0;
   }
 
   // printf("Flag count: %d\n", available_flags_count);
   // Just start the REPL
   if (argc - available_flags_count == 1) {
-    start_repl();
+    if (arguments[PROFILE])
+      start_profiler();
+
+    start_repl(arguments);
+
+    if (arguments[PROFILE])
+      stop_profiler(profile_path);
+    if (arguments[OPCODE_STATS])
+      report_opstats();
+    if (arguments[MEMO_STATS])
+      print_memo_stats();
   }
   // There are only two flags, check that the file exists first
   // ./nebula { no option } { file }
@@ -193,9 +373,19 @@ int main(int argc, const char* argv[]) {
       exit(74);
     }
 
+    if (arguments[PROFILE])
+      start_profiler();
+
     // File exists, just continue
     run_file(arguments, argv[available_flags_count + 1]);
 
+    if (arguments[PROFILE])
+      stop_profiler(profile_path);
+    if (arguments[OPCODE_STATS])
+      report_opstats();
+    if (arguments[MEMO_STATS])
+      print_memo_stats();
+
     // Exit the program as there is no issue
     exit(0);
   } else {
@@ -0,0 +1,194 @@
+#include "map.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "hash.h"
+#include "macros.h"
+
+// Kept below 3/4 full, keys and tombstones both count
+#define MAP_MAX_LOAD_NUMERATOR 3
+#define MAP_MAX_LOAD_DENOMINATOR 4
+#define MAP_MIN_CAPACITY 8
+
+bool is_map_key(Value key) {
+  return IS_STRING(key) || IS_INT(key) ||
+         (IS_NUMBER(key) && !isnan(AS_NUMBER(key)));
+}
+
+// Whole doubles become ints, -0.0 included, so that equal numbers are
+// the same key
+static Value normalize_key(Value key) {
+  if (IS_NUMBER(key)) {
+    double number = AS_NUMBER(key);
+    if (number >= INT64_MIN && number < INT64_MAX &&
+        !islessgreater(trunc(number), number))
+      return INT_VAL((int64_t)number);
+  }
+  return key;
+}
+
+static uint32_t hash_bits(uint64_t bits) {
+  uint64_t hash = wy_mix(bits ^ WY_P0, WY_P1);
+  return (uint32_t)(hash ^ (hash >> 32));
+}
+
+static uint32_t hash_key(Value key) {
+  if (IS_STRING(key))
+    return hash_obj_string(AS_OBJ_STRING(key));
+  if (IS_INT(key))
+    return hash_bits((uint64_t)AS_INT(key));
+
+  uint64_t bits;
+  double number = AS_NUMBER(key);
+  memcpy(&bits, &number, sizeof(bits));
+  return hash_bits(bits);
+}
+
+// Both keys are normalized, an int and a double are never equal here
+static bool keys_equal(Value a, Value b) {
+  if (a.type != b.type)
+    return false;
+  if (IS_INT(a))
+    return AS_INT(a) == AS_INT(b);
+  if (IS_NUMBER(a))
+    return memcmp(&a.as.number, &b.as.number, sizeof(double)) == 0;
+
+  ObjString* string_a = AS_OBJ_STRING(a);
+  ObjString* string_b = AS_OBJ_STRING(b);
+  return string_a == string_b ||
+         (string_a->length == string_b->length &&
+          memcmp(string_a->chars, string_b->chars, string_a->length) == 0);
+}
+
+// The entry with the key, otherwise where the key would go, which is the
+// first tombstone on the way if there was one
+static MapEntry* find_map_entry(MapEntry* entries,
+                                int capacity,
+                                Value key,
+                                uint32_t hash) {
+  uint32_t mask = (uint32_t)capacity - 1;
+  uint32_t index = hash & mask;
+  MapEntry* tombstone = NULL;
+
+  for (;;) {
+    MapEntry* entry = &entries[index];
+    if (IS_NIL(entry->key)) {
+      if (IS_NIL(entry->value))
+        return tombstone != NULL ? tombstone : entry;
+      if (tombstone == NULL)
+        tombstone = entry;
+    } else if (entry->hash == hash && keys_equal(entry->key, key)) {
+      return entry;
+    }
+    index = (index + 1) & mask;
+  }
+}
+
+static int capacity_for(int count) {
+  int capacity = MAP_MIN_CAPACITY;
+  while (count * MAP_MAX_LOAD_DENOMINATOR >
+         capacity * MAP_MAX_LOAD_NUMERATOR) {
+    capacity *= 2;
+  }
+  return capacity;
+}
+
+// Moves the keys into a new table, which also drops the tombstones
+static void resize_obj_map(ObjMap* map, int capacity) {
+  MapEntry* entries = ALLOCATE(MapEntry, capacity);
+  for (int i = 0; i < capacity; i++) {
+    entries[i].key = NIL_VAL;
+    entries[i].value = NIL_VAL;
+  }
+
+  for (int i = 0; i < map->capacity; i++) {
+    MapEntry* entry = &map->entries[i];
+    if (IS_NIL(entry->key))
+      continue;
+    // The keys are all different, the first empty slot is the one
+    uint32_t index = entry->hash & (capacity - 1);
+    while (!IS_NIL(entries[index].key)) {
+      index = (index + 1) & (capacity - 1);
+    }
+    entries[index] = *entry;
+  }
+
+  free(map->entries);
+  map->entries = entries;
+  map->capacity = capacity;
+  map->used = map->count;
+}
+
+ObjMap* make_obj_map(int capacity) {
+  ObjMap* map = ALLOCATE(ObjMap, 1);
+  map->obj.type = OBJ_MAP;
+  map->count = 0;
+  map->used = 0;
+  map->capacity = 0;
+  map->entries = NULL;
+  if (capacity > 0)
+    resize_obj_map(map, capacity_for(capacity));
+  return map;
+}
+
+void reserve_obj_map(ObjMap* map, int capacity) {
+  int needed = capacity_for(capacity);
+  if (needed > map->capacity)
+    resize_obj_map(map, needed);
+}
+
+bool get_obj_map(ObjMap* map, Value key, Value* value) {
+  if (map->count == 0)
+    return false;
+
+  key = normalize_key(key);
+  MapEntry* entry =
+      find_map_entry(map->entries, map->capacity, key, hash_key(key));
+  if (IS_NIL(entry->key))
+    return false;
+
+  *value = entry->value;
+  return true;
+}
+
+void set_obj_map(ObjMap* map, Value key, Value value) {
+  if ((map->used + 1) * MAP_MAX_LOAD_DENOMINATOR >
+      map->capacity * MAP_MAX_LOAD_NUMERATOR) {
+    // Only grows when it is the keys that fill the table, when it is
+    // tombstones rehashing at the same size clears them out
+    resize_obj_map(map, MAX(capacity_for(map->count + 1), map->capacity));
+  }
+
+  key = normalize_key(key);
+  uint32_t hash = hash_key(key);
+  MapEntry* entry = find_map_entry(map->entries, map->capacity, key, hash);
+  if (IS_NIL(entry->key)) {
+    map->count++;
+    // Reusing a tombstone does not take up another slot
+    if (IS_NIL(entry->value))
+      map->used++;
+  }
+
+  entry->key = key;
+  entry->value = value;
+  entry->hash = hash;
+}
+
+bool delete_obj_map(ObjMap* map, Value key) {
+  if (map->count == 0)
+    return false;
+
+  key = normalize_key(key);
+  MapEntry* entry =
+      find_map_entry(map->entries, map->capacity, key, hash_key(key));
+  if (IS_NIL(entry->key))
+    return false;
+
+  // The tombstone keeps the probe sequences that go past it intact
+  entry->key = NIL_VAL;
+  entry->value = BOOLEAN_VAL(true);
+  map->count--;
+  return true;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "object.h"
+#include "value.h"
+
+// The maps scripts make with {key: value}. Unlike the HashMap of globals,
+// keys are Values, strings and numbers. Numbers that are whole are keyed
+// as ints, so m[1] and m[1.0] are the same entry, like 1 == 1.0.
+
+// Strings and numbers other than NaN, the rest of the functions only
+// take keys this returns true for
+bool is_map_key(Value key);
+
+// Room for capacity keys before the table has to grow, 0 allocates the
+// table when the first key is set
+ObjMap* make_obj_map(int capacity);
+
+// Grows the table so that capacity keys fit without growing again
+void reserve_obj_map(ObjMap* map, int capacity);
+
+// Returns false if the key is not in the map
+bool get_obj_map(ObjMap* map, Value key, Value* value);
+void set_obj_map(ObjMap* map, Value key, Value value);
+// Returns false if the key was not in the map
+bool delete_obj_map(ObjMap* map, Value key);
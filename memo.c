@@ -0,0 +1,194 @@
+#include "memo.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hash.h"
+#include "macros.h"
+#include "object.h"
+
+#define MEMO_MIN_CAPACITY 8
+
+static int memo_limit = MEMO_DEFAULT_LIMIT;
+static MemoCache* caches = NULL;
+
+void set_memo_limit(int limit) {
+  memo_limit = limit < 1 ? 1 : limit;
+}
+
+MemoCache* make_memo_cache(const char* name, int arity) {
+  MemoCache* cache = ALLOCATE(MemoCache, 1);
+  cache->name = name;
+  cache->arity = arity;
+  cache->keys = NULL;
+  cache->results = NULL;
+  cache->done = NULL;
+  cache->hashes = NULL;
+  cache->count = 0;
+  cache->capacity = 0;
+  cache->table = NULL;
+  cache->table_capacity = 0;
+  cache->limit = memo_limit;
+  cache->hits = 0;
+  cache->misses = 0;
+  cache->next = caches;
+  caches = cache;
+  return cache;
+}
+
+static bool is_memo_value(Value value) {
+  return !IS_OBJ(value) || IS_STRING(value);
+}
+
+static uint64_t value_bits(Value value) {
+  if (IS_STRING(value))
+    return hash_obj_string(AS_OBJ_STRING(value));
+  if (IS_INT(value))
+    return (uint64_t)AS_INT(value);
+  if (IS_BOOLEAN(value))
+    return AS_BOOLEAN(value);
+
+  uint64_t bits = 0;
+  if (IS_NUMBER(value))
+    memcpy(&bits, &value.as.number, sizeof(bits));
+  return bits;
+}
+
+static uint32_t hash_args(Value* args, int count) {
+  uint64_t hash = WY_SEED;
+  for (int i = 0; i < count; i++) {
+    hash = wy_mix(hash ^ value_bits(args[i]) ^ WY_P0,
+                  (uint64_t)args[i].type ^ WY_P1);
+  }
+  return (uint32_t)(hash ^ (hash >> 32));
+}
+
+static bool same_value(Value a, Value b) {
+  if (a.type != b.type)
+    return false;
+  if (IS_STRING(a)) {
+    ObjString* string_a = AS_OBJ_STRING(a);
+    ObjString* string_b = AS_OBJ_STRING(b);
+    return string_a == string_b ||
+           (string_a->length == string_b->length &&
+            memcmp(string_a->chars, string_b->chars, string_a->length) == 0);
+  }
+  return value_bits(a) == value_bits(b);
+}
+
+static bool same_args(MemoCache* cache, int entry, Value* args) {
+  Value* keys = cache->keys + (size_t)entry * cache->arity;
+  for (int i = 0; i < cache->arity; i++) {
+    if (!same_value(keys[i], args[i]))
+      return false;
+  }
+  return true;
+}
+
+// The slot of the entry with the arguments, otherwise the empty slot where
+// it would go
+static int find_slot(MemoCache* cache, Value* args, uint32_t hash) {
+  uint32_t mask = (uint32_t)cache->table_capacity - 1;
+  uint32_t slot = hash & mask;
+  for (;;) {
+    int entry = cache->table[slot];
+    if (entry == -1 ||
+        (cache->hashes[entry] == hash && same_args(cache, entry, args)))
+      return (int)slot;
+    slot = (slot + 1) & mask;
+  }
+}
+
+// Kept at most half full, there are no deletes
+static void grow_table(MemoCache* cache) {
+  int capacity = cache->table_capacity == 0 ? MEMO_MIN_CAPACITY
+                                            : cache->table_capacity * 2;
+  free(cache->table);
+  cache->table = ALLOCATE(int, capacity);
+  cache->table_capacity = capacity;
+  for (int i = 0; i < capacity; i++) {
+    cache->table[i] = -1;
+  }
+  for (int i = 0; i < cache->count; i++) {
+    uint32_t slot = cache->hashes[i] & (capacity - 1);
+    while (cache->table[slot] != -1) {
+      slot = (slot + 1) & (capacity - 1);
+    }
+    cache->table[slot] = i;
+  }
+}
+
+static void grow_entries(MemoCache* cache) {
+  cache->capacity = cache->capacity == 0 ? MEMO_MIN_CAPACITY
+                                         : cache->capacity * 2;
+  cache->keys = (Value*)realloc(cache->keys,
+                                sizeof(Value) * cache->capacity * cache->arity);
+  cache->results =
+      (Value*)realloc(cache->results, sizeof(Value) * cache->capacity);
+  cache->done = (bool*)realloc(cache->done, sizeof(bool) * cache->capacity);
+  cache->hashes =
+      (uint32_t*)realloc(cache->hashes, sizeof(uint32_t) * cache->capacity);
+}
+
+bool lookup_memo(MemoCache* cache, Value* args, Value* result, int* entry) {
+  *entry = -1;
+  for (int i = 0; i < cache->arity; i++) {
+    if (!is_memo_value(args[i])) {
+      cache->misses++;
+      return false;
+    }
+  }
+
+  uint32_t hash = hash_args(args, cache->arity);
+  if (cache->table_capacity == 0)
+    grow_table(cache);
+  int slot = find_slot(cache, args, hash);
+  int found = cache->table[slot];
+  if (found != -1 && cache->done[found]) {
+    cache->hits++;
+    *result = cache->results[found];
+    return true;
+  }
+
+  cache->misses++;
+  // A call with the same arguments is still running, or never stored
+  // its result
+  if (found != -1) {
+    *entry = found;
+    return false;
+  }
+  if (cache->count == cache->limit)
+    return false;
+
+  if (cache->count == cache->capacity)
+    grow_entries(cache);
+  if ((cache->count + 1) * 2 > cache->table_capacity) {
+    grow_table(cache);
+    slot = find_slot(cache, args, hash);
+  }
+  if (cache->arity > 0)
+    memcpy(cache->keys + (size_t)cache->count * cache->arity, args,
+           sizeof(Value) * cache->arity);
+  cache->done[cache->count] = false;
+  cache->hashes[cache->count] = hash;
+  cache->table[slot] = cache->count;
+  *entry = cache->count++;
+  return false;
+}
+
+void store_memo(MemoCache* cache, int entry, Value result) {
+  if (!is_memo_value(result))
+    return;
+  cache->results[entry] = result;
+  cache->done[entry] = true;
+}
+
+void print_memo_stats() {
+  printf("%-20s %10s %14s %14s\n", "memoized", "entries", "hits", "misses");
+  for (MemoCache* cache = caches; cache != NULL; cache = cache->next) {
+    printf("%-20s %10d %14llu %14llu\n", cache->name, cache->count,
+           (unsigned long long)cache->hits,
+           (unsigned long long)cache->misses);
+  }
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "value.h"
+
+// The results of a memoized function, keyed by its arguments. Codegen only
+// memoizes functions that are pure, so the same arguments always give the
+// same result.
+//
+// Keys and results are ints, doubles, bools, nil and strings, which cannot
+// change once made. A call with any other argument is not cached, and
+// neither is a result that is anything else, as an array that is handed out
+// again could have been changed in between. Doubles are compared bit for
+// bit, 1 / 0.0 and 1 / -0.0 are different results, and an int is never the
+// same key as a double.
+
+// The most entries a cache holds unless set_memo_limit changed it. Calls
+// that miss a full cache run without adding to it
+#define MEMO_DEFAULT_LIMIT (1 << 16)
+
+typedef struct MemoCache {
+  const char* name;
+  int arity;
+  // arity arguments for every entry
+  Value* keys;
+  Value* results;
+  // false while the call that makes the result is still running
+  bool* done;
+  uint32_t* hashes;
+  int count;
+  int capacity;
+  // Open addressing over the entries, -1 for empty slots
+  int* table;
+  int table_capacity;
+  int limit;
+  uint64_t hits;
+  uint64_t misses;
+  // Every cache that was made, for print_memo_stats
+  struct MemoCache* next;
+} MemoCache;
+
+MemoCache* make_memo_cache(const char* name, int arity);
+
+// On a hit, writes the result and returns true. On a miss, entry is set to
+// where store_memo puts the result once the call returns, -1 if the call
+// is not cached
+bool lookup_memo(MemoCache* cache, Value* args, Value* result, int* entry);
+void store_memo(MemoCache* cache, int entry, Value result);
+
+// For the caches made after it is called, at least 1
+void set_memo_limit(int limit);
+
+// The entries, hits and misses of every cache
+void print_memo_stats();
@@ -0,0 +1,458 @@
+#include "native.h"
+
+#include <float.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "kernels.h"
+#include "macros.h"
+#include "map.h"
+#include "object.h"
+
+static void print_value(Value value) {
+  if (IS_INT(value)) {
+    printf("%lld\n", (long long)AS_INT(value));
+  } else if (IS_NUMBER(value)) {
+    printf("%f\n", AS_NUMBER(value));
+  } else if (IS_BOOLEAN(value) && AS_BOOLEAN(value) == true) {
+    printf("true\n");
+  } else if (IS_BOOLEAN(value) && AS_BOOLEAN(value) == false) {
+    printf("false\n");
+  } else if (IS_OBJ(value) && AS_OBJ(value)->type == OBJ_FUNC) {
+    ObjFunc* func = (ObjFunc*)AS_OBJ(value);
+    printf("func arity: %d\n", func->arity);
+    print_obj_string(func->name);
+  } else if (IS_OBJ(value) && AS_OBJ(value)->type == OBJ_STRING) {
+    print_obj_string((ObjString*)AS_OBJ(value));
+  } else if (IS_ARRAY(value)) {
+    print_obj_array(AS_OBJ_ARRAY(value));
+  } else if (IS_FLOAT_ARRAY(value)) {
+    print_obj_float_array(AS_OBJ_FLOAT_ARRAY(value));
+  } else if (IS_MAP(value)) {
+    print_obj_map(AS_OBJ_MAP(value));
+  } else if (IS_RECORD(value)) {
+    print_obj_record(AS_OBJ_RECORD(value));
+  } else {
+    printf("this value is not anything\n");
+  }
+}
+
+static bool clock_native(int argument_count, Value* args, Value* result) {
+  UNUSED(argument_count);
+  UNUSED(args);
+  *result = NUMBER_VAL((double)clock() / CLOCKS_PER_SEC);
+  return true;
+}
+
+static bool die(int argument_count, Value* args, Value* result) {
+  UNUSED(argument_count);
+  UNUSED(args);
+  UNUSED(result);
+  exit(0);
+}
+
+static bool assert(int argument_count, Value* args, Value* result) {
+  UNUSED(argument_count);
+  Value first = args[0];
+  Value second = args[1];
+
+  if (IS_NUMERIC(first) && IS_NUMERIC(second)) {
+    double first_number = AS_NUMERIC(first);
+    double second_number = AS_NUMERIC(second);
+
+    // If not equal
+    if ((first_number - second_number) > DBL_EPSILON) {
+      printf("assert: %f != %f\n", first_number, second_number);
+      exit(1);
+    }
+  }
+
+  if (IS_BOOLEAN(first) && IS_BOOLEAN(second)) {
+    bool first_bool = AS_BOOLEAN(first);
+    bool second_bool = AS_BOOLEAN(second);
+
+    if (first_bool != second_bool) {
+      char* first_string = first_bool ? "true" : "false";
+      char* second_string = second_bool ? "true" : "false";
+
+      printf("assert: %s != %s\n", first_string, second_string);
+      exit(1);
+    }
+  }
+
+  *result = BOOLEAN_VAL(false);
+  return true;
+}
+
+static bool print_v(int argument_count, Value* args, Value* result) {
+  for (int i = 0; i < argument_count; i++) {
+    print_value(*(args + i));
+  }
+  *result = NIL_VAL;
+  return true;
+}
+
+// Length of an array or a string, or the number of keys in a map
+static bool len(int argument_count, Value* args, Value* result) {
+  UNUSED(argument_count);
+  if (IS_ARRAY(args[0])) {
+    *result = INT_VAL(AS_OBJ_ARRAY(args[0])->values.count);
+  } else if (IS_FLOAT_ARRAY(args[0])) {
+    *result = INT_VAL(AS_OBJ_FLOAT_ARRAY(args[0])->count);
+  } else if (IS_STRING(args[0])) {
+    *result = INT_VAL((AS_OBJ_STRING(args[0]))->length);
+  } else if (IS_MAP(args[0])) {
+    *result = INT_VAL(AS_OBJ_MAP(args[0])->count);
+  } else {
+    printf("len: takes an array, a string or a map\n");
+    return false;
+  }
+  return true;
+}
+
+// Appends to the end of the array, amortized O(1)
+static bool push(int argument_count, Value* args, Value* result) {
+  UNUSED(argument_count);
+  if (IS_FLOAT_ARRAY(args[0]) && IS_NUMERIC(args[1])) {
+    push_obj_float_array(AS_OBJ_FLOAT_ARRAY(args[0]), AS_NUMERIC(args[1]));
+  } else if (IS_ARRAY(args[0])) {
+    push_value_array(&AS_OBJ_ARRAY(args[0])->values, args[1]);
+  } else {
+    printf("push: takes an array, or a float array and a number\n");
+    return false;
+  }
+
+  *result = NIL_VAL;
+  return true;
+}
+
+// Removes the last element of the array and returns it
+static bool pop(int argument_count, Value* args, Value* result) {
+  UNUSED(argument_count);
+  if (IS_FLOAT_ARRAY(args[0])) {
+    ObjFloatArray* array = AS_OBJ_FLOAT_ARRAY(args[0]);
+    if (array->count == 0) {
+      printf("pop: the array is empty\n");
+      return false;
+    }
+    *result = NUMBER_VAL(array->values[--array->count]);
+    return true;
+  }
+
+  if (!IS_ARRAY(args[0])) {
+    printf("pop: takes an array\n");
+    return false;
+  }
+
+  ValueArray* values = &AS_OBJ_ARRAY(args[0])->values;
+  if (values->count == 0) {
+    printf("pop: the array is empty\n");
+    return false;
+  }
+
+  *result = values->values[--values->count];
+  return true;
+}
+
+// farray(n) is n zeros, farray(array) copies an array of numbers or
+// another float array
+static bool farray(int argument_count, Value* args, Value* result) {
+  UNUSED(argument_count);
+  Value from = args[0];
+  ObjFloatArray* array;
+
+  if (IS_INT(from) && AS_INT(from) >= 0 && AS_INT(from) <= INT32_MAX) {
+    array = make_obj_float_array(AS_INT(from));
+  } else if (IS_ARRAY(from)) {
+    ValueArray* values = &AS_OBJ_ARRAY(from)->values;
+    array = make_obj_float_array(values->count);
+    for (int i = 0; i < values->count; i++) {
+      if (!IS_NUMERIC(values->values[i])) {
+        printf("farray: element %d is not a number\n", i);
+        return false;
+      }
+      array->values[i] = AS_NUMERIC(values->values[i]);
+    }
+  } else if (IS_FLOAT_ARRAY(from)) {
+    ObjFloatArray* other = AS_OBJ_FLOAT_ARRAY(from);
+    array = make_obj_float_array(other->count);
+    memcpy(array->values, other->values, sizeof(double) * other->count);
+  } else {
+    printf("farray: takes a length, an array or a float array\n");
+    return false;
+  }
+
+  *result = OBJ_VAL(array);
+  return true;
+}
+
+static bool fsum(int argument_count, Value* args, Value* result) {
+  UNUSED(argument_count);
+  if (!IS_FLOAT_ARRAY(args[0])) {
+    printf("fsum: takes a float array\n");
+    return false;
+  }
+
+  ObjFloatArray* array = AS_OBJ_FLOAT_ARRAY(args[0]);
+  *result = NUMBER_VAL(get_kernels()->sum(array->values, array->count));
+  return true;
+}
+
+static bool fmin_native(int argument_count, Value* args, Value* result) {
+  UNUSED(argument_count);
+  if (!IS_FLOAT_ARRAY(args[0]) || AS_OBJ_FLOAT_ARRAY(args[0])->count == 0) {
+    printf("fmin: takes a float array that is not empty\n");
+    return false;
+  }
+
+  ObjFloatArray* array = AS_OBJ_FLOAT_ARRAY(args[0]);
+  *result = NUMBER_VAL(get_kernels()->min(array->values, array->count));
+  return true;
+}
+
+static bool fmax_native(int argument_count, Value* args, Value* result) {
+  UNUSED(argument_count);
+  if (!IS_FLOAT_ARRAY(args[0]) || AS_OBJ_FLOAT_ARRAY(args[0])->count == 0) {
+    printf("fmax: takes a float array that is not empty\n");
+    return false;
+  }
+
+  ObjFloatArray* array = AS_OBJ_FLOAT_ARRAY(args[0]);
+  *result = NUMBER_VAL(get_kernels()->max(array->values, array->count));
+  return true;
+}
+
+// Both are float arrays of the same length
+static bool same_length_float_arrays(const char* name, Value a, Value b) {
+  if (!IS_FLOAT_ARRAY(a) || !IS_FLOAT_ARRAY(b)) {
+    printf("%s: takes two float arrays\n", name);
+    return false;
+  }
+  if (AS_OBJ_FLOAT_ARRAY(a)->count != AS_OBJ_FLOAT_ARRAY(b)->count) {
+    printf("%s: the float arrays have different lengths\n", name);
+    return false;
+  }
+  return true;
+}
+
+static bool fdot(int argument_count, Value* args, Value* result) {
+  UNUSED(argument_count);
+  if (!same_length_float_arrays("fdot", args[0], args[1]))
+    return false;
+
+  ObjFloatArray* a = AS_OBJ_FLOAT_ARRAY(args[0]);
+  ObjFloatArray* b = AS_OBJ_FLOAT_ARRAY(args[1]);
+  *result = NUMBER_VAL(get_kernels()->dot(a->values, b->values, a->count));
+  return true;
+}
+
+// fscale, fadd and fmul write into their first argument and return it
+static bool fscale(int argument_count, Value* args, Value* result) {
+  UNUSED(argument_count);
+  if (!IS_FLOAT_ARRAY(args[0]) || !IS_NUMERIC(args[1])) {
+    printf("fscale: takes a float array and a number\n");
+    return false;
+  }
+
+  ObjFloatArray* array = AS_OBJ_FLOAT_ARRAY(args[0]);
+  get_kernels()->scale(array->values, AS_NUMERIC(args[1]), array->count);
+  *result = args[0];
+  return true;
+}
+
+static bool fadd(int argument_count, Value* args, Value* result) {
+  UNUSED(argument_count);
+  if (!same_length_float_arrays("fadd", args[0], args[1]))
+    return false;
+
+  ObjFloatArray* a = AS_OBJ_FLOAT_ARRAY(args[0]);
+  ObjFloatArray* b = AS_OBJ_FLOAT_ARRAY(args[1]);
+  get_kernels()->add(a->values, b->values, a->count);
+  *result = args[0];
+  return true;
+}
+
+static bool fmul(int argument_count, Value* args, Value* result) {
+  UNUSED(argument_count);
+  if (!same_length_float_arrays("fmul", args[0], args[1]))
+    return false;
+
+  ObjFloatArray* a = AS_OBJ_FLOAT_ARRAY(args[0]);
+  ObjFloatArray* b = AS_OBJ_FLOAT_ARRAY(args[1]);
+  get_kernels()->mul(a->values, b->values, a->count);
+  *result = args[0];
+  return true;
+}
+
+// A map and a key it can hold
+static bool map_and_key(const char* name, Value map, Value key) {
+  if (!IS_MAP(map)) {
+    printf("%s: takes a map\n", name);
+    return false;
+  }
+  if (!is_map_key(key)) {
+    printf("%s: map keys have to be strings or numbers\n", name);
+    return false;
+  }
+  return true;
+}
+
+// map() is an empty map, map(n) has room for n keys before it grows
+static bool map(int argument_count, Value* args, Value* result) {
+  int capacity = 0;
+  if (argument_count == 1 && IS_INT(args[0]) && AS_INT(args[0]) >= 0 &&
+      AS_INT(args[0]) <= INT32_MAX / 4) {
+    capacity = AS_INT(args[0]);
+  } else if (argument_count != 0) {
+    printf("map: takes nothing, or how many keys to make room for\n");
+    return false;
+  }
+
+  *result = OBJ_VAL(make_obj_map(capacity));
+  return true;
+}
+
+static bool contains(int argument_count, Value* args, Value* result) {
+  UNUSED(argument_count);
+  if (!map_and_key("contains", args[0], args[1]))
+    return false;
+
+  Value value;
+  *result = BOOLEAN_VAL(get_obj_map(AS_OBJ_MAP(args[0]), args[1], &value));
+  return true;
+}
+
+// The value of the key, or the default when the key is not in the map
+static bool get(int argument_count, Value* args, Value* result) {
+  UNUSED(argument_count);
+  if (!map_and_key("get", args[0], args[1]))
+    return false;
+
+  if (!get_obj_map(AS_OBJ_MAP(args[0]), args[1], result))
+    *result = args[2];
+  return true;
+}
+
+// Returns whether the key was in the map
+static bool delete(int argument_count, Value* args, Value* result) {
+  UNUSED(argument_count);
+  if (!map_and_key("delete", args[0], args[1]))
+    return false;
+
+  *result = BOOLEAN_VAL(delete_obj_map(AS_OBJ_MAP(args[0]), args[1]));
+  return true;
+}
+
+// The keys in the order of the table, which is not the insertion order
+static bool keys(int argument_count, Value* args, Value* result) {
+  UNUSED(argument_count);
+  if (!IS_MAP(args[0])) {
+    printf("keys: takes a map\n");
+    return false;
+  }
+
+  ObjMap* map = AS_OBJ_MAP(args[0]);
+  ObjArray* array = make_obj_array(map->count);
+  for (int i = 0; i < map->capacity; i++) {
+    if (!IS_NIL(map->entries[i].key))
+      push_value_array(&array->values, map->entries[i].key);
+  }
+  *result = OBJ_VAL(array);
+  return true;
+}
+
+// A record with no fields, p.x = value adds them
+static bool record(int argument_count, Value* args, Value* result) {
+  UNUSED(argument_count);
+  UNUSED(args);
+  *result = OBJ_VAL(make_obj_record());
+  return true;
+}
+
+// Natives that come with the language, to add another built-in native,
+// add it to this table
+static const Native builtin_natives[] = {
+    {"clock", 0, NATIVE_NONE, clock_native},
+    {"assert", 2, NATIVE_SIDE_EFFECT, assert},
+    {"die", 0, NATIVE_SIDE_EFFECT, die},
+    {"print_v", VARIADIC, NATIVE_SIDE_EFFECT, print_v},
+    // Arrays are mutable, what len returns depends on more than the
+    // argument itself, so none of these are pure
+    {"len", 1, NATIVE_NONE, len},
+    {"push", 2, NATIVE_NONE, push},
+    {"pop", 1, NATIVE_NONE, pop},
+    {"farray", 1, NATIVE_NONE, farray},
+    {"fsum", 1, NATIVE_NONE, fsum},
+    {"fmin", 1, NATIVE_NONE, fmin_native},
+    {"fmax", 1, NATIVE_NONE, fmax_native},
+    {"fdot", 2, NATIVE_NONE, fdot},
+    {"fscale", 2, NATIVE_NONE, fscale},
+    {"fadd", 2, NATIVE_NONE, fadd},
+    {"fmul", 2, NATIVE_NONE, fmul},
+    {"map", VARIADIC, NATIVE_NONE, map},
+    {"contains", 2, NATIVE_NONE, contains},
+    {"get", 3, NATIVE_NONE, get},
+    {"delete", 2, NATIVE_NONE, delete},
+    {"keys", 1, NATIVE_NONE, keys},
+    {"record", 0, NATIVE_NONE, record},
+};
+
+static Native natives[MAX_NATIVES];
+static int natives_count = 0;
+
+// The built-in natives always take up the first indexes of the registry
+static void register_builtin_natives() {
+  if (natives_count != 0)
+    return;
+
+  int builtin_count = sizeof(builtin_natives) / sizeof(builtin_natives[0]);
+  for (int i = 0; i < builtin_count; i++) {
+    natives[natives_count++] = builtin_natives[i];
+  }
+}
+
+int register_native(const char* name, int arity, int flags, NativeFunc func) {
+  register_builtin_natives();
+
+  if (natives_count == MAX_NATIVES) {
+    printf("Tried to register more than %d natives\n", MAX_NATIVES);
+    return -1;
+  }
+
+  if (find_native(name, strlen(name)) != -1) {
+    printf("There already is a native named %s\n", name);
+    return -1;
+  }
+
+  Native* native = &natives[natives_count];
+  native->name = name;
+  native->arity = arity;
+  native->flags = flags;
+  native->func = func;
+  return natives_count++;
+}
+
+int find_native(const char* name, int length) {
+  register_builtin_natives();
+
+  for (int i = 0; i < natives_count; i++) {
+    if ((int)strlen(natives[i].name) == length &&
+        memcmp(natives[i].name, name, length) == 0) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+Native* get_native(int index) {
+  register_builtin_natives();
+  return &natives[index];
+}
+
+int native_count() {
+  register_builtin_natives();
+  return natives_count;
+}
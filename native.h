@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "value.h"
+
+// Native indexes are emitted as a single operand of OP_CALL_NATIVE
+#define MAX_NATIVES (UINT8_MAX + 1)
+
+// Arity for natives that take any number of arguments
+#define VARIADIC -1
+
+typedef enum {
+  NATIVE_NONE = 0,
+  // Always returns the same value for the same arguments, and does not
+  // touch anything outside of its arguments
+  NATIVE_PURE = 1 << 0,
+  // Does io, exits, or otherwise changes something outside of the vm
+  NATIVE_SIDE_EFFECT = 1 << 1,
+} NativeFlag;
+
+// Natives write their return value to result, returning false signals a
+// runtime error, in which case the native prints out what went wrong
+typedef bool (*NativeFunc)(int argument_count, Value* args, Value* result);
+
+typedef struct {
+  const char* name;
+  // Checked before the native is called, VARIADIC to skip the check
+  int arity;
+  // NativeFlag bits
+  int flags;
+  NativeFunc func;
+} Native;
+
+// The registry is shared by everything in the process, the codegen binds
+// calls to natives by name, and init_vm defines every registered native
+// as a global. Hosts register their natives before compiling code that
+// calls them.
+// Returns the index of the native, or -1 if the name is already taken
+// or the registry is full
+int register_native(const char* name, int arity, int flags, NativeFunc func);
+
+// Returns the index of the native with this name, -1 if there is none
+int find_native(const char* name, int length);
+
+Native* get_native(int index);
+int native_count();
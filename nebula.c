@@ -0,0 +1,110 @@
+#include "nebula.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "array.h"
+#include "codegen.h"
+#include "debugging.h"
+#include "hashmap.h"
+#include "lexer.h"
+#include "native.h"
+#include "parser.h"
+
+void init_nebula(Nebula* nebula) {
+  init_vm(&nebula->vm);
+}
+
+void free_nebula(Nebula* nebula) {
+  free_vm(&nebula->vm);
+}
+
+bool nebula_register_native(Nebula* nebula,
+                            const char* name,
+                            int arity,
+                            int flags,
+                            NativeFunc func) {
+  int native_index = register_native(name, arity, flags, func);
+  if (native_index == -1)
+    return false;
+
+  define_native(&nebula->vm, native_index);
+  return true;
+}
+
+bool nebula_load(Nebula* nebula, const char* source) {
+  TokenArray token_array;
+  init_token_array(&token_array);
+  lex_source(&token_array, source);
+
+  ErrorArray error_array;
+  init_error_array(&error_array);
+
+  AstArray ast_array;
+  init_ast_array(&ast_array);
+
+  parse_tokens(&token_array, &ast_array, &error_array);
+
+  if (error_array.count > 0) {
+    for (int i = 0; i < error_array.count; i++) {
+      print_error(error_array.errors[i]);
+    }
+    free_token_array(&token_array);
+    free_error_array(&error_array);
+    return false;
+  }
+
+  ObjFunc* main_func = codegen(&ast_array, &nebula->vm);
+
+  free_token_array(&token_array);
+  free_error_array(&error_array);
+  if (main_func == NULL)
+    return false;
+
+  // Hosts only get the output of the script itself, none of the dumps
+  bool arguments[TOTAL_FLAGS] = {0};
+  return run(arguments, &nebula->vm, main_func);
+}
+
+bool nebula_get_func(Nebula* nebula, const char* name, NebulaFunc* func) {
+  Value callee = nebula_get_global(nebula, name);
+
+  if (IS_FUNC(callee)) {
+    func->callee = callee;
+    func->arity = ((ObjFunc*)AS_OBJ(callee))->arity;
+    return true;
+  }
+
+  if (IS_NATIVE_FUNC(callee)) {
+    func->callee = callee;
+    func->arity = AS_OBJ_NATIVE(callee)->arity;
+    return true;
+  }
+
+  return false;
+}
+
+Value nebula_get_global(Nebula* nebula, const char* name) {
+  ObjString* key = make_obj_string(name, strlen(name));
+  Value value = get_hashmap(&nebula->vm.variables, key);
+
+  // The key is only needed for the lookup
+  free_obj_string(key);
+  return value;
+}
+
+bool nebula_call(Nebula* nebula,
+                 NebulaFunc* func,
+                 int argument_count,
+                 Value* args,
+                 Value* result) {
+  // The arity is checked here once, so that a mismatch never gets as far
+  // as setting up a frame
+  if (func->arity != -1 && func->arity != argument_count) {
+    printf("Arity count and function argument_count differs\n");
+    return false;
+  }
+
+  return call_func(&nebula->vm, func->callee, argument_count, args, result);
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "native.h"
+#include "object.h"
+#include "value.h"
+#include "vm.h"
+
+// Embedding API, for hosts that want to call into nebula code from C.
+//
+// Nebula nebula;
+// init_nebula(&nebula);
+// nebula_load(&nebula, "func add(a, b) { return a + b; }");
+//
+// NebulaFunc add;
+// nebula_get_func(&nebula, "add", &add);
+//
+// Value args[2] = {NUMBER_VAL(1), NUMBER_VAL(2)};
+// Value result;
+// nebula_call(&nebula, &add, 2, args, &result);
+//
+// free_nebula(&nebula);
+
+typedef struct {
+  Vm vm;
+} Nebula;
+
+// A handle to a function that is resolved once by nebula_get_func and can
+// be called over and over without looking it up again
+typedef struct {
+  Value callee;
+  // VARIADIC for natives that take any number of arguments
+  int arity;
+} NebulaFunc;
+
+void init_nebula(Nebula* nebula);
+void free_nebula(Nebula* nebula);
+
+// Adds a native written in C, the native can be called by any code that
+// is loaded after this. Returns false if the name is already taken
+bool nebula_register_native(Nebula* nebula,
+                            const char* name,
+                            int arity,
+                            int flags,
+                            NativeFunc func);
+
+// Compiles the source and runs its top-level code, so that the functions
+// and globals it declares can be looked up afterwards.
+// Returns false on syntax or runtime errors
+bool nebula_load(Nebula* nebula, const char* source);
+
+// Looks up a global function or native by name
+bool nebula_get_func(Nebula* nebula, const char* name, NebulaFunc* func);
+
+// Reads a global variable, nil if it does not exist
+Value nebula_get_global(Nebula* nebula, const char* name);
+
+// Calls the function with the arguments, the returned value is written to
+// result. Returns false on an arity mismatch or a runtime error
+bool nebula_call(Nebula* nebula,
+                 NebulaFunc* func,
+                 int argument_count,
+                 Value* args,
+                 Value* result);
@@ -1,15 +1,31 @@
 #include "object.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "hash.h"
 #include "macros.h"
+#include "shape.h"
 
 bool is_obj_type(Value value, ObjType type) {
   return IS_OBJ(value) && AS_OBJ(value)->type == type;
 }
 
+// Every string is a single allocation, the header followed by its
+// characters. All the ways of making a string go through here, strings
+// made by concatenation allocate no characters, they point into a
+// StringBuffer instead
+static ObjString* allocate_obj_string(int inline_length) {
+  ObjString* obj_string =
+      (ObjString*)malloc(sizeof(ObjString) + sizeof(char) * inline_length);
+  obj_string->obj.type = OBJ_STRING;
+  obj_string->buffer = NULL;
+  // Hashed the first time it is needed, most strings never end up as keys
+  obj_string->hash = 0;
+  return obj_string;
+}
+
 // The length is needed here because for a lot of the program internals
 // there is the start of the characters, 'chars' in this case
 // can refer to a random middle point of a very long string,
@@ -17,60 +33,42 @@ bool is_obj_type(Value value, ObjType type) {
 // in the cases where the length is very obvious (such as in test.c)
 // another function can be used for it.
 ObjString* make_obj_string(const char* chars, int length) {
-  ObjString* obj_string = ALLOCATE(ObjString, 1);
+  ObjString* obj_string = allocate_obj_string(length + 1);
 
-  // Create a new string, add c string delimiter
-  char* new_string = ALLOCATE(char, length + 1);
-  strncpy(new_string, chars, length);
-  new_string[length] = '\0';
+  // Copy the characters in, add c string delimiter
+  memcpy(obj_string->inline_chars, chars, length);
+  obj_string->inline_chars[length] = '\0';
 
-  obj_string->obj.type = OBJ_STRING;
   obj_string->length = length;
-  obj_string->chars = new_string;
-  obj_string->hash = fnv_hash32(new_string, length);
+  obj_string->chars = obj_string->inline_chars;
 
   return obj_string;
 }
 
 // This is for when the length can be determined using strlen()
 ObjString* make_obj_string_sl(const char* chars) {
-  ObjString* obj_string = ALLOCATE(ObjString, 1);
-
-  int length = strlen(chars);
-
-  // Create a new string, add c string delimiter
-  char* new_string = ALLOCATE(char, length + 1);
-  strncpy(new_string, chars, length);
-  new_string[length] = '\0';
-
-  obj_string->obj.type = OBJ_STRING;
-  obj_string->length = length;
-  obj_string->chars = new_string;
-  obj_string->hash = fnv_hash32(new_string, length);
-
-  return obj_string;
+  return make_obj_string(chars, strlen(chars));
 }
 
 ObjString* make_obj_string_from_token(Token token) {
-  ObjString* obj_string = ALLOCATE(ObjString, 1);
-
-  int length = token.length;
-
-  char* new_string = ALLOCATE(char, length + 1);
-  strncpy(new_string, token.start, length);
-  new_string[length] = '\0';
+  return make_obj_string(token.start, token.length);
+}
 
-  obj_string->obj.type = OBJ_STRING;
-  obj_string->length = length;
-  obj_string->chars = new_string;
-  obj_string->hash = fnv_hash32(new_string, length);
+uint32_t compute_obj_string_hash(ObjString* obj_string) {
+  uint32_t hash = wy_hash32(obj_string->chars, obj_string->length);
+  // 0 is what strings that are not hashed yet have
+  obj_string->hash = hash == 0 ? 1 : hash;
+  return obj_string->hash;
+}
 
-  return obj_string;
+// Buffers are shared with other strings, only the string itself is freed
+void free_obj_string(ObjString* obj_string) {
+  free(obj_string);
 }
 
 void print_obj_string(ObjString* obj_string) {
   if (obj_string != NULL)
-    printf("%s\n", obj_string->chars);
+    printf("%.*s\n", obj_string->length, obj_string->chars);
 }
 
 // Token is a string, Value is a ObjString
@@ -108,28 +106,43 @@ bool obj_string_equals(ObjString* obj1, ObjString* obj2) {
   return true;
 }
 
-ObjString* concatenate_obj_string(ObjString* obj1, ObjString* obj2) {
-  ObjString* obj_string = ALLOCATE(ObjString, 1);
+// Smallest buffer that a concatenation starts off with
+#define MIN_STRING_BUFFER 16
+
+static StringBuffer* make_string_buffer(int capacity) {
+  StringBuffer* buffer =
+      (StringBuffer*)malloc(sizeof(StringBuffer) + sizeof(char) * capacity);
+  buffer->capacity = capacity;
+  buffer->length = 0;
+  return buffer;
+}
 
+ObjString* concatenate_obj_string(ObjString* obj1, ObjString* obj2) {
   int length = obj1->length + obj2->length;
 
-  // Create a new string
-  char* new_string = ALLOCATE(char, length + 1);
-  // Add the first obj characters
-  for (int i = 0; i < obj1->length; i++) {
-    new_string[i] = obj1->chars[i];
-  }
-  // Add the second obj characters
-  for (int i = obj1->length; i < length; i++) {
-    new_string[i] = obj2->chars[i - obj1->length];
+  // obj1 is the longest string in its buffer, nothing else has written
+  // past it, so obj2 can go right after it
+  StringBuffer* buffer = obj1->buffer;
+  bool append_in_place = buffer != NULL && obj1->chars == buffer->chars &&
+                         obj1->length == buffer->length &&
+                         length + 1 <= buffer->capacity;
+
+  if (!append_in_place) {
+    // The old buffer is left as it is, the strings that are already in it
+    // still point into it. Doubling keeps the copying linear overall
+    buffer = make_string_buffer(MAX(MIN_STRING_BUFFER, length * 2 + 1));
+    memcpy(buffer->chars, obj1->chars, obj1->length);
   }
-  // Add the delimiter
-  new_string[length] = '\0';
 
-  obj_string->obj.type = OBJ_STRING;
+  // obj2 can be in the same buffer, but always before where this writes to
+  memcpy(buffer->chars + obj1->length, obj2->chars, obj2->length);
+  buffer->chars[length] = '\0';
+  buffer->length = length;
+
+  ObjString* obj_string = allocate_obj_string(0);
   obj_string->length = length;
-  obj_string->chars = new_string;
-  obj_string->hash = fnv_hash32(new_string, length);
+  obj_string->chars = buffer->chars;
+  obj_string->buffer = buffer;
 
   return obj_string;
 }
@@ -137,7 +150,9 @@ ObjString* concatenate_obj_string(ObjString* obj1, ObjString* obj2) {
 ObjFunc* make_obj_func(int arity, ObjString* name) {
   ObjFunc* obj_func = ALLOCATE(ObjFunc, 1);
   obj_func->arity = arity;
+  obj_func->slot_count = 0;
   obj_func->name = name;
+  obj_func->memo = NULL;
   obj_func->obj.type = OBJ_FUNC;
   init_chunk(&obj_func->chunk);
   return obj_func;
@@ -147,9 +162,10 @@ void print_func(ObjFunc* func) {
   printf("<func %s>", func->name->chars);
 }
 
-ObjNative* make_obj_native_func(NativeFunc func) {
+ObjNative* make_obj_native_func(NativeFunc func, int arity) {
   ObjNative* native_func = ALLOCATE(ObjNative, 1);
   native_func->func = func;
+  native_func->arity = arity;
   native_func->obj.type = OBJ_NATIVE_FUNC;
   return native_func;
 }
@@ -157,3 +173,145 @@ ObjNative* make_obj_native_func(NativeFunc func) {
 void print_native_func(ObjNative* native_func) {
   printf("<native func>");
 }
+
+ObjArray* make_obj_array(int capacity) {
+  ObjArray* array = ALLOCATE(ObjArray, 1);
+  array->obj.type = OBJ_ARRAY;
+  init_value_array(&array->values);
+  // push_value_array grows by doubling, which needs at least 1
+  reserve_value_array(&array->values, MAX(capacity, 1));
+  return array;
+}
+
+static void print_array_element(Value value) {
+  if (IS_INT(value)) {
+    printf("%lld", (long long)AS_INT(value));
+  } else if (IS_NUMBER(value)) {
+    printf("%f", AS_NUMBER(value));
+  } else if (IS_BOOLEAN(value)) {
+    printf(AS_BOOLEAN(value) ? "true" : "false");
+  } else if (IS_NIL(value)) {
+    printf("nil");
+  } else if (IS_STRING(value)) {
+    ObjString* obj_string = AS_OBJ_STRING(value);
+    printf("\"%.*s\"", obj_string->length, obj_string->chars);
+  } else if (IS_ARRAY(value) || IS_FLOAT_ARRAY(value)) {
+    // Nested arrays are left out, an array can contain itself
+    printf("[...]");
+  } else if (IS_MAP(value)) {
+    printf("{...}");
+  } else if (IS_RECORD(value)) {
+    printf("record{...}");
+  } else {
+    printf("<func>");
+  }
+}
+
+// [1, 2, "three"]
+void print_obj_array(ObjArray* array) {
+  printf("[");
+  for (int i = 0; i < array->values.count; i++) {
+    if (i != 0)
+      printf(", ");
+    print_array_element(array->values.values[i]);
+  }
+  printf("]\n");
+}
+
+// The size of an avx vector
+#define FLOAT_ARRAY_ALIGNMENT 32
+
+static double* allocate_floats(int capacity) {
+  // aligned_alloc takes a size that is a multiple of the alignment
+  size_t size = sizeof(double) * capacity;
+  size = (size + FLOAT_ARRAY_ALIGNMENT - 1) /
+         FLOAT_ARRAY_ALIGNMENT * FLOAT_ARRAY_ALIGNMENT;
+  return (double*)aligned_alloc(FLOAT_ARRAY_ALIGNMENT, size);
+}
+
+ObjFloatArray* make_obj_float_array(int count) {
+  ObjFloatArray* array = ALLOCATE(ObjFloatArray, 1);
+  array->obj.type = OBJ_FLOAT_ARRAY;
+  array->count = count;
+  array->capacity = MAX(count, 4);
+  array->values = allocate_floats(array->capacity);
+  memset(array->values, 0, sizeof(double) * count);
+  return array;
+}
+
+void push_obj_float_array(ObjFloatArray* array, double value) {
+  if (array->count == array->capacity) {
+    // realloc does not keep the alignment
+    int capacity = array->capacity * 2;
+    double* values = allocate_floats(capacity);
+    memcpy(values, array->values, sizeof(double) * array->count);
+    free(array->values);
+    array->values = values;
+    array->capacity = capacity;
+  }
+  array->values[array->count++] = value;
+}
+
+void print_obj_float_array(ObjFloatArray* array) {
+  printf("farray[");
+  for (int i = 0; i < array->count; i++) {
+    printf(i == 0 ? "%f" : ", %f", array->values[i]);
+  }
+  printf("]\n");
+}
+
+void print_obj_map(ObjMap* map) {
+  printf("{");
+  bool first = true;
+  for (int i = 0; i < map->capacity; i++) {
+    MapEntry* entry = &map->entries[i];
+    if (IS_NIL(entry->key))
+      continue;
+    if (!first)
+      printf(", ");
+    first = false;
+    print_array_element(entry->key);
+    printf(": ");
+    print_array_element(entry->value);
+  }
+  printf("}\n");
+}
+
+ObjRecord* make_obj_record() {
+  ObjRecord* record = ALLOCATE(ObjRecord, 1);
+  record->obj.type = OBJ_RECORD;
+  record->shape = empty_shape();
+  record->capacity = 0;
+  record->fields = NULL;
+  return record;
+}
+
+void push_obj_record_field(ObjRecord* record, Shape* shape, Value value) {
+  if (shape->field_count > record->capacity) {
+    record->capacity = MAX(record->capacity * 2, 4);
+    record->fields =
+        (Value*)realloc(record->fields, sizeof(Value) * record->capacity);
+  }
+  record->shape = shape;
+  record->fields[shape->field_count - 1] = value;
+}
+
+void print_obj_record(ObjRecord* record) {
+  // The shape chain goes from the last field to the first
+  int count = record->shape->field_count;
+  ObjString** names = ALLOCATE(ObjString*, MAX(count, 1));
+  for (Shape* shape = record->shape; shape->name != NULL;
+       shape = shape->parent) {
+    names[shape->field_count - 1] = shape->name;
+  }
+
+  printf("record{");
+  for (int i = 0; i < count; i++) {
+    if (i != 0)
+      printf(", ");
+    printf("%.*s: ", names[i]->length, names[i]->chars);
+    print_array_element(record->fields[i]);
+  }
+  printf("}\n");
+  free(names);
+}
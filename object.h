@@ -3,6 +3,8 @@
 #include <stdint.h>
 
 #include "chunk.h"
+#include "memo.h"
+#include "native.h"
 #include "token.h"
 #include "value.h"
 
@@ -17,6 +19,10 @@ typedef enum {
   OBJ_STRING,
   OBJ_FUNC,
   OBJ_NATIVE_FUNC,
+  OBJ_ARRAY,
+  OBJ_FLOAT_ARRAY,
+  OBJ_MAP,
+  OBJ_RECORD,
 } ObjType;
 
 // No need to type define this again, as value as done
@@ -24,33 +30,127 @@ struct Obj {
   ObjType type;
 };
 
+// Storage shared by the strings that concatenation makes. Appending to the
+// string that ends where the used part of the buffer ends writes into the
+// buffer in place, as the strings before it only read up to their own
+// length, which is what makes `s = s + x` in a loop linear
+typedef struct {
+  int capacity;
+  int length;
+  char chars[];
+} StringBuffer;
+
 typedef struct {
   Obj obj;
   int length;
-  char* chars;
+  // 0 until hash_obj_string is first called on it
   uint32_t hash;
+  // Points to inline_chars, or into the buffer for concatenations.
+  // Strings in a StringBuffer are not always terminated at their length,
+  // the length needs to be used to read them
+  char* chars;
+  // NULL unless chars points into a StringBuffer
+  StringBuffer* buffer;
+  // The characters are allocated together with the string
+  char inline_chars[];
 } ObjString;
 
 typedef struct {
   Obj obj;
   int arity;
+  // The most values the function has on the stack at once, slot 0, the
+  // parameters, locals and the temporaries of expressions, the vm checks
+  // that there is room for them on a call
+  int slot_count;
   Chunk chunk;
   ObjString* name;
+  // The results of earlier calls, NULL unless the function is memoized
+  MemoCache* memo;
 } ObjFunc;
 
-typedef Value (*NativeFunc)(int arg_count, Value* args);
 typedef struct {
   Obj obj;
   NativeFunc func;
+  int arity;
 } ObjNative;
 
+// The elements are stored contiguously, push_value_array doubles the
+// capacity so appending is amortized O(1)
+typedef struct {
+  Obj obj;
+  ValueArray values;
+} ObjArray;
+
+// Raw doubles instead of Values, for the float array natives that run
+// kernels.h over them. The buffer is aligned for vector loads
+typedef struct {
+  Obj obj;
+  int count;
+  int capacity;
+  double* values;
+} ObjFloatArray;
+
+// A nil key is an empty slot, or a tombstone when the value is true
+typedef struct {
+  Value key;
+  Value value;
+  // Kept so that growing the table and probing past other keys do not
+  // hash or compare strings again
+  uint32_t hash;
+} MapEntry;
+
+// Open addressing with linear probing, map.h has the operations
+typedef struct {
+  Obj obj;
+  // Keys in the map
+  int count;
+  // Keys and tombstones, the load factor counts both as they both make
+  // probes longer
+  int used;
+  // A power of two, or 0 before the first key
+  int capacity;
+  MapEntry* entries;
+} ObjMap;
+
+// The fields records have and the slot each one is in. Records that get
+// the same fields added in the same order share their shapes, see shape.h
+typedef struct Shape Shape;
+struct Shape {
+  Shape* parent;
+  // The field this shape adds to its parent, NULL for the empty shape
+  ObjString* name;
+  // Fields of records with this shape, name is in slot field_count - 1
+  int field_count;
+  // The shapes that add one more field to this one
+  Shape** transitions;
+  int transition_count;
+  int transition_capacity;
+};
+
+// Only the values are stored per record, the names are in the shape
+typedef struct {
+  Obj obj;
+  Shape* shape;
+  int capacity;
+  Value* fields;
+} ObjRecord;
+
 #define IS_STRING(value) (is_obj_type(value, OBJ_STRING))
+#define IS_ARRAY(value) (is_obj_type(value, OBJ_ARRAY))
+#define IS_FLOAT_ARRAY(value) (is_obj_type(value, OBJ_FLOAT_ARRAY))
+#define IS_MAP(value) (is_obj_type(value, OBJ_MAP))
+#define IS_RECORD(value) (is_obj_type(value, OBJ_RECORD))
 #define IS_FUNC(value) (is_obj_type(value, OBJ_FUNC))
 #define IS_NATIVE_FUNC(value) (is_obj_type(value, OBJ_NATIVE_FUNC))
 
 #define AS_OBJ_STRING(value) (ObjString*)AS_OBJ(value)
 #define AS_OBJ_FUNC(value) (ObjFunc*)AS_OBJ(value)
+#define AS_OBJ_NATIVE(value) ((ObjNative*)AS_OBJ(value))
 #define AS_OBJ_NATIVE_FUNC(value) (((ObjNative*)AS_OBJ(value))->func)
+#define AS_OBJ_ARRAY(value) ((ObjArray*)AS_OBJ(value))
+#define AS_OBJ_FLOAT_ARRAY(value) ((ObjFloatArray*)AS_OBJ(value))
+#define AS_OBJ_MAP(value) ((ObjMap*)AS_OBJ(value))
+#define AS_OBJ_RECORD(value) ((ObjRecord*)AS_OBJ(value))
 
 bool is_obj_type(Value value, ObjType type);
 
@@ -60,6 +160,16 @@ bool is_obj_type(Value value, ObjType type);
 ObjString* make_obj_string(const char* chars, int length);
 ObjString* make_obj_string_sl(const char* chars);
 ObjString* make_obj_string_from_token(Token token);
+void free_obj_string(ObjString* obj_string);
+
+uint32_t compute_obj_string_hash(ObjString* obj_string);
+
+// Strings are hashed lazily, the first time the hash is asked for
+static inline uint32_t hash_obj_string(ObjString* obj_string) {
+  if (obj_string->hash != 0)
+    return obj_string->hash;
+  return compute_obj_string_hash(obj_string);
+}
 void print_obj_string(ObjString* obj_string);
 void print_obj_string_without_quotes(ObjString* obj_string);
 bool token_value_equals(Token token, Value value);
@@ -69,5 +179,25 @@ ObjString* concatenate_obj_string(ObjString* obj1, ObjString* obj2);
 ObjFunc* make_obj_func(int arity, ObjString* name);
 void print_func(ObjFunc* func);
 
-ObjNative* make_obj_native_func(NativeFunc func);
+ObjNative* make_obj_native_func(NativeFunc func, int arity);
 void print_native_func(ObjNative* native_func);
+
+// An empty array with room for capacity elements
+ObjArray* make_obj_array(int capacity);
+void print_obj_array(ObjArray* array);
+
+// count zeros
+ObjFloatArray* make_obj_float_array(int count);
+void push_obj_float_array(ObjFloatArray* array, double value);
+void print_obj_float_array(ObjFloatArray* array);
+
+// {"a": 1, 2: "b"}, in the order of the table and not of insertion
+void print_obj_map(ObjMap* map);
+
+// A record with no fields
+ObjRecord* make_obj_record();
+// Moves the record to shape, which has one field more than its current
+// shape, and stores the value of that field
+void push_obj_record_field(ObjRecord* record, Shape* shape, Value value);
+// record{x: 1, y: 2}, in the order the fields were added
+void print_obj_record(ObjRecord* record);
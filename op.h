@@ -27,7 +27,8 @@ typedef enum {
   OP_SET_LOCAL,  // 17
   OP_GET_LOCAL,  // 18
 
-  // To define function when declared
+  // Sets the global named by the constant to the value on the stack and
+  // pops it, for functions and top-level lets
   OP_DEFINE_GLOBAL,  // 19
 
   // Jumps
@@ -40,4 +41,73 @@ typedef enum {
 
   // NIL
   OP_NIL,  // 24
+
+  // Calls a native that was resolved at compile time
+  OP_CALL_NATIVE,  // 25
+
+  // Integer operators
+  OP_MODULO,       // 26
+  OP_BIT_AND,      // 27
+  OP_BIT_OR,       // 28
+  OP_BIT_XOR,      // 29
+  OP_SHIFT_LEFT,   // 30
+  OP_SHIFT_RIGHT,  // 31
+  OP_BIT_NOT,      // 32
+
+  // Arrays
+  OP_ARRAY,      // 33
+  OP_INDEX_GET,  // 34
+  OP_INDEX_SET,  // 35
+
+  // Maps, indexing them goes through OP_INDEX_GET and OP_INDEX_SET
+  OP_MAP,  // 36
+
+  // Records, the operands are the constant with the field name and an
+  // index into the chunk's field caches, both two bytes
+  OP_GET_FIELD,  // 37
+  OP_SET_FIELD,  // 38
+
+  // OP_JUMP_IF_FALSE leaves the condition on the stack, which is what
+  // and/or need as it can be their result. Conditions of ifs and loops
+  // are only branched on, the POP_ forms take them off as they jump
+  OP_JUMP_IF_TRUE,       // 39
+  OP_POP_JUMP_IF_FALSE,  // 40
+  OP_POP_JUMP_IF_TRUE,   // 41
+
+  // The same as the ops without _WIDE, with a two byte operand, high byte
+  // first, for functions with more than 256 constants or locals. Codegen
+  // only uses them for operands that do not fit in one byte. The constant
+  // is the index itself, without the + 1 of OP_CONSTANT
+  OP_CONSTANT_WIDE,       // 42
+  OP_GET_LOCAL_WIDE,      // 43
+  OP_SET_LOCAL_WIDE,      // 44
+  OP_GET_GLOBAL_WIDE,     // 45
+  OP_SET_GLOBAL_WIDE,     // 46
+  OP_DEFINE_GLOBAL_WIDE,  // 47
+
+  // Inlined calls. OP_JUMP_IF_GLOBAL jumps when the global named by the
+  // first constant still holds the function in the second, the operands
+  // are the two constants and the jump, two bytes each. OP_POP_BELOW keeps
+  // the value on top and pops the operand's count of values under it
+  OP_JUMP_IF_GLOBAL,  // 48
+  OP_POP_BELOW,       // 49
+
+  // Arithmetic and comparisons on operands that codegen proved are numbers,
+  // they skip the checks for the other types. Ints still overflow into
+  // doubles
+  OP_ADD_NUMBER,       // 50
+  OP_SUBTRACT_NUMBER,  // 51
+  OP_MULTIPLY_NUMBER,  // 52
+  OP_DIVIDE_NUMBER,    // 53
+  OP_GREATER_NUMBER,   // 54
+  OP_LESS_NUMBER,      // 55
+
+  // Array and map literals with more elements than OP_ARRAY and OP_MAP can
+  // count are made in parts, these add the operand's count of elements, or
+  // of key value pairs, to the array or map under them
+  OP_ARRAY_EXTEND,  // 56
+  OP_MAP_EXTEND,    // 57
 } OpCode;
+
+// Keep this one past the last opcode
+#define OPCODE_COUNT (OP_MAP_EXTEND + 1)
@@ -0,0 +1,124 @@
+#include "opstats.h"
+
+#include "macros.h"
+
+#ifdef OPSTATS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "debugging.h"
+
+// How many of the most common pairs are printed
+#define OPSTATS_TOP_PAIRS 20
+
+OpStats opstats = {.previous = OPCODE_COUNT};
+
+void reset_opstats() {
+  memset(&opstats, 0, sizeof(opstats));
+  opstats.previous = OPCODE_COUNT;
+}
+
+uint64_t total_opstats() {
+  uint64_t total = 0;
+  for (int i = 0; i < OPCODE_COUNT; i++) {
+    total += opstats.counts[i];
+  }
+  return total;
+}
+
+static int compare_counts(const void* a, const void* b) {
+  uint64_t count_a = opstats.counts[*(const int*)a];
+  uint64_t count_b = opstats.counts[*(const int*)b];
+  return (count_a < count_b) - (count_a > count_b);
+}
+
+typedef struct {
+  int previous;
+  int current;
+  uint64_t count;
+} OpPair;
+
+static int compare_pairs(const void* a, const void* b) {
+  uint64_t count_a = ((const OpPair*)a)->count;
+  uint64_t count_b = ((const OpPair*)b)->count;
+  return (count_a < count_b) - (count_a > count_b);
+}
+
+static void print_cache_stats(const char* name,
+                              uint64_t hits,
+                              uint64_t misses) {
+  uint64_t total = hits + misses;
+  printf("%-20s %14llu hits %14llu misses %6.2f%%\n", name,
+         (unsigned long long)hits, (unsigned long long)misses,
+         total == 0 ? 0.0 : 100.0 * hits / total);
+}
+
+void print_opstats() {
+  uint64_t total = total_opstats();
+  if (total == 0)
+    total = 1;
+
+  int order[OPCODE_COUNT];
+  for (int i = 0; i < OPCODE_COUNT; i++) {
+    order[i] = i;
+  }
+  qsort(order, OPCODE_COUNT, sizeof(int), compare_counts);
+
+  printf("-----%s-----\n", "Opcode Stats");
+#ifdef OPSTATS_CYCLES
+  printf("%-20s %14s %7s %16s %10s\n", "opcode", "count", "%", "cycles",
+         "cycles/op");
+#else
+  printf("%-20s %14s %7s\n", "opcode", "count", "%");
+#endif
+  for (int i = 0; i < OPCODE_COUNT; i++) {
+    int op = order[i];
+    uint64_t count = opstats.counts[op];
+    if (count == 0)
+      break;
+
+#ifdef OPSTATS_CYCLES
+    printf("%-20s %14llu %6.2f%% %16llu %10.1f\n", opcode_name(op),
+           (unsigned long long)count, 100.0 * count / total,
+           (unsigned long long)opstats.cycles[op],
+           (double)opstats.cycles[op] / count);
+#else
+    printf("%-20s %14llu %6.2f%%\n", opcode_name(op),
+           (unsigned long long)count, 100.0 * count / total);
+#endif
+  }
+  printf("%-20s %14llu\n", "total", (unsigned long long)total_opstats());
+
+  OpPair* pairs = ALLOCATE(OpPair, OPCODE_COUNT * OPCODE_COUNT);
+  int pair_count = 0;
+  for (int previous = 0; previous < OPCODE_COUNT; previous++) {
+    for (int current = 0; current < OPCODE_COUNT; current++) {
+      uint64_t count = opstats.pairs[previous][current];
+      if (count == 0)
+        continue;
+      pairs[pair_count].previous = previous;
+      pairs[pair_count].current = current;
+      pairs[pair_count].count = count;
+      pair_count++;
+    }
+  }
+  qsort(pairs, pair_count, sizeof(OpPair), compare_pairs);
+
+  printf("-----%s-----\n", "Opcode Pairs");
+  for (int i = 0; i < pair_count && i < OPSTATS_TOP_PAIRS; i++) {
+    printf("%-20s -> %-20s %14llu %6.2f%%\n", opcode_name(pairs[i].previous),
+           opcode_name(pairs[i].current), (unsigned long long)pairs[i].count,
+           100.0 * pairs[i].count / total);
+  }
+  free(pairs);
+
+  printf("-----%s-----\n", "Inline Caches");
+  print_cache_stats("fields", opstats.field_cache_hits,
+                    opstats.field_cache_misses);
+  print_cache_stats("calls", opstats.call_cache_hits,
+                    opstats.call_cache_misses);
+}
+
+#endif
@@ -0,0 +1,91 @@
+#pragma once
+
+// Per-opcode counters for tuning the interpreter, only compiled in when
+// building with -DOPSTATS (make nebula-opstats), -DOPSTATS_CYCLES also
+// times every opcode with the cpu's timestamp counter.
+// Release builds have none of this, not even the calls from execute()
+#ifdef OPSTATS_CYCLES
+#ifndef OPSTATS
+#define OPSTATS
+#endif
+#endif
+
+#ifdef OPSTATS
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "op.h"
+
+#ifdef OPSTATS_CYCLES
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define OPSTATS_NOW() __rdtsc()
+#else
+#include <time.h>
+static inline uint64_t opstats_now() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+#define OPSTATS_NOW() opstats_now()
+#endif
+#endif
+
+typedef struct {
+  uint64_t counts[OPCODE_COUNT];
+  // pairs[previous][current]
+  uint64_t pairs[OPCODE_COUNT][OPCODE_COUNT];
+  // Cycles from the dispatch of an opcode to the dispatch of the next one
+  uint64_t cycles[OPCODE_COUNT];
+  // OPCODE_COUNT until the first opcode is dispatched
+  int previous;
+  uint64_t previous_time;
+  // Field accesses that found the shape of the record in their cache
+  uint64_t field_cache_hits;
+  uint64_t field_cache_misses;
+  // Calls that found their callee in their cache
+  uint64_t call_cache_hits;
+  uint64_t call_cache_misses;
+} OpStats;
+
+extern OpStats opstats;
+
+// Called by execute() on every dispatch
+static inline void count_opcode(OpCode op) {
+  opstats.counts[op]++;
+  if (opstats.previous != OPCODE_COUNT)
+    opstats.pairs[opstats.previous][op]++;
+
+#ifdef OPSTATS_CYCLES
+  uint64_t now = OPSTATS_NOW();
+  if (opstats.previous != OPCODE_COUNT)
+    opstats.cycles[opstats.previous] += now - opstats.previous_time;
+  opstats.previous_time = now;
+#endif
+
+  opstats.previous = op;
+}
+
+static inline void count_field_cache(bool hit) {
+  if (hit)
+    opstats.field_cache_hits++;
+  else
+    opstats.field_cache_misses++;
+}
+
+static inline void count_call_cache(bool hit) {
+  if (hit)
+    opstats.call_cache_hits++;
+  else
+    opstats.call_cache_misses++;
+}
+
+void reset_opstats();
+uint64_t total_opstats();
+
+// Prints the opcodes by how often they ran, followed by the most common
+// pairs of opcodes
+void print_opstats();
+
+#endif
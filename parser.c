@@ -1,7 +1,9 @@
 #include "parser.h"
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "array.h"
 #include "ast.h"
@@ -54,6 +56,8 @@ static bool match(TokenType type) {
 }
 
 static bool match_either(TokenType type1, TokenType type2) {
+  if (parser_is_at_end())
+    return false;
   if (token_array->tokens[parser_index].type == type1 ||
       token_array->tokens[parser_index].type == type2) {
     return true;
@@ -62,6 +66,8 @@ static bool match_either(TokenType type1, TokenType type2) {
 }
 
 static bool match_and_move(TokenType type) {
+  if (parser_is_at_end())
+    return false;
   if (token_array->tokens[parser_index].type == type) {
     parser_index++;
     return true;
@@ -81,6 +87,19 @@ static bool peek_match(int offset, TokenType type) {
 }
 
 static Token get_current() {
+  // There is no EOF token at the end of the token array, so hand one out
+  // instead of reading past the end of the array
+  if (parser_is_at_end()) {
+    Token token_eof = {
+        .type = TOKEN_EOF,
+        .start = "",
+        .length = 0,
+        .line = token_array->count > 0
+                    ? token_array->tokens[token_array->count - 1].line
+                    : 0,
+    };
+    return token_eof;
+  }
   return token_array->tokens[parser_index];
 }
 
@@ -108,6 +127,7 @@ static void eat_or_error(TokenType type, const char* error_message) {
 // Statements
 static Ast* declaration();
 static Ast* func_declaration();
+static Ast* memo_func_declaration();
 static Ast* return_statement();
 static Ast* var_declaration();
 static Ast* statement();
@@ -116,10 +136,14 @@ static Ast* expression_statement();
 // Expressions
 static Ast* expression();
 static Ast* assignment();
-static Ast* and_();
 static Ast* or_();
+static Ast* and_();
 static Ast* equality();
 static Ast* comparison();
+static Ast* bit_or();
+static Ast* bit_xor();
+static Ast* bit_and();
+static Ast* shift();
 static Ast* addition();
 static Ast* multiplication();
 static Ast* unary();
@@ -142,7 +166,13 @@ void parse_tokens(TokenArray* token_arr,
   error_array = error_arr;
 
   while (parser_index != token_arr->count) {
+    int previous_index = parser_index;
     push_ast_array(ast_array, declaration());
+
+    // If nothing could be parsed, skip the token so that a malformed
+    // statement does not stall the parser forever
+    if (parser_index == previous_index)
+      move();
   }
   // return declaration();
 }
@@ -151,6 +181,9 @@ static Ast* declaration() {
   if (match(TOKEN_FUNC)) {
     move();
     return func_declaration();
+  } else if (match(TOKEN_MEMO)) {
+    move();
+    return memo_func_declaration();
   } else if (match(TOKEN_RETURN)) {
     move();
     return return_statement();
@@ -191,7 +224,7 @@ static Ast* func_declaration() {
   TokenArray* parameters = (TokenArray*)malloc(sizeof(TokenArray) * 1);
   init_token_array(parameters);
 
-  while (!match(TOKEN_RIGHT_PAREN)) {
+  while (!parser_is_at_end() && !match(TOKEN_RIGHT_PAREN)) {
     if (!match(TOKEN_IDENTIFIER)) {
       Error* error = create_error(
           get_current().line, 0, "main.neb",
@@ -204,14 +237,21 @@ static Ast* func_declaration() {
     push_token_array(parameters, parameter_identifier);
 
     move();
+    arity++;
 
     // If there are multiple parameters
-    if (match(TOKEN_COMMA))
-      move();
-
-    arity++;
+    if (!match(TOKEN_COMMA))
+      break;
+    move();
   }
 
+  if (!match(TOKEN_RIGHT_PAREN)) {
+    Error* error = create_error(
+        get_current().line, 0, "main.neb",
+        "func_declaration could not find a ) after the parameters",
+        SyntaxError);
+    push_error_array(error_array, error);
+  }
   // Move past right_paren
   move();
 
@@ -250,6 +290,23 @@ static Ast* func_declaration() {
   return ast;
 }
 
+// memo func, the same as func with the memo flag set
+static Ast* memo_func_declaration() {
+  if (!match(TOKEN_FUNC)) {
+    Error* error =
+        create_error(get_current().line, 0, "main.neb",
+                     "memo_func_declaration could not find 'func' after 'memo'",
+                     SyntaxError);
+    push_error_array(error_array, error);
+    return NULL;
+  }
+  move();
+
+  Ast* ast = func_declaration();
+  ((FuncStmt*)ast->as)->memo = true;
+  return ast;
+}
+
 static Ast* return_statement() {
   Ast* value_expression;
   if (match(TOKEN_SEMICOLON)) {
@@ -453,7 +510,27 @@ static Ast* expression() {
 }
 
 static Ast* assignment() {
-  Ast* ast = and_();
+  Ast* ast = or_();
+
+  // a[i] = 10;
+  if (ast != NULL && ast->type == AST_INDEX && match(TOKEN_EQUAL)) {
+    move();
+    IndexExpr* index_expr = (IndexExpr*)ast->as;
+    Ast* value = assignment();
+    IndexSetExpr* index_set_expr = make_index_set_expr(
+        index_expr->object, index_expr->index, value, index_expr->bracket);
+    return wrap_ast(index_set_expr, AST_INDEX_SET);
+  }
+
+  // p.x = 10;
+  if (ast != NULL && ast->type == AST_GET_FIELD && match(TOKEN_EQUAL)) {
+    move();
+    GetFieldExpr* get_field_expr = (GetFieldExpr*)ast->as;
+    Ast* value = assignment();
+    SetFieldExpr* set_field_expr = make_set_field_expr(
+        get_field_expr->object, get_field_expr->name, value);
+    return wrap_ast(set_field_expr, AST_SET_FIELD);
+  }
 
   // a = 10;
   if (match_and_move(TOKEN_EQUAL)) {
@@ -506,13 +583,28 @@ static Ast* assignment() {
   return ast;
 }
 
-static Ast* and_() {
-  Ast* ast = or_();
+// or binds looser than and, a or b and c is a or (b and c)
+static Ast* or_() {
+  Ast* ast = and_();
+
+  while (ast != NULL && match(TOKEN_OR)) {
+    Token token_operator = get_current();
+    move();
+    Ast* right = and_();
+    ast = wrap_ast(make_logical_expr(ast, right, token_operator), AST_LOGICAL);
+  }
   return ast;
 }
 
-static Ast* or_() {
+static Ast* and_() {
   Ast* ast = equality();
+
+  while (ast != NULL && match(TOKEN_AND)) {
+    Token token_operator = get_current();
+    move();
+    Ast* right = equality();
+    ast = wrap_ast(make_logical_expr(ast, right, token_operator), AST_LOGICAL);
+  }
   return ast;
 }
 
@@ -535,13 +627,13 @@ static Ast* equality() {
 }
 
 static Ast* comparison() {
-  Ast* ast = addition();
+  Ast* ast = bit_or();
 
   if (match(TOKEN_LESS) || match(TOKEN_LESS_EQUAL) || match(TOKEN_GREATER) ||
       match(TOKEN_GREATER_EQUAL)) {
     Token token_operator = get_current();
     move();
-    Ast* right = addition();
+    Ast* right = bit_or();
 
     BinaryExpr* binary_expr = make_binary_expr(ast, right, token_operator);
     Ast* binary_ast = make_ast();
@@ -553,6 +645,64 @@ static Ast* comparison() {
   return ast;
 }
 
+// The bitwise operators bind tighter than the comparisons, so that
+// `a & 1 == 0` is `(a & 1) == 0`
+static Ast* bit_or() {
+  Ast* ast = bit_xor();
+
+  while (match(TOKEN_PIPE)) {
+    Token token_operator = get_current();
+    move();
+    Ast* right = bit_xor();
+    BinaryExpr* binary_expr = make_binary_expr(ast, right, token_operator);
+    ast = wrap_ast(binary_expr, AST_BINARY);
+  }
+
+  return ast;
+}
+
+static Ast* bit_xor() {
+  Ast* ast = bit_and();
+
+  while (match(TOKEN_CARET)) {
+    Token token_operator = get_current();
+    move();
+    Ast* right = bit_and();
+    BinaryExpr* binary_expr = make_binary_expr(ast, right, token_operator);
+    ast = wrap_ast(binary_expr, AST_BINARY);
+  }
+
+  return ast;
+}
+
+static Ast* bit_and() {
+  Ast* ast = shift();
+
+  while (match(TOKEN_AMPERSAND)) {
+    Token token_operator = get_current();
+    move();
+    Ast* right = shift();
+    BinaryExpr* binary_expr = make_binary_expr(ast, right, token_operator);
+    ast = wrap_ast(binary_expr, AST_BINARY);
+  }
+
+  return ast;
+}
+
+static Ast* shift() {
+  Ast* ast = addition();
+
+  while (match_either(TOKEN_LESS_LESS, TOKEN_GREATER_GREATER)) {
+    Token token_operator = get_current();
+    move();
+    Ast* right = addition();
+    BinaryExpr* binary_expr = make_binary_expr(ast, right, token_operator);
+    ast = wrap_ast(binary_expr, AST_BINARY);
+  }
+
+  return ast;
+}
+
 static Ast* addition() {
   Ast* ast = multiplication();  // number_expr
 
@@ -578,8 +728,8 @@ static Ast* addition() {
 static Ast* multiplication() {
   Ast* ast = unary();
 
-  // Multiply or divide
-  while (match_either(TOKEN_STAR, TOKEN_SLASH)) {
+  // Multiply, divide or modulo
+  while (match_either(TOKEN_STAR, TOKEN_SLASH) || match(TOKEN_PERCENT)) {
     Token token_operator = get_current();
     move();
     Ast* right = unary();
@@ -598,7 +748,7 @@ static Ast* multiplication() {
 }
 
 static Ast* unary() {
-  if (match_either(TOKEN_BANG, TOKEN_MINUS)) {
+  if (match_either(TOKEN_BANG, TOKEN_MINUS) || match(TOKEN_TILDE)) {
     Token token_operator = get_current();
     move();
     UnaryExpr* unary_expr = make_unary_expr(unary(), token_operator);
@@ -628,17 +778,23 @@ static Ast* call() {
     // Parse the arguments
     CallExpr* call_expr = make_call_expr(ast, arguments);
 
-    while (!match(TOKEN_RIGHT_PAREN)) {
+    while (!parser_is_at_end() && !match(TOKEN_RIGHT_PAREN)) {
       Ast* expr = expression();
       push_ast_array(arguments, expr);
       argument_count++;
 
-      if (match(TOKEN_COMMA))
-        move();
+      if (!match(TOKEN_COMMA))
+        break;
+      move();
     }
 
     // Move past right_paren
-    move();
+    if (!match_and_move(TOKEN_RIGHT_PAREN)) {
+      Error* error = create_error(
+          get_current().line, 0, "main.neb",
+          "The arguments of a call should be closed with a ')'.", SyntaxError);
+      push_error_array(error_array, error);
+    }
 
     if (argument_count != arguments->count) {
       printf(
@@ -649,7 +805,39 @@ static Ast* call() {
     Ast* call_expr_ast = make_ast();
     call_expr_ast->as = call_expr;
     call_expr_ast->type = AST_CALL;
-    return call_expr_ast;
+    ast = call_expr_ast;
+  }
+
+  // a[i], a[i][j], f()[i], p.x or a[i].x
+  while (match(TOKEN_LEFT_BRACKET) || match(TOKEN_DOT)) {
+    if (match_and_move(TOKEN_DOT)) {
+      if (!match(TOKEN_IDENTIFIER)) {
+        Error* error = create_error(get_current().line, 0, "main.neb",
+                                    "A '.' should be followed by the name of "
+                                    "a field.",
+                                    SyntaxError);
+        push_error_array(error_array, error);
+        return NULL;
+      }
+      Token name = get_current();
+      move();
+      ast = wrap_ast(make_get_field_expr(ast, name), AST_GET_FIELD);
+      continue;
+    }
+
+    Token bracket = get_current();
+    move();
+    Ast* index = expression();
+    if (!match_and_move(TOKEN_RIGHT_BRACKET)) {
+      Error* error = create_error(get_current().line, 0, "main.neb",
+                                  "After a '[', followed by an expression, "
+                                  "should have a closing ']'.",
+                                  SyntaxError);
+      push_error_array(error_array, error);
+      return NULL;
+    }
+    IndexExpr* index_expr = make_index_expr(ast, index, bracket);
+    ast = wrap_ast(index_expr, AST_INDEX);
   }
 
   return ast;
@@ -665,16 +853,24 @@ static Ast* primary() {
   Ast* ast = make_ast();
 
   if (match(TOKEN_NUMBER)) {
-    const char* start = token_array->tokens[parser_index].start;
-    char* end = (char*)token_array->tokens[parser_index].start +
-                token_array->tokens[parser_index].length;
-    double value = strtod(start, &end);
-    // printf("Parsing number: %f\n", value);
-    // Print out debug information before moving
-    move();
-    NumberExpr* number_expr = make_number_expr(value);
-    ast->as = number_expr;
-    ast->type = AST_NUMBER;
+    Token token_number = get_current();
+    move();
+
+    // The lexer only lets a . into a number when there are digits after it
+    bool fractional = memchr(token_number.start, '.', token_number.length);
+    errno = 0;
+    int64_t integer = strtoll(token_number.start, NULL, 10);
+    if (!fractional && errno != ERANGE) {
+      IntExpr* int_expr = make_int_expr(integer);
+      ast->as = int_expr;
+      ast->type = AST_INT;
+    } else {
+      // Integer literals that do not fit in 64 bits become doubles
+      double value = strtod(token_number.start, NULL);
+      NumberExpr* number_expr = make_number_expr(value);
+      ast->as = number_expr;
+      ast->type = AST_NUMBER;
+    }
   } else if (match(TOKEN_STRING)) {
     Token token_string = get_current();
     move();
@@ -698,6 +894,64 @@ static Ast* primary() {
     VariableExpr* variable_expr = make_variable_expr(identifier_name);
     ast->as = variable_expr;
     ast->type = AST_VARIABLE_EXPR;
+  } else if (match(TOKEN_LEFT_BRACKET)) {  // let a = [1, 2, 3]
+    Token bracket = get_current();
+    move();
+
+    AstArray* elements = (AstArray*)malloc(sizeof(AstArray) * 1);
+    init_ast_array(elements);
+    while (!parser_is_at_end() && !match(TOKEN_RIGHT_BRACKET)) {
+      push_ast_array(elements, expression());
+      if (!match(TOKEN_COMMA))
+        break;
+      move();
+    }
+
+    if (!match_and_move(TOKEN_RIGHT_BRACKET)) {
+      Error* error =
+          create_error(get_current().line, 0, "main.neb",
+                       "An array should be closed with a ']'.", SyntaxError);
+      push_error_array(error_array, error);
+      return NULL;
+    }
+    ArrayExpr* array_expr = make_array_expr(elements, bracket);
+    ast->as = array_expr;
+    ast->type = AST_ARRAY;
+  } else if (match(TOKEN_LEFT_BRACE)) {  // let m = {"a": 1, 2: "b"}
+    // A { only starts a block where a statement starts, here it is a map
+    Token brace = get_current();
+    move();
+
+    AstArray* keys = (AstArray*)malloc(sizeof(AstArray) * 1);
+    AstArray* values = (AstArray*)malloc(sizeof(AstArray) * 1);
+    init_ast_array(keys);
+    init_ast_array(values);
+    while (!parser_is_at_end() && !match(TOKEN_RIGHT_BRACE)) {
+      push_ast_array(keys, expression());
+      if (!match_and_move(TOKEN_COLON)) {
+        Error* error = create_error(get_current().line, 0, "main.neb",
+                                    "A key in a map should be followed by a "
+                                    "':' and its value.",
+                                    SyntaxError);
+        push_error_array(error_array, error);
+        return NULL;
+      }
+      push_ast_array(values, expression());
+      if (!match(TOKEN_COMMA))
+        break;
+      move();
+    }
+
+    if (!match_and_move(TOKEN_RIGHT_BRACE)) {
+      Error* error =
+          create_error(get_current().line, 0, "main.neb",
+                       "A map should be closed with a '}'.", SyntaxError);
+      push_error_array(error_array, error);
+      return NULL;
+    }
+    MapExpr* map_expr = make_map_expr(keys, values, brace);
+    ast->as = map_expr;
+    ast->type = AST_MAP;
   } else if (match(TOKEN_LEFT_PAREN)) {  // let a = (10 + 2)
     move();
     Ast* expr = expression();
@@ -720,7 +974,7 @@ static Ast* primary() {
 static Ast* block() {
   BlockStmt* block_stmt = make_block_stmt();
 
-  while (get_current().type != TOKEN_RIGHT_BRACE) {
+  while (!parser_is_at_end() && get_current().type != TOKEN_RIGHT_BRACE) {
     push_ast_array(&block_stmt->ast_array, declaration());
   }
   // Move past the right brace
@@ -0,0 +1,139 @@
+#include "profiler.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "array.h"
+#include "hashmap.h"
+#include "macros.h"
+#include "object.h"
+
+volatile sig_atomic_t profiler_ticks = 0;
+
+// Collapsed stack string to its index in sample_counts
+static HashMap samples;
+static IntArray sample_counts;
+static int sample_count = 0;
+
+static void handle_profiler_signal(int signal) {
+  UNUSED(signal);
+  profiler_ticks++;
+}
+
+static void set_profiler_timer(int interval) {
+  struct itimerval timer;
+  timer.it_interval.tv_sec = 0;
+  timer.it_interval.tv_usec = interval;
+  timer.it_value = timer.it_interval;
+  setitimer(ITIMER_PROF, &timer, NULL);
+}
+
+void start_profiler() {
+  init_hashmap(&samples);
+  init_int_array(&sample_counts);
+  sample_count = 0;
+  profiler_ticks = 0;
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = handle_profiler_signal;
+  // Do not cut reads short, i.e. the REPL waiting on stdin
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGPROF, &action, NULL);
+
+  set_profiler_timer(PROFILER_INTERVAL);
+}
+
+// Appends a frame to the stack string, frames are separated by ';'
+static int append_frame(char* stack, int length, int capacity,
+                        const char* name, int line) {
+  if (length >= capacity)
+    return length;
+
+  const char* separator = length == 0 ? "" : ";";
+  int written;
+  if (line == -1) {
+    written = snprintf(stack + length, capacity - length, "%s%s", separator,
+                       name);
+  } else {
+    written = snprintf(stack + length, capacity - length, "%s%s:%d",
+                       separator, name, line);
+  }
+  return MIN(length + written, capacity);
+}
+
+// Each frame can take up its name, a line number and the separator
+#define PROFILER_FRAME_SIZE 64
+
+void take_sample(Vm* vm, const char* leaf) {
+  int ticks = profiler_ticks;
+  profiler_ticks = 0;
+  // The vm codegen folds calls on is not the program's, the time spent in
+  // it is dropped
+  if (vm->quiet)
+    return;
+
+  char stack[MAX_FRAMES * PROFILER_FRAME_SIZE];
+  int length = 0;
+  for (int i = 0; i < vm->frame_count; i++) {
+    CallFrame* frame = &vm->frames[i];
+    ObjFunc* func = frame->func;
+
+    // ip points past the instruction that is being run, the line of the
+    // instruction before it is the one being executed, for callers that
+    // is the line of the call
+    int offset = (int)(frame->ip - func->chunk.code.ops) - 1;
+    int line = 0;
+    if (offset >= 0 && offset < func->chunk.lines.count)
+      line = func->chunk.lines.ints[offset];
+
+    const char* name = func->name == NULL ? "<script>" : func->name->chars;
+    length = append_frame(stack, length, sizeof(stack), name, line);
+  }
+
+  if (leaf != NULL)
+    length = append_frame(stack, length, sizeof(stack), leaf, -1);
+
+  ObjString* key = make_obj_string(stack, length);
+  Value index = get_hashmap(&samples, key);
+  if (IS_NUMBER(index)) {
+    sample_counts.ints[(int)AS_NUMBER(index)] += ticks;
+    // Already seen this stack, the key is only needed for the lookup
+    free_obj_string(key);
+  } else {
+    push_hashmap(&samples, key, NUMBER_VAL(sample_counts.count));
+    push_int_array(&sample_counts, ticks);
+  }
+  sample_count += ticks;
+}
+
+bool stop_profiler(const char* path) {
+  set_profiler_timer(0);
+  signal(SIGPROF, SIG_DFL);
+  profiler_ticks = 0;
+
+  FILE* file = fopen(path, "w");
+  if (file == NULL) {
+    fprintf(stderr, "Could not write profile to \"%s\".\n", path);
+    free_hashmap(&samples);
+    free_int_array(&sample_counts);
+    return false;
+  }
+
+  for (int i = 0; i < samples.capacity; i++) {
+    Entry* entry = &samples.entries[i];
+    if (entry->key == NULL)
+      continue;
+    fprintf(file, "%s %d\n", entry->key->chars,
+            sample_counts.ints[(int)AS_NUMBER(entry->value)]);
+  }
+  fclose(file);
+
+  fprintf(stderr, "Profile: %d samples written to %s\n", sample_count, path);
+  free_hashmap(&samples);
+  free_int_array(&sample_counts);
+  return true;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <signal.h>
+#include <stdbool.h>
+
+#include "vm.h"
+
+// How often the profiler samples, in microseconds of cpu time
+#define PROFILER_INTERVAL 1000
+
+#define PROFILER_DEFAULT_PATH "nebula.folded"
+
+// Set by the timer signal, counts the samples that are due. The vm only
+// checks it on backward jumps, calls and returns, and it stays 0 unless
+// the profiler is running
+extern volatile sig_atomic_t profiler_ticks;
+
+// Starts the cpu timer that drives the sampling
+void start_profiler();
+
+// Stops sampling and writes out every sampled stack in the collapsed
+// format that flamegraph tools read, one stack per line, i.e.
+// <script>:12;fib:3;fib:3 42
+// Returns false if the file could not be written
+bool stop_profiler(const char* path);
+
+// Records the frames that are currently on the vm, weighted by the
+// pending ticks. leaf is the native being called, or NULL
+void take_sample(Vm* vm, const char* leaf);
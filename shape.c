@@ -0,0 +1,59 @@
+#include "shape.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "macros.h"
+
+static Shape* make_shape(Shape* parent, ObjString* name) {
+  Shape* shape = ALLOCATE(Shape, 1);
+  shape->parent = parent;
+  shape->name = name;
+  shape->field_count = parent == NULL ? 0 : parent->field_count + 1;
+  shape->transitions = NULL;
+  shape->transition_count = 0;
+  shape->transition_capacity = 0;
+  return shape;
+}
+
+Shape* empty_shape() {
+  static Shape* empty = NULL;
+  if (empty == NULL)
+    empty = make_shape(NULL, NULL);
+  return empty;
+}
+
+static bool names_equal(ObjString* a, ObjString* b) {
+  return a == b ||
+         (a->length == b->length &&
+          hash_obj_string(a) == hash_obj_string(b) &&
+          memcmp(a->chars, b->chars, a->length) == 0);
+}
+
+// Records have few fields, walking the chain is the slow path of a field
+// access that missed its cache
+int find_shape_field(Shape* shape, ObjString* name) {
+  for (; shape->name != NULL; shape = shape->parent) {
+    if (names_equal(shape->name, name))
+      return shape->field_count - 1;
+  }
+  return -1;
+}
+
+Shape* add_shape_field(Shape* shape, ObjString* name) {
+  for (int i = 0; i < shape->transition_count; i++) {
+    if (names_equal(shape->transitions[i]->name, name))
+      return shape->transitions[i];
+  }
+
+  if (shape->transition_count == shape->transition_capacity) {
+    shape->transition_capacity = MAX(shape->transition_capacity * 2, 2);
+    shape->transitions = (Shape**)realloc(
+        shape->transitions, sizeof(Shape*) * shape->transition_capacity);
+  }
+
+  // Its own copy of the name, shapes outlive the code that made them
+  Shape* next = make_shape(shape, make_obj_string(name->chars, name->length));
+  shape->transitions[shape->transition_count++] = next;
+  return next;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "object.h"
+
+// Shapes are the hidden classes of records. A record starts out with the
+// empty shape, and adding a field moves it along a transition to the
+// shape with that field added. Records that are built the same way end up
+// with the same shape, which is what lets a field access cache the slot
+// of the field by shape, see FieldCache in chunk.h.
+//
+// Shapes live as long as the process and are shared by every vm.
+
+Shape* empty_shape();
+
+// The slot of the field in records of this shape, -1 if they do not have it
+int find_shape_field(Shape* shape, ObjString* name);
+
+// The shape with the field added after the fields of shape, made the first
+// time it is asked for and shared from then on
+Shape* add_shape_field(Shape* shape, ObjString* name);
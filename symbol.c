@@ -0,0 +1,91 @@
+#include "symbol.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "hash.h"
+#include "macros.h"
+
+// Kept below 3/4 full, nothing is ever removed so there are no tombstones
+#define SYMBOL_MAX_LOAD_NUMERATOR 3
+#define SYMBOL_MAX_LOAD_DENOMINATOR 4
+#define SYMBOL_MIN_CAPACITY 16
+
+void init_symbol_table(SymbolTable* table) {
+  table->count = 0;
+  table->capacity = 0;
+  table->symbols = NULL;
+}
+
+void free_symbol_table(SymbolTable* table) {
+  free(table->symbols);
+  init_symbol_table(table);
+}
+
+static uint32_t hash_name(Token name) {
+  return wy_hash32(name.start, name.length);
+}
+
+// The symbol with the name, otherwise the empty slot where it would go
+static Symbol* find_symbol_slot(Symbol* symbols,
+                                int capacity,
+                                Token name,
+                                uint32_t hash) {
+  uint32_t mask = (uint32_t)capacity - 1;
+  uint32_t index = hash & mask;
+  for (;;) {
+    Symbol* symbol = &symbols[index];
+    if (symbol->name.start == NULL)
+      return symbol;
+    if (symbol->hash == hash && symbol->name.length == name.length &&
+        memcmp(symbol->name.start, name.start, name.length) == 0)
+      return symbol;
+    index = (index + 1) & mask;
+  }
+}
+
+static void grow_symbol_table(SymbolTable* table) {
+  int capacity = table->capacity == 0 ? SYMBOL_MIN_CAPACITY
+                                      : table->capacity * 2;
+  Symbol* symbols = ALLOCATE(Symbol, capacity);
+  for (int i = 0; i < capacity; i++) {
+    symbols[i].name.start = NULL;
+  }
+
+  for (int i = 0; i < table->capacity; i++) {
+    Symbol* symbol = &table->symbols[i];
+    if (symbol->name.start == NULL)
+      continue;
+    *find_symbol_slot(symbols, capacity, symbol->name, symbol->hash) =
+        *symbol;
+  }
+
+  free(table->symbols);
+  table->symbols = symbols;
+  table->capacity = capacity;
+}
+
+int find_symbol(SymbolTable* table, Token name) {
+  if (table->count == 0)
+    return -1;
+
+  Symbol* symbol = find_symbol_slot(table->symbols, table->capacity, name,
+                                    hash_name(name));
+  return symbol->name.start == NULL ? -1 : symbol->value;
+}
+
+void set_symbol(SymbolTable* table, Token name, int value) {
+  if ((table->count + 1) * SYMBOL_MAX_LOAD_DENOMINATOR >
+      table->capacity * SYMBOL_MAX_LOAD_NUMERATOR)
+    grow_symbol_table(table);
+
+  uint32_t hash = hash_name(name);
+  Symbol* symbol =
+      find_symbol_slot(table->symbols, table->capacity, name, hash);
+  if (symbol->name.start == NULL) {
+    symbol->name = name;
+    symbol->hash = hash;
+    table->count++;
+  }
+  symbol->value = value;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "token.h"
+
+// Names to ints for the compiler, i.e. a local's slot or the constant that
+// holds a global's name. Keys are the tokens themselves, pointing into the
+// source, so looking a name up does not allocate. Entries are never
+// removed, a name that goes away is set to -1 instead.
+
+typedef struct {
+  Token name;
+  uint32_t hash;
+  int value;
+} Symbol;
+
+typedef struct {
+  int count;
+  int capacity;
+  Symbol* symbols;
+} SymbolTable;
+
+void init_symbol_table(SymbolTable* table);
+void free_symbol_table(SymbolTable* table);
+
+// -1 if the name is not in the table
+int find_symbol(SymbolTable* table, Token name);
+void set_symbol(SymbolTable* table, Token name, int value);
@@ -1,4 +1,5 @@
 #include <float.h>
+#include <math.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -9,10 +10,18 @@
 #include "codegen.h"
 #include "debugging.h"
 #include "hashmap.h"
+#include "ir.h"
+#include "kernels.h"
 #include "lexer.h"
 #include "macros.h"
+#include "map.h"
+#include "native.h"
+#include "nebula.h"
 #include "object.h"
 #include "parser.h"
+#include "profiler.h"
+#include "shape.h"
+#include "symbol.h"
 #include "value.h"
 #include "vm.h"
 
@@ -26,7 +35,9 @@ static int fail_count = 0;
 static ErrorArray* global_error_array;
 
 static void print_value(Value value) {
-  if (value.type == VAL_NUMBER) {
+  if (value.type == VAL_INT) {
+    printf("%lld\n", (long long)AS_INT(value));
+  } else if (value.type == VAL_NUMBER) {
     printf("%f\n", AS_NUMBER(value));
   } else if (value.type == VAL_BOOLEAN) {
     if (AS_BOOLEAN(value)) {
@@ -39,7 +50,9 @@ static void print_value(Value value) {
   }
 }
 
-Vm* run_source_return_vm(const char* source) {
+// Runs the source on an existing vm, the vm keeps its globals between
+// calls, the same way the REPL does it
+static void run_source_on_vm(Vm* vm, const char* source) {
   TokenArray token_array;
   init_token_array(&token_array);
   lex_source(&token_array, source);
@@ -63,25 +76,7 @@ Vm* run_source_return_vm(const char* source) {
   disassemble_ast(&ast_array);
 #endif
 
-  OpArray op_array;
-  ValueArray value_array;
-  LocalArray local_array;
-
-  init_op_array(&op_array);
-  init_value_array(&value_array);
-  init_local_array(&local_array);
-  reserve_local_array(&local_array, UINT8_MAX + 1);
-  ObjFunc* main_func = codegen(&ast_array);
-
-  push_value_array(&value_array, OBJ_VAL(main_func));
-
-  // #ifdef TEST_DEBUGGING
-  //   disassemble_opcode_values(&op_array, &ast_constants_array);
-  // #endif
-
-  // Vm vm;
-  Vm* vm = ALLOCATE(Vm, 1);
-  init_vm(vm);
+  ObjFunc* main_func = codegen(&ast_array, vm);
 
   // Set all the arguemnts to be false from the start
   bool arguments[TOTAL_FLAGS];
@@ -89,17 +84,42 @@ Vm* run_source_return_vm(const char* source) {
     arguments[i] = false;
   }
 
-  run(arguments, vm, main_func);
+  if (main_func != NULL)
+    run(arguments, vm, main_func);
 
-  // free_vm(&vm);
   // free_op_array(&op_array);
   // free_value_array(&ast_constants_array);
   // free_token_array(&token_array);
   // free(source);
+}
 
+Vm* run_source_return_vm(const char* source) {
+  // Vm vm;
+  Vm* vm = ALLOCATE(Vm, 1);
+  init_vm(vm);
+
+  run_source_on_vm(vm, source);
   return vm;
 }
 
+// Compiles the source without running it, for the tests that look at the
+// code codegen generates
+static ObjFunc* compile_source_for_test(const char* source) {
+  TokenArray token_array;
+  init_token_array(&token_array);
+  lex_source(&token_array, source);
+  ErrorArray error_array;
+  init_error_array(&error_array);
+  AstArray ast_array;
+  init_ast_array(&ast_array);
+  parse_tokens(&token_array, &ast_array, &error_array);
+  ObjFunc* func = codegen(&ast_array, NULL);
+
+  free_token_array(&token_array);
+  free_error_array(&error_array);
+  return func;
+}
+
 static void pass() {
   pass_count++;
 }
@@ -531,24 +551,25 @@ static void test_parse_binary_expressions() {
   Value value_g = get_hashmap(variables, obj_string_g);
   Value value_h = get_hashmap(variables, obj_string_h);
 
-  if (!IS_NUMBER(value_a) || !IS_NUMBER(value_b) || !IS_NUMBER(value_c) ||
-      !IS_NUMBER(value_d) || !IS_NUMBER(value_e) || !IS_NUMBER(value_f) ||
-      !IS_NUMBER(value_g) || !IS_NUMBER(value_h))
+  // Integer literals stay integers, until there is a division
+  if (!IS_INT(value_a) || !IS_INT(value_b) || !IS_INT(value_c) ||
+      !IS_NUMBER(value_d) || !IS_NUMBER(value_e) || !IS_INT(value_f) ||
+      !IS_INT(value_g) || !IS_NUMBER(value_h))
     FAIL();
 
-  if (AS_NUMBER(value_a) - (11.0f) > DBL_EPSILON)
+  if (AS_INT(value_a) != 11)
     FAIL();
-  if (AS_NUMBER(value_b) - (9.0f) > DBL_EPSILON)
+  if (AS_INT(value_b) != 9)
     FAIL();
-  if (AS_NUMBER(value_c) - (33.0f) > DBL_EPSILON)
+  if (AS_INT(value_c) != 33)
     FAIL();
   if (AS_NUMBER(value_d) - (4.0f) > DBL_EPSILON)
     FAIL();
   if (AS_NUMBER(value_e) - (8.0f) > DBL_EPSILON)
     FAIL();
-  if (AS_NUMBER(value_f) - (15.0f) > DBL_EPSILON)
+  if (AS_INT(value_f) != 15)
     FAIL();
-  if (AS_NUMBER(value_g) - (-90.0f) > DBL_EPSILON)
+  if (AS_INT(value_g) != -90)
     FAIL();
   if (AS_NUMBER(value_h) - (10.0f) > DBL_EPSILON)
     FAIL();
@@ -577,7 +598,7 @@ static void test_parse_unary_expressions() {
   Value value_c = get_hashmap(variables, obj_string_c);
   Value value_d = get_hashmap(variables, obj_string_d);
 
-  if (!IS_NUMBER(value_a))
+  if (!IS_INT(value_a))
     FAIL();
   if (!IS_BOOLEAN(value_b))
     FAIL();
@@ -586,7 +607,7 @@ static void test_parse_unary_expressions() {
   if (!IS_BOOLEAN(value_d))
     FAIL();
 
-  if (AS_NUMBER(value_a) - (-3.0) > DBL_EPSILON)
+  if (AS_INT(value_a) != -3)
     FAIL();
   if (AS_BOOLEAN(value_b) != false)
     FAIL();
@@ -608,6 +629,20 @@ static void test_codegen_binary_numbers() {
   PASS();
 }
 
+static void test_opcode_names() {
+  printf("test_opcode_names()\n");
+
+  // Every opcode up to OPCODE_COUNT needs a name for the opcode stats
+  for (int i = 0; i < OPCODE_COUNT; i++) {
+    if (strcmp(opcode_name(i), "OP_UNKNOWN") == 0)
+      FAIL();
+  }
+  if (strcmp(opcode_name(OPCODE_COUNT), "OP_UNKNOWN") != 0)
+    FAIL();
+
+  PASS();
+}
+
 static void test_obj_string() {
   printf("test_obj_string()\n");
 
@@ -617,8 +652,18 @@ static void test_obj_string() {
   // Can only check length and hash
   if (obj_string->length != 11)
     FAIL();
+  // Not hashed until it is first used as a key
+  if (obj_string->hash != 0)
+    FAIL();
   // The hash value for "test string"
-  if (obj_string->hash != 2533107786)
+  if (hash_obj_string(obj_string) != 2414734844u)
+    FAIL();
+  if (obj_string->hash != 2414734844u)
+    FAIL();
+  // The characters are stored right after the string itself
+  if (obj_string->chars != obj_string->inline_chars)
+    FAIL();
+  if (strcmp(obj_string->chars, test_string) != 0)
     FAIL();
 
   PASS();
@@ -645,11 +690,11 @@ static void test_vm_global_environment() {
       make_obj_string(variable_string_test1, strlen(variable_string_test1)));
 
   // Check that the value of the variable is 10
-  if (!IS_NUMBER(value))
+  if (!IS_INT(value))
     FAIL();
 
-  if (AS_NUMBER(value) != 10.0) {
-    printf("%f\n", AS_NUMBER(value));
+  if (AS_INT(value) != 10) {
+    printf("%lld\n", (long long)AS_INT(value));
     FAIL();
   }
 
@@ -708,6 +753,73 @@ static void test_vm_string_concatenation() {
   PASS();
 }
 
+static ObjString* get_global_string(Vm* vm, const char* name) {
+  Value value = get_hashmap(&vm->variables, make_obj_string_sl(name));
+  if (!IS_STRING(value))
+    return NULL;
+  return AS_OBJ_STRING(value);
+}
+
+static void test_vm_string_builder() {
+  printf("test_vm_string_builder()\n");
+
+  Vm* vm = run_source_return_vm(
+      "let s = \"\";"
+      "let t = \"\";"
+      "let i = 0;"
+      "while (i < 1000) {"
+      "  s = s + \"ab\";"
+      "  if (i == 10) {"
+      "    t = s;"
+      "  }"
+      "  i = i + 1;"
+      "}"
+      "let u = t + \"x\";");
+
+  ObjString* s = get_global_string(vm, "s");
+  ObjString* t = get_global_string(vm, "t");
+  ObjString* u = get_global_string(vm, "u");
+  if (s == NULL || t == NULL || u == NULL)
+    FAIL();
+
+  if (s->length != 2000)
+    FAIL();
+  for (int i = 0; i < s->length; i++) {
+    if (s->chars[i] != (i % 2 == 0 ? 'a' : 'b'))
+      FAIL();
+  }
+
+  // Appending to s in place does not change the strings made before
+  if (t->length != 22 || strncmp(t->chars, "abababababababababab", 20) != 0)
+    FAIL();
+  if (u->length != 23 || strncmp(u->chars, t->chars, 22) != 0 ||
+      u->chars[22] != 'x')
+    FAIL();
+  // u could not be appended to t's buffer in place, s is past t
+  if (u->buffer == s->buffer)
+    FAIL();
+  if (s->chars[22] != 'a')
+    FAIL();
+
+  // Hashes the characters in the buffer, not what comes after them
+  ObjString* u_copy = make_obj_string(u->chars, u->length);
+  if (hash_obj_string(u) != hash_obj_string(u_copy))
+    FAIL();
+
+  // Strings in buffers work as keys
+  HashMap hashmap;
+  init_hashmap(&hashmap);
+  push_hashmap(&hashmap, t, NUMBER_VAL(1));
+  Value value = get_hashmap(&hashmap, make_obj_string(t->chars, t->length));
+  if (!IS_NUMBER(value) || AS_NUMBER(value) != 1.0)
+    FAIL();
+  if (!IS_NIL(get_hashmap(&hashmap, s)))
+    FAIL();
+  free_hashmap(&hashmap);
+
+  PASS();
+}
+
 static void test_vm_order_of_operations() {
   printf("test_vm_order_of_operations()\n");
 
@@ -728,14 +840,13 @@ static void test_vm_order_of_operations() {
   Value value_b1 = get_hashmap(variables, obj_string_b1);
   Value value_c1 = get_hashmap(variables, obj_string_c1);
 
-  if (!IS_NUMBER(value_a1) || !IS_NUMBER(value_b1) || !IS_NUMBER(value_c1))
+  if (!IS_INT(value_a1) || !IS_INT(value_b1) || !IS_INT(value_c1))
     FAIL();
 
-  if (AS_NUMBER(value_c1) - (AS_NUMBER(value_a1) + AS_NUMBER(value_b1)) >
-      DBL_EPSILON)
+  if (AS_INT(value_c1) != AS_INT(value_a1) + AS_INT(value_b1))
     FAIL();
 
-  if (AS_NUMBER(value_c1) - 30.0f > DBL_EPSILON)
+  if (AS_INT(value_c1) != 30)
     FAIL();
 
   char test_string2[] =
@@ -757,8 +868,8 @@ static void test_vm_order_of_operations() {
   Value value_c2 = get_hashmap(variables, obj_string_c2);
   Value value_d2 = get_hashmap(variables, obj_string_d2);
 
-  if (!IS_NUMBER(value_a2) || !IS_NUMBER(value_b2) || !IS_NUMBER(value_c2) ||
-      !IS_NUMBER(value_d2))
+  if (!IS_NUMBER(value_a2) || !IS_NUMBER(value_b2) || !IS_INT(value_c2) ||
+      !IS_INT(value_d2))
     FAIL();
 
   if (AS_NUMBER(value_a2) - 8.0f > DBL_EPSILON)
@@ -767,10 +878,1102 @@ static void test_vm_order_of_operations() {
   if (AS_NUMBER(value_b2) - 5.0f > DBL_EPSILON)
     FAIL();
 
-  if (AS_NUMBER(value_c2) - (-47.0f) > DBL_EPSILON)
+  if (AS_INT(value_c2) != -47)
+    FAIL();
+
+  if (AS_INT(value_d2) != 53)
+    FAIL();
+
+  PASS();
+}
+
+static void test_vm_integers() {
+  printf("test_vm_integers()\n");
+
+  char test_string[] =
+      "let a = 7 % 3;"
+      "let b = 6 & 3 | 8;"
+      "let c = 1 << 62 ^ 1;"
+      "let d = ~5 >> 1;"
+      "let e = 9223372036854775807 + 1;"
+      "let f = 1.5 + 1;"
+      "let g = 1 == 1.0;"
+      "let h = 1 + 2 & 3 == 3;";
+
+  Vm* vm = run_source_return_vm(test_string);
+  HashMap* variables = &vm->variables;
+
+  Value value_a = get_hashmap(variables, make_obj_string_sl("a"));
+  Value value_b = get_hashmap(variables, make_obj_string_sl("b"));
+  Value value_c = get_hashmap(variables, make_obj_string_sl("c"));
+  Value value_d = get_hashmap(variables, make_obj_string_sl("d"));
+  Value value_e = get_hashmap(variables, make_obj_string_sl("e"));
+  Value value_f = get_hashmap(variables, make_obj_string_sl("f"));
+  Value value_g = get_hashmap(variables, make_obj_string_sl("g"));
+  Value value_h = get_hashmap(variables, make_obj_string_sl("h"));
+
+  if (!IS_INT(value_a) || AS_INT(value_a) != 1)
+    FAIL();
+  if (!IS_INT(value_b) || AS_INT(value_b) != 10)
+    FAIL();
+  if (!IS_INT(value_c) || AS_INT(value_c) != ((INT64_C(1) << 62) | 1))
+    FAIL();
+  // Arithmetic shift, ~5 is -6
+  if (!IS_INT(value_d) || AS_INT(value_d) != -3)
+    FAIL();
+  // Overflow carries on as a double
+  if (!IS_NUMBER(value_e) || AS_NUMBER(value_e) != 9223372036854775808.0)
+    FAIL();
+  if (!IS_NUMBER(value_f) || AS_NUMBER(value_f) - 2.5 > DBL_EPSILON)
+    FAIL();
+  if (!IS_BOOLEAN(value_g) || !AS_BOOLEAN(value_g))
+    FAIL();
+  // The bitwise operators bind tighter than ==
+  if (!IS_BOOLEAN(value_h) || !AS_BOOLEAN(value_h))
+    FAIL();
+
+  PASS();
+}
+
+static void test_vm_arrays() {
+  printf("test_vm_arrays()\n");
+
+  char test_string[] =
+      "let a = [10, 20, 30];"
+      "a[1] = a[0] + a[2];"
+      "let b = [];"
+      "for (let i = 0; i < 100; i += 1) {"
+      "  push(b, i);"
+      "}"
+      "let last = pop(b);"
+      "let m = [[1, 2], [3, 4]];"
+      "m[1][0] = len(b);";
+
+  Vm* vm = run_source_return_vm(test_string);
+  HashMap* variables = &vm->variables;
+
+  Value a = get_hashmap(variables, make_obj_string_sl("a"));
+  if (!IS_ARRAY(a) || AS_OBJ_ARRAY(a)->values.count != 3)
+    FAIL();
+  Value a1 = AS_OBJ_ARRAY(a)->values.values[1];
+  if (!IS_INT(a1) || AS_INT(a1) != 40)
+    FAIL();
+
+  Value b = get_hashmap(variables, make_obj_string_sl("b"));
+  if (!IS_ARRAY(b) || AS_OBJ_ARRAY(b)->values.count != 99)
+    FAIL();
+  // Appending grows the buffer by doubling
+  if (AS_OBJ_ARRAY(b)->values.capacity != 128)
+    FAIL();
+  Value last = get_hashmap(variables, make_obj_string_sl("last"));
+  if (!IS_INT(last) || AS_INT(last) != 99)
+    FAIL();
+
+  Value m = get_hashmap(variables, make_obj_string_sl("m"));
+  Value m1 = AS_OBJ_ARRAY(m)->values.values[1];
+  Value m10 = AS_OBJ_ARRAY(m1)->values.values[0];
+  if (!IS_INT(m10) || AS_INT(m10) != 99)
+    FAIL();
+
+  // Indexes are bounds checked, which is a runtime error
+  Nebula nebula;
+  init_nebula(&nebula);
+  if (nebula_load(&nebula, "let c = [1, 2]; c[2];"))
+    FAIL();
+  if (nebula_load(&nebula, "let d = [1, 2]; d[-1] = 0;"))
+    FAIL();
+  if (nebula_load(&nebula, "pop([]);"))
+    FAIL();
+
+  // Literals past what one OP_ARRAY counts are made in parts
+  char big[4096];
+  int length = sprintf(big, "let big = [");
+  for (int i = 0; i < 600; i++)
+    length += sprintf(big + length, "%d, ", i);
+  sprintf(big + length, "[1]]; let after = len(big);");
+  if (!nebula_load(&nebula, big))
+    FAIL();
+  Value after = nebula_get_global(&nebula, "after");
+  if (!IS_INT(after) || AS_INT(after) != 601)
+    FAIL();
+  Value big_array = nebula_get_global(&nebula, "big");
+  for (int i = 0; i < 600; i++) {
+    Value element = AS_OBJ_ARRAY(big_array)->values.values[i];
+    if (!IS_INT(element) || AS_INT(element) != i)
+      FAIL();
+  }
+  free_nebula(&nebula);
+
+  PASS();
+}
+
+static void test_vm_maps() {
+  printf("test_vm_maps()\n");
+
+  char test_string[] =
+      "let m = {\"a\": 1, \"b\": 2, 3: \"three\"};"
+      "m[\"c\"] = m[\"a\"] + m[\"b\"];"
+      "let three = m[3.0];"
+      "let has_b = contains(m, \"b\");"
+      "let deleted = delete(m, \"b\");"
+      "let missing = get(m, \"b\", -1);"
+      "let big = map(100);"
+      "for (let i = 0; i < 1000; i += 1) {"
+      "  big[i] = i;"
+      "  delete(big, i - 50);"
+      "}";
+
+  Vm* vm = run_source_return_vm(test_string);
+  HashMap* variables = &vm->variables;
+
+  Value m = get_hashmap(variables, make_obj_string_sl("m"));
+  if (!IS_MAP(m) || AS_OBJ_MAP(m)->count != 3)
+    FAIL();
+  Value c;
+  if (!get_obj_map(AS_OBJ_MAP(m), OBJ_VAL(make_obj_string_sl("c")), &c) ||
+      !IS_INT(c) || AS_INT(c) != 3)
+    FAIL();
+
+  // Whole numbers are the same key whether they are ints or doubles
+  Value three = get_hashmap(variables, make_obj_string_sl("three"));
+  if (!IS_STRING(three) || (AS_OBJ_STRING(three))->length != 5)
+    FAIL();
+
+  Value has_b = get_hashmap(variables, make_obj_string_sl("has_b"));
+  Value deleted = get_hashmap(variables, make_obj_string_sl("deleted"));
+  Value missing = get_hashmap(variables, make_obj_string_sl("missing"));
+  if (!AS_BOOLEAN(has_b) || !AS_BOOLEAN(deleted) || AS_INT(missing) != -1)
+    FAIL();
+
+  // Deleting leaves tombstones, they are cleared out instead of growing
+  // the table past what the keys need
+  Value big = get_hashmap(variables, make_obj_string_sl("big"));
+  if (AS_OBJ_MAP(big)->count != 50 || AS_OBJ_MAP(big)->capacity != 256)
+    FAIL();
+
+  Nebula nebula;
+  init_nebula(&nebula);
+  if (nebula_load(&nebula, "let n = {\"a\": 1}; n[\"b\"];"))
+    FAIL();
+  if (nebula_load(&nebula, "let o = {}; o[true] = 1;"))
+    FAIL();
+
+  // Literals past what one OP_MAP counts are made in parts
+  char literal[8192];
+  int length = sprintf(literal, "let p = {");
+  for (int i = 0; i < 600; i++)
+    length += sprintf(literal + length, "%d: %d, ", i, i * 2);
+  sprintf(literal + length, "\"x\": {1: 2}}; let p_len = len(p);");
+  if (!nebula_load(&nebula, literal))
+    FAIL();
+  Value p = nebula_get_global(&nebula, "p");
+  Value p_len = nebula_get_global(&nebula, "p_len");
+  if (!IS_MAP(p) || !IS_INT(p_len) || AS_INT(p_len) != 601)
+    FAIL();
+  for (int i = 0; i < 600; i++) {
+    Value value;
+    if (!get_obj_map(AS_OBJ_MAP(p), INT_VAL(i), &value) || !IS_INT(value) ||
+        AS_INT(value) != i * 2)
+      FAIL();
+  }
+  free_nebula(&nebula);
+
+  PASS();
+}
+
+static void test_vm_records() {
+  printf("test_vm_records()\n");
+
+  char test_string[] =
+      "func point(x, y) {"
+      "  let p = record();"
+      "  p.x = x;"
+      "  p.y = y;"
+      "  return p;"
+      "}"
+      "let a = point(1, 2);"
+      "let b = point(3, 4);"
+      "b.x = b.x + a.y;"
+      "let c = record();"
+      "c.y = 5;"
+      "c.x = 6;"
+      "let d = point(7, 8);"
+      "d.z = 9;";
+
+  Vm* vm = run_source_return_vm(test_string);
+  HashMap* variables = &vm->variables;
+
+  ObjRecord* a =
+      AS_OBJ_RECORD(get_hashmap(variables, make_obj_string_sl("a")));
+  ObjRecord* b =
+      AS_OBJ_RECORD(get_hashmap(variables, make_obj_string_sl("b")));
+  ObjRecord* c =
+      AS_OBJ_RECORD(get_hashmap(variables, make_obj_string_sl("c")));
+  ObjRecord* d =
+      AS_OBJ_RECORD(get_hashmap(variables, make_obj_string_sl("d")));
+
+  // Records built the same way share their shape
+  if (a->shape != b->shape || a->shape->field_count != 2)
+    FAIL();
+  if (!IS_INT(b->fields[0]) || AS_INT(b->fields[0]) != 5)
+    FAIL();
+
+  // The same fields added in another order are another shape
+  if (c->shape == a->shape || c->shape->field_count != 2)
+    FAIL();
+  if (find_shape_field(c->shape, make_obj_string_sl("x")) != 1)
+    FAIL();
+
+  // Adding a field follows the transition from the shape of a
+  if (d->shape->parent != a->shape || d->shape->field_count != 3)
+    FAIL();
+  if (add_shape_field(a->shape, make_obj_string_sl("z")) != d->shape)
+    FAIL();
+
+  Nebula nebula;
+  init_nebula(&nebula);
+  if (nebula_load(&nebula, "let e = record(); e.x;"))
+    FAIL();
+  if (nebula_load(&nebula, "let f = [1]; f.x = 1;"))
+    FAIL();
+  free_nebula(&nebula);
+
+  PASS();
+}
+
+static void test_vm_call_caches() {
+  printf("test_vm_call_caches()\n");
+
+  char test_string[] =
+      "func add(a, b) { return a + b; }"
+      "func mul(a, b) { return a * b; }"
+      "func apply(a, b) { return op(a, b); }"
+      "let op = add;"
+      "let x = apply(2, 3) + apply(4, 5);"
+      "op = mul;"
+      "let y = apply(2, 3);";
+
+  Vm* vm = run_source_return_vm(test_string);
+  HashMap* variables = &vm->variables;
+
+  Value x = get_hashmap(variables, make_obj_string_sl("x"));
+  Value y = get_hashmap(variables, make_obj_string_sl("y"));
+  if (!IS_INT(x) || AS_INT(x) != 14 || !IS_INT(y) || AS_INT(y) != 6)
+    FAIL();
+
+  // The call site in apply saw add first, then mul replaced it
+  ObjFunc* apply =
+      AS_OBJ_FUNC(get_hashmap(variables, make_obj_string_sl("apply")));
+  Value mul = get_hashmap(variables, make_obj_string_sl("mul"));
+  if (apply->chunk.call_cache_count != 1)
+    FAIL();
+  CallCache* cache = &apply->chunk.call_caches[0];
+  if (cache->callee != AS_OBJ(mul) || cache->kind != CALL_CACHE_FUNC)
+    FAIL();
+
+  // A callee that misses the cache gets its arity checked again
+  Nebula nebula;
+  init_nebula(&nebula);
+  if (nebula_load(&nebula,
+                  "func one(a) { return a; }"
+                  "func two(a, b) { return b; }"
+                  "func call_f() { return f(1, 2); }"
+                  "let f = two;"
+                  "call_f();"
+                  "f = one;"
+                  "call_f();"))
+    FAIL();
+  free_nebula(&nebula);
+
+  PASS();
+}
+
+static void test_vm_logical_operators() {
+  printf("test_vm_logical_operators()\n");
+
+  char test_string[] =
+      "let calls = [];"
+      "func right(x) { push(calls, x); return x; }"
+      "let a = false and right(1);"
+      "let b = true or right(2);"
+      "let c = 0 and right(3);"
+      "let d = false or right(4);"
+      "let e = 1 < 2 and 3 < 4 or right(5);"
+      "let n = 0;"
+      "let values = [3, 2, 1];"
+      "while (n < len(values) and values[n] > 1) { n += 1; }"
+      "let f = 0;"
+      "if (false or (right(6) and false)) { f = 1; } else { f = 2; }";
+
+  Vm* vm = run_source_return_vm(test_string);
+  HashMap* variables = &vm->variables;
+
+  // The result is the side that decided, not always a bool
+  Value a = get_hashmap(variables, make_obj_string_sl("a"));
+  Value b = get_hashmap(variables, make_obj_string_sl("b"));
+  Value c = get_hashmap(variables, make_obj_string_sl("c"));
+  Value d = get_hashmap(variables, make_obj_string_sl("d"));
+  Value e = get_hashmap(variables, make_obj_string_sl("e"));
+  if (!IS_BOOLEAN(a) || AS_BOOLEAN(a) || !IS_BOOLEAN(b) || !AS_BOOLEAN(b))
+    FAIL();
+  // 0 is not falsey
+  if (!IS_INT(c) || AS_INT(c) != 3 || !IS_INT(d) || AS_INT(d) != 4)
+    FAIL();
+  if (!IS_BOOLEAN(e) || !AS_BOOLEAN(e))
+    FAIL();
+
+  Value n = get_hashmap(variables, make_obj_string_sl("n"));
+  Value f = get_hashmap(variables, make_obj_string_sl("f"));
+  if (AS_INT(n) != 2 || AS_INT(f) != 2)
+    FAIL();
+
+  // Only the right sides that had to be evaluated were
+  ValueArray* calls =
+      &AS_OBJ_ARRAY(get_hashmap(variables, make_obj_string_sl("calls")))
+           ->values;
+  if (calls->count != 3 || AS_INT(calls->values[0]) != 3 ||
+      AS_INT(calls->values[1]) != 4 || AS_INT(calls->values[2]) != 6)
+    FAIL();
+
+  // An if condition is only branched on, the bools of the comparisons
+  // and of the and are never left on the stack to be popped
+  ObjFunc* func =
+      compile_source_for_test("let x = 1; if (x > 0 and x < 2) { x = 3; }");
+
+  int branches = 0;
+  for (int i = 0; i < func->chunk.code.count; i++) {
+    OpCode op = func->chunk.code.ops[i];
+    if (op == OP_JUMP_IF_FALSE || op == OP_JUMP)
+      FAIL();
+    if (op == OP_POP_JUMP_IF_FALSE) {
+      branches++;
+      i += 2;
+    } else if (op == OP_CONSTANT || op == OP_GET_GLOBAL ||
+               op == OP_SET_GLOBAL) {
+      i++;
+    }
+  }
+  if (branches != 2)
+    FAIL();
+
+  PASS();
+}
+
+static void test_codegen_name_resolution() {
+  printf("test_codegen_name_resolution()\n");
+
+  // Enough names that the table grows a few times
+  SymbolTable table;
+  init_symbol_table(&table);
+  char names[100][8];
+  for (int i = 0; i < 100; i++) {
+    snprintf(names[i], sizeof(names[i]), "n%d", i);
+    Token name = {.start = names[i], .length = (int)strlen(names[i])};
+    set_symbol(&table, name, i);
+  }
+  for (int i = 0; i < 100; i++) {
+    Token name = {.start = names[i], .length = (int)strlen(names[i])};
+    if (find_symbol(&table, name) != i)
+      FAIL();
+  }
+  // Keys are compared by their characters, not by where they point
+  Token n7 = {.start = "n7 + 1", .length = 2};
+  Token missing = {.start = "n100", .length = 4};
+  if (find_symbol(&table, n7) != 7 || find_symbol(&table, missing) != -1)
+    FAIL();
+  set_symbol(&table, n7, -1);
+  if (find_symbol(&table, n7) != -1 || table.count != 100)
+    FAIL();
+  free_symbol_table(&table);
+
+  // A local in an inner scope hides the outer one until its scope ends
+  char test_string[] =
+      "let x = 1;"
+      "func f(a) {"
+      "  let y = a;"
+      "  if (true) { let y = a * 2; x = y; }"
+      "  { let y = 7; let z = y; }"
+      "  return y;"
+      "}"
+      "let r = f(5);";
+  Vm* vm = run_source_return_vm(test_string);
+  Value r = get_hashmap(&vm->variables, make_obj_string_sl("r"));
+  Value x = get_hashmap(&vm->variables, make_obj_string_sl("x"));
+  if (!IS_INT(r) || AS_INT(r) != 5 || !IS_INT(x) || AS_INT(x) != 10)
+    FAIL();
+
+  // Every use of a global shares the constant with its name
+  ObjFunc* func =
+      compile_source_for_test("let g = 1; g = g + g; print g; g = len([g]);");
+
+  int name_constants = 0;
+  for (int i = 0; i < func->chunk.constants.count; i++) {
+    Value value = func->chunk.constants.values[i];
+    if (IS_STRING(value) && (AS_OBJ_STRING(value))->length == 1 &&
+        (AS_OBJ_STRING(value))->chars[0] == 'g')
+      name_constants++;
+  }
+  if (name_constants != 1)
     FAIL();
 
-  if (AS_NUMBER(value_d2) - 53.0f > DBL_EPSILON)
+  PASS();
+}
+
+static void test_vm_wide_operands() {
+  printf("test_vm_wide_operands()\n");
+
+  // 300 globals at the top level, each with its name and value as a
+  // constant, and a function with 300 locals
+  static char source[32768];
+  int length = 0;
+  for (int i = 0; i < 300; i++) {
+    length += snprintf(source + length, sizeof(source) - length,
+                       "let g%d = %d;", i, i);
+  }
+  length += snprintf(source + length, sizeof(source) - length,
+                     "func big(a) { let l0 = a;");
+  for (int i = 1; i < 300; i++) {
+    length += snprintf(source + length, sizeof(source) - length,
+                       "let l%d = l%d + 1;", i, i - 1);
+  }
+  snprintf(source + length, sizeof(source) - length,
+           "l299 = l299 + l1; return l299 + g299; }"
+           "let r = big(10); g290 = g290 + g5; let s = g290;");
+
+  Vm* vm = run_source_return_vm(source);
+  Value r = get_hashmap(&vm->variables, make_obj_string_sl("r"));
+  Value s = get_hashmap(&vm->variables, make_obj_string_sl("s"));
+  // l299 is 309, plus l1 and g299
+  if (!IS_INT(r) || AS_INT(r) != 309 + 11 + 299)
+    FAIL();
+  if (!IS_INT(s) || AS_INT(s) != 295)
+    FAIL();
+
+  // Only the operands past 255 take the wide forms
+  ObjFunc* func = compile_source_for_test(source);
+
+  int narrow = 0;
+  int wide = 0;
+  OpCode* ops = func->chunk.code.ops;
+  for (int i = 0; i < func->chunk.code.count; i++) {
+    if (ops[i] == OP_CONSTANT || ops[i] == OP_SET_GLOBAL) {
+      narrow++;
+      i++;
+    } else if (ops[i] == OP_CONSTANT_WIDE || ops[i] == OP_SET_GLOBAL_WIDE) {
+      wide++;
+      i += 2;
+    } else if (ops[i] == OP_GET_GLOBAL) {
+      i++;
+    } else if (ops[i] == OP_GET_GLOBAL_WIDE) {
+      i += 2;
+    } else if (ops[i] == OP_CALL) {
+      i += 3;
+    }
+  }
+  if (narrow == 0 || wide == 0)
+    FAIL();
+
+  PASS();
+}
+
+static void test_vm_stack_room() {
+  printf("test_vm_stack_room()\n");
+
+  // The slots of a frame count the temporaries as well as the locals, of
+  // generated and of lowered functions
+  static char source[8192];
+  int length = snprintf(source, sizeof(source), "func wide(x) { return {");
+  for (int i = 0; i < 300; i++) {
+    length += snprintf(source + length, sizeof(source) - length, "%d: x, ",
+                       i);
+  }
+  snprintf(source + length, sizeof(source) - length,
+           "}; }"
+           "func pick(a, b, c, d) { return d; }"
+           "func call(a) { return pick(a, a, a, a + 1); }"
+           "let r = call(1);");
+
+  Nebula nebula;
+  init_nebula(&nebula);
+  if (!nebula_load(&nebula, source))
+    FAIL();
+  ObjFunc* wide = AS_OBJ_FUNC(nebula_get_global(&nebula, "wide"));
+  ObjFunc* call = AS_OBJ_FUNC(nebula_get_global(&nebula, "call"));
+  // slot 0, x and the map under a part of 255 pairs
+  if (wide->slot_count < 3 + 2 * 255)
+    FAIL();
+  // slot 0, a, then pick, three arguments and the two operands of a + 1
+  if (call->slot_count < 2 + 6)
+    FAIL();
+  free_nebula(&nebula);
+
+  // A frame with as many locals as there is room for, called when the stack
+  // is nearly full, has no room left for the pairs of its map literal
+  int locals = 65500;
+  char* deep = malloc(locals * 16 + 4096);
+  length = sprintf(deep, "func big() {");
+  for (int i = 0; i < locals; i++)
+    length += sprintf(deep + length, "let b%d;", i);
+  length += sprintf(deep + length, "let m = {");
+  for (int i = 0; i < 300; i++)
+    length += sprintf(deep + length, "%d: %d, ", i, i);
+  length += sprintf(deep + length, "}; return len(m); }");
+  length += sprintf(deep + length, "func r(n) {");
+  for (int i = 0; i < 255; i++)
+    length += sprintf(deep + length, "let a%d = %d;", i, i);
+  length += sprintf(deep + length, "let z = [");
+  for (int i = 0; i < 256; i++)
+    length += sprintf(deep + length, "%d, ", i);
+  sprintf(deep + length,
+          "]; if (n > 0) { return r(n - 1); } return big(); }"
+          "let s = r(61);");
+
+  init_nebula(&nebula);
+  if (nebula_load(&nebula, deep))
+    FAIL();
+  if (!IS_NIL(nebula_get_global(&nebula, "s")))
+    FAIL();
+  free_nebula(&nebula);
+  free(deep);
+
+  PASS();
+}
+
+static void test_vm_inlining() {
+  printf("test_vm_inlining()\n");
+
+  // sq and add3 are inlined, inside expressions and in a function with
+  // locals of its own, addk reads the global k and not the parameter of f
+  const char* source =
+      "func sq(x) { return x * x; }"
+      "func add3(a, b, c) { let s = a + b; return s + c; }"
+      "let k = 10;"
+      "func addk(x) { return x + k; }"
+      "func f(k) { return addk(k); }"
+      "func user(a) { let b = a + 1; return [b, sq(b) + sq(a)]; }"
+      "let r1 = 1 + sq(2 + 1);"
+      "let r2 = add3(1, 2, 3) * add3(sq(1), sq(2), sq(3));"
+      "let r3 = f(1);"
+      "let r4 = user(2)[1];"
+      "func g(x) { return x + 1; }"
+      "func h(x) { return x * 100; }"
+      "let before = g(1);"
+      "g = h;"
+      "let after = g(1);";
+
+  Vm* vm = run_source_return_vm(source);
+  const char* names[] = {"r1", "r2", "r3", "r4", "before", "after"};
+  int64_t expected[] = {10, 84, 11, 13, 2, 100};
+  for (int i = 0; i < 6; i++) {
+    Value value = get_hashmap(&vm->variables, make_obj_string_sl(names[i]));
+    if (!IS_INT(value) || AS_INT(value) != expected[i])
+      FAIL();
+  }
+
+  // Every call here has a guard in front of it, apart from the one to the
+  // recursive fact. Folding is off, it would leave no calls to guard
+  source =
+      "func sq(x) { return x * x; }"
+      "func fact(n) { if (n < 2) { return 1; } return n * fact(n - 1); }"
+      "print sq(3) + sq(4);"
+      "print fact(5);";
+  set_fold_calls(false);
+  ObjFunc* func = compile_source_for_test(source);
+  set_fold_calls(true);
+
+  int guards = 0;
+  int calls = 0;
+  OpCode* ops = func->chunk.code.ops;
+  for (int i = 0; i < func->chunk.code.count; i++) {
+    if (ops[i] == OP_JUMP_IF_GLOBAL) {
+      guards++;
+      i += 6;
+    } else if (ops[i] == OP_CALL) {
+      calls++;
+      i += 3;
+    } else if (ops[i] == OP_CONSTANT || ops[i] == OP_GET_GLOBAL ||
+               ops[i] == OP_DEFINE_GLOBAL || ops[i] == OP_POP_BELOW) {
+      i++;
+    } else if (ops[i] == OP_JUMP) {
+      i += 2;
+    }
+  }
+  // The real calls behind the two guards, and the one to fact
+  if (guards != 2 || calls != 3)
+    FAIL();
+
+  PASS();
+}
+
+static void test_ir_optimizations() {
+  printf("test_ir_optimizations()\n");
+
+  // A loop that never writes x, then x + 1 twice and a dead comparison
+  IrFunc ir;
+  init_ir_func(&ir, NULL, 1);
+  int x = add_ir_variable(&ir);
+  int entry = add_ir_block(&ir);
+  int header = add_ir_block(&ir);
+  int body = add_ir_block(&ir);
+  int exit = add_ir_block(&ir);
+  seal_ir_block(&ir, entry);
+  start_ir_block(&ir, entry);
+  int param = add_ir_instr(&ir, entry, IR_PARAM, 1);
+  write_ir_variable(&ir, x, entry, param);
+  add_ir_jump(&ir, entry, header, 1);
+
+  start_ir_block(&ir, header);
+  add_ir_branch(&ir, header, read_ir_variable(&ir, x, header), body, exit, 1);
+  seal_ir_block(&ir, body);
+  seal_ir_block(&ir, exit);
+  start_ir_block(&ir, body);
+  add_ir_jump(&ir, body, header, 1);
+  seal_ir_block(&ir, header);
+
+  start_ir_block(&ir, exit);
+  int values[2];
+  for (int i = 0; i < 2; i++) {
+    values[i] = add_ir_instr(&ir, exit, IR_ADD, 1);
+    add_ir_operand(&ir, values[i], read_ir_variable(&ir, x, exit));
+    add_ir_operand(&ir, values[i], add_ir_constant(&ir, INT_VAL(1)));
+  }
+  int equal = add_ir_instr(&ir, exit, IR_EQUAL, 1);
+  add_ir_operand(&ir, equal, values[0]);
+  add_ir_operand(&ir, equal, values[1]);
+  int product = add_ir_instr(&ir, exit, IR_MULTIPLY, 1);
+  add_ir_operand(&ir, product, values[0]);
+  add_ir_operand(&ir, product, values[1]);
+  int ret = add_ir_instr(&ir, exit, IR_RETURN, 1);
+  add_ir_operand(&ir, ret, product);
+
+  optimize_ir(&ir);
+
+  // The phi of x in the header merged the parameter with itself
+  if (ir.blocks[header].phis.count != 0 ||
+      ir.instrs[ir.blocks[header].instrs.ints[0]].operands.ints[0] != param)
+    FAIL();
+  // add, multiply and return are left, the multiply squares the one add
+  IntArray* instrs = &ir.blocks[exit].instrs;
+  if (instrs->count != 3 || ir.instrs[instrs->ints[0]].op != IR_ADD)
+    FAIL();
+  IntArray* operands = &ir.instrs[product].operands;
+  if (operands->ints[0] != instrs->ints[0] ||
+      operands->ints[1] != instrs->ints[0])
+    FAIL();
+  free_ir_func(&ir);
+
+  PASS();
+}
+
+static void test_ir_loop_invariants() {
+  printf("test_ir_loop_invariants()\n");
+
+  // while (p) { print p * 3; print p * 4; print p == 5; }, lowered with
+  // the condition before the loop as well
+  IrFunc ir;
+  init_ir_func(&ir, NULL, 1);
+  int entry = add_ir_block(&ir);
+  int preheader = add_ir_block(&ir);
+  int body = add_ir_block(&ir);
+  int exit = add_ir_block(&ir);
+  seal_ir_block(&ir, entry);
+  start_ir_block(&ir, entry);
+  int param = add_ir_instr(&ir, entry, IR_PARAM, 1);
+  add_ir_branch(&ir, entry, param, preheader, exit, 1);
+  seal_ir_block(&ir, preheader);
+  start_ir_block(&ir, preheader);
+  add_ir_jump(&ir, preheader, body, 1);
+
+  start_ir_block(&ir, body);
+  int values[3];
+  IrOp ops[3] = {IR_MULTIPLY, IR_MULTIPLY, IR_EQUAL};
+  for (int i = 0; i < 3; i++) {
+    values[i] = add_ir_instr(&ir, body, ops[i], 1);
+    add_ir_operand(&ir, values[i], param);
+    add_ir_operand(&ir, values[i], add_ir_constant(&ir, INT_VAL(3 + i)));
+    int print = add_ir_instr(&ir, body, IR_PRINT, 1);
+    add_ir_operand(&ir, print, values[i]);
+  }
+  add_ir_branch(&ir, body, param, body, exit, 1);
+  seal_ir_block(&ir, body);
+  seal_ir_block(&ir, exit);
+  start_ir_block(&ir, exit);
+  int ret = add_ir_instr(&ir, exit, IR_RETURN, 1);
+  add_ir_operand(&ir, ret, add_ir_constant(&ir, NIL_VAL));
+
+  optimize_ir(&ir);
+
+  // p * 3 can fail on p, but it is the first thing the body does. p * 4
+  // comes after a print, only the comparison that cannot fail goes too
+  IntArray* hoisted = &ir.blocks[preheader].instrs;
+  if (hoisted->count != 3 || hoisted->ints[0] != values[0] ||
+      hoisted->ints[1] != values[2])
+    FAIL();
+  if (ir.instrs[values[1]].block != body)
+    FAIL();
+  free_ir_func(&ir);
+
+  // Loops that never run, and loops that write the globals they read
+  const char* source =
+      "let scale = 5;"
+      "let k = 1;"
+      "let k2 = 1;"
+      "func never(s) { let t = 0;"
+      "  for (let i = 0; i < 0; i += 1) { t = s * 2; } return t; }"
+      "func scaled(n) { let t = 0;"
+      "  for (let i = 0; i < n; i += 1) { t = t + scale * 2; } return t; }"
+      "func counter(n) { let t = 0;"
+      "  for (let i = 0; i < n; i += 1) { t = t + k; k = k + 1; } return t; }"
+      "func bump() { k2 = k2 + 10; }"
+      "func bumped(n) { let t = 0;"
+      "  for (let i = 0; i < n; i += 1) { t = t + k2; bump(); } return t; }"
+      "let r1 = never(\"a\");"
+      "let r2 = scaled(3);"
+      "let r3 = counter(3);"
+      "let r4 = bumped(3);";
+
+  Vm* vm = run_source_return_vm(source);
+  const char* names[] = {"r1", "r2", "r3", "r4"};
+  int64_t expected[] = {0, 30, 6, 33};
+  for (int i = 0; i < 4; i++) {
+    Value value = get_hashmap(&vm->variables, make_obj_string_sl(names[i]));
+    if (!IS_INT(value) || AS_INT(value) != expected[i])
+      FAIL();
+  }
+
+  PASS();
+}
+
+static void test_ir_type_specialization() {
+  printf("test_ir_type_specialization()\n");
+
+  // print p - 1; print p + p; print q + q;
+  IrFunc ir;
+  init_ir_func(&ir, NULL, 2);
+  int entry = add_ir_block(&ir);
+  seal_ir_block(&ir, entry);
+  start_ir_block(&ir, entry);
+  int p = add_ir_instr(&ir, entry, IR_PARAM, 1);
+  int q = add_ir_instr(&ir, entry, IR_PARAM, 1);
+  ir.instrs[q].index = 1;
+  int operands[3][2] = {{p, add_ir_constant(&ir, INT_VAL(1))}, {p, p}, {q, q}};
+  IrOp ops[3] = {IR_SUBTRACT, IR_ADD, IR_ADD};
+  int values[3];
+  for (int i = 0; i < 3; i++) {
+    values[i] = add_ir_instr(&ir, entry, ops[i], 1);
+    add_ir_operand(&ir, values[i], operands[i][0]);
+    add_ir_operand(&ir, values[i], operands[i][1]);
+    int print = add_ir_instr(&ir, entry, IR_PRINT, 1);
+    add_ir_operand(&ir, print, values[i]);
+  }
+  int ret = add_ir_instr(&ir, entry, IR_RETURN, 1);
+  add_ir_operand(&ir, ret, add_ir_constant(&ir, NIL_VAL));
+
+  optimize_ir(&ir);
+
+  // p is a number once p - 1 did not fail, nothing checked q
+  if (ir.instrs[values[0]].unchecked || !ir.instrs[values[1]].unchecked ||
+      ir.instrs[values[2]].unchecked)
+    FAIL();
+  if (ir.instrs[values[1]].type != (IR_TYPE_INT | IR_TYPE_DOUBLE) ||
+      ir.numeric_sites != 3 || ir.unchecked_sites != 1)
+    FAIL();
+  free_ir_func(&ir);
+
+  // Ints and doubles through the unchecked ops, overflow included, and a
+  // check that only runs on one branch
+  const char* source =
+      "func twice(a) { let y = a * 2; return a + y; }"
+      "func big(a) { let b = a - 1; return a + a; }"
+      "func half(a, c) { let x = 0; if (c) { x = a - 1; } return x + a; }"
+      "func loop(n) { let t = 0;"
+      "  for (let i = 0; i < n; i += 1) { t = t + i / 2; } return t; }"
+      "let r1 = twice(3);"
+      "let r2 = twice(1.5);"
+      "let r3 = big(4611686018427387904);"
+      "let r4 = half(5, true);"
+      "let r5 = half(5, false);"
+      "let r6 = loop(4);";
+
+  Vm* vm = run_source_return_vm(source);
+  Value r1 = get_hashmap(&vm->variables, make_obj_string_sl("r1"));
+  Value r2 = get_hashmap(&vm->variables, make_obj_string_sl("r2"));
+  Value r3 = get_hashmap(&vm->variables, make_obj_string_sl("r3"));
+  Value r4 = get_hashmap(&vm->variables, make_obj_string_sl("r4"));
+  Value r5 = get_hashmap(&vm->variables, make_obj_string_sl("r5"));
+  Value r6 = get_hashmap(&vm->variables, make_obj_string_sl("r6"));
+  if (!IS_INT(r1) || AS_INT(r1) != 9 || !IS_NUMBER(r2) || AS_NUMBER(r2) != 4.5)
+    FAIL();
+  if (!IS_NUMBER(r3) || AS_NUMBER(r3) != 9223372036854775808.0)
+    FAIL();
+  if (!IS_INT(r4) || AS_INT(r4) != 9 || !IS_INT(r5) || AS_INT(r5) != 5)
+    FAIL();
+  if (!IS_NUMBER(r6) || AS_NUMBER(r6) != 3)
+    FAIL();
+
+  PASS();
+}
+
+static void test_vm_lowered_functions() {
+  printf("test_vm_lowered_functions()\n");
+
+  // Loops, branches and shadowed locals through the IR, the swaps in the
+  // loops need the copies between the slots of their phis, and outer
+  // defines a function so that gen compiles it instead
+  const char* source =
+      "func sum(n) { let s = 0;"
+      "  for (let i = 0; i < n; i += 1) { s = s + i; } return s; }"
+      "func pick(a) { let r = 1;"
+      "  if (a > 2) { let r = 5; r = r + a; } else { r = 7; } return r; }"
+      "func find(n) { let i = 0;"
+      "  while (true) { if (i * i >= n) { return i; } i = i + 1; } }"
+      "func count(n) { while (n > 0 and n != 3) { n = n - 1; } return n; }"
+      "func fibi(n) { let a = 0; let b = 1;"
+      "  for (let i = 0; i < n; i += 1) { let t = a + b; a = b; b = t; }"
+      "  return a; }"
+      "func rot(n) { let a = 1; let b = 2; let c = 3;"
+      "  for (let i = 0; i < n; i += 1) { let t = a; a = b; b = c; c = t; }"
+      "  return a * 100 + b * 10 + c; }"
+      "func sq(x) { return x * x; }"
+      "func user(a) { return sq(a) + sq(a + 1); }"
+      "func either(a, b) { return a or b; }"
+      "func dead() { return 1; print 2; }"
+      "func outer() { func inner() { return 3; } return inner(); }"
+      "let r1 = sum(10);"
+      "let r2 = pick(3) * 10 + pick(1);"
+      "let r3 = find(50);"
+      "let r4 = count(10) * 10 + count(2);"
+      "let r5 = fibi(10);"
+      "let r6 = rot(2);"
+      "let r7 = user(2);"
+      "let r8 = either(false, 4);"
+      "let r9 = dead() + outer();";
+
+  Vm* vm = run_source_return_vm(source);
+  const char* names[] = {"r1", "r2", "r3", "r4", "r5",
+                         "r6", "r7", "r8", "r9"};
+  int64_t expected[] = {45, 17, 8, 30, 55, 312, 13, 4, 4};
+  for (int i = 0; i < 9; i++) {
+    Value value = get_hashmap(&vm->variables, make_obj_string_sl(names[i]));
+    if (!IS_INT(value) || AS_INT(value) != expected[i])
+      FAIL();
+  }
+
+  PASS();
+}
+
+static void test_vm_memoized_functions() {
+  printf("test_vm_memoized_functions()\n");
+
+  // fib and the pair that calls each other are pure, the others print,
+  // read a global that changes, call one that prints, or are nested
+  const char* source =
+      "let offset = 1;"
+      "memo func fib(n) { if (n < 2) { return n; }"
+      "  return fib(n - 1) + fib(n - 2); }"
+      "memo func even(n) { if (n == 0) { return true; } return odd(n - 1); }"
+      "memo func odd(n) { if (n == 0) { return false; } return even(n - 1); }"
+      "memo func loud(n) { print_v(n); return n; }"
+      "memo func shifted(n) { return n + offset; }"
+      "memo func quiet(n) { return loud(n); }"
+      "memo func list(n) { let a = [n]; return a; }"
+      "func outer() { memo func inner(n) { return n; } return inner(2); }"
+      "let r1 = fib(40);"
+      "let r2 = fib(40);"
+      "let r3 = even(10);"
+      "let r4 = shifted(1);"
+      "offset = 2;"
+      "let r5 = shifted(1);"
+      "let r6 = list(3);"
+      "r6[0] = 4;"
+      "let r7 = list(3)[0];";
+
+  Vm* vm = run_source_return_vm(source);
+  Value r1 = get_hashmap(&vm->variables, make_obj_string_sl("r1"));
+  Value r2 = get_hashmap(&vm->variables, make_obj_string_sl("r2"));
+  Value r3 = get_hashmap(&vm->variables, make_obj_string_sl("r3"));
+  Value r5 = get_hashmap(&vm->variables, make_obj_string_sl("r5"));
+  Value r7 = get_hashmap(&vm->variables, make_obj_string_sl("r7"));
+  if (!IS_INT(r1) || AS_INT(r1) != 102334155 || !IS_INT(r2) ||
+      AS_INT(r2) != 102334155 || !IS_BOOLEAN(r3) || !AS_BOOLEAN(r3))
+    FAIL();
+  // Arrays are not cached, the second call makes a new one
+  if (!IS_INT(r5) || AS_INT(r5) != 3 || !IS_INT(r7) || AS_INT(r7) != 3)
+    FAIL();
+
+  const char* memoized[] = {"fib", "even", "odd", "list"};
+  const char* plain[] = {"loud", "shifted", "quiet", "outer"};
+  for (int i = 0; i < 4; i++) {
+    ObjFunc* func = AS_OBJ_FUNC(
+        get_hashmap(&vm->variables, make_obj_string_sl(memoized[i])));
+    if (func->memo == NULL)
+      FAIL();
+    func = AS_OBJ_FUNC(
+        get_hashmap(&vm->variables, make_obj_string_sl(plain[i])));
+    if (func->memo != NULL)
+      FAIL();
+  }
+
+  // Every n from 0 to 40 misses once, fib(n - 2) from fib(3) on and the
+  // second fib(40) hit
+  ObjFunc* fib =
+      AS_OBJ_FUNC(get_hashmap(&vm->variables, make_obj_string_sl("fib")));
+  MemoCache* cache = fib->memo;
+  if (cache->count != 41 || cache->misses != 41 || cache->hits != 39)
+    FAIL();
+
+  // Without memo, only the functions that call themselves
+  set_auto_memo(true);
+  vm = run_source_return_vm(
+      "func fact(n) { if (n < 2) { return 1; } return n * fact(n - 1); }"
+      "func square(n) { return n * n; }"
+      "let r = fact(5);");
+  set_auto_memo(false);
+  ObjFunc* fact =
+      AS_OBJ_FUNC(get_hashmap(&vm->variables, make_obj_string_sl("fact")));
+  ObjFunc* square =
+      AS_OBJ_FUNC(get_hashmap(&vm->variables, make_obj_string_sl("square")));
+  if (fact->memo == NULL || square->memo != NULL)
+    FAIL();
+
+  PASS();
+}
+
+static void test_codegen_folded_calls() {
+  printf("test_codegen_folded_calls()\n");
+
+  // first is generated before later is defined, bad errors out and list
+  // returns an array, those calls are made at runtime
+  const char* source =
+      "func fib(n) { if (n < 2) { return n; }"
+      "  return fib(n - 1) + fib(n - 2); }"
+      "func first() { return later(2); }"
+      "func later(x) { return x + 1; }"
+      "func scale(x, y) { return x * y + 0.5; }"
+      "func greet(name) { return \"hi \" + name; }"
+      "func bad(x) { return x + \"s\"; }"
+      "func never() { return bad(1); }"
+      "func list(n) { return [n]; }"
+      "func user() { return fib(10) + scale(1, 1); }"
+      "let r1 = fib(20);"
+      "let r2 = scale(-2, (3));"
+      "let r3 = greet(\"nebula\");"
+      "let r4 = list(1)[0];"
+      "let r5 = user();"
+      "let r6 = first();";
+
+  ObjFunc* main_func = compile_source_for_test(source);
+  // Only list is called, first and user are folded at the top level, as
+  // later is defined by then
+  if (main_func->chunk.call_cache_count != 1)
+    FAIL();
+
+  Vm* vm = run_source_return_vm(source);
+  const char* called[] = {"first", "never", "user"};
+  int calls[] = {1, 1, 0};
+  for (int i = 0; i < 3; i++) {
+    ObjFunc* func = AS_OBJ_FUNC(
+        get_hashmap(&vm->variables, make_obj_string_sl(called[i])));
+    if (func->chunk.call_cache_count != calls[i])
+      FAIL();
+  }
+
+  Value r1 = get_hashmap(&vm->variables, make_obj_string_sl("r1"));
+  Value r2 = get_hashmap(&vm->variables, make_obj_string_sl("r2"));
+  Value r3 = get_hashmap(&vm->variables, make_obj_string_sl("r3"));
+  Value r4 = get_hashmap(&vm->variables, make_obj_string_sl("r4"));
+  Value r5 = get_hashmap(&vm->variables, make_obj_string_sl("r5"));
+  Value r6 = get_hashmap(&vm->variables, make_obj_string_sl("r6"));
+  if (!IS_INT(r1) || AS_INT(r1) != 6765 || !IS_NUMBER(r2) ||
+      fabs(AS_NUMBER(r2) + 5.5) > 1e-9 || !IS_STRING(r3))
+    FAIL();
+  ObjString* greeting = AS_OBJ_STRING(r3);
+  if (strcmp(greeting->chars, "hi nebula") != 0)
+    FAIL();
+  if (!IS_INT(r4) || AS_INT(r4) != 1 || !IS_NUMBER(r5) ||
+      fabs(AS_NUMBER(r5) - 56.5) > 1e-9 || !IS_INT(r6) || AS_INT(r6) != 3)
+    FAIL();
+
+  // fib(20) does not finish in 1000 steps
+  set_fold_steps(1000);
+  main_func = compile_source_for_test(
+      "func fib(n) { if (n < 2) { return n; }"
+      "  return fib(n - 1) + fib(n - 2); }"
+      "let r = fib(20) + fib(5);");
+  set_fold_steps(FOLD_DEFAULT_STEPS);
+  if (main_func->chunk.call_cache_count != 1)
+    FAIL();
+
+  PASS();
+}
+
+static void test_float_array_kernels() {
+  printf("test_float_array_kernels()\n");
+
+  // Lengths around the vector widths, so that the loops over whole
+  // vectors and the scalar tails both get used
+  double a[37];
+  double b[37];
+  for (int i = 0; i < 37; i++) {
+    a[i] = (i * 7919 % 101) - 50.25;
+    b[i] = (i * 104729 % 53) * 0.5;
+  }
+
+  set_kernel_level(KERNELS_SCALAR);
+  const Kernels* scalar = get_kernels();
+
+  KernelLevel levels[] = {KERNELS_SSE2, KERNELS_AVX2};
+  for (int l = 0; l < 2; l++) {
+    if (!set_kernel_level(levels[l]))
+      continue;
+    const Kernels* kernels = get_kernels();
+    if (get_kernel_level() != levels[l])
+      FAIL();
+
+    for (int count = 1; count <= 37; count++) {
+      if (fabs(kernels->sum(a, count) - scalar->sum(a, count)) > 1e-9)
+        FAIL();
+      if (fabs(kernels->dot(a, b, count) - scalar->dot(a, b, count)) > 1e-9)
+        FAIL();
+      // min and max only compare, so they are exact
+      if (memcmp(&(double){kernels->min(a, count)},
+                 &(double){scalar->min(a, count)}, sizeof(double)) != 0 ||
+          memcmp(&(double){kernels->max(a, count)},
+                 &(double){scalar->max(a, count)}, sizeof(double)) != 0)
+        FAIL();
+
+      double x[37];
+      double y[37];
+      memcpy(x, a, sizeof(a));
+      memcpy(y, a, sizeof(a));
+      kernels->scale(x, 3.0, count);
+      scalar->scale(y, 3.0, count);
+      kernels->add(x, b, count);
+      scalar->add(y, b, count);
+      kernels->mul(x, b, count);
+      scalar->mul(y, b, count);
+      // Elementwise kernels do the same operations, nothing is reordered
+      if (memcmp(x, y, sizeof(double) * count) != 0)
+        FAIL();
+      // And they stay within count
+      if (memcmp(x + count, a + count, sizeof(double) * (37 - count)) != 0)
+        FAIL();
+    }
+  }
+
+  // Back to the best level for the rest of the tests
+  if (!set_kernel_level(KERNELS_AVX2) && !set_kernel_level(KERNELS_SSE2))
+    set_kernel_level(KERNELS_SCALAR);
+
+  Vm* vm = run_source_return_vm(
+      "let a = farray([1, 2, 3, 4, 5]);"
+      "let b = farray(5);"
+      "b[0] = 2;"
+      "fadd(fscale(b, 2), a);"
+      "let total = fsum(a) + fdot(a, b) + fmax(a) - fmin(a);");
+  Value total = get_hashmap(&vm->variables, make_obj_string_sl("total"));
+  // b is [5, 2, 3, 4, 5], 15 + (5 + 4 + 9 + 16 + 25) + 5 - 1
+  if (!IS_NUMBER(total) || fabs(AS_NUMBER(total) - 78.0) > DBL_EPSILON)
     FAIL();
 
   PASS();
@@ -826,14 +2029,14 @@ static void test_vm_comparison_operators() {
   Value value_e = get_hashmap(variables, obj_string_e);
   Value value_f = get_hashmap(variables, obj_string_f);
 
-  if (!IS_NUMBER(value_e))
+  if (!IS_INT(value_e))
     FAIL();
-  if (AS_NUMBER(value_e) != 50.0)
+  if (AS_INT(value_e) != 50)
     FAIL();
 
-  if (!IS_NUMBER(value_f))
+  if (!IS_INT(value_f))
     FAIL();
-  if (AS_NUMBER(value_f) != 100.0)
+  if (AS_INT(value_f) != 100)
     FAIL();
 
   PASS();
@@ -865,15 +2068,15 @@ static void test_vm_if_conditions() {
   Value value_b = get_hashmap(variables, obj_string_b);
 
   // Test then branch codegen & run
-  if (!IS_NUMBER(value_a))
+  if (!IS_INT(value_a))
     FAIL();
-  if (AS_NUMBER(value_a) != 50.0)
+  if (AS_INT(value_a) != 50)
     FAIL();
 
   // Test else branch codegen & run
-  if (!IS_NUMBER(value_b))
+  if (!IS_INT(value_b))
     FAIL();
-  if (AS_NUMBER(value_b) != 100.0)
+  if (AS_INT(value_b) != 100)
     FAIL();
 
   PASS();
@@ -894,9 +2097,9 @@ static void test_vm_while_loops() {
   ObjString* obj_string_a = make_obj_string("a", strlen("a"));
   Value value_a = get_hashmap(variables, obj_string_a);
 
-  if (!IS_NUMBER(value_a))
+  if (!IS_INT(value_a))
     FAIL();
-  if (AS_NUMBER(value_a) != 10.0)
+  if (AS_INT(value_a) != 10)
     FAIL();
 
   PASS();
@@ -917,10 +2120,10 @@ static void test_vm_for_loops() {
   ObjString* obj_string_b = make_obj_string("b", strlen("b"));
   Value value_b = get_hashmap(variables, obj_string_b);
 
-  if (!IS_NUMBER(value_b))
+  if (!IS_INT(value_b))
     FAIL();
-  if (AS_NUMBER(value_b) != 55.0) {
-    printf("value_a is :%f\n", AS_NUMBER(value_b));
+  if (AS_INT(value_b) != 55) {
+    printf("value_b is :%lld\n", (long long)AS_INT(value_b));
     FAIL();
   }
 
@@ -949,15 +2152,15 @@ static void test_vm_hashmap_collision_resolution() {
   Value value_a = get_hashmap(variables, obj_string_a);
   Value value_b = get_hashmap(variables, obj_string_b);
 
-  if (!IS_NUMBER(value_a))
+  if (!IS_INT(value_a))
     FAIL();
-  if (!IS_NUMBER(value_b))
+  if (!IS_INT(value_b))
     FAIL();
 
-  if (AS_NUMBER(value_a) != 56.0) {
+  if (AS_INT(value_a) != 56) {
     FAIL();
   }
-  if (AS_NUMBER(value_b) != 55.0) {
+  if (AS_INT(value_b) != 55) {
     FAIL();
   }
 
@@ -978,6 +2181,323 @@ static void test_vm_parser_error_messages() {
   if (global_error_array->errors[0]->type != SyntaxError)
     FAIL();
 
+  // What the REPL is left with at the end of its input, the parameters and
+  // arguments are cut off and the parser has to stop there
+  const char* unclosed[] = {"func f(", "f(1, ", "let x = 1); f(",
+                            "func f(a, b"};
+  for (int i = 0; i < 4; i++) {
+    run_source_return_vm(unclosed[i]);
+    if (global_error_array->count == 0 ||
+        global_error_array->errors[0]->type != SyntaxError)
+      FAIL();
+  }
+
+  PASS();
+}
+
+static void test_vm_persistent_globals() {
+  printf("test_vm_persistent_globals()\n");
+
+  Vm* vm = ALLOCATE(Vm, 1);
+  init_vm(vm);
+
+  // Every input is compiled on its own, like the REPL does
+  run_source_on_vm(vm, "let a = 10;");
+  run_source_on_vm(vm, "func add(x, y) { return x + y; }");
+  run_source_on_vm(vm, "let b = add(a, 5);");
+  run_source_on_vm(vm, "a = a + 1;");
+
+  Value value_a = get_hashmap(&vm->variables, make_obj_string_sl("a"));
+  Value value_b = get_hashmap(&vm->variables, make_obj_string_sl("b"));
+
+  if (!IS_INT(value_a) || !IS_INT(value_b))
+    FAIL();
+  if (AS_INT(value_a) != 11)
+    FAIL();
+  if (AS_INT(value_b) != 15)
+    FAIL();
+
+  // Each run starts over from an empty stack
+  if (vm->frame_count != 0)
+    FAIL();
+
+  PASS();
+}
+
+static void test_embedding_replaced_natives() {
+  printf("test_embedding_replaced_natives()\n");
+
+  // The second load calls the function the first one put in place of the
+  // native, not the native
+  Nebula nebula;
+  init_nebula(&nebula);
+  if (!nebula_load(&nebula, "func len(x) { return 42; }") ||
+      !nebula_load(&nebula, "let r = len([1, 2]);"))
+    FAIL();
+  Value r = nebula_get_global(&nebula, "r");
+  if (!IS_INT(r) || AS_INT(r) != 42)
+    FAIL();
+  free_nebula(&nebula);
+
+  // A vm of its own still has the native
+  init_nebula(&nebula);
+  if (!nebula_load(&nebula, "let r = len([1, 2]);"))
+    FAIL();
+  r = nebula_get_global(&nebula, "r");
+  if (!IS_INT(r) || AS_INT(r) != 2)
+    FAIL();
+  free_nebula(&nebula);
+
+  PASS();
+}
+
+static void test_embedding_codegen_errors() {
+  printf("test_embedding_codegen_errors()\n");
+
+  // A script with more constants than one function can index is not run
+  // at all, nor is one that returns from the top level
+  int count = UINT16_MAX + 10;
+  char* source = malloc(count * 24 + 32);
+  int length = sprintf(source, "let a = \"s\";");
+  for (int i = 0; i < count; i++)
+    length += sprintf(source + length, "a = \"s%d\";", i);
+  sprintf(source + length, "let done = true;");
+
+  Nebula nebula;
+  init_nebula(&nebula);
+  if (nebula_load(&nebula, source))
+    FAIL();
+  if (!IS_NIL(nebula_get_global(&nebula, "done")))
+    FAIL();
+  if (nebula_load(&nebula, "let done = true; return;"))
+    FAIL();
+  if (!IS_NIL(nebula_get_global(&nebula, "done")))
+    FAIL();
+
+  // The vm is still usable after either
+  if (!nebula_load(&nebula, "let done = true;"))
+    FAIL();
+  if (!IS_BOOLEAN(nebula_get_global(&nebula, "done")))
+    FAIL();
+  free_nebula(&nebula);
+  free(source);
+
+  PASS();
+}
+
+static void test_embedding_call() {
+  printf("test_embedding_call()\n");
+
+  Nebula nebula;
+  init_nebula(&nebula);
+
+  if (!nebula_load(&nebula,
+                   "let offset = 100;"
+                   "func add(a, b) { return a + b; }"
+                   "func nothing() { }"))
+    FAIL();
+
+  NebulaFunc add;
+  if (!nebula_get_func(&nebula, "add", &add))
+    FAIL();
+  if (add.arity != 2)
+    FAIL();
+
+  // The same handle can be called over and over
+  Value result;
+  for (int i = 0; i < 100; i++) {
+    Value args[2] = {NUMBER_VAL(i), NUMBER_VAL(10)};
+    if (!nebula_call(&nebula, &add, 2, args, &result))
+      FAIL();
+    if (!IS_NUMBER(result) || AS_NUMBER(result) != i + 10.0)
+      FAIL();
+  }
+
+  // Functions without a return give back nil
+  NebulaFunc nothing;
+  if (!nebula_get_func(&nebula, "nothing", &nothing))
+    FAIL();
+  if (!nebula_call(&nebula, &nothing, 0, NULL, &result))
+    FAIL();
+  if (!IS_NIL(result))
+    FAIL();
+
+  // Wrong argument counts are rejected
+  Value args[1] = {NUMBER_VAL(1)};
+  if (nebula_call(&nebula, &add, 1, args, &result))
+    FAIL();
+
+  // Globals are not functions
+  NebulaFunc offset;
+  if (nebula_get_func(&nebula, "offset", &offset))
+    FAIL();
+  if (nebula_get_func(&nebula, "missing", &offset))
+    FAIL();
+
+  // Every call leaves the stack where it found it
+  if (nebula.vm.frame_count != 0)
+    FAIL();
+  if (nebula.vm.stack_top != &nebula.vm.vm_stack.values[0])
+    FAIL();
+
+  free_nebula(&nebula);
+  PASS();
+}
+
+static bool twice_native(int argument_count, Value* args, Value* result) {
+  UNUSED(argument_count);
+  *result = NUMBER_VAL(AS_NUMERIC(args[0]) * 2);
+  return true;
+}
+
+static bool failing_native(int argument_count, Value* args, Value* result) {
+  UNUSED(argument_count);
+  UNUSED(args);
+  UNUSED(result);
+  return false;
+}
+
+static void test_native_registry() {
+  printf("test_native_registry()\n");
+
+  Nebula nebula;
+  init_nebula(&nebula);
+
+  if (!nebula_register_native(&nebula, "twice", 1, NATIVE_PURE, twice_native))
+    FAIL();
+  if (!nebula_register_native(&nebula, "failing", 0, NATIVE_NONE,
+                              failing_native))
+    FAIL();
+  // Names can only be registered once
+  if (nebula_register_native(&nebula, "twice", 1, NATIVE_PURE, twice_native))
+    FAIL();
+
+  int twice_index = find_native("twice", 5);
+  if (twice_index == -1 || get_native(twice_index)->arity != 1)
+    FAIL();
+  if (!(get_native(twice_index)->flags & NATIVE_PURE))
+    FAIL();
+  if (nebula.vm.native_function_count != native_count())
+    FAIL();
+
+  // Known natives are bound at compile time
+  ObjFunc* func = compile_source_for_test("print twice(2);");
+
+  bool found_call_native = false;
+  for (int i = 0; i < func->chunk.code.count; i++) {
+    if (func->chunk.code.ops[i] == OP_CALL) {
+      FAIL();
+    }
+    if (func->chunk.code.ops[i] == OP_CALL_NATIVE) {
+      found_call_native = true;
+      if (func->chunk.code.ops[i + 1] != (OpCode)twice_index)
+        FAIL();
+      if (func->chunk.code.ops[i + 2] != 1)
+        FAIL();
+      break;
+    }
+  }
+  if (!found_call_native)
+    FAIL();
+
+  if (!nebula_load(&nebula,
+                   "let a = twice(21);"
+                   "func clock() { return 7; }"
+                   "let b = clock();"))
+    FAIL();
+
+  Value a = nebula_get_global(&nebula, "a");
+  if (!IS_NUMBER(a) || AS_NUMBER(a) != 42.0)
+    FAIL();
+  // A program that defines a native's name calls its own function
+  Value b = nebula_get_global(&nebula, "b");
+  if (!IS_INT(b) || AS_INT(b) != 7)
+    FAIL();
+
+  // Natives can fail, which is a runtime error
+  if (nebula_load(&nebula, "failing();"))
+    FAIL();
+
+  // Natives called through a handle get their arity checked
+  NebulaFunc twice;
+  if (!nebula_get_func(&nebula, "twice", &twice) || twice.arity != 1)
+    FAIL();
+  Value result;
+  if (nebula_call(&nebula, &twice, 0, NULL, &result))
+    FAIL();
+  Value args[1] = {NUMBER_VAL(5)};
+  if (!nebula_call(&nebula, &twice, 1, args, &result) ||
+      AS_NUMBER(result) != 10.0)
+    FAIL();
+
+  free_nebula(&nebula);
+  PASS();
+}
+
+static bool tick_native(int argument_count, Value* args, Value* result) {
+  UNUSED(argument_count);
+  UNUSED(args);
+  // Pretend that the profiler timer went off while inside the native
+  profiler_ticks = 1;
+  *result = NIL_VAL;
+  return true;
+}
+
+static void test_profiler_collapsed_stacks() {
+  printf("test_profiler_collapsed_stacks()\n");
+
+  if (register_native("tick", 0, NATIVE_SIDE_EFFECT, tick_native) == -1)
+    FAIL();
+
+  start_profiler();
+
+  Vm vm;
+  init_vm(&vm);
+  run_source_on_vm(&vm,
+                   "func f() {\n"
+                   "  tick();\n"
+                   "  return 1;\n"
+                   "}\n"
+                   "f();\n");
+
+  // Nothing is sampled on a quiet vm, like the one codegen folds calls on
+  Vm quiet_vm;
+  init_vm(&quiet_vm);
+  quiet_vm.quiet = true;
+  run_source_on_vm(&quiet_vm,
+                   "func g() {\n"
+                   "  tick();\n"
+                   "  return 1;\n"
+                   "}\n"
+                   "g();\n");
+  free_vm(&quiet_vm);
+
+  const char* path = "test.folded";
+  if (!stop_profiler(path))
+    FAIL();
+
+  FILE* file = fopen(path, "r");
+  if (file == NULL)
+    FAIL();
+
+  // Every frame is named by its function and the line it is at, the
+  // native that was being called is the leaf
+  char line[256];
+  bool found_stack = false;
+  bool found_quiet = false;
+  while (fgets(line, sizeof(line), file) != NULL) {
+    if (strncmp(line, "<script>:5;f:2;tick ", 20) == 0)
+      found_stack = true;
+    if (strstr(line, "g:2") != NULL)
+      found_quiet = true;
+  }
+  fclose(file);
+  remove(path);
+
+  if (!found_stack || found_quiet)
+    FAIL();
+
+  free_vm(&vm);
   PASS();
 }
 
@@ -1011,17 +2531,44 @@ int main() {
   // codegen to ast tests
   test_codegen_numbers();
   test_codegen_binary_numbers();
+  test_opcode_names();
   // obj tests
   test_obj_string();
   // vm tests
   test_vm_global_environment();
   test_vm_string_concatenation();
+  test_vm_string_builder();
   test_vm_order_of_operations();
+  test_vm_integers();
+  test_vm_arrays();
+  test_vm_maps();
+  test_vm_records();
+  test_vm_call_caches();
+  test_vm_logical_operators();
+  test_codegen_name_resolution();
+  test_vm_wide_operands();
+  test_vm_stack_room();
+  test_vm_inlining();
+  test_ir_optimizations();
+  test_vm_lowered_functions();
+  test_ir_loop_invariants();
+  test_ir_type_specialization();
+  test_vm_memoized_functions();
+  test_codegen_folded_calls();
+  test_float_array_kernels();
   test_vm_augmented_assignments();
   test_vm_comparison_operators();
   test_vm_if_conditions();
   test_vm_while_loops();
   test_vm_for_loops();
+  test_vm_persistent_globals();
+  // embedding api
+  test_embedding_call();
+  test_embedding_replaced_natives();
+  test_embedding_codegen_errors();
+  test_native_registry();
+  // profiler
+  test_profiler_collapsed_stacks();
   // vm + hashmap test
   test_vm_hashmap_collision_resolution();
   // error messages
@@ -6,13 +6,21 @@ typedef enum {
   TOKEN_RIGHT_PAREN,
   TOKEN_LEFT_BRACE,
   TOKEN_RIGHT_BRACE,
+  TOKEN_LEFT_BRACKET,
+  TOKEN_RIGHT_BRACKET,
   TOKEN_COMMA,
+  TOKEN_COLON,
   TOKEN_DOT,
   TOKEN_MINUS,
   TOKEN_PLUS,
   TOKEN_SEMICOLON,
   TOKEN_SLASH,
   TOKEN_STAR,
+  TOKEN_PERCENT,
+  TOKEN_AMPERSAND,
+  TOKEN_PIPE,
+  TOKEN_CARET,
+  TOKEN_TILDE,
   // One or two character tokens
   TOKEN_BANG,
   TOKEN_BANG_EQUAL,
@@ -22,6 +30,8 @@ typedef enum {
   TOKEN_GREATER_EQUAL,
   TOKEN_LESS,
   TOKEN_LESS_EQUAL,
+  TOKEN_LESS_LESS,
+  TOKEN_GREATER_GREATER,
   // Literals
   TOKEN_IDENTIFIER,
   TOKEN_STRING,
@@ -32,6 +42,7 @@ typedef enum {
   TOKEN_FOR,
   TOKEN_FUNC,
   TOKEN_IF,
+  TOKEN_MEMO,
   TOKEN_NIL,
   TOKEN_OR,
   TOKEN_PRINT,  // TODO : Remove TOKEN_PRINT, once internal functions work
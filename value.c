@@ -3,10 +3,18 @@
 #include <math.h>
 
 bool values_equal(Value value1, Value value2) {
+  // 1 == 1.0
+  if (IS_NUMERIC(value1) && IS_NUMERIC(value2) &&
+      value1.type != value2.type) {
+    return fabs(AS_NUMERIC(value1) - AS_NUMERIC(value2)) < DBL_EPSILON;
+  }
+
   if (value1.type != value2.type)
     return false;
 
-  if (value1.type == VAL_NUMBER && value2.type == VAL_NUMBER) {
+  if (value1.type == VAL_INT && value2.type == VAL_INT) {
+    return AS_INT(value1) == AS_INT(value2);
+  } else if (value1.type == VAL_NUMBER && value2.type == VAL_NUMBER) {
     return fabs(AS_NUMBER(value1) - AS_NUMBER(value2)) < DBL_EPSILON;
   } else if (value1.type == VAL_BOOLEAN && value2.type == VAL_BOOLEAN) {
     return AS_BOOLEAN(value1) == AS_BOOLEAN(value2);
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 
 // Forward declare this obj,
@@ -11,6 +12,9 @@ typedef struct Obj Obj;
 typedef enum {
   VAL_BOOLEAN,
   VAL_NUMBER,
+  // Integer literals and integer arithmetic, promoted to VAL_NUMBER on
+  // overflow
+  VAL_INT,
   VAL_OBJ,
   VAL_NIL,
 } ValueType;
@@ -20,25 +24,34 @@ typedef struct {
   union {
     bool b;
     double number;
+    int64_t integer;
     Obj* obj;
   } as;
 } Value;
 
 #define IS_BOOLEAN(value) ((value).type == VAL_BOOLEAN)
 #define IS_NUMBER(value) ((value).type == VAL_NUMBER)
+#define IS_INT(value) ((value).type == VAL_INT)
 #define IS_OBJ(value) ((value).type == VAL_OBJ)
 #define IS_NIL(value) ((value).type == VAL_NIL)
 
 #define AS_BOOLEAN(value) ((value).as.b)
 #define AS_NUMBER(value) ((value).as.number)
+#define AS_INT(value) ((value).as.integer)
 #define AS_OBJ(value) ((value).as.obj)
 
 #define BOOLEAN_VAL(value) ((Value){VAL_BOOLEAN, {.b = value}})
 #define NUMBER_VAL(value) ((Value){VAL_NUMBER, {.number = value}})
+#define INT_VAL(value) ((Value){VAL_INT, {.integer = value}})
 // Cannot name this obj, as the macro will substitute .obj and obj together
 // Base cast the object explicitly as well
 #define OBJ_VAL(object) ((Value){VAL_OBJ, {.obj = (Obj*)object}})
 // Set nil values to be false booleans
 #define NIL_VAL ((Value){VAL_NIL, {.b = false}})
 
+// Either an int or a double, for the places that take both
+#define IS_NUMERIC(value) (IS_INT(value) || IS_NUMBER(value))
+#define AS_NUMERIC(value) \
+  (IS_INT(value) ? (double)AS_INT(value) : AS_NUMBER(value))
+
 bool values_equal(Value value1, Value value2);
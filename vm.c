@@ -1,21 +1,26 @@
 #include "vm.h"
 
-#include <float.h>
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <math.h>
 #include <stdio.h>
 #include <string.h>
-#include <time.h>
 
 #include "debugging.h"
 #include "macros.h"
+#include "map.h"
+#include "native.h"
 #include "object.h"
 #include "op.h"
-
-static Vm* vm;
+#include "opstats.h"
+#include "profiler.h"
+#include "shape.h"
 
 static void print_value(Value value) {
-  if (IS_NUMBER(value)) {
+  if (IS_INT(value)) {
+    printf("%lld\n", (long long)AS_INT(value));
+  } else if (IS_NUMBER(value)) {
     printf("%f\n", AS_NUMBER(value));
   } else if (IS_BOOLEAN(value) && AS_BOOLEAN(value) == true) {
     printf("true\n");
@@ -28,118 +33,56 @@ static void print_value(Value value) {
     print_obj_string(func->name);
   } else if (IS_OBJ(value) && AS_OBJ(value)->type == OBJ_STRING) {
     print_obj_string((ObjString*)AS_OBJ(value));
+  } else if (IS_ARRAY(value)) {
+    print_obj_array(AS_OBJ_ARRAY(value));
+  } else if (IS_FLOAT_ARRAY(value)) {
+    print_obj_float_array(AS_OBJ_FLOAT_ARRAY(value));
+  } else if (IS_MAP(value)) {
+    print_obj_map(AS_OBJ_MAP(value));
+  } else if (IS_RECORD(value)) {
+    print_obj_record(AS_OBJ_RECORD(value));
   } else {
     printf("this value is not anything\n");
   }
 }
 
-static void push(Value value) {
+static void push(Vm* vm, Value value) {
   *vm->stack_top = value;
   vm->stack_top++;
 }
 
-static Value pop() {
-  // Decrement stack_top
-  // vm->stack_top--;
+static Value pop(Vm* vm) {
   // TODO: Debug flag for this to check if its in range
-
   vm->stack_top--;
   Value value = *vm->stack_top;
-  // vm->stack_top++;
   return value;
 }
 
-static Value peek(int index) {
-  Value value = vm->stack_top[-1 - index];
-  return value;
-}
-
-// Define native functions
-static void define_native_func(const char* name, NativeFunc native_func) {
-  ObjString* func_name = make_obj_string_sl(name);
-  ObjNative* obj_native_func = make_obj_native_func(native_func);
-
-  Value value_func_name = OBJ_VAL(func_name);
-  Value value_native_func = OBJ_VAL(obj_native_func);
-
-  // The push and pop here is for garbage collection
-  push(value_func_name);
-  push(value_native_func);
-
-  push_hashmap(&vm->variables, AS_OBJ_STRING(vm->vm_stack.values[0]),
-               vm->vm_stack.values[1]);
-
-  pop();
-  pop();
-}
-
-// VM native functions
-static Value clock_native(int argument_count, Value* args) {
-  return NUMBER_VAL((double)clock() / CLOCKS_PER_SEC);
-}
+void define_native(Vm* v, int native_index) {
+  Native* native = get_native(native_index);
+  ObjString* func_name = make_obj_string_sl(native->name);
+  ObjNative* obj_native_func =
+      make_obj_native_func(native->func, native->arity);
 
-static Value die(int argument_count, Value* args) {
-  exit(0);
-}
-
-static Value assert(int argument_count, Value* args) {
-  if (argument_count != 2)
-    return BOOLEAN_VAL(false);
-
-  Value first = args[0];
-  Value second = args[1];
-
-  // print_value(first);
-  // print_value(second);
-
-  if (IS_NUMBER(first) && IS_NUMBER(second)) {
-    double first_number = AS_NUMBER(first);
-    double second_number = AS_NUMBER(second);
-
-    // If not equal
-    if ((first_number - second_number) > DBL_EPSILON) {
-      printf("assert: %f != %f\n", first_number, second_number);
-      exit(1);
-    }
-  }
-
-  if (IS_BOOLEAN(first) && IS_BOOLEAN(second)) {
-    bool first_bool = AS_BOOLEAN(first);
-    bool second_bool = AS_BOOLEAN(second);
-
-    if (first_bool != second_bool) {
-      char* first_string = first_bool ? "true" : "false";
-      char* second_string = second_bool ? "true" : "false";
-
-      printf("assert: %s != %s\n", first_string, second_string);
-      exit(1);
-    }
-  }
-
-  return BOOLEAN_VAL(false);
-}
-
-static Value print_v(int argument_count, Value* args) {
-  for (int i = 0; i < argument_count; i++) {
-    print_value(*(args + i));
-  }
-  return NIL_VAL;
+  push_hashmap(&v->variables, func_name, OBJ_VAL(obj_native_func));
+  v->native_function_count++;
 }
 
 void init_vm(Vm* v) {
-  vm = v;
   v->frame_count = 0;
   init_hashmap(&v->variables);
   init_value_array(&v->vm_stack);
-  reserve_value_array(&vm->vm_stack, MAX_STACK);
+  reserve_value_array(&v->vm_stack, MAX_STACK);
   v->stack_top = &v->vm_stack.values[0];
 
-  // Just update the native_function_count when adding more
-  define_native_func("clock", clock_native);
-  define_native_func("assert", assert);
-  define_native_func("die", die);
-  define_native_func("print_v", print_v);
-  v->native_function_count = 4;
+  // Every native in the registry is a global
+  v->native_function_count = 0;
+  for (int i = 0; i < native_count(); i++) {
+    define_native(v, i);
+  }
+
+  v->steps = INT64_MAX;
+  v->quiet = false;
 }
 
 void free_vm(Vm* v) {
@@ -148,7 +91,7 @@ void free_vm(Vm* v) {
   free_value_array(&v->vm_stack);
 }
 
-static void inspect_stack(int up_to, const char* from) {
+static void inspect_stack(Vm* vm, int up_to, const char* from) {
   printf("Inspecting stack from %s START\n", from);
   for (int i = 0; i < up_to; i++) {
     print_value(vm->vm_stack.values[i]);
@@ -156,6 +99,24 @@ static void inspect_stack(int up_to, const char* from) {
   printf("Inspecting stack from %s END\n", from);
 }
 
+static void runtime_error(Vm* vm, const char* format, ...) {
+  if (vm->quiet)
+    return;
+  va_list args;
+  va_start(args, format);
+  vprintf(format, args);
+  va_end(args);
+}
+
+// Counts down the steps of a quiet vm, false once they have run out. The
+// vm a program runs on has no budget, it only tests the flag
+static inline bool take_step(Vm* vm) {
+  if (!vm->quiet || --vm->steps >= 0)
+    return true;
+  runtime_error(vm, "Error: Ran out of steps\n");
+  return false;
+}
+
 static bool is_falsey(Value value) {
   if (IS_NIL(value))
     return true;
@@ -165,32 +126,80 @@ static bool is_falsey(Value value) {
   return false;
 }
 
-static bool call(ObjFunc* func, int argument_count) {
-  if (argument_count != func->arity) {
-    printf("Arity count and function argument_count differs\n");
+// The arguments are on the stack and the arity has been checked
+// A memoized function that was called with the same arguments before
+// replaces the callee and its arguments with the result right away
+static inline bool push_frame(Vm* vm, ObjFunc* func) {
+  int memo_entry = -1;
+  if (func->memo != NULL) {
+    Value result;
+    if (lookup_memo(func->memo, vm->stack_top - func->arity, &result,
+                    &memo_entry)) {
+      vm->stack_top -= func->arity + 1;
+      push(vm, result);
+      return true;
+    }
+  }
+
+  if (!take_step(vm))
+    return false;
+  if (vm->frame_count == MAX_FRAMES) {
+    runtime_error(vm, "Stack overflow, more than %d nested calls\n",
+                  MAX_FRAMES);
+    return false;
+  }
+
+  Value* slots = vm->stack_top - func->arity - 1;
+  if (slots + func->slot_count > vm->vm_stack.values + MAX_STACK) {
+    runtime_error(vm,
+                  "Stack overflow, no room for the %d slots of the call\n",
+                  func->slot_count);
     return false;
   }
 
   CallFrame* frame = &vm->frames[vm->frame_count++];
   frame->func = func;
   frame->ip = func->chunk.code.ops;
-  frame->slots = vm->stack_top - func->arity - 1;
+  frame->slots = slots;
+  frame->memo_entry = memo_entry;
   return true;
 }
 
-static bool call_value(Value callee, int argument_count) {
+static bool call(Vm* vm, ObjFunc* func, int argument_count) {
+  if (argument_count != func->arity) {
+    runtime_error(vm, "Arity count and function argument_count differs\n");
+    return false;
+  }
+  return push_frame(vm, func);
+}
+
+// Replaces the callee and its arguments with the result
+static inline bool call_native(Vm* vm,
+                               ObjNative* native,
+                               int argument_count) {
+  Value result;
+  if (!native->func(argument_count, vm->stack_top - argument_count, &result))
+    return false;
+
+  vm->stack_top -= argument_count + 1;
+  push(vm, result);
+  return true;
+}
+
+static bool call_value(Vm* vm, Value callee, int argument_count) {
   if (IS_OBJ(callee)) {
     switch (OBJ_TYPE(callee)) {
       case OBJ_FUNC: {
-        return call(AS_OBJ_FUNC(callee), argument_count);
+        return call(vm, AS_OBJ_FUNC(callee), argument_count);
       }
       case OBJ_NATIVE_FUNC: {
-        NativeFunc native_func = AS_OBJ_NATIVE_FUNC(callee);
-        Value result =
-            native_func(argument_count, vm->stack_top - argument_count);
-        vm->stack_top -= argument_count + 1;
-        push(result);
-        return true;
+        ObjNative* native = AS_OBJ_NATIVE(callee);
+        if (native->arity != VARIADIC && argument_count != native->arity) {
+          runtime_error(vm,
+                        "Arity count and function argument_count differs\n");
+          return false;
+        }
+        return call_native(vm, native, argument_count);
       }
       default: {
         break;
@@ -200,168 +209,541 @@ static bool call_value(Value callee, int argument_count) {
   return false;
 }
 
-void run(bool arguments[const], Vm* vm, ObjFunc* main_func) {
-#define READ_BYTE() (*frame->ip++)
-#define READ_SHORT() \
-  (frame->ip += 2, (uint16_t)((frame->ip[-2] << 8 | frame->ip[-1])))
-#define READ_CONSTANT() (frame->func->chunk.constants.values[READ_BYTE()])
+static bool check_map_key(Vm* vm, Value key) {
+  if (!is_map_key(key)) {
+    runtime_error(vm, "Error: Map keys have to be strings or numbers\n");
+    return false;
+  }
+  return true;
+}
+
+// The slow path of indexing, for anything but an array and an int index
+// that is in bounds, float arrays go through here as well. Doubles with
+// no fractional part are taken as indexes too. Returns false if the
+// index cannot be used
+static bool check_index(Vm* vm,
+                        Value object,
+                        Value index,
+                        int* array_index) {
+  int count;
+  if (IS_ARRAY(object)) {
+    count = AS_OBJ_ARRAY(object)->values.count;
+  } else if (IS_FLOAT_ARRAY(object)) {
+    count = AS_OBJ_FLOAT_ARRAY(object)->count;
+  } else {
+    runtime_error(vm, "Error: Only arrays and maps can be indexed\n");
+    return false;
+  }
+
+  int64_t i;
+  if (IS_INT(index)) {
+    i = AS_INT(index);
+  } else if (IS_NUMBER(index) && AS_NUMBER(index) >= INT64_MIN &&
+             AS_NUMBER(index) < INT64_MAX &&
+             !islessgreater(trunc(AS_NUMBER(index)), AS_NUMBER(index))) {
+    i = (int64_t)AS_NUMBER(index);
+  } else {
+    runtime_error(vm, "Error: Array indexes have to be integers\n");
+    return false;
+  }
+
+  if (i < 0 || i >= count) {
+    runtime_error(
+        vm, "Error: Index %lld is out of bounds for an array of length %d\n",
+        (long long)i, count);
+    return false;
+  }
+
+  *array_index = (int)i;
+  return true;
+}
+
+// Runs frames until the frame at base_frame returns, the value it returns
+// is written to result. Returns false if there was a runtime error
+static bool execute(Vm* vm, int base_frame, Value* result) {
+  // The running frame is kept in locals, which the compiler can hold in
+  // registers, instead of going through frame and vm on every read.
+  // frame->ip and vm->stack_top are only written back before something
+  // that looks at them, calls, natives and the profiler, and the locals
+  // are loaded again when the frame changes
+  CallFrame* frame;
+  OpCode* ip;
+  Value* slots;
+  Value* constants;
+  Value* stack_top = vm->stack_top;
+
+#define READ_BYTE() (*ip++)
+#define READ_SHORT() (ip += 2, (uint16_t)((ip[-2] << 8 | ip[-1])))
+#define READ_CONSTANT() (constants[READ_BYTE()])
 #define READ_STRING() AS_OBJ_STRING(READ_CONSTANT())
+#define PUSH(value) (*stack_top++ = (value))
+#define POP() (*--stack_top)
+#define PEEK(index) (stack_top[-1 - (index)])
+#define SAVE_FRAME() (frame->ip = ip, vm->stack_top = stack_top)
+#define LOAD_FRAME()                                \
+  do {                                              \
+    frame = &vm->frames[vm->frame_count - 1];       \
+    ip = frame->ip;                                 \
+    slots = frame->slots;                           \
+    constants = frame->func->chunk.constants.values; \
+  } while (false)
 
-  call(main_func, 0);
+// Ints stay ints unless the result overflows, then both sides are carried
+// on as doubles, the same as when either side is a double
+#define ARITHMETIC_OP(overflow_op, op)                                 \
+  do {                                                                  \
+    Value right = POP();                                                \
+    Value left = POP();                                                 \
+    int64_t int_result;                                                 \
+    if (IS_INT(left) && IS_INT(right) &&                                \
+        !overflow_op(AS_INT(left), AS_INT(right), &int_result)) {       \
+      PUSH(INT_VAL(int_result));                                        \
+    } else if (IS_NUMERIC(left) && IS_NUMERIC(right)) {                 \
+      PUSH(NUMBER_VAL(AS_NUMERIC(left) op AS_NUMERIC(right)));          \
+    } else {                                                            \
+      runtime_error(vm, "Error: Operands of %s have to be numbers\n", #op); \
+      return false;                                                     \
+    }                                                                   \
+  } while (false)
+#define COMPARISON_OP(op)                                               \
+  do {                                                                  \
+    Value right = POP();                                                \
+    Value left = POP();                                                 \
+    if (IS_INT(left) && IS_INT(right)) {                                \
+      PUSH(BOOLEAN_VAL(AS_INT(left) op AS_INT(right)));                 \
+    } else if (IS_NUMERIC(left) && IS_NUMERIC(right)) {                 \
+      PUSH(BOOLEAN_VAL(AS_NUMERIC(left) op AS_NUMERIC(right)));         \
+    } else {                                                            \
+      runtime_error(vm, "Error: Operands of %s have to be numbers\n", #op); \
+      return false;                                                     \
+    }                                                                   \
+  } while (false)
+// The _NUMBER ops, whose operands codegen proved are ints or doubles
+#define NUMBER_OP(overflow_op, op)                                     \
+  do {                                                                  \
+    Value right = POP();                                                \
+    Value left = POP();                                                 \
+    int64_t int_result;                                                 \
+    if (IS_INT(left) && IS_INT(right) &&                                \
+        !overflow_op(AS_INT(left), AS_INT(right), &int_result)) {       \
+      PUSH(INT_VAL(int_result));                                        \
+    } else {                                                            \
+      PUSH(NUMBER_VAL(AS_NUMERIC(left) op AS_NUMERIC(right)));          \
+    }                                                                   \
+  } while (false)
+#define NUMBER_COMPARISON_OP(op)                                        \
+  do {                                                                  \
+    Value right = POP();                                                \
+    Value left = POP();                                                 \
+    if (IS_INT(left) && IS_INT(right)) {                                \
+      PUSH(BOOLEAN_VAL(AS_INT(left) op AS_INT(right)));                 \
+    } else {                                                            \
+      PUSH(BOOLEAN_VAL(AS_NUMERIC(left) op AS_NUMERIC(right)));         \
+    }                                                                   \
+  } while (false)
+#define INTEGER_OP(op)                                                  \
+  do {                                                                  \
+    Value right = POP();                                                \
+    Value left = POP();                                                 \
+    if (!IS_INT(left) || !IS_INT(right)) {                              \
+      runtime_error(vm, "Error: Operands of %s have to be integers\n", #op); \
+      return false;                                                     \
+    }                                                                   \
+    PUSH(INT_VAL(AS_INT(left) op AS_INT(right)));                       \
+  } while (false)
 
-  CallFrame* frame = &vm->frames[vm->frame_count - 1];
+  LOAD_FRAME();
 
   OpCode instruction;
   for (;;) {
     instruction = READ_BYTE();
+#ifdef OPSTATS
+    count_opcode(instruction);
+#endif
     switch (instruction) {
       case OP_CONSTANT: {
         OpCode constant_index = READ_BYTE();
 
-        Value constant =
-            frame->func->chunk.constants.values[constant_index - 1];
+        Value constant = constants[constant_index - 1];
 
-        push(constant);
+        PUSH(constant);
         break;
       }
       case OP_POP: {
-        pop();
+        stack_top--;
         break;
       }
       case OP_TRUE:
-        push(BOOLEAN_VAL(true));
+        PUSH(BOOLEAN_VAL(true));
         break;
       case OP_FALSE:
-        push(BOOLEAN_VAL(false));
+        PUSH(BOOLEAN_VAL(false));
         break;
       case OP_ADD: {
-        // TODO : This can be optimized, does not need so many local
-        // variables
-
-        Value value1 = pop();
-        Value value2 = pop();
-        if (IS_NUMBER(value1) && IS_NUMBER(value2)) {
-          double number1 = AS_NUMBER(value1);
-          double number2 = AS_NUMBER(value2);
-          // Note that it is 2 + 1, not 1 + 2 as it is poped in
-          // the reverse order from when it is pushed in
-          double number3 = number2 + number1;
-          push(NUMBER_VAL(number3));
-        } else if ((IS_OBJ(value1) && ((OBJ_TYPE(value1) == OBJ_STRING))) &&
-                   (IS_OBJ(value2) && ((OBJ_TYPE(value2) == OBJ_STRING)))) {
-          ObjString* obj_string1 = AS_OBJ_STRING(value1);
-          ObjString* obj_string2 = AS_OBJ_STRING(value2);
-          ObjString* obj_string3 =
-              concatenate_obj_string(obj_string2, obj_string1);
-          push(OBJ_VAL(obj_string3));
+        Value right = POP();
+        Value left = POP();
+        int64_t int_result;
+        if (IS_INT(left) && IS_INT(right) &&
+            !__builtin_add_overflow(AS_INT(left), AS_INT(right),
+                                    &int_result)) {
+          PUSH(INT_VAL(int_result));
+        } else if (IS_NUMERIC(left) && IS_NUMERIC(right)) {
+          PUSH(NUMBER_VAL(AS_NUMERIC(left) + AS_NUMERIC(right)));
+        } else if (IS_STRING(left) && IS_STRING(right)) {
+          ObjString* obj_string =
+              concatenate_obj_string(AS_OBJ_STRING(left), AS_OBJ_STRING(right));
+          PUSH(OBJ_VAL(obj_string));
         } else {
-          printf(
+          runtime_error(
+              vm,
               "Error: Tried to add two values that cannot be added together\n");
+          return false;
         }
         break;
       }
-      case OP_SUBTRACT: {
-        // TODO : This can be optimized, does not need so many local
-        // variables
-        Value value1 = pop();
-        Value value2 = pop();
-        double number1 = AS_NUMBER(value1);
-        double number2 = AS_NUMBER(value2);
-        // Note that it is 2 + 1, not 1 + 2 as it is poped in
-        // the reverse order from when it is pushed in
-        double number3 = number2 - number1;
-        push(NUMBER_VAL(number3));
+      case OP_SUBTRACT:
+        ARITHMETIC_OP(__builtin_sub_overflow, -);
         break;
-      }
-      case OP_MULTIPLY: {
-        Value value1 = pop();
-        Value value2 = pop();
-        double number1 = AS_NUMBER(value1);
-        double number2 = AS_NUMBER(value2);
-        double number3 = number2 * number1;
-        push(NUMBER_VAL(number3));
+      case OP_MULTIPLY:
+        ARITHMETIC_OP(__builtin_mul_overflow, *);
         break;
-      }
       case OP_DIVIDE: {
-        Value value1 = pop();
-        Value value2 = pop();
-        double number1 = AS_NUMBER(value1);
-        double number2 = AS_NUMBER(value2);
-        double number3 = number2 / number1;
-        push(NUMBER_VAL(number3));
+        // Always a double, 7 / 2 is 3.5
+        Value right = POP();
+        Value left = POP();
+        if (!IS_NUMERIC(left) || !IS_NUMERIC(right)) {
+          runtime_error(vm, "Error: Operands of / have to be numbers\n");
+          return false;
+        }
+        PUSH(NUMBER_VAL(AS_NUMERIC(left) / AS_NUMERIC(right)));
+        break;
+      }
+      case OP_MODULO: {
+        Value right = POP();
+        Value left = POP();
+        if (IS_INT(left) && IS_INT(right)) {
+          if (AS_INT(right) == 0) {
+            runtime_error(vm, "Error: Modulo by zero\n");
+            return false;
+          }
+          // INT64_MIN % -1 traps on x86
+          PUSH(INT_VAL(AS_INT(right) == -1 ? 0 : AS_INT(left) % AS_INT(right)));
+        } else if (IS_NUMERIC(left) && IS_NUMERIC(right)) {
+          PUSH(NUMBER_VAL(fmod(AS_NUMERIC(left), AS_NUMERIC(right))));
+        } else {
+          runtime_error(vm, "Error: Operands of %% have to be numbers\n");
+          return false;
+        }
         break;
       }
       case OP_NEGATE: {
-        Value value = pop();
-        if (IS_NUMBER(value)) {
-          push(NUMBER_VAL(-(AS_NUMBER(value))));
+        Value value = POP();
+        if (IS_INT(value) && AS_INT(value) != INT64_MIN) {
+          PUSH(INT_VAL(-AS_INT(value)));
+        } else if (IS_NUMERIC(value)) {
+          PUSH(NUMBER_VAL(-AS_NUMERIC(value)));
+        } else {
+          runtime_error(vm, "Error: Operand of - has to be a number\n");
+          return false;
+        }
+        break;
+      }
+      case OP_GREATER:
+        COMPARISON_OP(>);
+        break;
+      case OP_LESS:
+        COMPARISON_OP(<);
+        break;
+      case OP_ADD_NUMBER:
+        NUMBER_OP(__builtin_add_overflow, +);
+        break;
+      case OP_SUBTRACT_NUMBER:
+        NUMBER_OP(__builtin_sub_overflow, -);
+        break;
+      case OP_MULTIPLY_NUMBER:
+        NUMBER_OP(__builtin_mul_overflow, *);
+        break;
+      case OP_DIVIDE_NUMBER: {
+        Value right = POP();
+        Value left = POP();
+        PUSH(NUMBER_VAL(AS_NUMERIC(left) / AS_NUMERIC(right)));
+        break;
+      }
+      case OP_GREATER_NUMBER:
+        NUMBER_COMPARISON_OP(>);
+        break;
+      case OP_LESS_NUMBER:
+        NUMBER_COMPARISON_OP(<);
+        break;
+      case OP_BIT_AND:
+        INTEGER_OP(&);
+        break;
+      case OP_BIT_OR:
+        INTEGER_OP(|);
+        break;
+      case OP_BIT_XOR:
+        INTEGER_OP(^);
+        break;
+      case OP_SHIFT_LEFT: {
+        Value right = POP();
+        Value left = POP();
+        if (!IS_INT(left) || !IS_INT(right)) {
+          runtime_error(vm, "Error: Operands of << have to be integers\n");
+          return false;
+        }
+        // Shifting by 64 or more is undefined in C, only the low 6 bits of
+        // the count are used, and the shift is done unsigned so that
+        // shifting into the sign bit is defined
+        PUSH(INT_VAL(
+            (int64_t)((uint64_t)AS_INT(left) << (AS_INT(right) & 63))));
+        break;
+      }
+      case OP_SHIFT_RIGHT: {
+        Value right = POP();
+        Value left = POP();
+        if (!IS_INT(left) || !IS_INT(right)) {
+          runtime_error(vm, "Error: Operands of >> have to be integers\n");
+          return false;
+        }
+        // Arithmetic shift, -8 >> 1 is -4
+        PUSH(INT_VAL(AS_INT(left) >> (AS_INT(right) & 63)));
+        break;
+      }
+      case OP_ARRAY: {
+        int count = READ_BYTE();
+        ObjArray* array = make_obj_array(count);
+        memcpy(array->values.values, stack_top - count,
+               sizeof(Value) * count);
+        array->values.count = count;
+        stack_top -= count;
+        PUSH(OBJ_VAL(array));
+        break;
+      }
+      case OP_ARRAY_EXTEND: {
+        int count = READ_BYTE();
+        ObjArray* array = AS_OBJ_ARRAY(*(stack_top - count - 1));
+        for (Value* element = stack_top - count; element < stack_top;
+             element++)
+          push_value_array(&array->values, *element);
+        stack_top -= count;
+        break;
+      }
+      case OP_MAP: {
+        int count = READ_BYTE();
+        ObjMap* map = make_obj_map(count);
+        Value* entries = stack_top - count * 2;
+        for (int i = 0; i < count; i++) {
+          if (!check_map_key(vm, entries[i * 2]))
+            return false;
+          set_obj_map(map, entries[i * 2], entries[i * 2 + 1]);
         }
+        stack_top = entries;
+        PUSH(OBJ_VAL(map));
         break;
       }
-      case OP_GREATER: {
-        Value value1 = pop();
-        Value value2 = pop();
-        double number1 = AS_NUMBER(value1);
-        double number2 = AS_NUMBER(value2);
-        bool greater = number2 > number1;
-        push(BOOLEAN_VAL(greater));
+      case OP_MAP_EXTEND: {
+        int count = READ_BYTE();
+        Value* entries = stack_top - count * 2;
+        ObjMap* map = AS_OBJ_MAP(*(entries - 1));
+        for (int i = 0; i < count; i++) {
+          if (!check_map_key(vm, entries[i * 2]))
+            return false;
+          set_obj_map(map, entries[i * 2], entries[i * 2 + 1]);
+        }
+        stack_top = entries;
         break;
       }
-      case OP_LESS: {
-        Value value1 = pop();
-        Value value2 = pop();
-        double number1 = AS_NUMBER(value1);
-        double number2 = AS_NUMBER(value2);
-        bool greater = number2 < number1;
-        push(BOOLEAN_VAL(greater));
+      case OP_GET_FIELD: {
+        ObjString* name = AS_OBJ_STRING(constants[READ_SHORT()]);
+        FieldCache* cache = &frame->func->chunk.field_caches[READ_SHORT()];
+        Value object = PEEK(0);
+        if (!IS_RECORD(object)) {
+          runtime_error(vm, "Error: Only records have fields\n");
+          return false;
+        }
+
+        // Monomorphic, the cache only keeps the last shape seen here
+        ObjRecord* record = AS_OBJ_RECORD(object);
+#ifdef OPSTATS
+        count_field_cache(record->shape == cache->shape);
+#endif
+        if (record->shape != cache->shape) {
+          int offset = find_shape_field(record->shape, name);
+          if (offset == -1) {
+            runtime_error(vm, "Error: The record has no field \"%.*s\"\n",
+                          name->length, name->chars);
+            return false;
+          }
+          cache->shape = record->shape;
+          cache->transition = NULL;
+          cache->offset = offset;
+        }
+        stack_top[-1] = record->fields[cache->offset];
+        break;
+      }
+      case OP_SET_FIELD: {
+        ObjString* name = AS_OBJ_STRING(constants[READ_SHORT()]);
+        FieldCache* cache = &frame->func->chunk.field_caches[READ_SHORT()];
+        Value value = POP();
+        Value object = POP();
+        if (!IS_RECORD(object)) {
+          runtime_error(vm, "Error: Only records have fields\n");
+          return false;
+        }
+
+        ObjRecord* record = AS_OBJ_RECORD(object);
+#ifdef OPSTATS
+        count_field_cache(record->shape == cache->shape);
+#endif
+        if (record->shape != cache->shape) {
+          cache->shape = record->shape;
+          cache->offset = find_shape_field(record->shape, name);
+          cache->transition = NULL;
+          // A new field, the record moves on to the next shape
+          if (cache->offset == -1) {
+            cache->transition = add_shape_field(record->shape, name);
+            cache->offset = cache->transition->field_count - 1;
+          }
+        }
+
+        if (cache->transition != NULL)
+          push_obj_record_field(record, cache->transition, value);
+        else
+          record->fields[cache->offset] = value;
+        PUSH(value);
+        break;
+      }
+      case OP_INDEX_GET: {
+        Value index = POP();
+        Value object = POP();
+        // An int index into an array is the common case, the one unsigned
+        // compare catches negative indexes as well
+        if (IS_ARRAY(object) && IS_INT(index) &&
+            (uint64_t)AS_INT(index) <
+                (uint64_t)AS_OBJ_ARRAY(object)->values.count) {
+          PUSH(AS_OBJ_ARRAY(object)->values.values[AS_INT(index)]);
+          break;
+        }
+
+        if (IS_MAP(object)) {
+          Value value;
+          if (!check_map_key(vm, index))
+            return false;
+          if (!get_obj_map(AS_OBJ_MAP(object), index, &value)) {
+            runtime_error(vm, "Error: Key is not in the map\n");
+            return false;
+          }
+          PUSH(value);
+          break;
+        }
+
+        int array_index;
+        if (!check_index(vm, object, index, &array_index))
+          return false;
+        if (IS_FLOAT_ARRAY(object))
+          PUSH(NUMBER_VAL(AS_OBJ_FLOAT_ARRAY(object)->values[array_index]));
+        else
+          PUSH(AS_OBJ_ARRAY(object)->values.values[array_index]);
+        break;
+      }
+      case OP_INDEX_SET: {
+        Value value = POP();
+        Value index = POP();
+        Value object = POP();
+        if (IS_ARRAY(object) && IS_INT(index) &&
+            (uint64_t)AS_INT(index) <
+                (uint64_t)AS_OBJ_ARRAY(object)->values.count) {
+          AS_OBJ_ARRAY(object)->values.values[AS_INT(index)] = value;
+          PUSH(value);
+          break;
+        }
+
+        if (IS_MAP(object)) {
+          if (!check_map_key(vm, index))
+            return false;
+          set_obj_map(AS_OBJ_MAP(object), index, value);
+          PUSH(value);
+          break;
+        }
+
+        int array_index;
+        if (!check_index(vm, object, index, &array_index))
+          return false;
+        if (IS_FLOAT_ARRAY(object)) {
+          if (!IS_NUMERIC(value)) {
+            runtime_error(vm, "Error: Float arrays can only hold numbers\n");
+            return false;
+          }
+          AS_OBJ_FLOAT_ARRAY(object)->values[array_index] = AS_NUMERIC(value);
+        } else {
+          AS_OBJ_ARRAY(object)->values.values[array_index] = value;
+        }
+        // Assignments are expressions, the value stays on the stack
+        PUSH(value);
+        break;
+      }
+      case OP_BIT_NOT: {
+        Value value = POP();
+        if (!IS_INT(value)) {
+          runtime_error(vm, "Error: Operand of ~ has to be an integer\n");
+          return false;
+        }
+        PUSH(INT_VAL(~AS_INT(value)));
         break;
       }
       case OP_NOT: {
-        Value value = pop();
+        Value value = POP();
         if (AS_BOOLEAN(value) == true) {
-          push(BOOLEAN_VAL(false));
+          PUSH(BOOLEAN_VAL(false));
         } else {
-          push(BOOLEAN_VAL(true));
+          PUSH(BOOLEAN_VAL(true));
         }
         break;
       }
       case OP_EQUAL: {
-        Value value1 = pop();
-        Value value2 = pop();
-        push(BOOLEAN_VAL(values_equal(value2, value1)));
+        Value value1 = POP();
+        Value value2 = POP();
+        PUSH(BOOLEAN_VAL(values_equal(value2, value1)));
         break;
       }
       case OP_RETURN: {
         // inspect_stack(8, "OP_RETURN");
+        if (profiler_ticks) {
+          frame->ip = ip;
+          take_sample(vm, NULL);
+        }
 
-        Value result = pop();
+        Value return_value = POP();
+        if (frame->memo_entry != -1)
+          store_memo(frame->func->memo, frame->memo_entry, return_value);
 
         vm->frame_count--;
-        if (vm->frame_count == 0) {
-          pop();
-          // printf("Done interpreting all code\n");
-          return;
-        }
+        // Drop the callee and its arguments
+        stack_top = slots;
 
-        vm->stack_top = frame->slots;
+        // Returning out of the frame that execute() was entered with
+        if (vm->frame_count == base_frame) {
+          vm->stack_top = stack_top;
+          *result = return_value;
+          return true;
+        }
 
-        push(result);
-        frame = &vm->frames[vm->frame_count - 1];
+        PUSH(return_value);
+        LOAD_FRAME();
         break;
       }
       case OP_PRINT: {
-        print_value(pop());
+        print_value(POP());
         break;
       }
       case OP_SET_GLOBAL: {
         // Get the variable_name from the constants_array
         OpCode name_constant_index = READ_BYTE();
-        Obj* obj =
-            AS_OBJ(frame->func->chunk.constants.values[name_constant_index]);
+        Obj* obj = AS_OBJ(constants[name_constant_index]);
         ObjString* obj_string = (ObjString*)obj;
 
         // Get the value from the top of the stack
-        Value value = peek(0);
+        Value value = PEEK(0);
 
         // Add to the variables hashmap
         push_hashmap(&vm->variables, obj_string, value);
@@ -369,22 +751,21 @@ void run(bool arguments[const], Vm* vm, ObjFunc* main_func) {
       }
       case OP_SET_LOCAL: {
         OpCode index = READ_BYTE();
-        Value value = peek(0);
-        frame->slots[index] = value;
+        Value value = PEEK(0);
+        slots[index] = value;
         break;
       }
       case OP_GET_GLOBAL: {
         OpCode name_constant_index = READ_BYTE();
 
-        Obj* obj =
-            AS_OBJ(frame->func->chunk.constants.values[name_constant_index]);
+        Obj* obj = AS_OBJ(constants[name_constant_index]);
         ObjString* obj_string = (ObjString*)obj;
 
         // ObjString* obj_string = READ_STRING();
 
         Value value = get_hashmap(&vm->variables, obj_string);
 
-        push(value);
+        PUSH(value);
         break;
       }
       case OP_GET_LOCAL: {
@@ -392,91 +773,253 @@ void run(bool arguments[const], Vm* vm, ObjFunc* main_func) {
         // And push it onto the value stack, from
         // wherever the old local is.
         OpCode index = READ_BYTE();
-        push(frame->slots[index]);
+        PUSH(slots[index]);
         break;
       }
       case OP_DEFINE_GLOBAL: {
-        OpCode op_constant = READ_BYTE();
-        OpCode constant_index = READ_BYTE();
-        Value constant =
-            frame->func->chunk.constants.values[constant_index - 1];
-        Obj* obj = AS_OBJ(constant);
-        ObjString* obj_string = (ObjString*)obj;
-
-        // Will return the function
-        Value p = peek(0);
-
-        // inspect_stack(8, "OP_DEFINE_GLOBAL");
-
-        push_hashmap(&vm->variables, obj_string, p);
-
-        // pop the function off the stack
-        pop();
-
+        ObjString* name = AS_OBJ_STRING(constants[READ_BYTE()]);
+        push_hashmap(&vm->variables, name, POP());
+        break;
+      }
+      case OP_DEFINE_GLOBAL_WIDE: {
+        ObjString* name = AS_OBJ_STRING(constants[READ_SHORT()]);
+        push_hashmap(&vm->variables, name, POP());
+        break;
+      }
+      case OP_CONSTANT_WIDE: {
+        PUSH(constants[READ_SHORT()]);
+        break;
+      }
+      case OP_GET_LOCAL_WIDE: {
+        PUSH(slots[READ_SHORT()]);
+        break;
+      }
+      case OP_SET_LOCAL_WIDE: {
+        slots[READ_SHORT()] = PEEK(0);
+        break;
+      }
+      case OP_GET_GLOBAL_WIDE: {
+        ObjString* name = AS_OBJ_STRING(constants[READ_SHORT()]);
+        PUSH(get_hashmap(&vm->variables, name));
+        break;
+      }
+      case OP_SET_GLOBAL_WIDE: {
+        ObjString* name = AS_OBJ_STRING(constants[READ_SHORT()]);
+        push_hashmap(&vm->variables, name, PEEK(0));
+        break;
+      }
+      case OP_JUMP_IF_GLOBAL: {
+        ObjString* name = AS_OBJ_STRING(constants[READ_SHORT()]);
+        Obj* inlined = AS_OBJ(constants[READ_SHORT()]);
+        uint16_t offset = READ_SHORT();
+        Value value = get_hashmap(&vm->variables, name);
+        if (IS_OBJ(value) && AS_OBJ(value) == inlined)
+          ip += offset;
+        break;
+      }
+      case OP_POP_BELOW: {
+        int count = READ_BYTE();
+        stack_top[-1 - count] = stack_top[-1];
+        stack_top -= count;
         break;
       }
       case OP_JUMP: {
         // printf("OP_JUMP\n");
         uint16_t offset = READ_SHORT();
-        frame->ip += offset;
+        ip += offset;
+        break;
+      }
+      case OP_JUMP_IF_TRUE: {
+        uint16_t offset = READ_SHORT();
+        if (!is_falsey(PEEK(0)))
+          ip += offset;
+        break;
+      }
+      case OP_POP_JUMP_IF_FALSE: {
+        uint16_t offset = READ_SHORT();
+        if (is_falsey(POP()))
+          ip += offset;
+        break;
+      }
+      case OP_POP_JUMP_IF_TRUE: {
+        uint16_t offset = READ_SHORT();
+        if (!is_falsey(POP()))
+          ip += offset;
         break;
       }
       case OP_JUMP_IF_FALSE: {
         // printf("OP_JUMP_IF_FALSE\n");
         uint16_t jump_index_if_false = READ_SHORT();
 
-        Value condition_expr = peek(0);
+        Value condition_expr = PEEK(0);
         // if false, jump to the jump_index, otherwise, continue
         // executing the program.
         if (is_falsey(condition_expr)) {
-          frame->ip += jump_index_if_false;
+          ip += jump_index_if_false;
         }
 
         break;
       }
       case OP_LOOP: {
         uint16_t offset = READ_SHORT();
-        frame->ip -= offset;
+        // Backward jumps, calls and returns are where the profiler
+        // checks for a pending sample
+        if (profiler_ticks) {
+          frame->ip = ip;
+          take_sample(vm, NULL);
+        }
+        if (!take_step(vm))
+          return false;
+        ip -= offset;
         break;
       }
       case OP_CALL: {
-        // printf("OP_CALL\n");
-        // OP_CONSTANT, just move it over the OP_CONSTANT
-        READ_BYTE();
-        // OP_CONSTANT INDEX
-        OpCode index2 = READ_BYTE();
         // Argument count, from codegen, not the parser
-        // int argument_count = READ_BYTE();
-        // printf("Argument count: %d\n", argument_count);
-
-        Value func_name_obj = frame->func->chunk.constants.values[index2 - 1];
-        ObjString* func_name = AS_OBJ_STRING(func_name_obj);
-        Value func_obj = get_hashmap(&vm->variables, func_name);
-
         int argument_count = READ_BYTE();
+        CallCache* cache = &frame->func->chunk.call_caches[READ_SHORT()];
+        // OP_GET_GLOBAL pushed the callee below the arguments
+        Value callee = PEEK(argument_count);
 
-        // inspect_stack(8, "OP_CALL");
+        // The callee works off vm->stack_top and the new frame starts
+        // after ip, or the native's result replaces the arguments
+        SAVE_FRAME();
+        if (profiler_ticks)
+          take_sample(vm, NULL);
 
-        if (!call_value(func_obj, argument_count)) {
-          // if (!call_value(func_obj, func->arity)) {
-          printf("Error out here\n");
+        // The same callee as last time, its type and arity are known
+        if (IS_OBJ(callee) && AS_OBJ(callee) == cache->callee) {
+#ifdef OPSTATS
+          count_call_cache(true);
+#endif
+          bool called =
+              cache->kind == CALL_CACHE_FUNC
+                  ? push_frame(vm, (ObjFunc*)cache->callee)
+                  : call_native(vm, (ObjNative*)cache->callee, argument_count);
+          if (!called)
+            return false;
+          stack_top = vm->stack_top;
+          LOAD_FRAME();
           break;
         }
 
+#ifdef OPSTATS
+        count_call_cache(false);
+#endif
+        if (!call_value(vm, callee, argument_count)) {
+          runtime_error(vm, "Error out here\n");
+          return false;
+        }
+        // Only callees that passed the checks get cached
+        cache->callee = AS_OBJ(callee);
+        cache->kind = IS_FUNC(callee) ? CALL_CACHE_FUNC : CALL_CACHE_NATIVE;
+
         // call_value() if successful, will push a new callframe
         // and the current callframe will need to be updated to it
-        frame = &vm->frames[vm->frame_count - 1];
+        stack_top = vm->stack_top;
+        LOAD_FRAME();
         break;
       }
       case OP_NIL: {
+        PUSH(NIL_VAL);
+        break;
+      }
+      case OP_CALL_NATIVE: {
+        // The codegen has already resolved the native and checked its
+        // arity, only the arguments are on the stack, there is no callee
+        // slot and no frame
+        Native* native = get_native(READ_BYTE());
+        int argument_count = READ_BYTE();
+        Value* args = stack_top - argument_count;
+
+        // Natives can call back into the vm, which pushes its frames and
+        // values on top of these
+        SAVE_FRAME();
+        Value result;
+        if (!native->func(argument_count, args, &result))
+          return false;
+
+        // A tick that came in during the native is put down to it
+        if (profiler_ticks)
+          take_sample(vm, native->name);
+
+        stack_top = args;
+        PUSH(result);
         break;
       }
       default:  // Just break out of those that are not handled yet
-        return;
+        return false;
     }
   }
+#undef INTEGER_OP
+#undef NUMBER_COMPARISON_OP
+#undef NUMBER_OP
+#undef COMPARISON_OP
+#undef ARITHMETIC_OP
+#undef LOAD_FRAME
+#undef SAVE_FRAME
+#undef PEEK
+#undef POP
+#undef PUSH
 #undef READ_STRING
 #undef READ_CONSTANT
 #undef READ_SHORT
 #undef READ_BYTE
 }
+
+bool run(bool arguments[const], Vm* vm, ObjFunc* main_func) {
+  // Every top-level run starts from an empty stack, the same Vm can be
+  // handed to run() again (i.e. the REPL) and keep its globals, while
+  // anything left behind by a previous run or a runtime error is dropped
+  vm->frame_count = 0;
+  vm->stack_top = &vm->vm_stack.values[0];
+
+  // The script function takes up slot 0, which is the slot the compiler
+  // reserves for the vm's internal usage
+  push(vm, OBJ_VAL(main_func));
+  call(vm, main_func, 0);
+
+  Value result;
+  return execute(vm, 0, &result);
+}
+
+bool call_func(Vm* vm,
+               Value callee,
+               int argument_count,
+               Value* args,
+               Value* result) {
+  // Lay the call out on the stack exactly like OP_CALL would have it,
+  // the callee followed by its arguments, on top of whatever is running
+  Value* stack_start = vm->stack_top;
+  int base_frame = vm->frame_count;
+  // Nothing made room for these, the host can call from inside a native
+  if (stack_start + argument_count + 1 > vm->vm_stack.values + MAX_STACK) {
+    runtime_error(vm, "Stack overflow, no room for the %d arguments\n",
+                  argument_count);
+    return false;
+  }
+
+  push(vm, callee);
+  for (int i = 0; i < argument_count; i++) {
+    push(vm, args[i]);
+  }
+
+  if (!call_value(vm, callee, argument_count)) {
+    vm->stack_top = stack_start;
+    return false;
+  }
+
+  // Natives are done by the time call_value() returns
+  if (vm->frame_count == base_frame) {
+    *result = pop(vm);
+    return true;
+  }
+
+  if (!execute(vm, base_frame, result)) {
+    // Unwind whatever frames the runtime error left behind
+    vm->frame_count = base_frame;
+    vm->stack_top = stack_start;
+    return false;
+  }
+
+  return true;
+}
@@ -1,13 +1,16 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "array.h"
 #include "callframe.h"
 #include "hashmap.h"
 
 #define MAX_FRAMES 64
-#define MAX_STACK (MAX_FRAMES * UINT8_MAX)
+// Room for a frame with as many locals as wide operands can address, on
+// top of frames of the usual size
+#define MAX_STACK (MAX_FRAMES * UINT8_MAX + UINT16_MAX + 1)
 
 typedef struct {
   HashMap variables;
@@ -20,12 +23,32 @@ typedef struct {
   Value* stack_top;
   ValueArray vm_stack;
 
-  // native function count
+  // How many of the globals are natives
   int native_function_count;
+
+  // Calls and backward jumps left before a quiet vm stops with an error,
+  // so that code run at compile time cannot hang the compiler
+  int64_t steps;
+  // Runtime errors are not printed, the profiler takes no samples and the
+  // steps are counted, the caller only looks at the result, i.e. the calls
+  // codegen folds
+  bool quiet;
 } Vm;
 
 void init_vm(Vm* vm);
 void free_vm(Vm* vm);
 
-// TODO : Return and report run errors from here.
-void run(bool arguments[const], Vm* vm, ObjFunc* main_func);
+// Defines the native at native_index of the registry as a global
+void define_native(Vm* vm, int native_index);
+
+// Runs the top-level function, returns false on a runtime error
+bool run(bool arguments[const], Vm* vm, ObjFunc* main_func);
+
+// Calls a function or native with the arguments, reusing the vm's stack
+// and frames, the value returned is written to result.
+// Returns false if the callee cannot be called or errors out
+bool call_func(Vm* vm,
+               Value callee,
+               int argument_count,
+               Value* args,
+               Value* result);